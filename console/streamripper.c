@@ -95,6 +95,7 @@ main (int argc, char *argv[])
     print_to_console ("Connecting...\n");
     
     rip_manager_init ();
+    rip_manager_set_mem_budget (prefs.maxMB_mem_budget);
 
     /* Launch the ripping thread */
     if ((ret = rip_manager_start (&rmi, &prefs, rip_callback)) != SR_SUCCESS) {
@@ -304,6 +305,18 @@ print_usage (FILE* stream)
     fprintf(stream, "      --quiet        - Don't print ripping status to console\n");
     fprintf(stream, "      --stderr       - Print ripping status to stderr (old behavior)\n");
     fprintf(stream, "      --debug        - Save debugging trace\n");
+    fprintf(stream, "      --mem-budget=MB - Limit memory used for stream buffers\n");
+    fprintf(stream, "      --race-mirrors=n - Probe n servers of a pls, use the fastest\n");
+    fprintf(stream, "      --hot-standby  - Keep a second connection to switch to\n");
+    fprintf(stream, "      --sock-profile=profile - Socket options: none, normal, lowlatency\n");
+    fprintf(stream, "      --tracks-from-show - Copy tracks out of the show file (with -a)\n");
+    fprintf(stream, "      --hidden-incomplete - Don't show tracks until they are finished\n");
+    fprintf(stream, "      --track-index=file - Remember completed tracks in file\n");
+    fprintf(stream, "      --dedup=mode   - Share identical tracks: none, link, reflink\n");
+    fprintf(stream, "      --write-buffer=KB - Buffer this much of each file before writing\n");
+    fprintf(stream, "      --preallocate  - Reserve disk space for show file and tracks\n");
+    fprintf(stream, "      --direct-show  - Write the show file with O_DIRECT\n");
+    fprintf(stream, "      --durability=mode - Sync to disk: none, complete, periodic\n");
     fprintf(stream, "ID3 opts (mp3/aac/nsv):  [The default behavior is adding ID3V2.3 only]\n");
     fprintf(stream, "      -i                           - Don't add any ID3 tags to output file\n");
     fprintf(stream, "      --with-id3v1                 - Add ID3V1 tags to output file\n");
@@ -537,6 +550,93 @@ parse_extended_options (STREAM_PREFS* prefs, char* rule)
 	return;
     }
 
+    /* Memory options */
+    if ((1==sscanf(rule,"mem-budget=%d",&x))
+	|| (1==sscanf(rule,"mem_budget=%d",&x))) {
+	prefs->maxMB_mem_budget = x;
+	debug_printf ("Setting memory budget to %d MB\n",x);
+	return;
+    }
+
+    /* Connection options */
+    if ((1==sscanf(rule,"race-mirrors=%d",&x))
+	|| (1==sscanf(rule,"race_mirrors=%d",&x))) {
+	prefs->race_mirrors = x;
+	debug_printf ("Setting race mirrors to %d\n",x);
+	return;
+    }
+    if ((!strcmp(rule,"hot-standby"))
+	|| (!strcmp(rule,"hot_standby"))) {
+	OPT_FLAG_SET(prefs->flags,OPT_HOT_STANDBY,1);
+	debug_printf ("Setting hot standby\n");
+	return;
+    }
+    if ((!strncmp(rule,"sock-profile=",13))
+	|| (!strncmp(rule,"sock_profile=",13))) {
+	prefs->sock_profile = string_to_sock_profile (&rule[13]);
+	if (prefs->sock_profile == SOCK_PROFILE_UNKNOWN) {
+	    fprintf (stderr, "Error: unknown socket profile %s\n", &rule[13]);
+	    exit (1);
+	}
+	debug_printf ("Setting socket profile to %s\n", &rule[13]);
+	return;
+    }
+
+    /* File options */
+    if ((!strcmp(rule,"tracks-from-show"))
+	|| (!strcmp(rule,"tracks_from_show"))) {
+	OPT_FLAG_SET(prefs->flags,OPT_TRACKS_FROM_SHOW,1);
+	debug_printf ("Setting tracks from show\n");
+	return;
+    }
+    if ((!strcmp(rule,"hidden-incomplete"))
+	|| (!strcmp(rule,"hidden_incomplete"))) {
+	OPT_FLAG_SET(prefs->flags,OPT_HIDDEN_INCOMPLETE,1);
+	debug_printf ("Setting hidden incomplete\n");
+	return;
+    }
+    if ((!strncmp(rule,"track-index=",12))
+	|| (!strncmp(rule,"track_index=",12))) {
+	strncpy (prefs->track_index, &rule[12], SR_MAX_PATH);
+	debug_printf ("Setting track index to %s\n", prefs->track_index);
+	return;
+    }
+    if (!strncmp(rule,"dedup=",6)) {
+	prefs->dedup = string_to_dedup_mode (&rule[6]);
+	if (prefs->dedup == DEDUP_UNKNOWN) {
+	    fprintf (stderr, "Error: unknown dedup mode %s\n", &rule[6]);
+	    exit (1);
+	}
+	debug_printf ("Setting dedup to %s\n", &rule[6]);
+	return;
+    }
+    if ((1==sscanf(rule,"write-buffer=%d",&x))
+	|| (1==sscanf(rule,"write_buffer=%d",&x))) {
+	prefs->write_buffer_kb = x;
+	debug_printf ("Setting write buffer to %d\n",x);
+	return;
+    }
+    if (!strcmp(rule,"preallocate")) {
+	OPT_FLAG_SET(prefs->flags,OPT_PREALLOCATE,1);
+	debug_printf ("Setting preallocate\n");
+	return;
+    }
+    if ((!strcmp(rule,"direct-show"))
+	|| (!strcmp(rule,"direct_show"))) {
+	OPT_FLAG_SET(prefs->flags,OPT_DIRECT_SHOW,1);
+	debug_printf ("Setting direct show\n");
+	return;
+    }
+    if (!strncmp(rule,"durability=",11)) {
+	prefs->durability = string_to_durable_mode (&rule[11]);
+	if (prefs->durability == DURABLE_UNKNOWN) {
+	    fprintf (stderr, "Error: unknown durability mode %s\n", &rule[11]);
+	    exit (1);
+	}
+	debug_printf ("Setting durability to %s\n", &rule[11]);
+	return;
+    }
+
     /* Splitpoint options */
     if ((!strcmp(rule,"xs-none"))
 	|| (!strcmp(rule,"xs_none"))) {
@@ -0,0 +1,356 @@
+/* bgcopy.c
+ * process-wide background copies of finished tracks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* A finished track can't be renamed into a complete directory on
+   another file system, so it is copied there by a worker thread
+   instead, and the ripping thread carries on with the stream.  The
+   copy is written to an unnamed file in the destination directory
+   and linked in when it is done, so a partial copy is never seen.
+   The source stays in the incomplete directory until the copy has
+   succeeded.  Copies still queued at cleanup are finished first. */
+#define _GNU_SOURCE 1		/* For O_TMPFILE and copy_file_range */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined (WIN32)
+#include <unistd.h>
+#endif
+#include "srtypes.h"
+#include "errors.h"
+#include "threadlib.h"
+#include "bgcopy.h"
+#include "durable.h"
+#include "debug.h"
+
+#define BGCOPY_BUF_SIZE		(64 * 1024)
+
+typedef struct bgcopy_job Bgcopy_job;
+struct bgcopy_job
+{
+    int src;
+    char *src_fn;
+    char *dest_fn;
+    int sync;			/* The copy is synced before it is named */
+    guint64 bytes;
+};
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void bgcopy_lock (void);
+static void bgcopy_unlock (void);
+static void bgcopy_worker (void *arg);
+static error_code bgcopy_run (Bgcopy_job *job);
+static void bgcopy_job_free (Bgcopy_job *job);
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+static HSEM m_sem;
+static HSEM m_work_sem;
+static int m_initialized = 0;
+static int m_shutdown = 0;
+static int m_have_thread = 0;
+static THREAD_HANDLE m_thread;
+static GQueue *m_queue = 0;
+
+static u_long m_num_copies = 0;
+static u_long m_num_failures = 0;
+static guint64 m_bytes_copied = 0;
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+void
+bgcopy_init (void)
+{
+    if (m_initialized) return;
+    m_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_sem);
+    m_work_sem = threadlib_create_sem ();
+    m_queue = g_queue_new ();
+    m_shutdown = 0;
+    m_initialized = 1;
+}
+
+void
+bgcopy_cleanup (void)
+{
+    if (!m_initialized) return;
+
+    /* The worker finishes the queue before it exits */
+    bgcopy_lock ();
+    m_shutdown = 1;
+    bgcopy_unlock ();
+    threadlib_signal_sem (&m_work_sem);
+    if (m_have_thread) {
+	threadlib_waitforclose (&m_thread);
+	m_have_thread = 0;
+    }
+    bgcopy_debug_report ();
+
+    g_queue_free (m_queue);
+    m_queue = 0;
+    threadlib_destroy_sem (&m_work_sem);
+    threadlib_destroy_sem (&m_sem);
+    m_initialized = 0;
+}
+
+/* Queue a copy of src_fn to dest_fn.  Both names are in the file
+   system codeset.  The source is opened now, so a new track which
+   takes its name before the copy starts is not copied instead.  If
+   sync is set, the copy is on disk before it gets its name. */
+error_code
+bgcopy_move_file (const char *src_fn, const char *dest_fn, int sync)
+{
+#if defined (WIN32)
+    return SR_ERROR_INVALID_PARAM;
+#else
+    Bgcopy_job *job;
+
+    if (!m_initialized) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+    job = (Bgcopy_job*) calloc (1, sizeof(Bgcopy_job));
+    if (!job) {
+	return SR_ERROR_CANT_ALLOC_MEMORY;
+    }
+    job->src = open (src_fn, O_RDONLY);
+    if (job->src < 0) {
+	free (job);
+	return SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+    job->src_fn = strdup (src_fn);
+    job->dest_fn = strdup (dest_fn);
+    job->sync = sync;
+
+    debug_printf ("BGCOPY: queued %s -> %s\n", src_fn, dest_fn);
+    bgcopy_lock ();
+    g_queue_push_tail (m_queue, job);
+    if (!m_have_thread) {
+	if (threadlib_beginthread (&m_thread, bgcopy_worker, 0)
+	    == SR_SUCCESS) {
+	    m_have_thread = 1;
+	}
+    }
+    bgcopy_unlock ();
+    threadlib_signal_sem (&m_work_sem);
+    return SR_SUCCESS;
+#endif
+}
+
+void
+bgcopy_debug_report (void)
+{
+    bgcopy_lock ();
+    debug_printf ("------ BGCOPY -------\n");
+    debug_printf ("copies = %lu, failures = %lu, bytes = %llu, "
+		  "queued = %d\n",
+		  m_num_copies, m_num_failures,
+		  (unsigned long long) m_bytes_copied,
+		  m_queue ? g_queue_get_length (m_queue) : 0);
+    bgcopy_unlock ();
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void
+bgcopy_lock (void)
+{
+    if (m_initialized) {
+	threadlib_waitfor_sem (&m_sem);
+    }
+}
+
+static void
+bgcopy_unlock (void)
+{
+    if (m_initialized) {
+	threadlib_signal_sem (&m_sem);
+    }
+}
+
+static void
+bgcopy_worker (void *arg)
+{
+    Bgcopy_job *job;
+
+    while (1) {
+	threadlib_waitfor_sem (&m_work_sem);
+
+	/* Drain the queue, one wakeup may stand for several jobs */
+	bgcopy_lock ();
+	while ((job = g_queue_pop_head (m_queue)) != 0) {
+	    error_code rc;
+	    bgcopy_unlock ();
+	    rc = bgcopy_run (job);
+	    bgcopy_lock ();
+	    if (rc == SR_SUCCESS) {
+		m_num_copies++;
+		m_bytes_copied += job->bytes;
+	    } else {
+		m_num_failures++;
+	    }
+	    bgcopy_job_free (job);
+	}
+	if (m_shutdown) {
+	    bgcopy_unlock ();
+	    break;
+	}
+	bgcopy_unlock ();
+    }
+}
+
+static error_code
+bgcopy_run (Bgcopy_job *job)
+{
+#if defined (WIN32)
+    return SR_ERROR_CANT_WRITE_TO_FILE;
+#else
+    char *dir, *p;
+    char proc_fn[64];
+    int dest;
+    int named = 0;
+    off_t in_offset = 0;
+    struct stat st_src, st_now;
+    error_code rc = SR_SUCCESS;
+
+    /* Copy into an unnamed file where the system allows it */
+    dir = strdup (job->dest_fn);
+    p = strrchr (dir, '/');
+    if (p) {
+	*(p + 1) = 0;
+    } else {
+	strcpy (dir, ".");
+    }
+#if defined (O_TMPFILE)
+    dest = open (dir, O_TMPFILE | O_WRONLY,
+		 S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+#else
+    dest = -1;
+#endif
+    free (dir);
+    if (dest < 0) {
+	dest = open (job->dest_fn, O_WRONLY | O_CREAT | O_TRUNC,
+		     S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	named = 1;
+    }
+    if (dest < 0) {
+	debug_printf ("BGCOPY: can't create %s (%d)\n", job->dest_fn, errno);
+	return SR_ERROR_CANT_CREATE_FILE;
+    }
+
+    /* Let the kernel copy, and fall back to read and write if it
+       can't copy between these file systems */
+#if defined (HAVE_COPY_FILE_RANGE)
+    while (1) {
+	ssize_t n = copy_file_range (job->src, &in_offset, dest, NULL,
+				     BGCOPY_BUF_SIZE * 16, 0);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    break;
+	}
+    }
+#endif
+    {
+	char *buf = (char*) malloc (BGCOPY_BUF_SIZE);
+	if (!buf) {
+	    rc = SR_ERROR_CANT_ALLOC_MEMORY;
+	}
+	while (rc == SR_SUCCESS) {
+	    ssize_t n = pread (job->src, buf, BGCOPY_BUF_SIZE, in_offset);
+	    if (n < 0 && errno == EINTR) {
+		continue;
+	    }
+	    if (n < 0) {
+		rc = SR_ERROR_CANT_WRITE_TO_FILE;
+	    }
+	    if (n <= 0) {
+		break;
+	    }
+	    if (write (dest, buf, n) != n) {
+		rc = SR_ERROR_CANT_WRITE_TO_FILE;
+		break;
+	    }
+	    in_offset += n;
+	}
+	free (buf);
+    }
+
+    if (rc == SR_SUCCESS && job->sync && fdatasync (dest) != 0) {
+	rc = SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+
+    /* Publish the copy.  The caller already decided to replace an
+       existing file of this name. */
+    if (rc == SR_SUCCESS && !named) {
+	snprintf (proc_fn, sizeof(proc_fn), "/proc/self/fd/%d", dest);
+	if (linkat (AT_FDCWD, proc_fn, AT_FDCWD, job->dest_fn,
+		    AT_SYMLINK_FOLLOW) != 0) {
+	    if (errno == EEXIST) {
+		unlink (job->dest_fn);
+	    }
+	    if (errno != EEXIST
+		|| linkat (AT_FDCWD, proc_fn, AT_FDCWD, job->dest_fn,
+			   AT_SYMLINK_FOLLOW) != 0) {
+		rc = SR_ERROR_CANT_CREATE_FILE;
+	    }
+	}
+    }
+    close (dest);
+    job->bytes = in_offset;
+
+    if (rc != SR_SUCCESS) {
+	debug_printf ("BGCOPY: copy to %s failed (%d), keeping %s\n",
+		      job->dest_fn, errno, job->src_fn);
+	if (named) {
+	    unlink (job->dest_fn);
+	}
+	return rc;
+    }
+
+    if (job->sync) {
+	durable_sync_dir (job->dest_fn);
+    }
+
+    /* Remove the source, unless a new track has taken its name */
+    if (fstat (job->src, &st_src) == 0 && stat (job->src_fn, &st_now) == 0
+	&& st_src.st_dev == st_now.st_dev && st_src.st_ino == st_now.st_ino) {
+	unlink (job->src_fn);
+    }
+    debug_printf ("BGCOPY: copied %s -> %s\n", job->src_fn, job->dest_fn);
+    return SR_SUCCESS;
+#endif
+}
+
+static void
+bgcopy_job_free (Bgcopy_job *job)
+{
+#if !defined (WIN32)
+    close (job->src);
+#endif
+    free (job->src_fn);
+    free (job->dest_fn);
+    free (job);
+}
@@ -0,0 +1,32 @@
+/* bgcopy.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __BGCOPY_H__
+#define __BGCOPY_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+void bgcopy_init (void);
+void bgcopy_cleanup (void);
+error_code bgcopy_move_file (const char *src_fn, const char *dest_fn, 
+			    int sync);
+void bgcopy_debug_report (void);
+
+#endif
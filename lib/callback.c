@@ -22,6 +22,7 @@
  *                              int message, void *data));
  *   Functions
  *     void rip_manager_init (void);
+ *     void rip_manager_set_mem_budget (u_long maxMB);
  *     error_code rip_manager_start (RIP_MANAGER_INFO **rmi, 
  *	  STREAM_PREFS *prefs, RIP_MANAGER_CALLBACK status_callback);
  *     void rip_manager_stop (RIP_MANAGER_INFO *rmi);
@@ -85,7 +86,7 @@ callback_post_error (RIP_MANAGER_INFO* rmi, error_code err)
  * update via the callback 
  */
 error_code
-callback_start_track (RIP_MANAGER_INFO *rmi, TRACK_INFO* ti)
+callback_start_track (RIP_MANAGER_INFO *rmi, Track_record* ti)
 {
     mchar console_string[SR_MAX_PATH];
 
@@ -43,7 +43,7 @@ callback_post_status (RIP_MANAGER_INFO* rmi, int status);
 void
 callback_post_error (RIP_MANAGER_INFO* rmi, error_code err);
 error_code
-callback_start_track (RIP_MANAGER_INFO *rmi, TRACK_INFO* ti);
+callback_start_track (RIP_MANAGER_INFO *rmi, Track_record* ti);
 void
 callback_put_data (RIP_MANAGER_INFO *rmi, u_long size);
 
@@ -22,10 +22,24 @@
 #include "cbuf3.h"
 #include "threadlib.h"
 #include "relaylib.h"
+#include "memgov.h"
+#include "track_info.h"
 #include "debug.h"
 
+/* Relay clients get this many chunks of history beyond what the 
+   splitpoint windows need.  They are optional memory, so they are 
+   only added below the high water mark, and given back above it. */
+#define RELAY_HISTORY(min_chunks)	((min_chunks) / 2 + 1)
+
 static void
 cbuf3_disconnect_slow_clients (RIP_MANAGER_INFO *rmi, Cbuf3 *cbuf3);
+static error_code cbuf3_grow (struct cbuf3 *cbuf3, u_long num_new);
+static int cbuf3_release_surplus (struct cbuf3 *cbuf3, GList *node);
+static u_long cbuf3_target_for (struct cbuf3 *cbuf3, u_long min_chunks);
+static void cbuf3_stamp_push (Cbuf3 *cbuf3, GList *node);
+static void cbuf3_stamp_pop (Cbuf3 *cbuf3, GList *node);
+static Cbuf3_stamp* cbuf3_stamp_at (Cbuf3 *cbuf3, u_long i);
+static long cbuf3_stamp_search (Cbuf3 *cbuf3, guint64 ms);
 
 
 /******************************************************************************
@@ -33,6 +47,7 @@ cbuf3_disconnect_slow_clients (RIP_MANAGER_INFO *rmi, Cbuf3 *cbuf3);
  *****************************************************************************/
 error_code
 cbuf3_init (struct cbuf3 *cbuf3, 
+	    Memgov_account *mem_account,
 	    int content_type, 
 	    int have_relay, 
 	    unsigned long chunk_size, 
@@ -46,11 +61,14 @@ cbuf3_init (struct cbuf3 *cbuf3,
     cbuf3->have_relay = have_relay;
     cbuf3->content_type = content_type;
     cbuf3->chunk_size = chunk_size;
+    cbuf3->mem_account = mem_account;
 
     cbuf3->buf = g_queue_new ();
     cbuf3->free_list = g_queue_new ();
     cbuf3->pending = 0;
     cbuf3->num_chunks = 0;
+    cbuf3->min_chunks = 0;
+    cbuf3->target_chunks = 0;
 
     /* Ogg stuff */
     cbuf3->ogg_page_refs = g_queue_new ();
@@ -59,6 +77,18 @@ cbuf3_init (struct cbuf3 *cbuf3,
     cbuf3->write_list = g_queue_new ();
     cbuf3->metadata_list = g_queue_new ();
 
+    /* Time index */
+    cbuf3->stamps_size = num_chunks;
+    cbuf3->stamps = g_new0 (Cbuf3_stamp, cbuf3->stamps_size);
+    cbuf3->stamps_head = 0;
+    cbuf3->stamps_len = 0;
+    cbuf3->stamps_seq = 0;
+    cbuf3->stamp_seq = g_hash_table_new (g_direct_hash, g_direct_equal);
+    cbuf3->stream_ms = 0;
+    cbuf3->show_offsets = g_hash_table_new_full (g_direct_hash, 
+						 g_direct_equal, 
+						 NULL, g_free);
+
     //    cbuf2->next_song = 0;        /* MP3 only */
     //    cbuf2->song_page = 0;        /* OGG only */
     //    cbuf2->song_page_done = 0;   /* OGG only */
@@ -67,16 +97,18 @@ cbuf3_init (struct cbuf3 *cbuf3,
     threadlib_signal_sem (&cbuf3->sem);
 
     /* Allocate chunks */
-    cbuf3_allocate_minimum (cbuf3, num_chunks);
-
-    return SR_SUCCESS;
+    return cbuf3_allocate_minimum (cbuf3, num_chunks);
 }
 
+/* Allocate the chunks needed by the splitpoint windows.  The relay 
+   history above them is added later, as memory allows (see 
+   cbuf3_grow_history). */
 error_code
 cbuf3_allocate_minimum (struct cbuf3 *cbuf3, 
 			unsigned long num_chunks)
 {
-    int i;
+    u_long target;
+    error_code rc = SR_SUCCESS;
 
     debug_printf ("Allocating cbuf3\n");
 
@@ -85,25 +117,66 @@ cbuf3_allocate_minimum (struct cbuf3 *cbuf3,
     }
 
     threadlib_waitfor_sem (&cbuf3->sem);
+    if (cbuf3->num_chunks < num_chunks) {
+	rc = cbuf3_grow (cbuf3, num_chunks - cbuf3->num_chunks);
+    }
 
-    if (cbuf3->num_chunks >= num_chunks) {
-	/* Already have enough chunks */
-	threadlib_signal_sem (&cbuf3->sem);
-	return SR_SUCCESS;
+    /* Chunks above this number may be given back under memory pressure */
+    if (rc == SR_SUCCESS) {
+	cbuf3->min_chunks = num_chunks;
+	target = cbuf3_target_for (cbuf3, num_chunks);
+	if (cbuf3->target_chunks < target) {
+	    cbuf3->target_chunks = target;
+	}
     }
+    threadlib_signal_sem (&cbuf3->sem);
+    debug_printf ("Allocating cbuf3 [complete]\n");
+    return rc;
+}
 
-    for (i = 0; i < num_chunks - cbuf3->num_chunks; i++) {
-	char* chunk = (char*) malloc (cbuf3->chunk_size);
-	if (!chunk) {
+/* Change the number of chunks in the cbuf, for example when the 
+   bitrate of a VBR stream changes.  Growing allocates right away.  
+   When shrinking, free chunks are released right away, and chunks 
+   in use are released after they are written (see 
+   cbuf3_insert_free_node).  If growing fails, the sizing is left 
+   as it was. */
+error_code
+cbuf3_resize (struct cbuf3 *cbuf3, unsigned long num_chunks)
+{
+    GList *node;
+    u_long num_released = 0;
+    error_code rc;
+
+    if (num_chunks == 0) {
+        return SR_ERROR_INVALID_PARAM;
+    }
+
+    debug_printf ("Resizing cbuf3: %lu -> %lu chunks\n", 
+		  cbuf3->num_chunks, num_chunks);
+
+    threadlib_waitfor_sem (&cbuf3->sem);
+    if (cbuf3->num_chunks < num_chunks) {
+	rc = cbuf3_grow (cbuf3, num_chunks - cbuf3->num_chunks);
+	if (rc != SR_SUCCESS) {
 	    threadlib_signal_sem (&cbuf3->sem);
-	    return SR_ERROR_CANT_ALLOC_MEMORY;
+	    return rc;
 	}
-	g_queue_push_head (cbuf3->free_list, chunk);
     }
-    cbuf3->num_chunks = num_chunks;
 
+    cbuf3->min_chunks = num_chunks;
+    cbuf3->target_chunks = cbuf3_target_for (cbuf3, num_chunks);
+    while (cbuf3->num_chunks > cbuf3->target_chunks
+	   && (node = g_queue_pop_head_link (cbuf3->free_list)) != 0)
+    {
+	free (node->data);
+	g_list_free_1 (node);
+	cbuf3->num_chunks--;
+	num_released++;
+    }
     threadlib_signal_sem (&cbuf3->sem);
-    debug_printf ("Allocating cbuf3 [complete]\n");
+
+    memgov_release (cbuf3->mem_account, MEMGOV_CBUF, 
+		    num_released * cbuf3->chunk_size);
     return SR_SUCCESS;
 }
 
@@ -111,6 +184,8 @@ void
 cbuf3_destroy (struct cbuf3 *cbuf3)
 {
     char *c;
+    Metadata *metadata;
+    Writer *writer;
 
     /* Remove buffer */
     if (cbuf3->buf) {
@@ -138,6 +213,45 @@ cbuf3_destroy (struct cbuf3 *cbuf3)
 	g_queue_free (cbuf3->ogg_page_refs);
 	cbuf3->ogg_page_refs = 0;
     }
+
+    /* Remove metadata list */
+    if (cbuf3->metadata_list) {
+	while ((metadata = g_queue_pop_head (cbuf3->metadata_list)) != 0) {
+	    track_record_unref (metadata->m_track);
+	    free (metadata);
+	}
+	g_queue_free (cbuf3->metadata_list);
+	cbuf3->metadata_list = 0;
+    }
+
+    /* Remove writers which were not finished */
+    if (cbuf3->write_list) {
+	while ((writer = g_queue_pop_head (cbuf3->write_list)) != 0) {
+	    track_record_unref (writer->m_ti);
+	    free (writer);
+	}
+	g_queue_free (cbuf3->write_list);
+	cbuf3->write_list = 0;
+    }
+
+    /* Remove time index */
+    if (cbuf3->stamp_seq) {
+	g_hash_table_destroy (cbuf3->stamp_seq);
+	cbuf3->stamp_seq = 0;
+    }
+    g_free (cbuf3->stamps);
+    cbuf3->stamps = 0;
+    cbuf3->stamps_size = 0;
+    cbuf3->stamps_len = 0;
+    if (cbuf3->show_offsets) {
+	g_hash_table_destroy (cbuf3->show_offsets);
+	cbuf3->show_offsets = 0;
+    }
+
+    /* Return chunk memory to the budget */
+    memgov_release (cbuf3->mem_account, MEMGOV_CBUF, 
+		    cbuf3->num_chunks * cbuf3->chunk_size);
+    cbuf3->num_chunks = 0;
 }
 
 void
@@ -158,6 +272,8 @@ GList*
 cbuf3_request_free_node (RIP_MANAGER_INFO *rmi,
 			  struct cbuf3 *cbuf3)
 {
+    GList *node;
+
     /* If there is a free chunk, return it */
     /* No need to lock, only the main thread accesses free_list */
     if (! g_queue_is_empty (cbuf3->free_list)) {
@@ -166,9 +282,48 @@ cbuf3_request_free_node (RIP_MANAGER_INFO *rmi,
 	return g_queue_pop_head_link (cbuf3->free_list);
     }
 
-    /* Otherwise, we have to eject the oldest chunk from buf. */
+    /* Grow into the relay history while there is memory to spare */
+    if (cbuf3_grow_history (cbuf3)) {
+	return g_queue_pop_head_link (cbuf3->free_list);
+    }
+
+    /* Otherwise, we have to eject the oldest chunk from buf.  Ogg 
+       streams retire their chunks here, so surplus relay history is 
+       given back here too. */
     debug_printf ("Free node from used list.\n");
-    return cbuf3_extract_oldest_node (rmi, cbuf3);
+    node = cbuf3_extract_oldest_node (rmi, cbuf3);
+    if (node && cbuf3_release_surplus (cbuf3, node)) {
+	if (cbuf3->content_type == CONTENT_TYPE_OGG) {
+	    cbuf3_ogg_remove_old_page_references (cbuf3);
+	}
+	node = cbuf3_extract_oldest_node (rmi, cbuf3);
+    }
+    return node;
+}
+
+/* Called when the cbuf is full, before its oldest chunk is retired.  
+   If the relay history is short of its target and memory is not 
+   tight, a chunk is added to the free list instead, and 1 is 
+   returned. */
+int
+cbuf3_grow_history (Cbuf3 *cbuf3)
+{
+    error_code rc;
+
+    if (cbuf3->num_chunks >= cbuf3->target_chunks 
+	|| memgov_under_pressure ())
+    {
+	return 0;
+    }
+    threadlib_waitfor_sem (&cbuf3->sem);
+    rc = cbuf3_grow (cbuf3, 1);
+    threadlib_signal_sem (&cbuf3->sem);
+    if (rc != SR_SUCCESS) {
+	return 0;
+    }
+    debug_printf ("Added relay history node [%d/%d]\n", 
+		  cbuf3->num_chunks, cbuf3->target_chunks);
+    return 1;
 }
 
 error_code
@@ -187,6 +342,7 @@ cbuf3_insert_node (struct cbuf3 *cbuf3, GList *node)
 
     node->prev = node->next = 0;
     g_queue_push_tail_link (cbuf3->buf, node);
+    cbuf3_stamp_push (cbuf3, node);
 
     for (i = 0, p = cbuf3->buf->head; p; i++, p = p->next) {
 	debug_printf ("[%3d]  %p, %p\n", i, p, p->data);
@@ -205,8 +361,13 @@ void
 cbuf3_insert_free_node (struct cbuf3 *cbuf3, GList *node)
 {
     /* No need to lock, only the main thread accesses free_list */
-    debug_printf ("Inserting free node\n");
     node->prev = node->next = 0;
+
+    if (cbuf3_release_surplus (cbuf3, node)) {
+	return;
+    }
+
+    debug_printf ("Inserting free node\n");
     g_queue_push_head_link (cbuf3->free_list, node);
 }
 
@@ -216,7 +377,7 @@ cbuf3_ogg_remove_old_page_references (Cbuf3 *cbuf3)
 {
     Ogg_page_reference *opr;
 
-    if (!cbuf3_is_full (cbuf3)) {
+    if (!cbuf3_is_full (cbuf3) || !cbuf3->ogg_page_refs->head) {
 	return;
     }
 
@@ -286,6 +447,7 @@ cbuf3_extract_oldest_node (RIP_MANAGER_INFO *rmi,
 
     /* Remove the chunk */
     node = g_queue_pop_head_link (cbuf3->buf);
+    cbuf3_stamp_pop (cbuf3, node);
 
     /* Done */
     threadlib_signal_sem (&cbuf3->sem);
@@ -298,13 +460,25 @@ cbuf3_extract_oldest_node (RIP_MANAGER_INFO *rmi,
     return node;
 }
 
+/* If the metadata changed, *changed is set to the new record, which
+   is owned by the metadata list */
 error_code
-cbuf3_insert_metadata (struct cbuf3 *cbuf3, TRACK_INFO* ti)
+cbuf3_insert_metadata (struct cbuf3 *cbuf3, TRACK_INFO* ti,
+		       Track_record **changed)
 {
+    *changed = 0;
     if (ti && ti->have_track_info) {
 	Metadata *metadata;
 	threadlib_waitfor_sem (&cbuf3->sem);
 
+	/* The metadata applies until the next change, so only 
+	   changes are queued */
+	metadata = (Metadata*) g_queue_peek_tail (cbuf3->metadata_list);
+	if (metadata && !track_info_different (metadata->m_track, ti)) {
+	    threadlib_signal_sem (&cbuf3->sem);
+	    return SR_SUCCESS;
+	}
+
 	metadata = (Metadata*) malloc (sizeof(Metadata));
 	if (!metadata) {
 	    threadlib_signal_sem (&cbuf3->sem);
@@ -312,10 +486,9 @@ cbuf3_insert_metadata (struct cbuf3 *cbuf3, TRACK_INFO* ti)
 	}
 
 	metadata->m_node = cbuf3->buf->tail;
-	memcpy (metadata->m_composed_metadata, 
-		ti->composed_metadata, 
-		MAX_METADATA_LEN+1);
+	metadata->m_track = track_record_new (ti);
 	g_queue_push_tail (cbuf3->metadata_list, metadata);
+	*changed = metadata->m_track;
 	threadlib_signal_sem (&cbuf3->sem);
     }
     return SR_SUCCESS;
@@ -530,7 +703,8 @@ cbuf3_ogg_advance_page (Cbuf3 *cbuf3)
 error_code
 cbuf3_initialize_relay_client_ptr (struct cbuf3 *cbuf3,
 		       struct relay_client *relay_client,
-		       u_long burst_request)
+		       u_long burst_request,
+		       u_long burst_ms)
 {
     debug_printf ("cbuf3_add_relay_entry is waiting for cbuf3->sem\n");
     threadlib_waitfor_sem (&cbuf3->sem);
@@ -595,12 +769,19 @@ cbuf3_initialize_relay_client_ptr (struct cbuf3 *cbuf3,
 	}
 	burst_amt += cbuf3->chunk_size;
 
-	while (burst_amt < burst_request) {
-	    node_ptr = node_ptr->prev;
-	    if (!node_ptr) {
-		break;
+	if (cbuf3->stream_ms > burst_ms) {
+	    /* The time index knows the duration of each chunk, so 
+	       the burst can be measured in time */
+	    long i = cbuf3_stamp_search (cbuf3, cbuf3->stream_ms - burst_ms);
+	    if (i < 0) {
+		i = 0;
+	    }
+	    node_ptr = cbuf3_stamp_at (cbuf3, i)->node;
+	} else {
+	    while (burst_amt < burst_request && node_ptr->prev) {
+		node_ptr = node_ptr->prev;
+		burst_amt += cbuf3->chunk_size;
 	    }
-	    burst_amt += cbuf3->chunk_size;
 	}
 
 	relay_client->m_cbuf_ptr.node = node_ptr;
@@ -733,6 +914,76 @@ cbuf3_extract (Cbuf3 *cbuf3,
     return SR_SUCCESS;
 }
 
+/* Record the decoded duration of the newest chunk.  The stream 
+   time of the following chunks is derived from this. */
+void
+cbuf3_set_tail_timing (Cbuf3 *cbuf3, u_long duration_ms)
+{
+    Cbuf3_stamp *stamp;
+
+    threadlib_waitfor_sem (&cbuf3->sem);
+    if (cbuf3->stamps_len > 0) {
+	stamp = cbuf3_stamp_at (cbuf3, cbuf3->stamps_len - 1);
+	stamp->duration_ms = duration_ms;
+	cbuf3->stream_ms = stamp->start_ms + duration_ms;
+    }
+    threadlib_signal_sem (&cbuf3->sem);
+}
+
+/* Record where node was written in the show file */
+void
+cbuf3_set_show_offset (Cbuf3 *cbuf3, GList *node, guint64 offset)
+{
+    guint64 *value = g_new (guint64, 1);
+
+    *value = offset;
+    threadlib_waitfor_sem (&cbuf3->sem);
+    g_hash_table_replace (cbuf3->show_offsets, node, value);
+    threadlib_signal_sem (&cbuf3->sem);
+}
+
+/* Get and forget where node was written in the show file.  Returns 
+   0 if it wasn't recorded. */
+int
+cbuf3_take_show_offset (Cbuf3 *cbuf3, GList *node, guint64 *offset)
+{
+    guint64 *value;
+    int found = 0;
+
+    threadlib_waitfor_sem (&cbuf3->sem);
+    value = (guint64*) g_hash_table_lookup (cbuf3->show_offsets, node);
+    if (value) {
+	*offset = *value;
+	found = 1;
+	g_hash_table_remove (cbuf3->show_offsets, node);
+    }
+    threadlib_signal_sem (&cbuf3->sem);
+    return found;
+}
+
+/* Find the stream time at which the byte at in_ptr was playing */
+error_code
+cbuf3_pointer_to_time (Cbuf3 *cbuf3, Cbuf3_pointer *in_ptr, guint64 *ms)
+{
+    Cbuf3_stamp *stamp;
+    gpointer value;
+    u_long seq;
+
+    threadlib_waitfor_sem (&cbuf3->sem);
+    if (!in_ptr->node 
+	|| !g_hash_table_lookup_extended (cbuf3->stamp_seq, in_ptr->node, 
+					  NULL, &value)) {
+	threadlib_signal_sem (&cbuf3->sem);
+	return SR_ERROR_BUFFER_TOO_SMALL;
+    }
+    seq = GPOINTER_TO_UINT (value);
+    stamp = cbuf3_stamp_at (cbuf3, seq - cbuf3->stamps_seq);
+    *ms = stamp->start_ms 
+	    + (guint64) in_ptr->offset * stamp->duration_ms / cbuf3->chunk_size;
+    threadlib_signal_sem (&cbuf3->sem);
+    return SR_SUCCESS;
+}
+
 /******************************************************************************
  * Private functions
  *****************************************************************************/
@@ -755,3 +1006,132 @@ cbuf3_disconnect_slow_clients (RIP_MANAGER_INFO *rmi, Cbuf3 *cbuf3)
 	rlist_node = next;
     }
 }
+
+/* Add num_new chunks to the free list.  Caller holds cbuf3->sem. */
+static error_code
+cbuf3_grow (struct cbuf3 *cbuf3, u_long num_new)
+{
+    u_long i;
+    error_code rc;
+
+    rc = memgov_reserve (cbuf3->mem_account, MEMGOV_CBUF, 
+			 num_new * cbuf3->chunk_size);
+    if (rc != SR_SUCCESS) {
+	return rc;
+    }
+    for (i = 0; i < num_new; i++) {
+	char* chunk = (char*) malloc (cbuf3->chunk_size);
+	if (!chunk) {
+	    memgov_release (cbuf3->mem_account, MEMGOV_CBUF, 
+			    (num_new - i) * cbuf3->chunk_size);
+	    return SR_ERROR_CANT_ALLOC_MEMORY;
+	}
+	g_queue_push_head (cbuf3->free_list, chunk);
+	cbuf3->num_chunks++;
+    }
+    return SR_SUCCESS;
+}
+
+/* If the cbuf was made smaller, or if memory is tight, give back 
+   chunks which are not needed for splitting.  These only lengthen 
+   the history for relay clients.  Returns 1 if node was freed. */
+static int
+cbuf3_release_surplus (struct cbuf3 *cbuf3, GList *node)
+{
+    if (cbuf3->num_chunks <= cbuf3->min_chunks 
+	|| (cbuf3->num_chunks <= cbuf3->target_chunks 
+	    && !memgov_under_pressure ()))
+    {
+	return 0;
+    }
+    debug_printf ("Releasing surplus node\n");
+    threadlib_waitfor_sem (&cbuf3->sem);
+    cbuf3->num_chunks--;
+    threadlib_signal_sem (&cbuf3->sem);
+    free (node->data);
+    g_list_free_1 (node);
+    memgov_release (cbuf3->mem_account, MEMGOV_CBUF, cbuf3->chunk_size);
+    return 1;
+}
+
+/* The size to keep the cbuf at when there is memory to spare */
+static u_long
+cbuf3_target_for (struct cbuf3 *cbuf3, u_long min_chunks)
+{
+    if (!cbuf3->have_relay) {
+	return min_chunks;
+    }
+    return min_chunks + RELAY_HISTORY (min_chunks);
+}
+
+/* The stamps are a ring which parallels buf, so the i'th stamp 
+   describes the i'th chunk.  Caller holds cbuf3->sem. */
+static Cbuf3_stamp*
+cbuf3_stamp_at (Cbuf3 *cbuf3, u_long i)
+{
+    return &cbuf3->stamps[(cbuf3->stamps_head + i) % cbuf3->stamps_size];
+}
+
+static void
+cbuf3_stamp_push (Cbuf3 *cbuf3, GList *node)
+{
+    Cbuf3_stamp *stamp;
+
+    /* Grow the ring if the buffer has grown */
+    if (cbuf3->stamps_len == cbuf3->stamps_size) {
+	u_long new_size = cbuf3->stamps_size ? 2 * cbuf3->stamps_size : 16;
+	Cbuf3_stamp *new_stamps = g_new0 (Cbuf3_stamp, new_size);
+	u_long i;
+	for (i = 0; i < cbuf3->stamps_len; i++) {
+	    new_stamps[i] = *cbuf3_stamp_at (cbuf3, i);
+	}
+	g_free (cbuf3->stamps);
+	cbuf3->stamps = new_stamps;
+	cbuf3->stamps_size = new_size;
+	cbuf3->stamps_head = 0;
+    }
+
+    stamp = cbuf3_stamp_at (cbuf3, cbuf3->stamps_len);
+    stamp->node = node;
+    stamp->start_ms = cbuf3->stream_ms;
+    stamp->duration_ms = 0;
+    g_hash_table_insert (cbuf3->stamp_seq, node, 
+			 GUINT_TO_POINTER (cbuf3->stamps_seq 
+					   + cbuf3->stamps_len));
+    cbuf3->stamps_len++;
+}
+
+static void
+cbuf3_stamp_pop (Cbuf3 *cbuf3, GList *node)
+{
+    if (cbuf3->stamps_len == 0) {
+	return;
+    }
+    g_hash_table_remove (cbuf3->stamp_seq, node);
+    cbuf3->stamps_head = (cbuf3->stamps_head + 1) % cbuf3->stamps_size;
+    cbuf3->stamps_len--;
+    cbuf3->stamps_seq++;
+}
+
+/* Binary search for the chunk playing at stream time ms.  
+   Returns -1 if ms is not in the buffer. */
+static long
+cbuf3_stamp_search (Cbuf3 *cbuf3, guint64 ms)
+{
+    long lo = 0;
+    long hi = (long) cbuf3->stamps_len - 1;
+
+    if (hi < 0 || ms < cbuf3_stamp_at (cbuf3, 0)->start_ms 
+	|| ms >= cbuf3->stream_ms) {
+	return -1;
+    }
+    while (lo < hi) {
+	long mid = (lo + hi + 1) / 2;
+	if (cbuf3_stamp_at (cbuf3, mid)->start_ms <= ms) {
+	    lo = mid;
+	} else {
+	    hi = mid - 1;
+	}
+    }
+    return lo;
+}
@@ -25,6 +25,7 @@
  *****************************************************************************/
 error_code
 cbuf3_init (struct cbuf3 *cbuf3, 
+	    Memgov_account *mem_account,
 	    int content_type, 
 	    int have_relay, 
 	    unsigned long chunk_size, 
@@ -32,6 +33,8 @@ cbuf3_init (struct cbuf3 *cbuf3,
 error_code
 cbuf3_allocate_minimum (struct cbuf3 *cbuf3, 
 			unsigned long num_chunks);
+error_code
+cbuf3_resize (struct cbuf3 *cbuf3, unsigned long num_chunks);
 void
 cbuf3_destroy (struct cbuf3 *cbuf3);
 GList*
@@ -41,6 +44,8 @@ void
 cbuf3_debug_free_list (Cbuf3 *cbuf3);
 int
 cbuf3_is_full (Cbuf3 *cbuf3);
+int
+cbuf3_grow_history (Cbuf3 *cbuf3);
 error_code
 cbuf3_insert_node (struct cbuf3 *cbuf3, GList *node);
 void
@@ -49,7 +54,8 @@ GList*
 cbuf3_extract_oldest_node (RIP_MANAGER_INFO *rmi,
 			   struct cbuf3 *cbuf3);
 error_code
-cbuf3_insert_metadata (struct cbuf3 *cbuf3, TRACK_INFO* ti);
+cbuf3_insert_metadata (struct cbuf3 *cbuf3, TRACK_INFO* ti,
+		       Track_record **changed);
 error_code
 cbuf3_pointer_add (struct cbuf3 *cbuf3, 
 		   struct cbuf3_pointer *out_ptr, 
@@ -78,6 +84,14 @@ void
 cbuf3_splice_page_list (struct cbuf3 *cbuf3, 
 			GList **new_pages);
 void
+cbuf3_set_tail_timing (Cbuf3 *cbuf3, u_long duration_ms);
+error_code
+cbuf3_pointer_to_time (Cbuf3 *cbuf3, Cbuf3_pointer *in_ptr, guint64 *ms);
+void
+cbuf3_set_show_offset (Cbuf3 *cbuf3, GList *node, guint64 offset);
+int
+cbuf3_take_show_offset (Cbuf3 *cbuf3, GList *node, guint64 *offset);
+void
 cbuf3_ogg_peek_page (Cbuf3 *cbuf3, 
 		     GList **page_node);
 void
@@ -87,7 +101,8 @@ cbuf3_ogg_remove_old_page_references (Cbuf3 *cbuf3);
 error_code
 cbuf3_initialize_relay_client_ptr (struct cbuf3 *cbuf3,
 				   struct relay_client *relay_client,
-				   u_long burst_request);
+				   u_long burst_request,
+				   u_long burst_ms);
 error_code 
 cbuf3_extract_relay (Cbuf3 *cbuf3,
 		     Relay_client *relay_client);
@@ -0,0 +1,265 @@
+/* connsched.c
+ * process-wide scheduling of new stream connections
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* Every connect goes through here.  A connect needs a token from a 
+   bucket which is refilled at CONNSCHED_RATE tokens per second, and 
+   no more than CONNSCHED_MAX_PER_HOST connects to one host may be in 
+   progress at once.  Streams which wait poll the scheduler, so the 
+   order they get through is not strictly first come first served.
+   Retries are spaced by exponential backoff with decorrelated 
+   jitter, so that streams which lost their server together don't 
+   come back together. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "errors.h"
+#include "threadlib.h"
+#include "connsched.h"
+#include "debug.h"
+
+#define CONNSCHED_RATE		5	/* New connects per second */
+#define CONNSCHED_BURST		10
+#define CONNSCHED_MAX_PER_HOST	4
+#define CONNSCHED_POLL_MS	50
+#define CONNSCHED_DEFAULT_WAIT_MS	(15 * 1000)
+#define BACKOFF_BASE_MS		1000
+#define BACKOFF_CAP_MS		(60 * 1000)
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void connsched_lock (void);
+static void connsched_unlock (void);
+static void connsched_refill (guint64 now);
+static guint32 connsched_random (void);
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+static HSEM m_sem;
+static int m_initialized = 0;
+static GHashTable *m_hosts = 0;		/* host -> connects in progress */
+static u_long m_tokens = 0;		/* In thousandths of a token */
+static guint64 m_refill_ms = 0;
+static guint32 m_seed = 1;
+static Connsched_stats m_stats;
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+void
+connsched_init (void)
+{
+    if (m_initialized) return;
+    m_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_sem);
+    m_hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    m_tokens = CONNSCHED_BURST * 1000;
+    m_refill_ms = threadlib_monotonic_ms ();
+    m_seed = (guint32) m_refill_ms | 1;
+    memset (&m_stats, 0, sizeof(m_stats));
+    m_initialized = 1;
+}
+
+void
+connsched_cleanup (void)
+{
+    if (!m_initialized) return;
+    connsched_debug_report ();
+    g_hash_table_destroy (m_hosts);
+    m_hosts = 0;
+    threadlib_destroy_sem (&m_sem);
+    m_initialized = 0;
+}
+
+/* Wait until a connect to host may start.  Gives up when the ripper 
+   is stopped, or after the prefs timeout.  Each successful call must 
+   be matched by connsched_release once the connect is done. */
+error_code
+connsched_acquire (RIP_MANAGER_INFO* rmi, const char *host)
+{
+    guint64 start, now, max_wait;
+    int queued = 0;
+    error_code rc = SR_SUCCESS;
+
+    if (!m_initialized) {
+	return SR_SUCCESS;
+    }
+    max_wait = rmi->prefs->timeout > 0 
+	    ? (guint64) rmi->prefs->timeout * 1000 
+	    : CONNSCHED_DEFAULT_WAIT_MS;
+
+    start = now = threadlib_monotonic_ms ();
+    connsched_lock ();
+    while (1) {
+	int in_progress;
+	connsched_refill (now);
+	in_progress = GPOINTER_TO_INT (g_hash_table_lookup (m_hosts, host));
+	if (m_tokens >= 1000 && in_progress < CONNSCHED_MAX_PER_HOST) {
+	    m_tokens -= 1000;
+	    g_hash_table_replace (m_hosts, g_strdup (host), 
+				  GINT_TO_POINTER (in_progress + 1));
+	    m_stats.num_connects++;
+	    break;
+	}
+	if (!queued) {
+	    queued = 1;
+	    m_stats.num_waits++;
+	    m_stats.waiting++;
+	    if (m_stats.waiting > m_stats.max_waiting) {
+		m_stats.max_waiting = m_stats.waiting;
+	    }
+	}
+	connsched_unlock ();
+
+	if (!rmi->started) {
+	    rc = SR_ERROR_ABORT_PIPE_SIGNALLED;
+	} else if (now - start >= max_wait) {
+	    rc = SR_ERROR_TIMEOUT;
+	} else {
+	    Sleep (CONNSCHED_POLL_MS);
+	}
+	now = threadlib_monotonic_ms ();
+	connsched_lock ();
+	if (rc == SR_ERROR_TIMEOUT) {
+	    m_stats.num_timeouts++;
+	}
+	if (rc != SR_SUCCESS) {
+	    break;
+	}
+    }
+
+    if (queued) {
+	m_stats.waiting--;
+	m_stats.total_wait_ms += now - start;
+	if (now - start > m_stats.max_wait_ms) {
+	    m_stats.max_wait_ms = now - start;
+	}
+	debug_printf ("CONNSCHED: waited %lu ms for %s\n", 
+		      (u_long) (now - start), host);
+    }
+    connsched_unlock ();
+    return rc;
+}
+
+void
+connsched_release (const char *host)
+{
+    int in_progress;
+
+    if (!m_initialized) return;
+    connsched_lock ();
+    in_progress = GPOINTER_TO_INT (g_hash_table_lookup (m_hosts, host));
+    if (in_progress > 1) {
+	g_hash_table_replace (m_hosts, g_strdup (host), 
+			      GINT_TO_POINTER (in_progress - 1));
+    } else {
+	g_hash_table_remove (m_hosts, host);
+    }
+    connsched_unlock ();
+}
+
+/* Sleep before the next retry.  *delay_ms holds the previous delay, 
+   and should be zero before the first retry.  The sleep ends early 
+   if the ripper is stopped. */
+void
+connsched_backoff (RIP_MANAGER_INFO* rmi, guint64 *delay_ms)
+{
+    guint64 prev = *delay_ms < BACKOFF_BASE_MS ? BACKOFF_BASE_MS : *delay_ms;
+    guint64 delay, end;
+
+    connsched_lock ();
+    delay = BACKOFF_BASE_MS 
+	    + connsched_random () % (prev * 3 - BACKOFF_BASE_MS + 1);
+    connsched_unlock ();
+    if (delay > BACKOFF_CAP_MS) {
+	delay = BACKOFF_CAP_MS;
+    }
+    *delay_ms = delay;
+    debug_printf ("CONNSCHED: backing off %lu ms\n", (u_long) delay);
+
+    end = threadlib_monotonic_ms () + delay;
+    while (rmi->started && threadlib_monotonic_ms () < end) {
+	Sleep (CONNSCHED_POLL_MS);
+    }
+}
+
+void
+connsched_get_stats (Connsched_stats *stats)
+{
+    connsched_lock ();
+    *stats = m_stats;
+    connsched_unlock ();
+}
+
+void
+connsched_debug_report (void)
+{
+    Connsched_stats stats;
+
+    connsched_get_stats (&stats);
+    debug_printf ("------ CONNSCHED -------\n");
+    debug_printf ("connects = %lu, waited = %lu, timeouts = %lu, "
+		  "waiting = %d (max %d)\n",
+		  stats.num_connects, stats.num_waits, stats.num_timeouts,
+		  stats.waiting, stats.max_waiting);
+    debug_printf ("wait ms: total = %lu, max = %lu\n",
+		  (u_long) stats.total_wait_ms, (u_long) stats.max_wait_ms);
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void
+connsched_lock (void)
+{
+    if (m_initialized) {
+	threadlib_waitfor_sem (&m_sem);
+    }
+}
+
+static void
+connsched_unlock (void)
+{
+    if (m_initialized) {
+	threadlib_signal_sem (&m_sem);
+    }
+}
+
+/* Called with the lock held */
+static void
+connsched_refill (guint64 now)
+{
+    guint64 tokens;
+    if (now <= m_refill_ms) {
+	return;
+    }
+    tokens = m_tokens + (now - m_refill_ms) * CONNSCHED_RATE;
+    m_tokens = tokens > CONNSCHED_BURST * 1000 
+	    ? CONNSCHED_BURST * 1000 : (u_long) tokens;
+    m_refill_ms = now;
+}
+
+/* Called with the lock held.  xorshift, good enough for jitter. */
+static guint32
+connsched_random (void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
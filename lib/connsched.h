@@ -0,0 +1,46 @@
+/* connsched.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __CONNSCHED_H__
+#define __CONNSCHED_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+typedef struct connsched_stats Connsched_stats;
+struct connsched_stats
+{
+    int waiting;		/* Connects queued right now */
+    int max_waiting;
+    u_long num_connects;
+    u_long num_waits;		/* Connects which had to queue */
+    u_long num_timeouts;
+    guint64 total_wait_ms;
+    guint64 max_wait_ms;
+};
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+void connsched_init (void);
+void connsched_cleanup (void);
+error_code connsched_acquire (RIP_MANAGER_INFO* rmi, const char *host);
+void connsched_release (const char *host);
+void connsched_backoff (RIP_MANAGER_INFO* rmi, guint64 *delay_ms);
+void connsched_get_stats (Connsched_stats *stats);
+void connsched_debug_report (void);
+
+#endif
@@ -0,0 +1,334 @@
+/* dedup.c
+ * process-wide table of completed tracks by the hash of their audio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* The audio of each track is hashed as it is written, so that when
+   the track is finished we know without reading it again whether an
+   identical track was already completed.  Tags are not hashed.  The
+   hash is XXH64, computed 32 bytes at a time with the leftover bytes
+   of each write kept for the next one.  The table remembers the file
+   of each hash and audio size; a file is only used again if it still
+   has the size it had when it was completed. */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "srtypes.h"
+#include "threadlib.h"
+#include "dedup.h"
+#include "debug.h"
+
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+
+#define ROTL64(x,r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+typedef struct dedup_entry Dedup_entry;
+struct dedup_entry
+{
+    guint64 hash;
+    guint64 audio_size;
+    guint64 file_size;
+    char *fn;
+};
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void dedup_lock (void);
+static void dedup_unlock (void);
+static void dedup_entry_free (Dedup_entry *de);
+static guint dedup_key_hash (gconstpointer key);
+static gboolean dedup_key_equal (gconstpointer a, gconstpointer b);
+static guint64 dedup_round (guint64 acc, guint64 input);
+static guint64 dedup_merge_round (guint64 acc, guint64 val);
+static guint64 dedup_read64 (const unsigned char *p);
+static guint32 dedup_read32 (const unsigned char *p);
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+static HSEM m_sem;
+static int m_initialized = 0;
+static GHashTable *m_table = 0;		/* hash -> Dedup_entry */
+
+static u_long m_num_dups = 0;
+static guint64 m_bytes_saved = 0;
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+void
+dedup_init (void)
+{
+    if (m_initialized) return;
+    m_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_sem);
+    m_table = g_hash_table_new_full (dedup_key_hash, dedup_key_equal, NULL,
+				     (GDestroyNotify) dedup_entry_free);
+    m_initialized = 1;
+}
+
+void
+dedup_cleanup (void)
+{
+    if (!m_initialized) return;
+    dedup_debug_report ();
+    g_hash_table_destroy (m_table);
+    m_table = 0;
+    threadlib_destroy_sem (&m_sem);
+    m_initialized = 0;
+}
+
+void
+dedup_hash_init (Dedup_hash *dh)
+{
+    dh->v[0] = PRIME64_1 + PRIME64_2;
+    dh->v[1] = PRIME64_2;
+    dh->v[2] = 0;
+    dh->v[3] = - PRIME64_1;
+    dh->total = 0;
+    dh->buf_len = 0;
+}
+
+void
+dedup_hash_update (Dedup_hash *dh, const char *buf, u_long size)
+{
+    const unsigned char *p = (const unsigned char*) buf;
+    const unsigned char *end = p + size;
+
+    dh->total += size;
+
+    /* Finish the stripe left over from the last write */
+    if (dh->buf_len) {
+	u_long n = 32 - dh->buf_len;
+	if (n > size) {
+	    n = size;
+	}
+	memcpy (dh->buf + dh->buf_len, p, n);
+	dh->buf_len += n;
+	p += n;
+	if (dh->buf_len < 32) {
+	    return;
+	}
+	dh->v[0] = dedup_round (dh->v[0], dedup_read64 (dh->buf));
+	dh->v[1] = dedup_round (dh->v[1], dedup_read64 (dh->buf + 8));
+	dh->v[2] = dedup_round (dh->v[2], dedup_read64 (dh->buf + 16));
+	dh->v[3] = dedup_round (dh->v[3], dedup_read64 (dh->buf + 24));
+	dh->buf_len = 0;
+    }
+
+    while (end - p >= 32) {
+	dh->v[0] = dedup_round (dh->v[0], dedup_read64 (p));
+	dh->v[1] = dedup_round (dh->v[1], dedup_read64 (p + 8));
+	dh->v[2] = dedup_round (dh->v[2], dedup_read64 (p + 16));
+	dh->v[3] = dedup_round (dh->v[3], dedup_read64 (p + 24));
+	p += 32;
+    }
+
+    if (p < end) {
+	memcpy (dh->buf, p, end - p);
+	dh->buf_len = end - p;
+    }
+}
+
+/* The hash of everything so far.  The state is not changed. */
+guint64
+dedup_hash_digest (Dedup_hash *dh)
+{
+    const unsigned char *p = dh->buf;
+    const unsigned char *end = p + dh->buf_len;
+    guint64 h;
+
+    if (dh->total >= 32) {
+	h = ROTL64 (dh->v[0], 1) + ROTL64 (dh->v[1], 7)
+		+ ROTL64 (dh->v[2], 12) + ROTL64 (dh->v[3], 18);
+	h = dedup_merge_round (h, dh->v[0]);
+	h = dedup_merge_round (h, dh->v[1]);
+	h = dedup_merge_round (h, dh->v[2]);
+	h = dedup_merge_round (h, dh->v[3]);
+    } else {
+	h = PRIME64_5;
+    }
+    h += dh->total;
+
+    while (end - p >= 8) {
+	h ^= dedup_round (0, dedup_read64 (p));
+	h = ROTL64 (h, 27) * PRIME64_1 + PRIME64_4;
+	p += 8;
+    }
+    if (end - p >= 4) {
+	h ^= (guint64) dedup_read32 (p) * PRIME64_1;
+	h = ROTL64 (h, 23) * PRIME64_2 + PRIME64_3;
+	p += 4;
+    }
+    while (p < end) {
+	h ^= (*p) * PRIME64_5;
+	h = ROTL64 (h, 11) * PRIME64_1;
+	p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* Look for a completed file with the same audio.  Returns 1 and
+   copies its name (in the file system codeset) to fn if there is
+   one which hasn't changed since. */
+int
+dedup_find (guint64 hash, guint64 audio_size, char *fn, int fn_size)
+{
+    Dedup_entry *de;
+    struct stat st;
+    int found = 0;
+
+    if (!m_initialized || !audio_size) {
+	return 0;
+    }
+    dedup_lock ();
+    de = (Dedup_entry*) g_hash_table_lookup (m_table, &hash);
+    if (de && de->audio_size == audio_size) {
+	if (stat (de->fn, &st) == 0 && (guint64) st.st_size == de->file_size
+	    && (int) strlen (de->fn) < fn_size) {
+	    strcpy (fn, de->fn);
+	    found = 1;
+	} else {
+	    debug_printf ("DEDUP: %s has changed\n", de->fn);
+	    g_hash_table_remove (m_table, &hash);
+	}
+    }
+    dedup_unlock ();
+    return found;
+}
+
+/* Remember the completed file fn, named in the file system codeset */
+void
+dedup_add (guint64 hash, guint64 audio_size, const char *fn)
+{
+    Dedup_entry *de;
+    struct stat st;
+
+    if (!m_initialized || !audio_size || stat (fn, &st) != 0) {
+	return;
+    }
+    de = (Dedup_entry*) malloc (sizeof(Dedup_entry));
+    if (!de) {
+	return;
+    }
+    de->hash = hash;
+    de->audio_size = audio_size;
+    de->file_size = st.st_size;
+    de->fn = strdup (fn);
+    dedup_lock ();
+    g_hash_table_replace (m_table, &de->hash, de);
+    dedup_unlock ();
+}
+
+void
+dedup_saved (guint64 bytes)
+{
+    dedup_lock ();
+    m_num_dups++;
+    m_bytes_saved += bytes;
+    dedup_unlock ();
+}
+
+void
+dedup_debug_report (void)
+{
+    dedup_lock ();
+    debug_printf ("------ DEDUP -------\n");
+    debug_printf ("tracks = %d, duplicates = %lu, bytes saved = %llu\n",
+		  m_table ? g_hash_table_size (m_table) : 0,
+		  m_num_dups, (unsigned long long) m_bytes_saved);
+    dedup_unlock ();
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void
+dedup_lock (void)
+{
+    if (m_initialized) {
+	threadlib_waitfor_sem (&m_sem);
+    }
+}
+
+static void
+dedup_unlock (void)
+{
+    if (m_initialized) {
+	threadlib_signal_sem (&m_sem);
+    }
+}
+
+static void
+dedup_entry_free (Dedup_entry *de)
+{
+    free (de->fn);
+    free (de);
+}
+
+/* The keys point to the guint64 hash of the entry */
+static guint
+dedup_key_hash (gconstpointer key)
+{
+    guint64 h = *(const guint64*) key;
+    return (guint) (h ^ (h >> 32));
+}
+
+static gboolean
+dedup_key_equal (gconstpointer a, gconstpointer b)
+{
+    return *(const guint64*) a == *(const guint64*) b;
+}
+
+static guint64
+dedup_round (guint64 acc, guint64 input)
+{
+    acc += input * PRIME64_2;
+    acc = ROTL64 (acc, 31);
+    return acc * PRIME64_1;
+}
+
+static guint64
+dedup_merge_round (guint64 acc, guint64 val)
+{
+    acc ^= dedup_round (0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* Little endian, whatever the machine */
+static guint64
+dedup_read64 (const unsigned char *p)
+{
+    return (guint64) dedup_read32 (p) | ((guint64) dedup_read32 (p + 4) << 32);
+}
+
+static guint32
+dedup_read32 (const unsigned char *p)
+{
+    return (guint32) p[0] | ((guint32) p[1] << 8)
+	    | ((guint32) p[2] << 16) | ((guint32) p[3] << 24);
+}
@@ -0,0 +1,35 @@
+/* dedup.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include "srtypes.h"
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+void dedup_init (void);
+void dedup_cleanup (void);
+void dedup_hash_init (Dedup_hash *dh);
+void dedup_hash_update (Dedup_hash *dh, const char *buf, u_long size);
+guint64 dedup_hash_digest (Dedup_hash *dh);
+int dedup_find (guint64 hash, guint64 audio_size, char *fn, int fn_size);
+void dedup_add (guint64 hash, guint64 audio_size, const char *fn);
+void dedup_saved (guint64 bytes);
+void dedup_debug_report (void);
+
+#endif
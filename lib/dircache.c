@@ -0,0 +1,458 @@
+/* dircache.c
+ * cache of the directories of an output tree
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* Each stream remembers the directories it has made or looked in, so
+   that a finished track doesn't mkdir every component of its path
+   again.  The most recently used directories are kept open, and new
+   directories and file lookups are made relative to them.  A cached
+   directory is checked with one fstat, which notices when it was
+   removed behind our back.  The next %q sequence number of each file
+   name prefix is found by reading the directory once, and is counted
+   up from then on.  The numbers are shared by all streams, so two 
+   streams writing to one directory don't hand out the same number.  
+   A number which ends up not being used is given back, if no later 
+   one was handed out.  Files added to the directory by other programs 
+   after the scan are not noticed.  Paths are in the file system 
+   codeset. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+#include "srtypes.h"
+#include "mchar.h"
+#include "filelib.h"
+#include "dircache.h"
+#include "uce_dirent.h"
+#include "threadlib.h"
+#include "debug.h"
+
+#define DIRCACHE_MAX_FDS	32
+
+typedef struct dircache_dir Dircache_dir;
+struct dircache_dir
+{
+    char *path;			/* Without trailing slash */
+    int fd;
+};
+
+struct dircache
+{
+    GHashTable *dirs;		/* path -> Dircache_dir */
+    GQueue *open_dirs;		/* Least recently used first */
+    char *seq_key;		/* Sequence number handed out and not */
+    int seq;			/*   yet ended, if seq_key is set */
+    u_long num_hits;
+    u_long num_misses;
+    u_long num_scans;
+};
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static Dircache_dir*
+dircache_get_dir (Dircache *dc, const char *path, int create);
+static int dircache_check (Dircache *dc, Dircache_dir *d);
+static void dircache_used (Dircache *dc, Dircache_dir *d);
+static void dircache_forget (Dircache *dc, Dircache_dir *d);
+static void dircache_dir_free (Dircache_dir *d);
+static int dircache_split (const char *path, char *dir, const char **name);
+static void dircache_strip_slashes (char *path);
+static int dircache_stat_exists (const char *path);
+static void dircache_lock (void);
+static void dircache_unlock (void);
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+static HSEM m_sem;
+static int m_initialized = 0;
+static GHashTable *m_seqs;	/* dir/prefix -> next sequence number */
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+void
+dircache_init (void)
+{
+    if (m_initialized) return;
+    m_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_sem);
+    m_seqs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    m_initialized = 1;
+}
+
+void
+dircache_cleanup (void)
+{
+    if (!m_initialized) return;
+    g_hash_table_destroy (m_seqs);
+    m_seqs = 0;
+    threadlib_destroy_sem (&m_sem);
+    m_initialized = 0;
+}
+
+Dircache*
+dircache_create (void)
+{
+    Dircache *dc = (Dircache*) calloc (1, sizeof(Dircache));
+    if (!dc) {
+	return 0;
+    }
+    dc->dirs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+				      (GDestroyNotify) dircache_dir_free);
+    dc->open_dirs = g_queue_new ();
+    return dc;
+}
+
+void
+dircache_destroy (Dircache *dc)
+{
+    if (!dc) return;
+    dircache_debug_report (dc);
+    g_queue_free (dc->open_dirs);
+    g_hash_table_destroy (dc->dirs);
+    g_free (dc->seq_key);
+    free (dc);
+}
+
+/* Make every directory of path which ends with a slash.  If
+   make_last is set, path itself is a directory too. */
+error_code
+dircache_make_dirs (Dircache *dc, const char *path, int make_last)
+{
+    char dir[SR_MAX_PATH];
+
+    if (!dc) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+    if (make_last) {
+	strncpy (dir, path, SR_MAX_PATH - 1);
+	dir[SR_MAX_PATH - 1] = 0;
+    } else {
+	const char *name;
+	if (!dircache_split (path, dir, &name)) {
+	    return SR_SUCCESS;
+	}
+    }
+    dircache_strip_slashes (dir);
+    if (!dircache_get_dir (dc, dir, 1)) {
+	return SR_ERROR_CANT_CREATE_FILE;
+    }
+    return SR_SUCCESS;
+}
+
+int
+dircache_file_exists (Dircache *dc, const char *path)
+{
+    char dir[SR_MAX_PATH];
+    const char *name;
+    Dircache_dir *d = 0;
+
+    if (dc && dircache_split (path, dir, &name)) {
+	dircache_strip_slashes (dir);
+	d = dircache_get_dir (dc, dir, 0);
+    }
+#if !defined (WIN32)
+    if (d && d->fd >= 0) {
+	return faccessat (d->fd, name, F_OK, 0) == 0;
+    }
+#endif
+    return dircache_stat_exists (path);
+}
+
+/* Return the next sequence number for files in dir which start with
+   prefix, and count it as used.  The caller says whether it was used 
+   with dircache_end_sequence(). */
+int
+dircache_next_sequence (Dircache *dc, const char *dir, const char *prefix)
+{
+    Dircache_dir *d;
+    gpointer value;
+    gchar *key;
+    int seq = 0;
+
+    if (!dc || !m_initialized || !(d = dircache_get_dir (dc, dir, 0))) {
+	return 0;
+    }
+    key = g_strconcat (d->path, "/", prefix, NULL);
+
+    dircache_lock ();
+    if (g_hash_table_lookup_extended (m_seqs, key, NULL, &value)) {
+	seq = GPOINTER_TO_INT (value);
+    } else {
+	DIR* dp;
+	struct dirent* de;
+	size_t plen = strlen (prefix);
+
+	dc->num_scans++;
+	if ((dp = opendir (d->path)) == 0) {
+	    dircache_unlock ();
+	    g_free (key);
+	    return 0;
+	}
+	while ((de = readdir (dp)) != 0) {
+	    if (strncmp (de->d_name, prefix, plen) == 0
+		&& isdigit (de->d_name[plen])) {
+		int this_seq = atoi (&de->d_name[plen]);
+		if (seq <= this_seq) {
+		    seq = this_seq + 1;
+		}
+	    }
+	}
+	closedir (dp);
+    }
+    g_free (dc->seq_key);
+    dc->seq_key = g_strdup (key);
+    dc->seq = seq;
+    g_hash_table_replace (m_seqs, key, GINT_TO_POINTER (seq + 1));
+    dircache_unlock ();
+    return seq;
+}
+
+/* The file named with the last sequence number from 
+   dircache_next_sequence() was made, or not.  If not, the number is 
+   given back, unless a later one was handed out meanwhile. */
+void
+dircache_end_sequence (Dircache *dc, int used)
+{
+    gpointer value;
+
+    if (!dc || !dc->seq_key) {
+	return;
+    }
+    if (!used) {
+	dircache_lock ();
+	if (g_hash_table_lookup_extended (m_seqs, dc->seq_key, NULL, &value)
+	    && GPOINTER_TO_INT (value) == dc->seq + 1) {
+	    g_hash_table_insert (m_seqs, g_strdup (dc->seq_key), 
+				 GINT_TO_POINTER (dc->seq));
+	}
+	dircache_unlock ();
+    }
+    g_free (dc->seq_key);
+    dc->seq_key = 0;
+}
+
+void
+dircache_debug_report (Dircache *dc)
+{
+    debug_printf ("------ DIRCACHE -------\n");
+    debug_printf ("dirs = %d, open = %d, hits = %lu, misses = %lu, "
+		  "scans = %lu\n",
+		  g_hash_table_size (dc->dirs),
+		  g_queue_get_length (dc->open_dirs),
+		  dc->num_hits, dc->num_misses, dc->num_scans);
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+/* Find the directory in the cache, or else open it, making it and
+   its parents first if create is set. */
+static Dircache_dir*
+dircache_get_dir (Dircache *dc, const char *path, int create)
+{
+    Dircache_dir *d;
+    Dircache_dir *parent = 0;
+    char parent_path[SR_MAX_PATH];
+    const char *name = 0;
+    int fd;
+
+    d = (Dircache_dir*) g_hash_table_lookup (dc->dirs, path);
+    if (d) {
+	if (dircache_check (dc, d)) {
+	    dc->num_hits++;
+	    return d;
+	}
+	debug_printf ("DIRCACHE: %s went away\n", path);
+	dircache_forget (dc, d);
+    }
+    dc->num_misses++;
+
+    /* The parent is made first, so the new one can be made in it */
+    if (create && dircache_split (path, parent_path, &name) && *name) {
+	dircache_strip_slashes (parent_path);
+	parent = dircache_get_dir (dc, parent_path, 1);
+    }
+
+#if defined (WIN32)
+    if (create) {
+	mkdir (path);
+    }
+    fd = -1;
+    if (!dircache_stat_exists (path)) {
+	return 0;
+    }
+#else
+    if (parent && parent->fd >= 0) {
+	if (create) {
+	    mkdirat (parent->fd, name, 0777);
+	}
+	fd = openat (parent->fd, name, O_RDONLY | O_DIRECTORY);
+    } else {
+	if (create) {
+	    mkdir (path, 0777);
+	}
+	fd = open (path, O_RDONLY | O_DIRECTORY);
+    }
+    if (fd < 0) {
+	return 0;
+    }
+#endif
+
+    d = (Dircache_dir*) calloc (1, sizeof(Dircache_dir));
+    if (!d) {
+#if !defined (WIN32)
+	close (fd);
+#endif
+	return 0;
+    }
+    d->path = strdup (path);
+    d->fd = fd;
+    g_hash_table_insert (dc->dirs, d->path, d);
+    if (fd >= 0) {
+	g_queue_push_tail (dc->open_dirs, d);
+	dircache_used (dc, d);
+    }
+    return d;
+}
+
+/* Is the cached directory still there?  A directory whose fd was
+   closed to save fds is opened again. */
+static int
+dircache_check (Dircache *dc, Dircache_dir *d)
+{
+#if defined (WIN32)
+    return 1;
+#else
+    struct stat st;
+
+    if (d->fd < 0) {
+	d->fd = open (d->path, O_RDONLY | O_DIRECTORY);
+	if (d->fd < 0) {
+	    return 0;
+	}
+	g_queue_push_tail (dc->open_dirs, d);
+    }
+    dircache_used (dc, d);
+    return fstat (d->fd, &st) == 0 && st.st_nlink > 0;
+#endif
+}
+
+/* Move d to the end of the open list, and close the fd of the least
+   recently used directory if there are too many. */
+static void
+dircache_used (Dircache *dc, Dircache_dir *d)
+{
+    if (dc->open_dirs->tail && dc->open_dirs->tail->data != d) {
+	g_queue_remove (dc->open_dirs, d);
+	g_queue_push_tail (dc->open_dirs, d);
+    }
+    if (g_queue_get_length (dc->open_dirs) > DIRCACHE_MAX_FDS) {
+	Dircache_dir *old = (Dircache_dir*) g_queue_pop_head (dc->open_dirs);
+#if !defined (WIN32)
+	close (old->fd);
+#endif
+	old->fd = -1;
+    }
+}
+
+static void
+dircache_forget (Dircache *dc, Dircache_dir *d)
+{
+    if (d->fd >= 0) {
+	g_queue_remove (dc->open_dirs, d);
+    }
+    g_hash_table_remove (dc->dirs, d->path);
+}
+
+static void
+dircache_dir_free (Dircache_dir *d)
+{
+#if !defined (WIN32)
+    if (d->fd >= 0) {
+	close (d->fd);
+    }
+#endif
+    free (d->path);
+    free (d);
+}
+
+/* Split path at its last slash into the directory and the name 
+   after the slash.  Returns 0 if there is no slash. */
+static int
+dircache_split (const char *path, char *dir, const char **name)
+{
+    const char *p;
+    const char *slash = 0;
+    size_t len;
+
+    for (p = path; *p; p++) {
+	if (ISSLASH (*p)) {
+	    slash = p;
+	}
+    }
+    if (!slash) {
+	return 0;
+    }
+    /* The root directory keeps its slash */
+    len = (slash == path) ? 1 : slash - path;
+    if (len >= SR_MAX_PATH) {
+	return 0;
+    }
+    memcpy (dir, path, len);
+    dir[len] = 0;
+    *name = slash + 1;
+    return 1;
+}
+
+static void
+dircache_strip_slashes (char *path)
+{
+    size_t len = strlen (path);
+    while (len > 1 && ISSLASH (path[len-1])) {
+	path[--len] = 0;
+    }
+}
+
+static int
+dircache_stat_exists (const char *path)
+{
+    struct stat st;
+    return stat (path, &st) == 0;
+}
+
+static void
+dircache_lock (void)
+{
+    threadlib_waitfor_sem (&m_sem);
+}
+
+static void
+dircache_unlock (void)
+{
+    threadlib_signal_sem (&m_sem);
+}
@@ -0,0 +1,36 @@
+/* dircache.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __DIRCACHE_H__
+#define __DIRCACHE_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+void dircache_init (void);
+void dircache_cleanup (void);
+Dircache* dircache_create (void);
+void dircache_destroy (Dircache *dc);
+error_code dircache_make_dirs (Dircache *dc, const char *path, int make_last);
+int dircache_file_exists (Dircache *dc, const char *path);
+int dircache_next_sequence (Dircache *dc, const char *dir, const char *prefix);
+void dircache_end_sequence (Dircache *dc, int used);
+void dircache_debug_report (Dircache *dc);
+
+#endif
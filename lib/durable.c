@@ -0,0 +1,573 @@
+/* durable.c
+ * process-wide group commit of the data of output files
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* A finished track must be on disk before it is given its name in
+   the complete directory, or a power loss can leave an empty or torn
+   file there.  Syncing each track as it finishes would make hundreds
+   of streams wait on the disk one after another, so the syncs are
+   done by one thread for all of them.  A stream which needs a file
+   synced queues it and waits.  The thread waits a short window for
+   other streams to join, then syncs everything queued: one syncfs
+   for a file system with many files in the batch, fdatasync for the
+   rest.  Directories which got new names are synced in the next
+   batch, without anyone waiting for them.  Files being watched, such
+   as show files, are synced every DURABLE_PERIOD_MS. */
+#define _GNU_SOURCE 1		/* For syncfs */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined (WIN32)
+#include <unistd.h>
+#endif
+#include "srtypes.h"
+#include "errors.h"
+#include "threadlib.h"
+#include "durable.h"
+#include "debug.h"
+
+/* How long the thread waits for more files before syncing a batch */
+#define DURABLE_WINDOW_MS	20
+
+/* How often watched files are synced */
+#define DURABLE_PERIOD_MS	(10 * 1000)
+
+/* A file system with this many files in a batch is synced whole */
+#define DURABLE_SYNCFS_MIN	4
+
+/* Latencies kept for the percentiles */
+#define DURABLE_NUM_SAMPLES	1024
+
+typedef struct durable_req Durable_req;
+struct durable_req
+{
+    int fd;
+    dev_t dev;
+    HSEM done;
+    error_code rc;
+};
+
+typedef struct durable_watch Durable_watch;
+struct durable_watch
+{
+    int fd;			/* As given by the caller */
+    int dup_fd;			/* Ours, so the caller may close fd */
+    dev_t dev;
+};
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void durable_lock (void);
+static void durable_unlock (void);
+static void durable_start_thread (void);
+static void durable_wake (void);
+static void durable_worker (void *arg);
+static void durable_run_batch (GQueue *reqs, GQueue *dirs);
+static void durable_run_periodic (void);
+static int durable_timed_sync (int fd, int whole_fs);
+static void durable_add_sample (guint64 us);
+static int durable_compare_samples (const void *a, const void *b);
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+static HSEM m_sem;
+static HSEM m_work_sem;
+static int m_initialized = 0;
+static int m_shutdown = 0;
+static int m_have_thread = 0;
+static int m_waiting = 0;		/* The thread waits for m_work_sem */
+static THREAD_HANDLE m_thread;
+static GQueue *m_reqs = 0;
+static GQueue *m_dirs = 0;		/* Directory names, strdup'd */
+static GList *m_watches = 0;
+
+static u_long m_num_reqs = 0;
+static u_long m_num_batches = 0;
+static u_long m_num_fdatasyncs = 0;
+static u_long m_num_syncfs = 0;
+static u_long m_num_dir_syncs = 0;
+static u_long m_num_failures = 0;
+static guint64 m_samples[DURABLE_NUM_SAMPLES];
+static u_long m_num_samples = 0;
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+void
+durable_init (void)
+{
+    if (m_initialized) return;
+    m_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_sem);
+    m_work_sem = threadlib_create_sem ();
+    m_reqs = g_queue_new ();
+    m_dirs = g_queue_new ();
+    m_shutdown = 0;
+    m_initialized = 1;
+}
+
+void
+durable_cleanup (void)
+{
+    GList *p;
+
+    if (!m_initialized) return;
+
+    /* The thread finishes what is queued before it exits */
+    durable_lock ();
+    m_shutdown = 1;
+    durable_wake ();
+    durable_unlock ();
+    if (m_have_thread) {
+	threadlib_waitforclose (&m_thread);
+	m_have_thread = 0;
+    }
+    durable_debug_report ();
+
+    for (p = m_watches; p; p = p->next) {
+	Durable_watch *w = (Durable_watch*) p->data;
+#if !defined (WIN32)
+	close (w->dup_fd);
+#endif
+	free (w);
+    }
+    g_list_free (m_watches);
+    m_watches = 0;
+    g_queue_free (m_reqs);
+    g_queue_free (m_dirs);
+    m_reqs = m_dirs = 0;
+    threadlib_destroy_sem (&m_work_sem);
+    threadlib_destroy_sem (&m_sem);
+    m_initialized = 0;
+}
+
+/* Wait until the data of fp is on disk */
+error_code
+durable_sync (FHANDLE fp)
+{
+#if defined (WIN32)
+    return SR_SUCCESS;
+#else
+    Durable_req req;
+    struct stat st;
+
+    if (!m_initialized) {
+	return fdatasync (fp) == 0 ? SR_SUCCESS : SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+    req.fd = fp;
+    req.dev = fstat (fp, &st) == 0 ? st.st_dev : 0;
+    req.done = threadlib_create_sem ();
+    req.rc = SR_SUCCESS;
+
+    durable_lock ();
+    durable_start_thread ();
+    if (!m_have_thread) {
+	durable_unlock ();
+	threadlib_destroy_sem (&req.done);
+	return fdatasync (fp) == 0 ? SR_SUCCESS : SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+    g_queue_push_tail (m_reqs, &req);
+    m_num_reqs++;
+    durable_wake ();
+    durable_unlock ();
+
+    threadlib_waitfor_sem (&req.done);
+    threadlib_destroy_sem (&req.done);
+    return req.rc;
+#endif
+}
+
+/* Sync the directory of fn (in the file system codeset), so that a 
+   new name there survives a power loss.  This doesn't wait. */
+void
+durable_sync_dir (const char *fn)
+{
+#if !defined (WIN32)
+    char *dir;
+    char *p;
+
+    if (!m_initialized) {
+	return;
+    }
+    dir = strdup (fn);
+    p = strrchr (dir, '/');
+    if (p == dir) {
+	*(p + 1) = 0;
+    } else if (p) {
+	*p = 0;
+    } else {
+	strcpy (dir, ".");
+    }
+    durable_lock ();
+    g_queue_push_tail (m_dirs, dir);
+    durable_start_thread ();
+    durable_wake ();
+    durable_unlock ();
+#endif
+}
+
+/* Sync fp every DURABLE_PERIOD_MS until it is unwatched */
+void
+durable_watch (FHANDLE fp)
+{
+#if !defined (WIN32)
+    Durable_watch *w;
+    struct stat st;
+
+    if (!m_initialized || fstat (fp, &st) != 0) {
+	return;
+    }
+    w = (Durable_watch*) malloc (sizeof(Durable_watch));
+    if (!w) {
+	return;
+    }
+    w->fd = fp;
+    w->dup_fd = dup (fp);
+    w->dev = st.st_dev;
+    if (w->dup_fd < 0) {
+	free (w);
+	return;
+    }
+    durable_lock ();
+    m_watches = g_list_prepend (m_watches, w);
+    durable_start_thread ();
+    durable_wake ();
+    durable_unlock ();
+#endif
+}
+
+/* Stop watching fp.  Must be called before fp is closed. */
+void
+durable_unwatch (FHANDLE fp)
+{
+#if !defined (WIN32)
+    GList *p;
+
+    if (!m_initialized) {
+	return;
+    }
+    durable_lock ();
+    for (p = m_watches; p; p = p->next) {
+	Durable_watch *w = (Durable_watch*) p->data;
+	if (w->fd == fp) {
+	    m_watches = g_list_delete_link (m_watches, p);
+	    close (w->dup_fd);
+	    free (w);
+	    break;
+	}
+    }
+    durable_unlock ();
+#endif
+}
+
+void
+durable_debug_report (void)
+{
+    guint64 sorted[DURABLE_NUM_SAMPLES];
+    u_long n;
+
+    durable_lock ();
+    n = m_num_samples < DURABLE_NUM_SAMPLES 
+	    ? m_num_samples : DURABLE_NUM_SAMPLES;
+    memcpy (sorted, m_samples, n * sizeof(guint64));
+    debug_printf ("------ DURABLE -------\n");
+    debug_printf ("requests = %lu, batches = %lu, fdatasyncs = %lu, "
+		  "syncfs = %lu, dir syncs = %lu, failures = %lu, "
+		  "watched = %d\n",
+		  m_num_reqs, m_num_batches, m_num_fdatasyncs, 
+		  m_num_syncfs, m_num_dir_syncs, m_num_failures,
+		  g_list_length (m_watches));
+    durable_unlock ();
+
+    if (n > 0) {
+	qsort (sorted, n, sizeof(guint64), durable_compare_samples);
+	debug_printf ("sync latency (us) of last %lu: p50 = %llu, "
+		      "p90 = %llu, p99 = %llu, max = %llu\n", n,
+		      (unsigned long long) sorted[n * 50 / 100],
+		      (unsigned long long) sorted[n * 90 / 100],
+		      (unsigned long long) sorted[n * 99 / 100],
+		      (unsigned long long) sorted[n - 1]);
+    }
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void
+durable_lock (void)
+{
+    if (m_initialized) {
+	threadlib_waitfor_sem (&m_sem);
+    }
+}
+
+static void
+durable_unlock (void)
+{
+    if (m_initialized) {
+	threadlib_signal_sem (&m_sem);
+    }
+}
+
+/* Called with the lock held */
+static void
+durable_start_thread (void)
+{
+    if (!m_have_thread) {
+	if (threadlib_beginthread (&m_thread, durable_worker, 0)
+	    == SR_SUCCESS) {
+	    m_have_thread = 1;
+	}
+    }
+}
+
+/* Called with the lock held */
+static void
+durable_wake (void)
+{
+    if (m_waiting) {
+	m_waiting = 0;
+	threadlib_signal_sem (&m_work_sem);
+    }
+}
+
+static void
+durable_worker (void *arg)
+{
+    guint64 next_period = threadlib_monotonic_ms () + DURABLE_PERIOD_MS;
+
+    while (1) {
+	GQueue reqs = G_QUEUE_INIT;
+	GQueue dirs = G_QUEUE_INIT;
+	int shutdown;
+	int have_watches;
+	int have_reqs;
+
+	/* Sleep until there is work.  If files are watched, wake up 
+	   for their next sync too. */
+	durable_lock ();
+	if (!m_reqs->length && !m_dirs->length && !m_shutdown) {
+	    m_waiting = 1;
+	    have_watches = (m_watches != 0);
+	    durable_unlock ();
+	    if (!have_watches) {
+		threadlib_waitfor_sem (&m_work_sem);
+	    } else {
+		guint64 now = threadlib_monotonic_ms ();
+		if (now < next_period) {
+		    threadlib_waitfor_sem_timeout (&m_work_sem, 
+						   (u_long) (next_period - now));
+		}
+	    }
+	    durable_lock ();
+	    m_waiting = 0;
+	}
+	have_reqs = m_reqs->length;
+	durable_unlock ();
+
+	/* If a stream is waiting, give the other streams a moment to 
+	   join its batch */
+	if (have_reqs) {
+	    Sleep (DURABLE_WINDOW_MS);
+	}
+
+	durable_lock ();
+	reqs = *m_reqs;
+	dirs = *m_dirs;
+	g_queue_init (m_reqs);
+	g_queue_init (m_dirs);
+	shutdown = m_shutdown;
+	durable_unlock ();
+
+	if (reqs.length || dirs.length) {
+	    durable_run_batch (&reqs, &dirs);
+	}
+	if (threadlib_monotonic_ms () >= next_period) {
+	    durable_run_periodic ();
+	    next_period = threadlib_monotonic_ms () + DURABLE_PERIOD_MS;
+	}
+	if (shutdown) {
+	    break;
+	}
+    }
+}
+
+/* Sync the files of the batch, tell their streams, and then sync the 
+   directories */
+static void
+durable_run_batch (GQueue *reqs, GQueue *dirs)
+{
+#if !defined (WIN32)
+    GList *p, *q;
+    char *dir;
+
+    for (p = reqs->head; p; p = p->next) {
+	Durable_req *req = (Durable_req*) p->data;
+	int same_fs = 0;
+	int rc;
+
+	if (req->rc != SR_SUCCESS || req->fd < 0) {
+	    continue;		/* Already done by a syncfs */
+	}
+	for (q = p; q; q = q->next) {
+	    if (((Durable_req*) q->data)->dev == req->dev) {
+		same_fs++;
+	    }
+	}
+	rc = durable_timed_sync (req->fd, same_fs >= DURABLE_SYNCFS_MIN);
+	if (same_fs >= DURABLE_SYNCFS_MIN) {
+	    for (q = p; q; q = q->next) {
+		Durable_req *other = (Durable_req*) q->data;
+		if (other->dev == req->dev) {
+		    other->rc = rc == 0 ? SR_SUCCESS 
+			    : SR_ERROR_CANT_WRITE_TO_FILE;
+		    other->fd = -1;
+		}
+	    }
+	} else {
+	    req->rc = rc == 0 ? SR_SUCCESS : SR_ERROR_CANT_WRITE_TO_FILE;
+	    req->fd = -1;
+	}
+    }
+
+    durable_lock ();
+    m_num_batches++;
+    durable_unlock ();
+    for (p = reqs->head; p; p = p->next) {
+	threadlib_signal_sem (&((Durable_req*) p->data)->done);
+    }
+    g_queue_clear (reqs);
+
+    /* Each directory once per batch */
+    while ((dir = (char*) g_queue_pop_head (dirs)) != 0) {
+	int fd;
+	for (p = dirs->head; p; ) {
+	    q = p->next;
+	    if (!strcmp ((char*) p->data, dir)) {
+		free (p->data);
+		g_queue_delete_link (dirs, p);
+	    }
+	    p = q;
+	}
+	fd = open (dir, O_RDONLY | O_DIRECTORY);
+	if (fd >= 0) {
+	    guint64 start = threadlib_monotonic_us ();
+	    int rc = fsync (fd);
+	    durable_lock ();
+	    durable_add_sample (threadlib_monotonic_us () - start);
+	    m_num_dir_syncs++;
+	    if (rc != 0) {
+		m_num_failures++;
+	    }
+	    durable_unlock ();
+	    close (fd);
+	}
+	free (dir);
+    }
+#endif
+}
+
+/* Sync every file system with a watched file on it */
+static void
+durable_run_periodic (void)
+{
+#if !defined (WIN32)
+    GList *fds = 0;
+    GList *devs = 0;
+    GList *p;
+
+    durable_lock ();
+    for (p = m_watches; p; p = p->next) {
+	Durable_watch *w = (Durable_watch*) p->data;
+#if defined (HAVE_SYNCFS)
+	if (g_list_find (devs, GINT_TO_POINTER ((int) w->dev))) {
+	    continue;
+	}
+	devs = g_list_prepend (devs, GINT_TO_POINTER ((int) w->dev));
+#endif
+	fds = g_list_prepend (fds, GINT_TO_POINTER (dup (w->dup_fd)));
+    }
+    durable_unlock ();
+
+    for (p = fds; p; p = p->next) {
+	int fd = GPOINTER_TO_INT (p->data);
+	if (fd >= 0) {
+	    durable_timed_sync (fd, 1);
+	    close (fd);
+	}
+    }
+    g_list_free (fds);
+    g_list_free (devs);
+#endif
+}
+
+/* Returns the result of fdatasync, or of syncfs if whole_fs is set 
+   and the system has it */
+static int
+durable_timed_sync (int fd, int whole_fs)
+{
+#if defined (WIN32)
+    return 0;
+#else
+    guint64 start = threadlib_monotonic_us ();
+    int rc;
+
+#if defined (HAVE_SYNCFS)
+    if (whole_fs) {
+	rc = syncfs (fd);
+    } else {
+	rc = fdatasync (fd);
+    }
+#else
+    whole_fs = 0;
+    rc = fdatasync (fd);
+#endif
+    durable_lock ();
+    durable_add_sample (threadlib_monotonic_us () - start);
+    if (whole_fs) {
+	m_num_syncfs++;
+    } else {
+	m_num_fdatasyncs++;
+    }
+    if (rc != 0) {
+	debug_printf ("DURABLE: sync failed: %d\n", errno);
+	m_num_failures++;
+    }
+    durable_unlock ();
+    return rc;
+#endif
+}
+
+/* Called with the lock held */
+static void
+durable_add_sample (guint64 us)
+{
+    m_samples[m_num_samples % DURABLE_NUM_SAMPLES] = us;
+    m_num_samples++;
+}
+
+static int
+durable_compare_samples (const void *a, const void *b)
+{
+    guint64 x = *(const guint64*) a;
+    guint64 y = *(const guint64*) b;
+    return x < y ? -1 : x > y;
+}
@@ -0,0 +1,34 @@
+/* durable.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __DURABLE_H__
+#define __DURABLE_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+void durable_init (void);
+void durable_cleanup (void);
+error_code durable_sync (FHANDLE fp);
+void durable_sync_dir (const char *fn);
+void durable_watch (FHANDLE fp);
+void durable_unwatch (FHANDLE fp);
+void durable_debug_report (void);
+
+#endif
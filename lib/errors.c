@@ -122,6 +122,10 @@ errors_init (void)
     SET_ERR_STR("SR_ERROR_CANT_PARSE_M3U",                      0x41);
     SET_ERR_STR("SR_ERROR_CANT_CREATE_SOCKET",                  0x42);
     SET_ERR_STR("SR_ERROR_CREATE_PIPE_FAILED",                  0x43);
+    SET_ERR_STR("SR_ERROR_MEMORY_BUDGET_EXCEEDED",              0x45);
+    SET_ERR_STR("SR_ERROR_SOURCE_TOO_SLOW",                     0x46);
+    SET_ERR_STR("SR_ERROR_TOO_MANY_REDIRECTS",                  0x47);
+    SET_ERR_STR("SR_ERROR_STREAM_CHANGED",                      0x48);
 }
 
 char*
@@ -15,6 +15,7 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
+#define _GNU_SOURCE 1		/* For copy_file_range and O_TMPFILE */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,13 +27,35 @@
 #include "debug.h"
 #include <assert.h>
 #include <sys/types.h>
+#if !defined (WIN32)
+#include <sys/uio.h>
+#endif
+#if defined (HAVE_COPY_FILE_RANGE)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #include "glib.h"
 #include "glib/gstdio.h"
 #include "rip_manager.h"
+#include "bgcopy.h"
+#include "dircache.h"
+#include "trackindex.h"
+#include "dedup.h"
+#include "durable.h"
+#include "sink.h"
 #include "uce_dirent.h"
 
 #define TEMP_STR_LEN	(SR_MAX_PATH*2)
 
+/* Operations of a compiled file name pattern */
+#define PAT_LITERAL	0
+#define PAT_DATE	1	/* %D */
+#define PAT_ARTIST	2	/* %A */
+#define PAT_TITLE	3	/* %T */
+#define PAT_ALBUM	4	/* %a */
+#define PAT_SEQUENCE	5	/* %q */
+#define PAT_COUNT	6	/* %Nq */
+
 /*****************************************************************************
  * Private Functions
  *****************************************************************************/
@@ -42,25 +65,60 @@ static error_code mkdir_recursive (RIP_MANAGER_INFO* rmi, gchar *str, int make_l
 static void close_file (FHANDLE* fp);
 static void close_files (RIP_MANAGER_INFO* rmi);
 static error_code filelib_write (FHANDLE fp, char *buf, u_long size);
+static void 
+wbuf_init (Filelib_wbuf *wb, u_long size, u_long prealloc_step);
+static error_code 
+wbuf_write (FHANDLE fp, Filelib_wbuf *wb, char *buf, u_long size);
+static error_code
+wbuf_writev (FHANDLE fp, Filelib_wbuf *wb, char *head, u_long head_size, 
+	     char *buf, u_long size);
+static error_code wbuf_flush (FHANDLE fp, Filelib_wbuf *wb);
+static void wbuf_preallocate (FHANDLE fp, Filelib_wbuf *wb, u_long size);
+static void wbuf_finish (FHANDLE fp, Filelib_wbuf *wb);
+static void clear_direct (FHANDLE fp);
+static u_long estimate_track_size (RIP_MANAGER_INFO* rmi, Track_record* ti);
+static int is_durable (RIP_MANAGER_INFO* rmi);
+static void sync_track (RIP_MANAGER_INFO* rmi, Writer *writer);
+static void sync_name (RIP_MANAGER_INFO* rmi, gchar* path);
+static error_code
+filelib_writev (FHANDLE fp, char *head, u_long head_size, 
+		char *buf, u_long size);
+#if defined (HAVE_COPY_FILE_RANGE)
+static u_long
+filelib_copy_range (FHANDLE in_fp, loff_t *in_offset, FHANDLE out_fp, 
+		    u_long size);
+#endif
 static BOOL file_exists (RIP_MANAGER_INFO* rmi, gchar *filename);
 static void 
 trim_filename (RIP_MANAGER_INFO* rmi, gchar* out, gchar *filename);
 static void
 trim_mp3_suffix (RIP_MANAGER_INFO* rmi, gchar *filename);
 static error_code filelib_open_for_write (RIP_MANAGER_INFO* rmi, FHANDLE* fp, gchar *filename);
+static error_code filelib_open_tmpfile (RIP_MANAGER_INFO* rmi, FHANDLE* fp);
+static error_code link_file (RIP_MANAGER_INFO* rmi, gchar* filename, FHANDLE fp);
+static error_code
+link_incomplete (RIP_MANAGER_INFO* rmi, Writer *writer, gchar* path);
+static void
+publish_track (RIP_MANAGER_INFO* rmi, Writer *writer, gchar* new_path);
+static void
+compose_track_fnbase (RIP_MANAGER_INFO* rmi, gchar* fnbase, Track_record* ti);
+static long get_file_size (RIP_MANAGER_INFO* rmi, gchar *filename);
+static long get_fd_size (FHANDLE fp);
+static int is_known_duplicate (RIP_MANAGER_INFO* rmi, Track_record* ti);
+static void update_track_index (RIP_MANAGER_INFO* rmi, guint64 key, 
+				guint64 size, guint64 content_hash);
+static error_code
+link_duplicate (RIP_MANAGER_INFO* rmi, Writer *writer, gchar* new_path, 
+		guint64 content_hash);
 static void
 parse_and_subst_dir (RIP_MANAGER_INFO* rmi, 
 		     gchar* pattern_head, gchar* pattern_tail, 
 		     gchar* opat_path, int is_for_showfile);
+static int append_text (gchar* newfile, int nfi, const gchar* str, int len,
+			int max_len);
 static void
-parse_and_subst_pat (RIP_MANAGER_INFO* rmi,
-		     gchar* newfile,
-		     TRACK_INFO* ti,
-		     gchar* directory,
-		     gchar* pattern,
-		     gchar* extension);
-static void
-set_default_pattern (RIP_MANAGER_INFO* rmi, 
+set_default_pattern (RIP_MANAGER_INFO* rmi, gchar* default_pattern,
+		     gchar* default_showfile_pattern,
 		     BOOL get_separate_dirs, BOOL do_count);
 static error_code 
 set_output_directory (RIP_MANAGER_INFO* rmi, 
@@ -81,7 +139,6 @@ static void fill_date_buf (RIP_MANAGER_INFO* rmi, gchar* datebuf,
 			   int datebuf_len);
 static error_code filelib_open_showfiles (RIP_MANAGER_INFO* rmi);
 static void move_file (RIP_MANAGER_INFO* rmi, gchar* new_filename, gchar* old_filename);
-static gchar* replace_invalid_chars (gchar *str);
 static void remove_trailing_periods (gchar *str);
 static BOOL new_file_is_better (RIP_MANAGER_INFO* rmi, gchar *oldfile, gchar *newfile);
 static void delete_file (RIP_MANAGER_INFO* rmi, gchar* filename);
@@ -89,6 +146,25 @@ static void truncate_file (RIP_MANAGER_INFO* rmi, gchar* filename);
 static void
 filelib_rename_versioned (gchar** new_fn, RIP_MANAGER_INFO* rmi, 
 			  gchar* directory, gchar* fnbase, gchar* extension);
+static error_code
+filelib_write_show (RIP_MANAGER_INFO* rmi, char *buf, u_long size);
+static error_code
+filelib_write_cue (RIP_MANAGER_INFO* rmi, Track_record* ti, int secs);
+static error_code show_sink_event (RIP_MANAGER_INFO* rmi, Sink_event *ev);
+static error_code cue_sink_event (RIP_MANAGER_INFO* rmi, Sink_event *ev);
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+/* Both files are written in the ripping thread.  The show file
+   because tracks are copied out of it as they leave the buffer, the
+   cue sheet so that no entry is dropped and its errors stop the rip. */
+static const Sink_ops show_sink = {
+    "show", SINK_CHUNK, 0, 0, NULL, show_sink_event, NULL
+};
+static const Sink_ops cue_sink = {
+    "cue", SINK_TRACK, 0, 0, NULL, cue_sink_event, NULL
+};
 
 
 /*****************************************************************************
@@ -113,15 +189,44 @@ filelib_init (RIP_MANAGER_INFO* rmi,
     gchar tmp_output_directory[SR_MAX_PATH];
     gchar tmp_output_pattern[SR_MAX_PATH];
     gchar tmp_showfile_pattern[SR_MAX_PATH];
+    /* Only needed until the patterns are compiled, so they are not 
+       kept in FILELIB_INFO */
+    gchar default_pattern[SR_MAX_PATH];
+    gchar default_showfile_pattern[SR_MAX_PATH];
+    gchar resolved_pattern[SR_MAX_PATH];
+    gchar resolved_showfile_pattern[SR_MAX_PATH];
+    gchar icy_name_buf[SR_MAX_PATH];
 
     fli->m_show_file = INVALID_FHANDLE;
     fli->m_cue_file = INVALID_FHANDLE;
+    if (!fli->m_dircache) {
+	fli->m_dircache = dircache_create ();
+    }
     fli->m_count = do_count ? count_start : -1;
     fli->m_keep_incomplete = keep_incomplete;
     memset(&fli->m_output_directory, 0, SR_MAX_PATH);
     fli->m_show_name[0] = 0;
     fli->m_do_show = do_show_file;
+    fli->m_show_offset = 0;
     fli->m_do_individual_tracks = do_individual_tracks;
+#if defined (HAVE_COPY_FILE_RANGE)
+    fli->m_copy_show = do_show_file && do_individual_tracks 
+	    && content_type != CONTENT_TYPE_OGG
+	    && GET_TRACKS_FROM_SHOW (rmi->prefs->flags);
+#else
+    fli->m_copy_show = 0;
+#endif
+    fli->m_reflink_show = fli->m_copy_show;
+    fli->m_use_tmpfile = GET_HIDDEN_INCOMPLETE (rmi->prefs->flags);
+    fli->m_wbuf_size = rmi->prefs->write_buffer_kb * 1024;
+    fli->m_preallocate = GET_PREALLOCATE (rmi->prefs->flags);
+    /* Copies out of the show file need it written out, so it 
+       can't be kept in aligned blocks */
+    fli->m_direct_show = GET_DIRECT_SHOW (rmi->prefs->flags) 
+	    && !fli->m_copy_show;
+    memset (&fli->m_show_wbuf, 0, sizeof(Filelib_wbuf));
+    fli->m_track_bytes = 0;
+    fli->m_tracks_done = 0;
     fli->m_track_no = 1;
     
     debug_printf ("FILELIB_INIT: output_directory=%s\n",
@@ -141,14 +246,14 @@ filelib_init (RIP_MANAGER_INFO* rmi,
     gstring_from_string (rmi, tmp_showfile_pattern, SR_MAX_PATH, 
 			 showfile_pattern, CODESET_LOCALE);
     debug_printf ("converting icy_name\n");
-    gstring_from_string (rmi, fli->m_icy_name, SR_MAX_PATH, icy_name, 
+    gstring_from_string (rmi, icy_name_buf, SR_MAX_PATH, icy_name, 
 			 CODESET_METADATA);
     debug_printf ("Converted output directory: len=%d\n", 
 		  mstrlen (tmp_output_directory));
-    mstrcpy (fli->m_stripped_icy_name, fli->m_icy_name);
+    mstrcpy (fli->m_stripped_icy_name, icy_name_buf);
     
     debug_printf ("Replacing invalid chars in stripped_icy_name\n");
-    replace_invalid_chars (fli->m_stripped_icy_name);
+    filelib_replace_invalid_chars (fli->m_stripped_icy_name);
     debug_printf ("  %s\n", fli->m_stripped_icy_name);
 
     debug_printf ("Removing trailing periods\n");
@@ -179,7 +284,8 @@ filelib_init (RIP_MANAGER_INFO* rmi,
     fill_date_buf (rmi, fli->m_session_datebuf, DATEBUF_LEN);
 
     /* Set up the proper pattern if we're using -q and -s flags */
-    set_default_pattern (rmi, get_separate_dirs, do_count);
+    set_default_pattern (rmi, default_pattern, default_showfile_pattern,
+			 get_separate_dirs, do_count);
 
     /* Get the path to the "parent" directory.  This is the directory
        that contains the incomplete dir and the show files.
@@ -187,18 +293,20 @@ filelib_init (RIP_MANAGER_INFO* rmi,
        was specified. */
     set_output_directory (rmi, 
 			  fli->m_output_directory,
-			  fli->m_output_pattern,
+			  resolved_pattern,
 			  tmp_output_pattern,
 			  tmp_output_directory,
-			  fli->m_default_pattern,
+			  default_pattern,
 			  m_("%A - %T"),
 			  get_separate_dirs,
 			  get_date_stamp,
 			  0);
     debug_mprintf (m_("m_output_directory: ") m_S m_("\n"),
 		   fli->m_output_directory);
-    debug_mprintf (m_("m_output_pattern: ") m_S m_("\n"),
-		   fli->m_output_pattern);
+    debug_mprintf (m_("output_pattern: ") m_S m_("\n"),
+		   resolved_pattern);
+    filelib_compile_pattern (rmi, &fli->m_output_pat, 
+			     resolved_pattern, 0);
     msnprintf (fli->m_incomplete_directory, SR_MAX_PATH, m_S m_S m_C, 
 	       fli->m_output_directory, m_("incomplete"), PATH_SLASH);
 
@@ -230,14 +338,16 @@ filelib_init (RIP_MANAGER_INFO* rmi,
 	}
 	set_output_directory (rmi, 
 			      fli->m_showfile_directory,
-			      fli->m_showfile_pattern,
+			      resolved_showfile_pattern,
 			      tmp_showfile_pattern,
 			      tmp_output_directory,
-			      fli->m_default_showfile_pattern,
+			      default_showfile_pattern,
 			      m_(""),
 			      get_separate_dirs,
 			      get_date_stamp,
 			      1);
+	filelib_compile_pattern (rmi, &fli->m_showfile_pat,
+				 resolved_showfile_pattern, 1);
 	mkdir_recursive (rmi, fli->m_showfile_directory, 1);
 	filelib_open_showfiles (rmi);
     }
@@ -245,22 +355,214 @@ filelib_init (RIP_MANAGER_INFO* rmi,
     return SR_SUCCESS;
 }
 
+/* Set up the write-behind buffer of a newly opened file.  The file 
+   is preallocated prealloc_step bytes at a time. */
+static void 
+wbuf_init (Filelib_wbuf *wb, u_long size, u_long prealloc_step)
+{
+    memset (wb, 0, sizeof(Filelib_wbuf));
+#if defined (HAVE_FALLOCATE)
+    wb->prealloc_step = prealloc_step;
+#endif
+    if (size == 0) {
+	return;
+    }
+#if defined (WIN32)
+    wb->buf = (char*) malloc (size);
+#else
+    /* Aligned for O_DIRECT */
+    if (posix_memalign ((void**) &wb->buf, FILELIB_BLOCK_SIZE, size) != 0) {
+	wb->buf = 0;
+    }
+#endif
+    if (wb->buf) {
+	wb->size = size;
+    } else {
+	debug_printf ("wbuf_init: can't allocate %lu, not buffering\n", size);
+    }
+}
+
+static error_code 
+wbuf_write (FHANDLE fp, Filelib_wbuf *wb, char *buf, u_long size)
+{
+    error_code rc;
+
+    if (!wb->size) {
+	wbuf_preallocate (fp, wb, size);
+	rc = filelib_write (fp, buf, size);
+	if (rc == SR_SUCCESS) {
+	    wb->offset += size;
+	}
+	return rc;
+    }
+    while (size > 0) {
+	u_long n = wb->size - wb->len;
+	if (n > size) {
+	    n = size;
+	}
+	memcpy (wb->buf + wb->len, buf, n);
+	wb->len += n;
+	buf += n;
+	size -= n;
+	if (wb->len == wb->size) {
+	    rc = wbuf_flush (fp, wb);
+	    if (rc != SR_SUCCESS) {
+		return rc;
+	    }
+	}
+    }
+    return SR_SUCCESS;
+}
+
+static error_code
+wbuf_writev (FHANDLE fp, Filelib_wbuf *wb, char *head, u_long head_size, 
+	     char *buf, u_long size)
+{
+    error_code rc;
+
+    if (!wb->size) {
+	wbuf_preallocate (fp, wb, head_size + size);
+	rc = filelib_writev (fp, head, head_size, buf, size);
+	if (rc == SR_SUCCESS) {
+	    wb->offset += head_size + size;
+	}
+	return rc;
+    }
+    rc = wbuf_write (fp, wb, head, head_size);
+    if (rc != SR_SUCCESS) {
+	return rc;
+    }
+    return wbuf_write (fp, wb, buf, size);
+}
+
+/* Write out the buffer.  O_DIRECT only takes whole blocks, so a 
+   partly filled buffer turns it off for the rest of the file. */
+static error_code
+wbuf_flush (FHANDLE fp, Filelib_wbuf *wb)
+{
+    error_code rc;
+
+    if (!wb->len) {
+	return SR_SUCCESS;
+    }
+    if (wb->direct && wb->len % FILELIB_BLOCK_SIZE) {
+	clear_direct (fp);
+	wb->direct = 0;
+    }
+    wbuf_preallocate (fp, wb, wb->len);
+    rc = filelib_write (fp, wb->buf, wb->len);
+    if (rc != SR_SUCCESS && wb->direct) {
+	/* Some file systems refuse O_DIRECT only when writing */
+	debug_printf ("wbuf_flush: O_DIRECT write failed (%d)\n", errno);
+	clear_direct (fp);
+	wb->direct = 0;
+	rc = filelib_write (fp, wb->buf, wb->len);
+    }
+    if (rc == SR_SUCCESS) {
+	wb->offset += wb->len;
+    }
+    wb->len = 0;
+    return rc;
+}
+
+/* Reserve disk space ahead of a write of size bytes, so the file 
+   is laid out in large extents.  The reserved space is past the end 
+   of the file until it is written. */
+static void
+wbuf_preallocate (FHANDLE fp, Filelib_wbuf *wb, u_long size)
+{
+#if defined (HAVE_FALLOCATE)
+    while (wb->prealloc_step && wb->offset + size > wb->prealloc_end) {
+	if (fallocate (fp, FALLOC_FL_KEEP_SIZE, wb->prealloc_end, 
+		       wb->prealloc_step) != 0) {
+	    debug_printf ("fallocate failed (%d), not preallocating\n", 
+			  errno);
+	    wb->prealloc_step = 0;
+	    break;
+	}
+	wb->prealloc_end += wb->prealloc_step;
+    }
+#endif
+}
+
+/* Flush the buffer and free it, and give back the space which was 
+   preallocated but not written.  Doing it twice is harmless. */
+static void
+wbuf_finish (FHANDLE fp, Filelib_wbuf *wb)
+{
+    if (fp == INVALID_FHANDLE) {
+	return;
+    }
+    wbuf_flush (fp, wb);
+#if defined (HAVE_FALLOCATE)
+    if (wb->prealloc_end > wb->offset 
+	&& ftruncate (fp, wb->offset) != 0) {
+	debug_printf ("wbuf_finish: ftruncate failed (%d)\n", errno);
+    }
+#endif
+    wb->prealloc_end = 0;
+    wb->prealloc_step = 0;
+    free (wb->buf);
+    wb->buf = 0;
+    wb->size = 0;
+}
+
+static void
+clear_direct (FHANDLE fp)
+{
+#if defined (O_DIRECT)
+    int flags = fcntl (fp, F_GETFL);
+    if (flags != -1) {
+	fcntl (fp, F_SETFL, flags & ~O_DIRECT);
+    }
+#endif
+}
+
 error_code
-filelib_start (RIP_MANAGER_INFO* rmi, Writer *writer, TRACK_INFO* ti)
+filelib_start (RIP_MANAGER_INFO* rmi, Writer *writer, Track_record* ti)
 {
     FILELIB_INFO* fli = &rmi->filelib_info;
     gchar newfile[TEMP_STR_LEN];
     gchar fnbase[TEMP_STR_LEN];
-    gchar fnbase1[TEMP_STR_LEN];
+    error_code rc;
 
     if (!fli->m_do_individual_tracks) return SR_SUCCESS;
 
     debug_printf ("filelib_start\n");
 
-    /* Compose and trim filename (not including directory) */
-    msnprintf (fnbase1, TEMP_STR_LEN, m_S m_(" - ") m_S, 
-	       ti->artist, ti->title);
-    trim_filename (rmi, fnbase, fnbase1);
+    writer->m_bytes = 0;
+    writer->m_duplicate = 0;
+    dedup_hash_init (&writer->m_hash);
+    memset (&writer->m_wbuf, 0, sizeof(Filelib_wbuf));
+
+    /* A track which the index says is already complete would only 
+       be truncated when it is finished, so it isn't written at all. 
+       No file is made for it, and an incomplete copy from an earlier 
+       rip is left alone. */
+    if (is_known_duplicate (rmi, ti)) {
+	writer->m_file = INVALID_FHANDLE;
+	writer->m_tmpfile = 0;
+	writer->m_duplicate = 1;
+	debug_printf ("filelib_start: skipping known track\n");
+	return SR_SUCCESS;
+    }
+
+    /* A hidden track is given its name when it is finished */
+    writer->m_tmpfile = 0;
+    if (fli->m_use_tmpfile) {
+	if (filelib_open_tmpfile (rmi, &writer->m_file) == SR_SUCCESS) {
+	    writer->m_tmpfile = 1;
+	    wbuf_init (&writer->m_wbuf, fli->m_wbuf_size, 
+		       estimate_track_size (rmi, ti));
+	    if (rmi->prefs->durability == DURABLE_PERIODIC) {
+		durable_watch (writer->m_file);
+	    }
+	    return SR_SUCCESS;
+	}
+	fli->m_use_tmpfile = 0;
+    }
+
+    compose_track_fnbase (rmi, fnbase, ti);
     msnprintf (newfile, TEMP_STR_LEN, m_S m_S m_S, 
 	       fli->m_incomplete_directory, fnbase, fli->m_extension);
     if (fli->m_keep_incomplete) {
@@ -268,11 +570,35 @@ filelib_start (RIP_MANAGER_INFO* rmi, Writer *writer, TRACK_INFO* ti)
 				  fnbase, fli->m_extension);
     }
     mstrcpy (fli->m_incomplete_filename, newfile);
-    return filelib_open_for_write (rmi, &writer->m_file, newfile);
+    rc = filelib_open_for_write (rmi, &writer->m_file, newfile);
+    if (rc == SR_SUCCESS) {
+	wbuf_init (&writer->m_wbuf, fli->m_wbuf_size, 
+		   estimate_track_size (rmi, ti));
+	if (rmi->prefs->durability == DURABLE_PERIODIC) {
+	    durable_watch (writer->m_file);
+	}
+    }
+    return rc;
 }
 
+/* Have the show file and cue sheet fed by the stream */
 error_code
-filelib_write_cue (RIP_MANAGER_INFO* rmi, TRACK_INFO* ti, int secs)
+filelib_add_sinks (RIP_MANAGER_INFO* rmi)
+{
+    error_code rc;
+
+    if (!rmi->filelib_info.m_do_show) {
+	return SR_SUCCESS;
+    }
+    rc = sink_add (rmi, &show_sink);
+    if (rc != SR_SUCCESS) {
+	return rc;
+    }
+    return sink_add (rmi, &cue_sink);
+}
+
+static error_code
+filelib_write_cue (RIP_MANAGER_INFO* rmi, Track_record* ti, int secs)
 {
     FILELIB_INFO* fli = &rmi->filelib_info;
     int rc;
@@ -301,11 +627,58 @@ filelib_write_cue (RIP_MANAGER_INFO* rmi, TRACK_INFO* ti, int secs)
 error_code
 filelib_write_track (Writer *writer, char *buf, u_long size)
 {
+    error_code rc;
     debug_printf ("filelib_write_track %p %u\n", buf, size);
-    return filelib_write (writer->m_file, buf, size);
+    if (writer->m_duplicate) {
+	return SR_SUCCESS;
+    }
+    rc = wbuf_write (writer->m_file, &writer->m_wbuf, buf, size);
+    if (rc == SR_SUCCESS) {
+	writer->m_bytes += size;
+	dedup_hash_update (&writer->m_hash, buf, size);
+    }
+    return rc;
+}
+
+/* Like filelib_write_track, but buf is a tag, which is left out of 
+   the hash of the audio */
+error_code
+filelib_write_tag (Writer *writer, char *buf, u_long size)
+{
+    error_code rc;
+    debug_printf ("filelib_write_tag %p %u\n", buf, size);
+    if (writer->m_duplicate) {
+	return SR_SUCCESS;
+    }
+    rc = wbuf_write (writer->m_file, &writer->m_wbuf, buf, size);
+    if (rc == SR_SUCCESS) {
+	writer->m_bytes += size;
+    }
+    return rc;
 }
 
+/* Write the tag head followed by the audio buf, with one system call 
+   where possible */
 error_code
+filelib_writev_track (Writer *writer, char *head, u_long head_size, 
+		      char *buf, u_long size)
+{
+    error_code rc;
+    debug_printf ("filelib_writev_track %p %u %p %u\n", 
+		  head, head_size, buf, size);
+    if (writer->m_duplicate) {
+	return SR_SUCCESS;
+    }
+    rc = wbuf_writev (writer->m_file, &writer->m_wbuf, head, head_size, 
+		      buf, size);
+    if (rc == SR_SUCCESS) {
+	writer->m_bytes += head_size + size;
+	dedup_hash_update (&writer->m_hash, buf, size);
+    }
+    return rc;
+}
+
+static error_code
 filelib_write_show (RIP_MANAGER_INFO* rmi, char *buf, u_long size)
 {
     FILELIB_INFO* fli = &rmi->filelib_info;
@@ -315,13 +688,128 @@ filelib_write_show (RIP_MANAGER_INFO* rmi, char *buf, u_long size)
 	return SR_SUCCESS;
     }
     debug_printf ("Trying to write showfile\n");
-    rc = filelib_write (fli->m_show_file, buf, size);
+    rc = wbuf_write (fli->m_show_file, &fli->m_show_wbuf, buf, size);
     if (rc != SR_SUCCESS) {
 	fli->m_do_show = 0;
+    } else {
+	fli->m_show_offset += size;
     }
     return rc;
 }
 
+int
+filelib_can_copy_show (RIP_MANAGER_INFO* rmi)
+{
+    FILELIB_INFO* fli = &rmi->filelib_info;
+    return fli->m_copy_show && fli->m_do_show;
+}
+
+guint64
+filelib_get_show_offset (RIP_MANAGER_INFO* rmi)
+{
+    return rmi->filelib_info.m_show_offset;
+}
+
+/* Append size bytes of the show file, starting at show_offset, to the 
+   track.  The kernel copies the data without it passing through 
+   user space.  Where the show file and the track line up on 
+   FILELIB_BLOCK_SIZE, the whole blocks are reflinked, so that on a 
+   copy on write file system they share the disk space.  *copied is 
+   set to the number of bytes appended.  If it is short, the caller 
+   writes the rest itself.  No more copies are tried after an error.  
+   buf holds the same bytes in memory, for the hash of the audio. */
+error_code
+filelib_copy_show_to_track (RIP_MANAGER_INFO* rmi, Writer *writer, 
+			    guint64 show_offset, char *buf, u_long size, 
+			    u_long *copied)
+{
+    FILELIB_INFO* fli = &rmi->filelib_info;
+#if defined (HAVE_COPY_FILE_RANGE)
+    loff_t in_offset = show_offset;
+    u_long done = 0;
+
+    *copied = 0;
+    if (writer->m_duplicate) {
+	*copied = size;
+	return SR_SUCCESS;
+    }
+    if (!filelib_can_copy_show (rmi)) {
+	return SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+
+    /* The kernel copies what is in the files, not in the buffers.  
+       If the range is still in the show file's buffer, nothing is 
+       copied and the caller writes it from memory, rather than 
+       cutting the buffer short. */
+    if (show_offset + size > fli->m_show_wbuf.offset) {
+	return SR_SUCCESS;
+    }
+    if (wbuf_flush (writer->m_file, &writer->m_wbuf) != SR_SUCCESS) {
+	fli->m_copy_show = 0;
+	return SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+
+#if defined (FICLONERANGE)
+    {
+	off_t out_offset = lseek (writer->m_file, 0, SEEK_CUR);
+	if (fli->m_reflink_show && out_offset >= 0 
+	    && (in_offset % FILELIB_BLOCK_SIZE) 
+	    == (out_offset % FILELIB_BLOCK_SIZE)) {
+	    u_long head = (u_long) ((FILELIB_BLOCK_SIZE 
+				     - in_offset % FILELIB_BLOCK_SIZE) 
+				    % FILELIB_BLOCK_SIZE);
+	    u_long blocks = 0;
+	    if (head < size) {
+		blocks = (size - head) / FILELIB_BLOCK_SIZE 
+			* FILELIB_BLOCK_SIZE;
+	    }
+	    if (blocks > 0) {
+		struct file_clone_range fcr;
+		done = filelib_copy_range (fli->m_show_file, &in_offset, 
+					   writer->m_file, head);
+		if (done == head) {
+		    fcr.src_fd = fli->m_show_file;
+		    fcr.src_offset = in_offset;
+		    fcr.src_length = blocks;
+		    fcr.dest_offset = out_offset + head;
+		    if (ioctl (writer->m_file, FICLONERANGE, &fcr) == 0) {
+			lseek (writer->m_file, out_offset + head + blocks, 
+			       SEEK_SET);
+			in_offset += blocks;
+			done += blocks;
+		    } else {
+			debug_printf ("FICLONERANGE failed (%d), "
+				      "copying instead\n", errno);
+			fli->m_reflink_show = 0;
+		    }
+		}
+	    }
+	}
+    }
+#endif
+
+    if (done < size) {
+	done += filelib_copy_range (fli->m_show_file, &in_offset, 
+				    writer->m_file, size - done);
+    }
+    *copied = done;
+    writer->m_bytes += done;
+    writer->m_wbuf.offset += done;
+    dedup_hash_update (&writer->m_hash, buf, done);
+    if (done < size) {
+	debug_printf ("filelib_copy_show_to_track: copied %lu of %lu, "
+		      "errno = %d\n", done, size, errno);
+	fli->m_copy_show = 0;
+	return SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+    return SR_SUCCESS;
+#else
+    *copied = 0;
+    fli->m_copy_show = 0;
+    return SR_ERROR_CANT_WRITE_TO_FILE;
+#endif
+}
+
 /** Move file from incomplete to complete directory. */
 error_code
 filelib_rename_to_complete (
@@ -339,13 +827,27 @@ filelib_rename_to_complete (
        the caller through the "streamripper API".  Is this necessary?
        If so, the methodology should be documented. */
     gchar *fullpath = 0;
+    guint64 key;
+    guint64 content_hash;
+    Trackindex_info known;
+    int have_known;
 
     if (!fli->m_do_individual_tracks) return SR_SUCCESS;
 
+    /* Nothing was written, and there is no file to move */
+    if (writer->m_duplicate) {
+	if (fli->m_count != -1)
+	    fli->m_count++;
+	return SR_SUCCESS;
+    }
+
+    key = trackindex_key (writer->m_ti);
+    have_known = trackindex_lookup (key, &known);
+
     /* Construct filename for completed file */
-    parse_and_subst_pat (rmi, new_path, &writer->m_ti, 
-			 fli->m_output_directory, 
-			 fli->m_output_pattern, fli->m_extension);
+    filelib_expand_pattern (rmi, new_path, writer->m_ti,
+			    fli->m_output_directory,
+			    &fli->m_output_pat, fli->m_extension);
 
     /* Build up the output directory */
     mkdir_recursive (rmi, new_path, 0);
@@ -357,7 +859,7 @@ filelib_rename_to_complete (
 	ok_to_write = TRUE;
 	break;
     case OVERWRITE_NEVER:
-	if (file_exists (rmi, new_path)) {
+	if (have_known || file_exists (rmi, new_path)) {
 	    ok_to_write = FALSE;
 	} else {
 	    ok_to_write = TRUE;
@@ -365,8 +867,15 @@ filelib_rename_to_complete (
 	break;
     case OVERWRITE_LARGER:
 	/* Smart overwriting -- only overwrite if new file is bigger */
-	ok_to_write = new_file_is_better (rmi, new_path, 
-					  fli->m_incomplete_filename);
+	if (have_known) {
+	    ok_to_write = writer->m_bytes > known.size;
+	} else if (writer->m_tmpfile) {
+	    ok_to_write = get_fd_size (writer->m_file) 
+		    > get_file_size (rmi, new_path);
+	} else {
+	    ok_to_write = new_file_is_better (rmi, new_path, 
+					      fli->m_incomplete_filename);
+	}
 	break;
     case OVERWRITE_VERSION:
     default:
@@ -381,12 +890,53 @@ filelib_rename_to_complete (
     }
 
     debug_printf ("filelib_end: new_path = %s\n", new_path);
+    /* A %q number is only used up if the track gets its name */
+    dircache_end_sequence (fli->m_dircache, ok_to_write);
 
+    content_hash = dedup_hash_digest (&writer->m_hash);
+    fli->m_track_bytes += writer->m_bytes;
+    fli->m_tracks_done++;
     if (ok_to_write) {
-	if (file_exists (rmi, new_path)) {
-	    delete_file (rmi, new_path);
+	update_track_index (rmi, key, writer->m_bytes, content_hash);
+    } else if (!have_known && key && trackindex_is_open ()) {
+	/* Learn about a track which was ripped before the index */
+	long size = get_file_size (rmi, new_path);
+	if (size > 0) {
+	    update_track_index (rmi, key, size, 0);
 	}
-	move_file (rmi, new_path, fli->m_incomplete_filename);
+    }
+
+    if (ok_to_write 
+	&& link_duplicate (rmi, writer, new_path, content_hash) == SR_SUCCESS) {
+	/* The track just written was dropped */
+	sync_name (rmi, new_path);
+    } else if (ok_to_write) {
+	sync_track (rmi, writer);
+	if (writer->m_tmpfile) {
+	    /* Replaces an older copy without deleting it first */
+	    publish_track (rmi, writer, new_path);
+	} else {
+	    if (file_exists (rmi, new_path)) {
+		delete_file (rmi, new_path);
+	    }
+	    move_file (rmi, new_path, fli->m_incomplete_filename);
+	}
+	sync_name (rmi, new_path);
+	if (rmi->prefs->dedup == DEDUP_LINK 
+	    || rmi->prefs->dedup == DEDUP_REFLINK) {
+	    char fn[SR_MAX_PATH];
+	    string_from_gstring (rmi, fn, SR_MAX_PATH, new_path, 
+				 CODESET_FILESYS);
+	    dedup_add (content_hash, writer->m_hash.total, fn);
+	}
+    } else if (writer->m_tmpfile) {
+#if !defined (WIN32)
+	if (truncate_dup && ftruncate (writer->m_file, 0) != 0) {
+	    debug_printf ("ftruncate of duplicate failed (%d), "
+			  "keeping it whole\n", errno);
+	}
+#endif
+	link_incomplete (rmi, writer, 0);
     } else {
 	if (truncate_dup && file_exists (rmi, fli->m_incomplete_filename)) {
 	    truncate_file (rmi, fli->m_incomplete_filename);
@@ -412,14 +962,75 @@ filelib_close (
     if (!fli->m_do_individual_tracks) {
 	return SR_SUCCESS;
     }
+    wbuf_finish (writer->m_file, &writer->m_wbuf);
+    durable_unwatch (writer->m_file);
+    /* A hidden track stays open until it is given its name */
+    if (writer->m_tmpfile) {
+	return SR_SUCCESS;
+    }
     close_file (&writer->m_file);
     return SR_SUCCESS;
 }
 
+/* The track will not be moved to the complete directory.  A hidden 
+   track is linked into the incomplete directory, where it is kept 
+   like any other unfinished track. */
+void
+filelib_abandon (RIP_MANAGER_INFO* rmi, Writer *writer)
+{
+    wbuf_finish (writer->m_file, &writer->m_wbuf);
+    durable_unwatch (writer->m_file);
+    if (writer->m_tmpfile) {
+	link_incomplete (rmi, writer, 0);
+    }
+}
+
 void
 filelib_shutdown (RIP_MANAGER_INFO* rmi)
 {
+    FILELIB_INFO* fli = &rmi->filelib_info;
+
     close_files (rmi);
+    dircache_destroy (fli->m_dircache);
+    fli->m_dircache = 0;
+    filelib_free_pattern (&fli->m_output_pat);
+    filelib_free_pattern (&fli->m_showfile_pat);
+}
+
+gchar* 
+filelib_replace_invalid_chars (gchar *str)
+{
+    gchar invalid_chars[] = m_("\\/:*?\"<>|~");
+    gchar replacement = m_('-');
+
+    gchar *oldstr = str;
+    gchar *newstr = str;
+
+    if (!str) return NULL;
+
+    /* Skip leading "." */
+    for (;*oldstr; oldstr++) {
+	if (*oldstr != '.') {
+	    break;
+	}
+    }
+
+    for (;*oldstr; oldstr++) {
+	if (g_ascii_iscntrl (*oldstr)) {
+	    /* Do nothing -- skip control characters without replacement */
+	}
+	else if (mstrchr(invalid_chars, *oldstr) == NULL) {
+	    /* Ordinary case -- copy */
+	    *newstr++ = *oldstr;
+	}
+	else {
+	    /* Replace case -- append replacement char */
+	    *newstr++ = replacement;
+	}
+    }
+    *newstr = '\0';
+
+    return str;
 }
 
 
@@ -434,11 +1045,7 @@ mkdir_if_needed (RIP_MANAGER_INFO* rmi, gchar *str)
     char s[SR_MAX_PATH];
     string_from_gstring (rmi, s, SR_MAX_PATH, str, CODESET_FILESYS);
     debug_printf ("mkdir = %s -> %s\n", str, s);
-#if WIN32
-    mkdir (s);
-#else
-    mkdir (s, 0777);
-#endif
+    dircache_make_dirs (rmi->filelib_info.m_dircache, s, 1);
     return SR_SUCCESS;
 }
 
@@ -448,54 +1055,47 @@ mkdir_if_needed (RIP_MANAGER_INFO* rmi, gchar *str)
 static error_code
 mkdir_recursive (RIP_MANAGER_INFO* rmi, gchar *str, int make_last)
 {
-    gchar buf[SR_MAX_PATH];
-    gchar* p = buf;
-    gchar q;
+    char s[SR_MAX_PATH];
 
-    buf[0] = 0;
-    while ((q = *p++ = *str++) != 0) {
-	if (ISSLASH(q)) {
-	    *p = 0;
-	    mkdir_if_needed (rmi, buf);
-	}
-    }
-    if (make_last) {
-	mkdir_if_needed (rmi, str);
-    }
+    /* Directories already made or seen are remembered, so this is 
+       usually a lookup */
+    string_from_gstring (rmi, s, SR_MAX_PATH, str, CODESET_FILESYS);
+    dircache_make_dirs (rmi->filelib_info.m_dircache, s, make_last);
     return SR_SUCCESS;
 }
 
-/* This sets the value for m_default_pattern and m_default_showfile_pattern,
-   using the -q & -s flags.  This function cannot overflow 
-   these static buffers. */
+/* This sets the value for default_pattern and default_showfile_pattern,
+   using the -q & -s flags.  Both are SR_MAX_PATH long.  This function 
+   cannot overflow these buffers. */
 static void
-set_default_pattern (RIP_MANAGER_INFO* rmi, 
+set_default_pattern (RIP_MANAGER_INFO* rmi, gchar* default_pattern,
+		     gchar* default_showfile_pattern,
 		     BOOL get_separate_dirs, BOOL do_count)
 {
     FILELIB_INFO* fli = &rmi->filelib_info;
 
-    /* Set up m_default_pattern */
-    fli->m_default_pattern[0] = 0;
+    /* Set up default_pattern */
+    default_pattern[0] = 0;
     if (get_separate_dirs) {
-	mstrcpy (fli->m_default_pattern, m_("%S") PATH_SLASH_STR);
+	mstrcpy (default_pattern, m_("%S") PATH_SLASH_STR);
     }
     if (do_count) {
 	if (fli->m_count < 0) {
-	    mstrncat (fli->m_default_pattern, m_("%q_"), SR_MAX_PATH);
+	    mstrncat (default_pattern, m_("%q_"), SR_MAX_PATH);
 	} else {
-	    msnprintf (&fli->m_default_pattern[mstrlen(fli->m_default_pattern)], 
-		       SR_MAX_PATH - mstrlen(fli->m_default_pattern), 
+	    msnprintf (&default_pattern[mstrlen(default_pattern)], 
+		       SR_MAX_PATH - mstrlen(default_pattern), 
 		       m_("%%%dq_"), fli->m_count);
 	}
     }
-    mstrncat (fli->m_default_pattern, m_("%A - %T"), SR_MAX_PATH);
+    mstrncat (default_pattern, m_("%A - %T"), SR_MAX_PATH);
 
-    /* Set up m_default_showfile_pattern */
-    fli->m_default_showfile_pattern[0] = 0;
+    /* Set up default_showfile_pattern */
+    default_showfile_pattern[0] = 0;
     if (get_separate_dirs) {
-	mstrcpy (fli->m_default_showfile_pattern, m_("%S") PATH_SLASH_STR);
+	mstrcpy (default_showfile_pattern, m_("%S") PATH_SLASH_STR);
     }
-    mstrncat (fli->m_default_showfile_pattern, m_("sr_program_%d"), SR_MAX_PATH);
+    mstrncat (default_showfile_pattern, m_("sr_program_%d"), SR_MAX_PATH);
 }
 
 /* This function sets the value of m_output_directory or 
@@ -778,6 +1378,13 @@ close_files (RIP_MANAGER_INFO* rmi)
     FILELIB_INFO* fli = &rmi->filelib_info;
     /* GCS FIX: Need to close writers */
     //    close_file (&fli->m_file);
+    wbuf_finish (fli->m_show_file, &fli->m_show_wbuf);
+    if (fli->m_show_file != INVALID_FHANDLE) {
+	durable_unwatch (fli->m_show_file);
+	if (is_durable (rmi)) {
+	    durable_sync (fli->m_show_file);
+	}
+    }
     close_file (&fli->m_show_file);
     close_file (&fli->m_cue_file);
 }
@@ -785,177 +1392,245 @@ close_files (RIP_MANAGER_INFO* rmi)
 static BOOL
 file_exists (RIP_MANAGER_INFO* rmi, gchar *filename)
 {
-    FHANDLE f;
     char fn[SR_MAX_PATH];
     string_from_gstring (rmi, fn, SR_MAX_PATH, filename, CODESET_FILESYS);
 #if defined (WIN32)
-    f = CreateFile (fn, GENERIC_READ,
-	    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
-	    FILE_ATTRIBUTE_NORMAL, NULL);
-#else
-    f = open (fn, O_RDONLY);
-#endif
-    if (f == INVALID_FHANDLE) {
-	return FALSE;
+    {
+	FHANDLE f;
+	f = CreateFile (fn, GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_FHANDLE) {
+	    return FALSE;
+	}
+	close_file (&f);
+	return TRUE;
     }
-    close_file (&f);
-    return TRUE;
+#else
+    return dircache_file_exists (rmi->filelib_info.m_dircache, fn);
+#endif
 }
 
-/* It's a bit touch and go here. My artist substitution might 
-   be into a directory, in which case I don't have enough 
-   room for a legit file name */
-/* Also, what about versioning of completed filenames? */
-/* If (TRACK_INFO* ti) is NULL, that means we're being called for the 
-   showfile, and therefore some parts don't apply */
-static void
-parse_and_subst_pat (RIP_MANAGER_INFO* rmi,
-		     gchar* newfile,
-		     TRACK_INFO* ti,
-		     gchar* directory,
-		     gchar* pattern,
-		     gchar* extension)
+static error_code
+show_sink_event (RIP_MANAGER_INFO* rmi, Sink_event *ev)
+{
+    return filelib_write_show (rmi, ev->data, ev->len);
+}
+
+static error_code
+cue_sink_event (RIP_MANAGER_INFO* rmi, Sink_event *ev)
+{
+    return filelib_write_cue (rmi, ev->ti, (int) ev->secs);
+}
+
+/* Compile the pattern into literal text and the fields which change
+   from track to track.  The stream name and session date don't
+   change, so they become part of the literal text.  Fields which
+   don't apply to the show file are taken literally, as %A etc. */
+void
+filelib_compile_pattern (RIP_MANAGER_INFO* rmi, Filelib_pattern* fp,
+			 gchar* pattern, int is_for_showfile)
 {
     FILELIB_INFO* fli = &rmi->filelib_info;
-    gchar stripped_artist[SR_MAX_PATH];
-    gchar stripped_title[SR_MAX_PATH];
-    gchar stripped_album[SR_MAX_PATH];
-    gchar temp[DATEBUF_LEN];
-    gchar datebuf[DATEBUF_LEN];
-    int opi = 0;
-    int nfi = 0;
-    int done;
+    GString* text = g_string_new ("");
+    GArray* ops = g_array_new (FALSE, TRUE, sizeof(Filelib_pat_op));
     gchar* pat = pattern;
+    int opi = 0;
+
+    filelib_free_pattern (fp);
+    while (pat[opi]) {
+	Filelib_pat_op op;
+	int skip = 2;
+
+	memset (&op, 0, sizeof(op));
+	op.type = PAT_LITERAL;
+	op.off = text->len;
+	if (pat[opi] != m_('%')) {
+	    g_string_append_c (text, pat[opi]);
+	    skip = 1;
+	} else {
+	    switch (pat[opi+1]) {
+	    case m_('%'):
+		g_string_append_c (text, m_('%'));
+		break;
+	    case m_('S'):
+		/* stream name */
+		g_string_append (text, fli->m_stripped_icy_name);
+		break;
+	    case m_('d'):
+		/* session date */
+		g_string_append (text, fli->m_session_datebuf);
+		break;
+	    case m_('D'):
+		op.type = PAT_DATE;
+		break;
+	    case m_('A'):
+		op.type = PAT_ARTIST;
+		break;
+	    case m_('T'):
+		op.type = PAT_TITLE;
+		break;
+	    case m_('a'):
+		op.type = PAT_ALBUM;
+		break;
+	    case m_('q'):
+		op.type = PAT_SEQUENCE;
+		break;
+	    default:
+		/* %Nq, or else an illegal pattern, which is ok */
+		skip = 1;
+		if (isdigit (pat[opi+1])) {
+		    int ai = 0;
+		    gchar ascii_buf[7];      /* max 6 chars */
+		    while (isdigit (pat[opi+1+ai]) && ai < 6) {
+			ascii_buf[ai] = pat[opi+1+ai];
+			ai ++;
+		    }
+		    ascii_buf[ai] = 0;
+		    if (pat[opi+1+ai] == m_('q')) {
+			op.type = PAT_COUNT;
+			op.arg = mtol (ascii_buf);
+			skip = ai + 2;
+			break;
+		    }
+		}
+		g_string_append_c (text, pat[opi]);
+		break;
+	    }
+	}
+	if (is_for_showfile && (op.type == PAT_ARTIST || op.type == PAT_TITLE
+				|| op.type == PAT_ALBUM)) {
+	    op.type = PAT_LITERAL;
+	    skip = 1;
+	    g_string_append_c (text, pat[opi]);
+	}
+	if (op.type != PAT_LITERAL) {
+	    /* Used if there is no track to fill it in */
+	    g_string_append_len (text, &pat[opi], skip);
+	}
+	op.len = text->len - op.off;
+	opi += skip;
+
+	/* Runs of literal text become a single op */
+	if (op.type == PAT_LITERAL && ops->len > 0) {
+	    Filelib_pat_op* last = &g_array_index (ops, Filelib_pat_op,
+						   ops->len - 1);
+	    if (last->type == PAT_LITERAL) {
+		last->len += op.len;
+		continue;
+	    }
+	}
+	g_array_append_val (ops, op);
+    }
+
+    fp->num_ops = ops->len;
+    fp->ops = (Filelib_pat_op*) g_array_free (ops, FALSE);
+    fp->text = g_string_free (text, FALSE);
+    debug_mprintf (m_("Compiled pattern ") m_S m_(" into %d ops\n"),
+		   pattern, fp->num_ops);
+}
+
+void
+filelib_free_pattern (Filelib_pattern* fp)
+{
+    g_free (fp->ops);
+    g_free (fp->text);
+    memset (fp, 0, sizeof(Filelib_pattern));
+}
+
+/* Fill in the compiled pattern in a single pass.  If (Track_record* ti)
+   is NULL, its fields are left as they were in the pattern. */
+void
+filelib_expand_pattern (RIP_MANAGER_INFO* rmi,
+			gchar* newfile,
+			Track_record* ti,
+			gchar* directory,
+			Filelib_pattern* fp,
+			gchar* extension)
+{
+    FILELIB_INFO* fli = &rmi->filelib_info;
+    gchar temp[DATEBUF_LEN];
+    int nfi;
+    int i;
 
     /* Reserve 5 bytes: 4 for the .mp3 extension, and 1 for null char */
     int MAX_FILEBASELEN = SR_MAX_PATH-5;
 
-    mstrcpy (newfile, directory);
-    opi = 0;
-    nfi = mstrlen(newfile);
-    done = 0;
-
-    /* Strip artist, title, album */
-    debug_printf ("parse_and_subst_pat: stripping\n");
-    if (ti) {
-	mstrncpy (stripped_artist, ti->artist, SR_MAX_PATH);
-	mstrncpy (stripped_title, ti->title, SR_MAX_PATH);
-	mstrncpy (stripped_album, ti->album, SR_MAX_PATH);
-	replace_invalid_chars (stripped_artist);
-	replace_invalid_chars (stripped_title);
-	replace_invalid_chars (stripped_album);
-    }
-
-    debug_printf ("parse_and_subst_pat: substitute pattern\n");
-    while (nfi < MAX_FILEBASELEN) {
-	if (pat[opi] == 0) {
-	    done = 1;
+    nfi = append_text (newfile, 0, directory, mstrlen (directory),
+		       SR_MAX_PATH - 1);
+    for (i = 0; i < fp->num_ops && nfi < MAX_FILEBASELEN; i++) {
+	Filelib_pat_op* op = &fp->ops[i];
+	gchar* str = &fp->text[op->off];
+	int len = op->len;
+
+	switch (op->type) {
+	case PAT_DATE:
+	    /* current timestamp */
+	    fill_date_buf (rmi, temp, DATEBUF_LEN);
+	    str = temp;
+	    len = -1;
 	    break;
-	}
-	if (pat[opi] != m_('%')) {
-	    newfile[nfi++] = pat[opi++];
-	    newfile[nfi] = 0;
-	    continue;
-	}
-	/* If we got here, we have a '%' */
-	switch (pat[opi+1]) {
-	case m_('%'):
-	    newfile[nfi++] = m_('%');
+	case PAT_ARTIST:
+	    if (ti) {
+		str = ti->fn_artist;
+		len = -1;
+	    }
+	    break;
+	case PAT_TITLE:
+	    if (ti) {
+		str = ti->fn_title;
+		len = -1;
+	    }
+	    break;
+	case PAT_ALBUM:
+	    if (ti) {
+		str = ti->fn_album;
+		len = -1;
+	    }
+	    break;
+	case PAT_SEQUENCE:
+	    /* automatic sequence number of the name so far */
 	    newfile[nfi] = 0;
-	    opi+=2;
-	    continue;
-	case m_('S'):
-	    /* stream name */
-	    /* GCS FIX: Not sure here */
-	    mstrncat (newfile, fli->m_stripped_icy_name, MAX_FILEBASELEN-nfi);
-	    nfi = mstrlen (newfile);
-	    opi+=2;
-	    continue;
-	case m_('d'):
-	    /* append date info */
-	    mstrncat (newfile, fli->m_session_datebuf, MAX_FILEBASELEN-nfi);
-	    nfi = mstrlen (newfile);
-	    opi+=2;
-	    continue;
-	case m_('D'):
-	    /* current timestamp */
-	    fill_date_buf (rmi, datebuf, DATEBUF_LEN);
-	    mstrncat (newfile, datebuf, MAX_FILEBASELEN-nfi);
-	    nfi = mstrlen (newfile);
-	    opi+=2;
-	    continue;
-	case m_('a'):
-	    /* album */
-	    if (!ti) goto illegal_pattern;
-	    mstrncat (newfile, stripped_album, MAX_FILEBASELEN-nfi);
-	    nfi = mstrlen (newfile);
-	    opi+=2;
-	    continue;
-	case m_('A'):
-	    /* artist */
-	    if (!ti) goto illegal_pattern;
-	    mstrncat (newfile, stripped_artist, MAX_FILEBASELEN-nfi);
-	    nfi = mstrlen (newfile);
-	    opi+=2;
-	    continue;
-	case m_('q'):
-	    /* automatic sequence number */
-	    msnprintf (temp, DATEBUF_LEN, m_("%04d"), 
+	    msnprintf (temp, DATEBUF_LEN, m_("%04d"),
 		       get_next_sequence_number (rmi, newfile));
-	    mstrncat (newfile, temp, MAX_FILEBASELEN-nfi);
-	    nfi = mstrlen (newfile);
-	    opi+=2;
-	    continue;
-	case m_('T'):
-	    /* title */
-	    if (!ti) goto illegal_pattern;
-	    mstrncat (newfile, stripped_title, MAX_FILEBASELEN-nfi);
-	    nfi = mstrlen (newfile);
-	    opi+=2;
-	    continue;
-	case 0:
-	    /* The pattern ends in '%', but that's ok. */
-	    newfile[nfi++] = pat[opi++];
-	    newfile[nfi] = 0;
-	    done = 1;
+	    str = temp;
+	    len = -1;
 	    break;
-	case m_('0'): case m_('1'): case m_('2'): case m_('3'): case m_('4'): 
-	case m_('5'): case m_('6'): case m_('7'): case m_('8'): case m_('9'): 
-	    {
-		/* Get integer */
-		int ai = 0;
-		gchar ascii_buf[7];      /* max 6 chars */
-		while (isdigit (pat[opi+1+ai]) && ai < 6) {
-		    ascii_buf[ai] = pat[opi+1+ai];
-		    ai ++;
-		}
-		ascii_buf[ai] = 0;
-		/* If we got a q, get starting number */
-		if (pat[opi+1+ai] == m_('q')) {
-		    if (fli->m_count == -1) {
-			fli->m_count = mtol(ascii_buf);
-		    }
-		    msnprintf (temp, DATEBUF_LEN, m_("%04d"), fli->m_count);
-		    mstrncat (newfile, temp, MAX_FILEBASELEN-nfi);
-		    nfi = mstrlen (newfile);
-		    opi+=ai+2;
-		    continue;
-		}
-		/* Otherwise, no 'q', so drop through to default case */
+	case PAT_COUNT:
+	    /* The first track gets the starting number */
+	    if (fli->m_count == -1) {
+		fli->m_count = op->arg;
 	    }
-	default:
-	illegal_pattern:
-	    /* Illegal pattern, but that's ok. */
-	    newfile[nfi++] = pat[opi++];
-	    newfile[nfi] = 0;
-	    continue;
+	    msnprintf (temp, DATEBUF_LEN, m_("%04d"), fli->m_count);
+	    str = temp;
+	    len = -1;
+	    break;
+	}
+	if (len < 0) {
+	    len = mstrlen (str);
 	}
+	nfi = append_text (newfile, nfi, str, len, MAX_FILEBASELEN);
     }
 
     /* Pop on the extension */
-    /* GCS FIX - is SR_MAX_PATH right here? */
-    debug_printf ("parse_and_subst_pat: pop on the extension\n");
-    mstrncat (newfile, extension, SR_MAX_PATH);
+    nfi = append_text (newfile, nfi, extension, mstrlen (extension),
+		       SR_MAX_PATH - 1);
+    newfile[nfi] = 0;
+}
+
+/* Copy len characters of str to newfile at nfi, but no further than
+   max_len.  Returns the new length; newfile is not terminated. */
+static int
+append_text (gchar* newfile, int nfi, const gchar* str, int len, int max_len)
+{
+    if (nfi + len > max_len) {
+	len = max_len - nfi;
+    }
+    if (len > 0) {
+	memcpy (&newfile[nfi], str, len * sizeof(gchar));
+	nfi += len;
+    }
+    return nfi;
 }
 
 static long
@@ -984,6 +1659,20 @@ get_file_size (RIP_MANAGER_INFO* rmi, gchar *filename)
     return len;
 }
 
+static long
+get_fd_size (FHANDLE fp)
+{
+#if defined (WIN32)
+    return (long) GetFileSize (fp, NULL);
+#else
+    struct stat st;
+    if (fstat (fp, &st) != 0) {
+	return 0;
+    }
+    return (long) st.st_size;
+#endif
+}
+
 /*
  * Added by Daniel Lord 29.06.2005 to only overwrite files with better 
  * captures, modified by GCS to get file size from file system 
@@ -1057,7 +1746,10 @@ move_file (RIP_MANAGER_INFO* rmi, gchar* new_filename, gchar* old_filename)
 #if defined WIN32
     MoveFile(old_fn, new_fn);
 #else
-    rename (old_fn, new_fn);
+    if (rename (old_fn, new_fn) != 0 && errno == EXDEV) {
+	/* Copy to the other file system without holding up the stream */
+	bgcopy_move_file (old_fn, new_fn, is_durable (rmi));
+    }
 #endif
 }
 
@@ -1106,6 +1798,294 @@ filelib_open_for_write (RIP_MANAGER_INFO* rmi, FHANDLE* fp, gchar* filename)
     return SR_SUCCESS;
 }
 
+/* Create an unnamed file on the file system of the output directory */
+static error_code
+filelib_open_tmpfile (RIP_MANAGER_INFO* rmi, FHANDLE* fp)
+{
+#if defined (O_TMPFILE)
+    FILELIB_INFO* fli = &rmi->filelib_info;
+    char dir[SR_MAX_PATH];
+    string_from_gstring (rmi, dir, SR_MAX_PATH, fli->m_output_directory, 
+			 CODESET_FILESYS);
+    *fp = open (dir, O_TMPFILE | O_RDWR, 
+		S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (*fp == INVALID_FHANDLE) {
+	debug_printf ("O_TMPFILE failed in %s: %d\n", dir, errno);
+	return SR_ERROR_CANT_CREATE_FILE;
+    }
+    return SR_SUCCESS;
+#else
+    return SR_ERROR_CANT_CREATE_FILE;
+#endif
+}
+
+/* Give a name to a file created by filelib_open_tmpfile.  On failure, 
+   errno is left as linkat set it. */
+static error_code
+link_file (RIP_MANAGER_INFO* rmi, gchar* filename, FHANDLE fp)
+{
+#if defined (O_TMPFILE)
+    char fn[SR_MAX_PATH];
+    char proc_fn[64];
+    int err;
+
+    string_from_gstring (rmi, fn, SR_MAX_PATH, filename, CODESET_FILESYS);
+    snprintf (proc_fn, sizeof(proc_fn), "/proc/self/fd/%d", fp);
+    if (linkat (AT_FDCWD, proc_fn, AT_FDCWD, fn, AT_SYMLINK_FOLLOW) == 0) {
+	return SR_SUCCESS;
+    }
+    err = errno;
+    debug_printf ("linkat (%s) failed: %d\n", fn, err);
+    errno = err;
+#endif
+    return SR_ERROR_CANT_CREATE_FILE;
+}
+
+/* Name a hidden track in the incomplete directory, and close it.  If 
+   path is not null, the name is copied there. */
+static error_code
+link_incomplete (RIP_MANAGER_INFO* rmi, Writer *writer, gchar* path)
+{
+    FILELIB_INFO* fli = &rmi->filelib_info;
+    gchar fnbase[TEMP_STR_LEN];
+    gchar newfile[TEMP_STR_LEN];
+    error_code rc;
+
+    compose_track_fnbase (rmi, fnbase, writer->m_ti);
+    msnprintf (newfile, TEMP_STR_LEN, m_S m_S m_S, 
+	       fli->m_incomplete_directory, fnbase, fli->m_extension);
+    if (fli->m_keep_incomplete) {
+	filelib_rename_versioned (0, rmi, fli->m_incomplete_directory, 
+				  fnbase, fli->m_extension);
+    } else if (file_exists (rmi, newfile)) {
+	delete_file (rmi, newfile);
+    }
+    rc = link_file (rmi, newfile, writer->m_file);
+    close_file (&writer->m_file);
+    writer->m_tmpfile = 0;
+    if (path) {
+	mstrcpy (path, newfile);
+    }
+    return rc;
+}
+
+/* Name a hidden track in the complete directory.  It is linked 
+   under a temporary name and renamed over new_path, so an older 
+   copy there is replaced in one step, and the name is never missing 
+   or half written.  If the complete directory is on another file 
+   system, the track goes through the incomplete directory, and is 
+   copied from there in the background. */
+static void
+publish_track (RIP_MANAGER_INFO* rmi, Writer *writer, gchar* new_path)
+{
+    gchar incomplete_path[TEMP_STR_LEN];
+    gchar tmp_path[TEMP_STR_LEN];
+
+    msnprintf (tmp_path, TEMP_STR_LEN, m_S m_(".part"), new_path);
+    if (file_exists (rmi, tmp_path)) {
+	/* Left by a crash */
+	delete_file (rmi, tmp_path);
+    }
+    if (link_file (rmi, tmp_path, writer->m_file) == SR_SUCCESS) {
+	close_file (&writer->m_file);
+	writer->m_tmpfile = 0;
+	move_file (rmi, new_path, tmp_path);
+	return;
+    }
+    if (errno == EXDEV) {
+	if (link_incomplete (rmi, writer, incomplete_path) == SR_SUCCESS) {
+	    move_file (rmi, new_path, incomplete_path);
+	}
+	return;
+    }
+    link_incomplete (rmi, writer, 0);
+}
+
+/* Compose and trim filename (not including directory) */
+static void
+compose_track_fnbase (RIP_MANAGER_INFO* rmi, gchar* fnbase, Track_record* ti)
+{
+    gchar fnbase1[TEMP_STR_LEN];
+
+    msnprintf (fnbase1, TEMP_STR_LEN, m_S m_(" - ") m_S, 
+	       ti->artist, ti->title);
+    trim_filename (rmi, fnbase, fnbase1);
+}
+
+/* How much to preallocate for a new track.  The size of the track 
+   when it was last ripped is best, else the average of the tracks 
+   of this stream.  Returns 0 when there is nothing to go by. */
+static u_long
+estimate_track_size (RIP_MANAGER_INFO* rmi, Track_record* ti)
+{
+    FILELIB_INFO* fli = &rmi->filelib_info;
+    Trackindex_info known;
+
+    if (!fli->m_preallocate) {
+	return 0;
+    }
+    if (trackindex_lookup (trackindex_key (ti), &known) && known.size) {
+	return (u_long) known.size;
+    }
+    if (fli->m_tracks_done) {
+	return (u_long) (fli->m_track_bytes / fli->m_tracks_done);
+    }
+    return 0;
+}
+
+static int
+is_durable (RIP_MANAGER_INFO* rmi)
+{
+    return rmi->prefs->durability == DURABLE_COMPLETE
+	    || rmi->prefs->durability == DURABLE_PERIODIC;
+}
+
+/* Wait until the data of a finished track is on disk, so that it 
+   is never seen in the complete directory empty or torn */
+static void
+sync_track (RIP_MANAGER_INFO* rmi, Writer *writer)
+{
+    FILELIB_INFO* fli = &rmi->filelib_info;
+
+    if (!is_durable (rmi)) {
+	return;
+    }
+    if (writer->m_tmpfile) {
+	durable_sync (writer->m_file);
+	return;
+    }
+#if !defined (WIN32)
+    {
+	char fn[SR_MAX_PATH];
+	int fd;
+	string_from_gstring (rmi, fn, SR_MAX_PATH, 
+			     fli->m_incomplete_filename, CODESET_FILESYS);
+	fd = open (fn, O_RDONLY);
+	if (fd >= 0) {
+	    durable_sync (fd);
+	    close (fd);
+	}
+    }
+#endif
+}
+
+/* Have the new name of a finished track synced, in the background */
+static void
+sync_name (RIP_MANAGER_INFO* rmi, gchar* path)
+{
+    char fn[SR_MAX_PATH];
+
+    if (!is_durable (rmi)) {
+	return;
+    }
+    string_from_gstring (rmi, fn, SR_MAX_PATH, path, CODESET_FILESYS);
+    durable_sync_dir (fn);
+}
+
+/* Is the track one which would be thrown away when it is finished, 
+   because the index says it is already complete? */
+static int
+is_known_duplicate (RIP_MANAGER_INFO* rmi, Track_record* ti)
+{
+    Trackindex_info known;
+
+    if (rmi->prefs->overwrite != OVERWRITE_NEVER
+	|| !GET_TRUNCATE_DUPS(rmi->prefs->flags)) {
+	return 0;
+    }
+    return trackindex_lookup (trackindex_key (ti), &known);
+}
+
+static void
+update_track_index (RIP_MANAGER_INFO* rmi, guint64 key, guint64 size, 
+		    guint64 content_hash)
+{
+    Trackindex_info info;
+    int kbps = rmi->detected_bitrate > 0 
+	    ? rmi->detected_bitrate : rmi->http_bitrate;
+
+    info.size = size;
+    info.content_hash = content_hash;
+    info.duration_ms = kbps > 0 ? (u_long) (size * 8 / kbps) : 0;
+    trackindex_update (key, &info);
+}
+
+/* If a completed track has the same audio, make new_path share its 
+   data, and drop the track just written.  A hard link shares the 
+   file itself, a reflink only its blocks.  Returns SR_SUCCESS if the 
+   track was dropped. */
+static error_code
+link_duplicate (RIP_MANAGER_INFO* rmi, Writer *writer, gchar* new_path, 
+		guint64 content_hash)
+{
+#if defined (WIN32)
+    return SR_ERROR_INVALID_PARAM;
+#else
+    FILELIB_INFO* fli = &rmi->filelib_info;
+    enum DedupMode mode = rmi->prefs->dedup;
+    char old_fn[SR_MAX_PATH];
+    char new_fn[SR_MAX_PATH];
+    int ok = 0;
+
+    if (mode != DEDUP_LINK && mode != DEDUP_REFLINK) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+    if (!dedup_find (content_hash, writer->m_hash.total, 
+		     old_fn, SR_MAX_PATH)) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+    string_from_gstring (rmi, new_fn, SR_MAX_PATH, new_path, 
+			 CODESET_FILESYS);
+
+    if (!strcmp (old_fn, new_fn)) {
+	/* The file to be replaced is the same already */
+	ok = 1;
+    } else {
+	if (file_exists (rmi, new_path)) {
+	    delete_file (rmi, new_path);
+	}
+	if (mode == DEDUP_LINK) {
+	    ok = link (old_fn, new_fn) == 0;
+	}
+#if defined (FICLONE)
+	else {
+	    int src = open (old_fn, O_RDONLY);
+	    int dest = open (new_fn, O_WRONLY | O_CREAT | O_EXCL, 
+			     S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	    if (src >= 0 && dest >= 0) {
+		ok = ioctl (dest, FICLONE, src) == 0;
+	    }
+	    if (dest >= 0) {
+		close (dest);
+		if (!ok) {
+		    unlink (new_fn);
+		}
+	    }
+	    if (src >= 0) {
+		close (src);
+	    }
+	}
+#endif
+    }
+    if (!ok) {
+	debug_printf ("link_duplicate: can't link %s to %s (%d)\n", 
+		      new_fn, old_fn, errno);
+	return SR_ERROR_CANT_CREATE_FILE;
+    }
+
+    debug_printf ("link_duplicate: %s is the same as %s, saved %llu\n", 
+		  new_fn, old_fn, (unsigned long long) writer->m_bytes);
+    if (writer->m_tmpfile) {
+	close_file (&writer->m_file);
+	writer->m_tmpfile = 0;
+    } else {
+	delete_file (rmi, fli->m_incomplete_filename);
+    }
+    dedup_saved (writer->m_bytes);
+    return SR_SUCCESS;
+#endif
+}
+
 static error_code
 filelib_write (FHANDLE fp, char *buf, u_long size)
 {
@@ -1134,6 +2114,73 @@ filelib_write (FHANDLE fp, char *buf, u_long size)
     return SR_SUCCESS;
 }
 
+#if defined (HAVE_COPY_FILE_RANGE)
+/* Copy from in_fp at *in_offset to the current position of out_fp.  
+   Returns the number of bytes copied. */
+static u_long
+filelib_copy_range (FHANDLE in_fp, loff_t *in_offset, FHANDLE out_fp, 
+		    u_long size)
+{
+    u_long done = 0;
+    while (done < size) {
+	ssize_t rc = copy_file_range (in_fp, in_offset, out_fp, NULL, 
+				      size - done, 0);
+	if (rc == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (rc <= 0) {
+	    break;
+	}
+	done += rc;
+    }
+    return done;
+}
+#endif
+
+static error_code
+filelib_writev (FHANDLE fp, char *head, u_long head_size, 
+		char *buf, u_long size)
+{
+#if WIN32
+    error_code rc = filelib_write (fp, head, head_size);
+    if (rc != SR_SUCCESS) {
+	return rc;
+    }
+    return filelib_write (fp, buf, size);
+#else
+    struct iovec iov[2];
+    int i = 0;
+
+    if (!fp) {
+	debug_printf("filelib_writev: fp = 0\n");
+	return SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+    iov[0].iov_base = head;
+    iov[0].iov_len = head_size;
+    iov[1].iov_base = buf;
+    iov[1].iov_len = size;
+    while (i < 2) {
+	ssize_t rc = writev (fp, &iov[i], 2 - i);
+	if (rc == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return SR_ERROR_CANT_WRITE_TO_FILE;
+	}
+	/* Skip what was written, in case of a short write */
+	while (i < 2 && (size_t) rc >= iov[i].iov_len) {
+	    rc -= iov[i].iov_len;
+	    i++;
+	}
+	if (i < 2) {
+	    iov[i].iov_base = (char*) iov[i].iov_base + rc;
+	    iov[i].iov_len -= rc;
+	}
+    }
+    return SR_SUCCESS;
+#endif
+}
+
 /* This function takes in a directory, filename base, and extension, 
    and renames any existing file "${directory}/${fnbase}${extensions}"
    to a file of the form "${directory}/${fnbase} (${n}}${extensions}" 
@@ -1262,17 +2309,25 @@ filelib_open_showfiles (RIP_MANAGER_INFO* rmi)
 {
     FILELIB_INFO* fli = &rmi->filelib_info;
     int rc;
+    u_long buf_size;
     gchar mcue_buf[1024];
     char cue_buf[1024];
     gchar* basename;
     gchar *new_dir, *new_fnbase;
     gchar *new_show_name, *new_cue_name;
-
-    parse_and_subst_pat (rmi, fli->m_show_name, 0, fli->m_showfile_directory, 
-			 fli->m_showfile_pattern, fli->m_extension);
-    parse_and_subst_pat (rmi, fli->m_cue_name, 0, fli->m_showfile_directory, 
-			 fli->m_showfile_pattern, 
-			 m_(".cue"));
+    gchar cue_name[SR_MAX_PATH];
+
+    /* The cue file is named after the show file, so %q and %D are
+       only filled in once */
+    filelib_expand_pattern (rmi, fli->m_show_name, 0, 
+			    fli->m_showfile_directory,
+			    &fli->m_showfile_pat, m_(""));
+    dircache_end_sequence (fli->m_dircache, 1);
+    mstrcpy (cue_name, fli->m_show_name);
+    mstrncat (fli->m_show_name, fli->m_extension,
+	      SR_MAX_PATH - 1 - mstrlen (fli->m_show_name));
+    mstrncat (cue_name, m_(".cue"),
+	      SR_MAX_PATH - 1 - mstrlen (cue_name));
 
     /* Rename previously ripped files with same name */
     new_dir = g_path_get_dirname (fli->m_show_name);
@@ -1294,7 +2349,7 @@ filelib_open_showfiles (RIP_MANAGER_INFO* rmi)
 
     /* Open cue file, write header */
     if (rmi->http_info.content_type != CONTENT_TYPE_OGG) {
-	rc = filelib_open_for_write (rmi, &fli->m_cue_file, fli->m_cue_name);
+	rc = filelib_open_for_write (rmi, &fli->m_cue_file, cue_name);
 	if (rc != SR_SUCCESS) {
 	    fli->m_do_show = 0;
 	    return rc;
@@ -1327,6 +2382,37 @@ filelib_open_showfiles (RIP_MANAGER_INFO* rmi)
 	fli->m_do_show = 0;
 	return rc;
     }
+
+    /* O_DIRECT writes whole aligned blocks out of the buffer */
+    buf_size = fli->m_wbuf_size;
+#if defined (O_DIRECT)
+    if (fli->m_direct_show) {
+	int flags = fcntl (fli->m_show_file, F_GETFL);
+	if (buf_size < FILELIB_DIRECT_MIN_BUF) {
+	    buf_size = FILELIB_DIRECT_MIN_BUF;
+	}
+	buf_size = (buf_size + FILELIB_BLOCK_SIZE - 1) 
+		/ FILELIB_BLOCK_SIZE * FILELIB_BLOCK_SIZE;
+	if (flags == -1 
+	    || fcntl (fli->m_show_file, F_SETFL, flags | O_DIRECT) == -1) {
+	    debug_printf ("Can't write show file with O_DIRECT: %d\n", errno);
+	    fli->m_direct_show = 0;
+	    buf_size = fli->m_wbuf_size;
+	}
+    }
+#endif
+    wbuf_init (&fli->m_show_wbuf, buf_size, 
+	       fli->m_preallocate ? FILELIB_SHOW_PREALLOC : 0);
+    if (rmi->prefs->durability == DURABLE_PERIODIC) {
+	durable_watch (fli->m_show_file);
+    }
+    if (fli->m_direct_show) {
+	if (fli->m_show_wbuf.size) {
+	    fli->m_show_wbuf.direct = 1;
+	} else {
+	    clear_direct (fli->m_show_file);
+	}
+    }
     return rc;
 }
 
@@ -1337,7 +2423,7 @@ trim_filename (RIP_MANAGER_INFO* rmi, gchar* out, gchar *filename)
     FILELIB_INFO* fli = &rmi->filelib_info;
     long maxlen = fli->m_max_filename_length;
     mstrncpy (out, filename, MAX_TRACK_LEN);
-    replace_invalid_chars (out);
+    filelib_replace_invalid_chars (out);
     out[maxlen-4] = 0;	// -4 = make room for ".mp3"
 }
 
@@ -1358,16 +2444,12 @@ trim_mp3_suffix (RIP_MANAGER_INFO* rmi, gchar *filename)
 static int
 get_next_sequence_number (RIP_MANAGER_INFO* rmi, gchar* fn_base)
 {
-    int rc;
     int di = 0;
     int edi = 0;
-    int seq;
     gchar dir_name[SR_MAX_PATH];
     gchar fn_prefix[SR_MAX_PATH];
     char dname[SR_MAX_PATH];
     char fnp[SR_MAX_PATH];
-    DIR* dp;
-    struct dirent* de;
 
     /* Get directory from fn_base */
     while (fn_base[di]) {
@@ -1383,62 +2465,13 @@ get_next_sequence_number (RIP_MANAGER_INFO* rmi, gchar* fn_base)
     fn_prefix[0] = 0;
     mstrcpy (fn_prefix, &fn_base[edi+1]);
 
-    rc = string_from_gstring (rmi, dname, SR_MAX_PATH, dir_name, CODESET_FILESYS);
-    rc = string_from_gstring (rmi, fnp, SR_MAX_PATH, fn_prefix, CODESET_FILESYS);
+    string_from_gstring (rmi, dname, SR_MAX_PATH, dir_name, CODESET_FILESYS);
+    string_from_gstring (rmi, fnp, SR_MAX_PATH, fn_prefix, CODESET_FILESYS);
 
-    /* Look through directory for a filenames that match prefix */
-    if ((dp = opendir (dname)) == 0) {
-	return 0;
-    }
-    seq = 0;
-    while ((de = readdir (dp)) != 0) {
-	if (strncmp(de->d_name, fnp, strlen(fnp)) == 0) {
-	    if (isdigit(de->d_name[strlen(fnp)])) {
-		int this_seq = atoi(&de->d_name[strlen(fnp)]);
-		if (seq <= this_seq) {
-		    seq = this_seq + 1;
-		}
-	    }
-	}
-    }
-    closedir (dp);
-    return seq;
-}
-
-static gchar* 
-replace_invalid_chars (gchar *str)
-{
-    gchar invalid_chars[] = m_("\\/:*?\"<>|~");
-    gchar replacement = m_('-');
-
-    gchar *oldstr = str;
-    gchar *newstr = str;
-
-    if (!str) return NULL;
-
-    /* Skip leading "." */
-    for (;*oldstr; oldstr++) {
-	if (*oldstr != '.') {
-	    break;
-	}
-    }
-
-    for (;*oldstr; oldstr++) {
-	if (g_ascii_iscntrl (*oldstr)) {
-	    /* Do nothing -- skip control characters without replacement */
-	}
-	else if (mstrchr(invalid_chars, *oldstr) == NULL) {
-	    /* Ordinary case -- copy */
-	    *newstr++ = *oldstr;
-	}
-	else {
-	    /* Replace case -- append replacement char */
-	    *newstr++ = replacement;
-	}
-    }
-    *newstr = '\0';
-
-    return str;
+    /* The directory is read the first time a prefix is seen, and the 
+       numbers are counted up after that */
+    return dircache_next_sequence (rmi->filelib_info.m_dircache, 
+				   dname, fnp);
 }
 
 static void
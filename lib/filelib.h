@@ -32,6 +32,15 @@
 #define PATH_SLASH_STR m_("/")
 #endif
 
+/* Copies out of the show file are reflinked in blocks of this size */
+#define FILELIB_BLOCK_SIZE 4096
+
+/* The show file is preallocated this much at a time */
+#define FILELIB_SHOW_PREALLOC (64 * 1024 * 1024)
+
+/* Smallest buffer of a show file written with O_DIRECT */
+#define FILELIB_DIRECT_MIN_BUF (1024 * 1024)
+
 
 /* Pathname support.
    Copyright (C) 1995-1999, 2000-2003 Free Software Foundation, Inc.
@@ -83,12 +92,21 @@ filelib_init (RIP_MANAGER_INFO* rmi,
 	      int get_date_stamp,
 	      char* icy_name);
 error_code
-filelib_start (RIP_MANAGER_INFO* rmi, Writer *writer, TRACK_INFO* ti);
+filelib_start (RIP_MANAGER_INFO* rmi, Writer *writer, Track_record* ti);
 error_code
 filelib_write_track (Writer *writer, char *buf, u_long size);
 error_code
-filelib_write_show (RIP_MANAGER_INFO* rmi, char *buf, u_long size);
-error_code filelib_write_cue (RIP_MANAGER_INFO* rmi, TRACK_INFO* ti, int secs);
+filelib_write_tag (Writer *writer, char *buf, u_long size);
+error_code
+filelib_writev_track (Writer *writer, char *head, u_long head_size, 
+		      char *buf, u_long size);
+int filelib_can_copy_show (RIP_MANAGER_INFO* rmi);
+guint64 filelib_get_show_offset (RIP_MANAGER_INFO* rmi);
+error_code
+filelib_copy_show_to_track (RIP_MANAGER_INFO* rmi, Writer *writer, 
+			    guint64 show_offset, char *buf, u_long size, 
+			    u_long *copied);
+error_code filelib_add_sinks (RIP_MANAGER_INFO* rmi);
 error_code
 filelib_close (
     RIP_MANAGER_INFO* rmi,
@@ -98,6 +116,19 @@ error_code
 filelib_rename_to_complete (
     RIP_MANAGER_INFO* rmi,
     Writer *writer);
+void filelib_abandon (RIP_MANAGER_INFO* rmi, Writer *writer);
 void filelib_shutdown (RIP_MANAGER_INFO* rmi);
+gchar* filelib_replace_invalid_chars (gchar *str);
+void
+filelib_compile_pattern (RIP_MANAGER_INFO* rmi, Filelib_pattern* fp,
+			 gchar* pattern, int is_for_showfile);
+void
+filelib_expand_pattern (RIP_MANAGER_INFO* rmi,
+			gchar* newfile,
+			Track_record* ti,
+			gchar* directory,
+			Filelib_pattern* fp,
+			gchar* extension);
+void filelib_free_pattern (Filelib_pattern* fp);
 
 #endif //FILELIB
@@ -615,3 +615,187 @@ header_get_bitrate (void *data, struct mad_header const *pheader)
     debug_printf ("Decoded bitrate from stream: %ld\n", gbs->bitrate);
     return MAD_FLOW_STOP;
 }
+
+/* The following routines parse mp3 frame headers without decoding, 
+ * so the frames and their duration can be counted for each chunk 
+ * as it arrives.
+ */
+static const int m_mp3_bitrates[2][3][16] = {
+    {   /* MPEG 1 */
+	{0,32,64,96,128,160,192,224,256,288,320,352,384,416,448,0},
+	{0,32,48,56,64,80,96,112,128,160,192,224,256,320,384,0},
+	{0,32,40,48,56,64,80,96,112,128,160,192,224,256,320,0}
+    },
+    {   /* MPEG 2 & 2.5 */
+	{0,32,48,56,64,80,96,112,128,144,160,176,192,224,256,0},
+	{0,8,16,24,32,40,48,56,64,80,96,112,128,144,160,0},
+	{0,8,16,24,32,40,48,56,64,80,96,112,128,144,160,0}
+    }
+};
+
+static const int m_mp3_samplerates[4][3] = {
+    {11025,12000,8000},		/* MPEG 2.5 */
+    {0,0,0},			/* reserved */
+    {22050,24000,16000},	/* MPEG 2 */
+    {44100,48000,32000}		/* MPEG 1 */
+};
+
+/* Return the frame length in bytes if hdr is a valid frame header, 
+   or zero if not */
+static u_long
+mp3_frame_header (const unsigned char* hdr, u_long* samples, 
+		  u_long* samplerate, u_long* bitrate)
+{
+    int version, layer, br_idx, sr_idx, padding;
+    int lsf;
+    u_long br, sr;
+
+    if (hdr[0] != 0xff || (hdr[1] & 0xe0) != 0xe0) return 0;
+    version = (hdr[1] >> 3) & 0x03;
+    layer = 4 - ((hdr[1] >> 1) & 0x03);
+    br_idx = (hdr[2] >> 4) & 0x0f;
+    sr_idx = (hdr[2] >> 2) & 0x03;
+    padding = (hdr[2] >> 1) & 0x01;
+    if (version == 1 || layer == 4 || br_idx == 0 || br_idx == 15 
+	|| sr_idx == 3) {
+	return 0;
+    }
+
+    lsf = (version != 3);
+    br = m_mp3_bitrates[lsf][layer-1][br_idx];
+    sr = m_mp3_samplerates[version][sr_idx];
+    *samplerate = sr;
+    *bitrate = br;
+    if (layer == 1) {
+	*samples = 384;
+	return (12 * br * 1000 / sr + padding) * 4;
+    }
+    if (layer == 3 && lsf) {
+	*samples = 576;
+	return 72 * br * 1000 / sr + padding;
+    }
+    *samples = 1152;
+    return 144 * br * 1000 / sr + padding;
+}
+
+static void
+mp3_scan_add_frame (Mp3_scan* scan, u_long frame_len, u_long samples, 
+		    u_long samplerate, u_long bitrate)
+{
+    scan->frames++;
+    scan->bytes += frame_len;
+    scan->time_us += (guint64) samples * 1000000 / samplerate;
+    scan->samplerate = samplerate;
+    scan->bitrate = bitrate;
+}
+
+/* Forget a frame in progress.  Used when the data which follows 
+   comes from a new connection, and the next frame header has to be 
+   searched for. */
+void
+mp3_scan_resync (Mp3_scan* scan)
+{
+    scan->skip = 0;
+    scan->partial_len = 0;
+}
+
+/* Return the offset of the first frame header in the buffer, or -1 
+   if there is none.  A header is only taken if another one follows 
+   where its frame ends, or if the frame runs past the end of the 
+   buffer, so that a stray sync word in the audio is not mistaken for 
+   a frame. */
+long
+find_frame_start (const char* mpgbuf, long mpgsize)
+{
+    const unsigned char* buf = (const unsigned char*) mpgbuf;
+    u_long frame_len, samples, samplerate, bitrate;
+    long pos;
+
+    for (pos = 0; pos + 4 <= mpgsize; pos++) {
+	frame_len = mp3_frame_header (&buf[pos], &samples, &samplerate, 
+				      &bitrate);
+	if (!frame_len) {
+	    continue;
+	}
+	if (pos + (long) frame_len + 4 > mpgsize) {
+	    return pos;
+	}
+	if (mp3_frame_header (&buf[pos + frame_len], &samples, 
+			      &samplerate, &bitrate)) {
+	    return pos;
+	}
+    }
+    return -1;
+}
+
+/* Count the frames which start in this chunk, and their decoded 
+   duration.  Frames may span chunks; the scan state keeps track 
+   of this.  If the stream is not mp3, no frames are found. */
+error_code
+find_frames (Mp3_scan* scan, const char* mpgbuf, long mpgsize, 
+	     u_long* frames, u_long* duration_ms)
+{
+    const unsigned char* buf = (const unsigned char*) mpgbuf;
+    u_long frames_before = scan->frames;
+    guint64 time_us_before = scan->time_us;
+    u_long frame_len, samples, samplerate, bitrate;
+    long pos = 0;
+
+    /* Finish a header which was split by the end of the last chunk */
+    if (scan->partial_len > 0) {
+	unsigned char hdr[4];
+	int i;
+	for (i = 0; i < 4; i++) {
+	    if (i < scan->partial_len) {
+		hdr[i] = scan->partial[i];
+	    } else if (i - scan->partial_len < mpgsize) {
+		hdr[i] = buf[i - scan->partial_len];
+	    } else {
+		hdr[i] = 0;
+	    }
+	}
+	frame_len = mp3_frame_header (hdr, &samples, &samplerate, &bitrate);
+	if (frame_len) {
+	    mp3_scan_add_frame (scan, frame_len, samples, samplerate, bitrate);
+	    scan->skip = frame_len - scan->partial_len;
+	}
+	scan->partial_len = 0;
+    }
+
+    /* Skip the rest of a frame which started in an earlier chunk */
+    if (scan->skip >= (u_long) mpgsize) {
+	scan->skip -= mpgsize;
+	pos = mpgsize;
+    } else {
+	pos = scan->skip;
+	scan->skip = 0;
+    }
+
+    while (pos < mpgsize) {
+	if (pos + 4 > mpgsize) {
+	    /* Keep the start of the header for the next chunk */
+	    if (buf[pos] == 0xff) {
+		scan->partial_len = mpgsize - pos;
+		memcpy (scan->partial, &buf[pos], scan->partial_len);
+	    }
+	    break;
+	}
+	frame_len = mp3_frame_header (&buf[pos], &samples, &samplerate, 
+				      &bitrate);
+	if (!frame_len) {
+	    /* Lost sync, so search for the next header */
+	    pos++;
+	    continue;
+	}
+	mp3_scan_add_frame (scan, frame_len, samples, samplerate, bitrate);
+	if (pos + frame_len > (u_long) mpgsize) {
+	    scan->skip = pos + frame_len - mpgsize;
+	    break;
+	}
+	pos += frame_len;
+    }
+
+    *frames = scan->frames - frames_before;
+    *duration_ms = (u_long) (scan->time_us / 1000 - time_us_before / 1000);
+    return SR_SUCCESS;
+}
@@ -45,5 +45,10 @@ findsep_silence_2 (const char* mpgbuf,
 		 );
 error_code
 find_bitrate (unsigned long* bitrate, const char* mpgbuf, long mpgsize);
+error_code
+find_frames (Mp3_scan* scan, const char* mpgbuf, long mpgsize, 
+	     u_long* frames, u_long* duration_ms);
+void mp3_scan_resync (Mp3_scan* scan);
+long find_frame_start (const char* mpgbuf, long mpgsize);
 
 #endif //__FINDSEP_H__
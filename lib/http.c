@@ -21,8 +21,76 @@
 #include "socklib.h"
 #include "http.h"
 #include "mchar.h"  /* for substrn_until, etc. */
+#include "threadlib.h"
+#include "connsched.h"
 #include "debug.h"
 
+/******************************************************************************
+ * Private defines
+ *****************************************************************************/
+/* Mirror racing: how many pls entries are tried, how long each may 
+   take to connect (in seconds), and how long and how much they are 
+   read before the best one is chosen */
+#define HTTP_MAX_MIRRORS 8
+#define MIRROR_CONNECT_TIMEOUT 5
+#define MIRROR_PROBE_MS 3000
+#define MIRROR_PROBE_BYTES (128 * 1024)
+
+/******************************************************************************
+ * Private types
+ *****************************************************************************/
+/* Header fields recognized by http_scan_header() */
+enum {
+    HF_LOCATION,
+    HF_SERVER,
+    HF_CONTENT_TYPE,
+    HF_ICY_NAME,
+    HF_ICE_NAME,
+    HF_ICY_URL,
+    HF_ICE_URL,
+    HF_ICY_GENRE,
+    HF_ICE_GENRE,
+    HF_ICY_BR,
+    HF_ICY_METAINT,
+    HF_ICY_NOTICE1,
+    HF_ICY_NOTICE2,
+    HF_XA_SERVER_URL,
+    HF_XA_NAME,
+    HF_XA_GENRE,
+    HF_XA_BITRATE,
+    HF_NUM_FIELDS
+};
+
+/* A piece of the header buffer, not null terminated */
+typedef struct http_slice {
+    const char *ptr;
+    int len;
+} Http_slice;
+
+typedef struct http_fields {
+    Http_slice status;
+    Http_slice field[HF_NUM_FIELDS];
+} Http_fields;
+
+/* Stream urls listed in a pls, in the order of the file */
+typedef struct http_mirrors {
+    int num;
+    char url[HTTP_MAX_MIRRORS][MAX_HOST_LEN];
+} Http_mirrors;
+
+/* One mirror of a race, connected and probed by its own thread */
+typedef struct http_mirror_try {
+    RIP_MANAGER_INFO *rmi;
+    char *url;
+    const char *proxyurl;
+    char *useragent;
+    char *if_name;
+    HSOCKET sock;
+    Socklib_probe probe;
+    THREAD_HANDLE thread;
+    error_code ret;
+} Http_mirror_try;
+
 /******************************************************************************
  * Function prototypes
  *****************************************************************************/
@@ -30,14 +98,38 @@ static char* make_auth_header(const char *header_name,
 			      const char *username, const char *password);
 static char* b64enc(const char *buf, int size);
 static error_code
-http_get_pls (RIP_MANAGER_INFO* rmi, HSOCKET *sock, SR_HTTP_HEADER *info);
+http_sc_follow (RIP_MANAGER_INFO* rmi, HSOCKET *sock, const char *url, 
+		const char *proxyurl, SR_HTTP_HEADER *info, 
+		char *useragent, char *if_name, char *final_url, 
+		int *num_mirrors);
+static error_code
+http_open_request (RIP_MANAGER_INFO* rmi, HSOCKET *sock, const char *url, 
+		   const char *proxyurl, char *useragent, char *if_name, 
+		   int timeout);
+static error_code
+http_race_mirrors (RIP_MANAGER_INFO* rmi, HSOCKET *sock, 
+		   Http_mirrors *mirrors, const char *proxyurl, 
+		   SR_HTTP_HEADER *info, char *useragent, char *if_name, 
+		   char *location, int *num_mirrors);
+static void http_mirror_thread (void *arg);
+static int http_probe_better (Socklib_probe *a, Socklib_probe *b);
+static error_code
+http_get_pls (RIP_MANAGER_INFO* rmi, HSOCKET *sock, SR_HTTP_HEADER *info, 
+	      Http_mirrors *mirrors);
 static error_code
 http_get_m3u (RIP_MANAGER_INFO* rmi, HSOCKET *sock, SR_HTTP_HEADER *info);
 static error_code
 http_get_sc_header(RIP_MANAGER_INFO* rmi, const char* url, 
-		   HSOCKET *sock, SR_HTTP_HEADER *info);
+		   HSOCKET *sock, SR_HTTP_HEADER *info, Http_mirrors *mirrors);
 static error_code
 http_parse_url(const char *url, URLINFO *urlinfo);
+static void http_scan_header (const char *header, Http_fields *hf);
+static int http_field_id (const char *name, int len);
+static const char* slice_find (Http_slice *slice, const char *needle);
+static int slice_to_int (Http_slice *slice);
+static char* slice_strdup (Http_slice *slice);
+static const char* http_guess_server (Http_fields *hf, const char *needle, 
+				      char *valbuf, int size);
 
 /******************************************************************************
  * Private Vars
@@ -45,78 +137,530 @@ http_parse_url(const char *url, URLINFO *urlinfo);
 #define MAX_PLS_LEN 8192
 #define MAX_M3U_LEN 8192
 
+/* How long to reconnect straight to the stream found last time */
+#define ENDPOINT_TTL_MS (30 * 60 * 1000)
+
+/* Playlists and redirects followed before giving up, so a cycle 
+   doesn't hang the connect */
+#define MAX_REDIRECTS 8
+
+
 
 /******************************************************************************
  * Public functions
  *****************************************************************************/
 /* Connect to a shoutcast type stream, leaves when it's about to 
-   get the header info */
+   get the header info.  The stream URL found at the end of the 
+   playlists and redirects is remembered, and later connects go 
+   straight to it until it expires or fails. */
 error_code
 http_sc_connect (RIP_MANAGER_INFO* rmi,
 		 HSOCKET *sock, const char *url, const char *proxyurl, 
 		 SR_HTTP_HEADER *info, char *useragent, char *if_name)
 {
-    char headbuf[MAX_HEADER_LEN];
-    URLINFO url_info;
     int ret;
 
-    while (1) {
-	debug_printf ("***** URL = %s *****\n", url);
-	debug_printf("http_sc_connect(): calling http_parse_url\n");
-	if (proxyurl) {
-	    debug_printf ("***** PROXY = %s *****\n", proxyurl);
-	    if ((ret = http_parse_url (proxyurl, &url_info)) != SR_SUCCESS) {
-		return ret;
-	    }
-	} else if ((ret = http_parse_url (url, &url_info)) != SR_SUCCESS) {
-	    return ret;
+    if (rmi->endpoint_url[0] && strcmp (rmi->endpoint_url, url)
+	&& threadlib_monotonic_ms () < rmi->endpoint_expires_ms) {
+	debug_printf ("http_sc_connect(): trying cached endpoint %s\n",
+		      rmi->endpoint_url);
+	ret = http_sc_follow (rmi, sock, rmi->endpoint_url, proxyurl, info, 
+			      useragent, if_name, rmi->endpoint_url, 
+			      &rmi->num_mirrors);
+	if (ret == SR_SUCCESS) {
+	    return SR_SUCCESS;
 	}
+	debug_printf ("http_sc_connect(): cached endpoint failed (%d)\n", ret);
+	if (!sock->closed) {
+	    socklib_close (sock);
+	}
+    }
 
-	debug_printf("http_sc_connect(): calling socklib_init\n");
-	if ((ret = socklib_init()) != SR_SUCCESS)
-	    return ret;
+    rmi->endpoint_url[0] = 0;
+    rmi->num_mirrors = 0;
+    ret = http_sc_follow (rmi, sock, url, proxyurl, info, useragent, 
+			  if_name, rmi->endpoint_url, &rmi->num_mirrors);
+    if (ret != SR_SUCCESS) {
+	rmi->endpoint_url[0] = 0;
+	return ret;
+    }
+    rmi->endpoint_expires_ms = threadlib_monotonic_ms () + ENDPOINT_TTL_MS;
+    return SR_SUCCESS;
+}
+
+/* Open a second connection to url, which the caller copied from 
+   the stream found by the last http_sc_connect().  This runs in the 
+   standby thread, so it leaves the cached endpoint and the mirror 
+   count of rmi alone. */
+error_code
+http_sc_connect_standby (RIP_MANAGER_INFO* rmi, HSOCKET *sock, 
+			 const char *url, const char *proxyurl, 
+			 SR_HTTP_HEADER *info)
+{
+    char final_url[MAX_URL_LEN];
+    int num_mirrors = 0;
+
+    return http_sc_follow (rmi, sock, url, proxyurl, info, 
+			   rmi->prefs->useragent, rmi->prefs->if_name, 
+			   final_url, &num_mirrors);
+}
+
+/******************************************************************************
+ * Private functions
+ *****************************************************************************/
+/* Connect to url, following playlists and redirects.  The url of 
+   the stream which was finally connected is copied to final_url, 
+   which may be the same buffer as url.  If mirrors were raced, 
+   num_mirrors is set to how many could be probed. */
+static error_code
+http_sc_follow (RIP_MANAGER_INFO* rmi, HSOCKET *sock, const char *url, 
+		const char *proxyurl, SR_HTTP_HEADER *info, 
+		char *useragent, char *if_name, char *final_url, 
+		int *num_mirrors)
+{
+    char location[MAX_URL_LEN];
+    Http_mirrors mirrors;
+    int redirects = 0;
+    int ret;
 
-	debug_printf ("http_sc_connect(): calling socklib_open"
-		      " host=%s, port=%d\n", url_info.host, url_info.port);
-	ret = socklib_open (sock, url_info.host, url_info.port, if_name, 
-			    rmi->prefs->timeout);
+    sr_strncpy (location, (char*) url, MAX_URL_LEN);
+    while (1) {
+	ret = http_open_request (rmi, sock, location, proxyurl, useragent, 
+				 if_name, rmi->prefs->timeout);
 	if (ret != SR_SUCCESS) {
 	    return ret;
 	}
 
-	debug_printf("http_sc_connect(): calling http_construct_sc_request\n");
-	ret = http_construct_sc_request (url, proxyurl, headbuf, useragent);
-	if (ret != SR_SUCCESS) {
+	debug_printf("http_sc_connect(): calling http_get_sc_header\n");
+	mirrors.num = 0;
+	ret = http_get_sc_header (rmi, location, sock, info, &mirrors);
+	if (ret != SR_SUCCESS)
 	    return ret;
+
+	if (!*info->http_location) {
+	    break;
 	}
+	socklib_close (sock);
 
-	debug_printf("http_sc_connect(): calling socklib_sendall\n");
-	ret = socklib_sendall (sock, headbuf, strlen(headbuf));
-	if (ret < 0) {
-	    return ret;
+	if (mirrors.num > 1 && rmi->prefs->race_mirrors > 1) {
+	    ret = http_race_mirrors (rmi, sock, &mirrors, proxyurl, info, 
+				     useragent, if_name, location, 
+				     num_mirrors);
+	    if (ret != SR_SUCCESS) {
+		return ret;
+	    }
+	    if (!*info->http_location) {
+		break;
+	    }
+	    socklib_close (sock);
+	}
+	if (++redirects > MAX_REDIRECTS) {
+	    debug_printf ("Too many redirects, last was to %s\n", 
+			  info->http_location);
+	    return SR_ERROR_TOO_MANY_REDIRECTS;
 	}
+	debug_printf ("Redirecting: %s\n", info->http_location);
+	sr_strncpy (location, info->http_location, MAX_URL_LEN);
+    }
 
-	debug_printf("http_sc_connect(): calling http_get_sc_header\n");
-	if ((ret = http_get_sc_header(rmi, url, sock, info)) != SR_SUCCESS)
+    sr_strncpy (final_url, location, MAX_URL_LEN);
+    return SR_SUCCESS;
+}
+
+/* Connect to the server of url (or the proxy), and send the request 
+   for url.  timeout is the connect timeout in seconds. */
+static error_code
+http_open_request (RIP_MANAGER_INFO* rmi, HSOCKET *sock, const char *url, 
+		   const char *proxyurl, char *useragent, char *if_name, 
+		   int timeout)
+{
+    char headbuf[MAX_HEADER_LEN];
+    URLINFO url_info;
+    Socklib_opts opts;
+    int abort_fd = -1;
+    int ret;
+
+    debug_printf ("***** URL = %s *****\n", url);
+    debug_printf("http_sc_connect(): calling http_parse_url\n");
+    if (proxyurl) {
+	debug_printf ("***** PROXY = %s *****\n", proxyurl);
+	if ((ret = http_parse_url (proxyurl, &url_info)) != SR_SUCCESS) {
 	    return ret;
+	}
+    } else if ((ret = http_parse_url (url, &url_info)) != SR_SUCCESS) {
+	return ret;
+    }
 
-	if (*info->http_location) {
-	    /* RECURSIVE CASE */
-	    debug_printf ("Redirecting: %s\n", info->http_location);
-	    url = info->http_location;
-	    return http_sc_connect (rmi, sock, info->http_location, 
-				    proxyurl, info, useragent, if_name);
-	} else {
+    debug_printf("http_sc_connect(): calling socklib_init\n");
+    if ((ret = socklib_init()) != SR_SUCCESS)
+	return ret;
+
+    debug_printf ("http_sc_connect(): calling socklib_open"
+		  " host=%s, port=%d\n", url_info.host, url_info.port);
+    ret = connsched_acquire (rmi, url_info.host);
+    if (ret != SR_SUCCESS) {
+	return ret;
+    }
+    socklib_profile_opts (rmi, 0, &opts);
+#if __UNIX__
+    abort_fd = rmi->abort_pipe[0];
+#endif
+    ret = socklib_open (sock, url_info.host, url_info.port, if_name, 
+			timeout, &opts, abort_fd);
+    connsched_release (url_info.host);
+    if (ret != SR_SUCCESS) {
+	return ret;
+    }
+    socklib_debug_opts ("Stream", &opts);
+    if (sock == &rmi->stream_sock) {
+	rmi->stream_sockopts = opts;
+    }
+
+    debug_printf("http_sc_connect(): calling http_construct_sc_request\n");
+    ret = http_construct_sc_request (url, proxyurl, headbuf, useragent);
+    if (ret != SR_SUCCESS) {
+	return ret;
+    }
+
+    debug_printf("http_sc_connect(): calling socklib_sendall\n");
+    ret = socklib_sendall (sock, headbuf, strlen(headbuf));
+    if (ret < 0) {
+	return ret;
+    }
+    return SR_SUCCESS;
+}
+
+/* Open up to prefs->race_mirrors of the pls entries at once, each 
+   in its own thread, and read from each of them for MIRROR_PROBE_MS 
+   after its request was sent.  The one which delivered fastest is 
+   kept in sock, with its header parsed into info and the probed 
+   bytes put back for the stream reader.  If its header can't be 
+   used, the next best is tried.  The url of the winner is copied 
+   to location, and the number of mirrors probed to num_mirrors. */
+static error_code
+http_race_mirrors (RIP_MANAGER_INFO* rmi, HSOCKET *sock, 
+		   Http_mirrors *mirrors, const char *proxyurl, 
+		   SR_HTTP_HEADER *info, char *useragent, char *if_name, 
+		   char *location, int *num_mirrors)
+{
+    Http_mirror_try tries[HTTP_MAX_MIRRORS];
+    int num_tries, num_started = 0, num_probes = 0;
+    int i, best;
+    error_code ret = SR_SUCCESS;
+
+    num_tries = mirrors->num;
+    if (num_tries > (int) rmi->prefs->race_mirrors) {
+	num_tries = rmi->prefs->race_mirrors;
+    }
+    for (i = 0; i < num_tries; i++) {
+	Http_mirror_try *t = &tries[num_started];
+	memset (t, 0, sizeof(Http_mirror_try));
+	t->rmi = rmi;
+	t->url = mirrors->url[i];
+	t->proxyurl = proxyurl;
+	t->useragent = useragent;
+	t->if_name = if_name;
+	t->sock.closed = TRUE;
+	t->probe.sock = &t->sock;
+	t->probe.size = MIRROR_PROBE_BYTES;
+	t->probe.buffer = (char*) malloc (t->probe.size);
+	if (!t->probe.buffer) {
+	    continue;
+	}
+	if (threadlib_beginthread (&t->thread, http_mirror_thread, t)
+	    != SR_SUCCESS) {
+	    free (t->probe.buffer);
+	    continue;
+	}
+	num_started++;
+    }
+    for (i = 0; i < num_started; i++) {
+	Http_mirror_try *t = &tries[i];
+	threadlib_waitforclose (&t->thread);
+	if (t->ret == SR_ERROR_ABORT_PIPE_SIGNALLED) {
+	    ret = t->ret;
+	}
+	if (t->ret != SR_SUCCESS) {
+	    debug_printf ("MIRROR: %s failed (%d)\n", t->url, t->ret);
+	    continue;
+	}
+	num_probes++;
+	debug_printf ("MIRROR: %s first byte %d ms, %d bytes in %d ms\n",
+		      t->url, t->probe.len 
+		      ? (int) (t->probe.first_byte_ms - t->probe.start_ms) 
+		      : -1, t->probe.len, t->probe.len 
+		      ? (int) (t->probe.last_byte_ms - t->probe.start_ms) 
+		      : -1);
+    }
+    if (ret == SR_SUCCESS && num_probes == 0) {
+	ret = SR_ERROR_CONNECT_FAILED;
+    }
+    *num_mirrors = num_probes;
+
+    /* Try the candidates from best to worst */
+    while (ret == SR_SUCCESS) {
+	Http_mirror_try *t;
+	best = -1;
+	for (i = 0; i < num_started; i++) {
+	    t = &tries[i];
+	    if (t->ret != SR_SUCCESS || !t->probe.buffer || t->probe.len == 0) {
+		continue;
+	    }
+	    if (best < 0 || http_probe_better (&t->probe, &tries[best].probe)) {
+		best = i;
+	    }
+	}
+	if (best < 0) {
+	    ret = SR_ERROR_CONNECT_FAILED;
 	    break;
 	}
+
+	t = &tries[best];
+	debug_printf ("MIRROR: trying %s\n", t->url);
+	ret = socklib_unread (&t->sock, t->probe.buffer, t->probe.len);
+	if (ret == SR_SUCCESS) {
+	    ret = http_get_sc_header (rmi, t->url, &t->sock, info, 0);
+	}
+	free (t->probe.buffer);
+	t->probe.buffer = 0;
+	if (ret == SR_SUCCESS) {
+	    *sock = t->sock;
+	    t->sock.closed = TRUE;
+	    sr_strncpy (location, t->url, MAX_URL_LEN);
+	    break;
+	}
+	socklib_close (&t->sock);
+	if (ret == SR_ERROR_CANT_ALLOC_MEMORY) {
+	    break;
+	}
+	ret = SR_SUCCESS;
     }
 
-    return SR_SUCCESS;
+    for (i = 0; i < num_started; i++) {
+	if (tries[i].probe.buffer) {
+	    free (tries[i].probe.buffer);
+	}
+	if (!tries[i].sock.closed) {
+	    socklib_close (&tries[i].sock);
+	}
+    }
+    return ret;
+}
+
+/* Connect to one mirror of a race and probe it.  The probe times 
+   count from when this mirror's request was sent, so a mirror isn't 
+   penalized for connecting later than the others. */
+static void
+http_mirror_thread (void *arg)
+{
+    Http_mirror_try *t = (Http_mirror_try*) arg;
+
+    t->ret = http_open_request (t->rmi, &t->sock, t->url, t->proxyurl, 
+				t->useragent, t->if_name, 
+				MIRROR_CONNECT_TIMEOUT);
+    if (t->ret != SR_SUCCESS) {
+	if (!t->sock.closed) {
+	    socklib_close (&t->sock);
+	}
+	return;
+    }
+    t->probe.start_ms = threadlib_monotonic_ms ();
+    t->ret = socklib_probe_recv (t->rmi, &t->probe, 1, MIRROR_PROBE_MS);
+}
+
+/* Return 1 if probe a delivered faster than probe b.  Probes which 
+   filled their buffer are compared by how long they took, the rest 
+   by bytes received.  Ties go to the earlier first byte.  Times are 
+   counted from each probe's own request. */
+static int
+http_probe_better (Socklib_probe *a, Socklib_probe *b)
+{
+    int a_full = (a->len == a->size);
+    int b_full = (b->len == b->size);
+    guint64 a_last = a->last_byte_ms - a->start_ms;
+    guint64 b_last = b->last_byte_ms - b->start_ms;
+
+    if (a_full != b_full) {
+	return a_full;
+    }
+    if (a_full && a_last != b_last) {
+	return a_last < b_last;
+    }
+    if (!a_full && a->len != b->len) {
+	return a->len > b->len;
+    }
+    return a->first_byte_ms - a->start_ms < b->first_byte_ms - b->start_ms;
+}
+
+/* Walk the header once.  The status line and the value of each 
+   recognized field are recorded as slices of the header, trimmed of 
+   whitespace.  If a field is repeated, the first one is kept. */
+static void
+http_scan_header (const char *header, Http_fields *hf)
+{
+    const char *line = header;
+
+    memset (hf, 0, sizeof(Http_fields));
+    while (*line) {
+	const char *eol = strchr (line, '\n');
+	const char *colon;
+
+	if (!eol) {
+	    eol = line + strlen (line);
+	}
+	if (!hf->status.ptr) {
+	    if (!strncmp (line, "ICY ", 4) || !strncmp (line, "HTTP/1.", 7)) {
+		hf->status.ptr = line;
+		hf->status.len = eol - line;
+	    }
+	} else if ((colon = memchr (line, ':', eol - line)) != 0) {
+	    int id = http_field_id (line, colon - line);
+	    if (id >= 0 && !hf->field[id].ptr) {
+		const char *p = colon + 1;
+		const char *end = eol;
+		while (p < end && (*p == ' ' || *p == '\t')) {
+		    p++;
+		}
+		while (end > p && isspace ((unsigned char) end[-1])) {
+		    end--;
+		}
+		hf->field[id].ptr = p;
+		hf->field[id].len = end - p;
+	    }
+	}
+	if (!*eol) {
+	    break;
+	}
+	line = eol + 1;
+    }
+}
+
+/* Map a field name to HF_*, or -1 if not recognized.  Names are 
+   case insensitive.  The switch on length means at most three 
+   names are compared. */
+static int
+http_field_id (const char *name, int len)
+{
+#define FIELD_IS(s) (g_ascii_strncasecmp (name, s, len) == 0)
+    switch (len) {
+    case 6:
+	if (FIELD_IS ("server")) return HF_SERVER;
+	if (FIELD_IS ("icy-br")) return HF_ICY_BR;
+	break;
+    case 7:
+	if (FIELD_IS ("icy-url")) return HF_ICY_URL;
+	if (FIELD_IS ("ice-url")) return HF_ICE_URL;
+	break;
+    case 8:
+	if (FIELD_IS ("location")) return HF_LOCATION;
+	if (FIELD_IS ("icy-name")) return HF_ICY_NAME;
+	if (FIELD_IS ("ice-name")) return HF_ICE_NAME;
+	break;
+    case 9:
+	if (FIELD_IS ("icy-genre")) return HF_ICY_GENRE;
+	if (FIELD_IS ("ice-genre")) return HF_ICE_GENRE;
+	break;
+    case 11:
+	if (FIELD_IS ("icy-metaint")) return HF_ICY_METAINT;
+	if (FIELD_IS ("icy-notice1")) return HF_ICY_NOTICE1;
+	if (FIELD_IS ("icy-notice2")) return HF_ICY_NOTICE2;
+	break;
+    case 12:
+	if (FIELD_IS ("content-type")) return HF_CONTENT_TYPE;
+	break;
+    case 16:
+	if (FIELD_IS ("x-audiocast-name")) return HF_XA_NAME;
+	break;
+    case 17:
+	if (FIELD_IS ("x-audiocast-genre")) return HF_XA_GENRE;
+	break;
+    case 19:
+	if (FIELD_IS ("x-audiocast-bitrate")) return HF_XA_BITRATE;
+	break;
+    case 22:
+	if (FIELD_IS ("x-audiocast-server-url")) return HF_XA_SERVER_URL;
+	break;
+    }
+    return -1;
+#undef FIELD_IS
+}
+
+/* Case sensitive search within a slice */
+static const char*
+slice_find (Http_slice *slice, const char *needle)
+{
+    int len = strlen (needle);
+    const char *p = slice->ptr;
+    const char *last;
+
+    if (!p || len == 0 || slice->len < len) {
+	return 0;
+    }
+    last = slice->ptr + slice->len - len;
+    while ((p = memchr (p, needle[0], last - p + 1)) != 0) {
+	if (!memcmp (p, needle, len)) {
+	    return p;
+	}
+	p++;
+    }
+    return 0;
+}
+
+static int
+slice_to_int (Http_slice *slice)
+{
+    char buf[16];
+    int len = slice->len < 15 ? slice->len : 15;
+
+    memcpy (buf, slice->ptr, len);
+    buf[len] = 0;
+    return atoi (buf);
+}
+
+/* Return the value of a field as an allocated string (or 0 if the 
+   field was not present) */
+static char*
+slice_strdup (Http_slice *slice)
+{
+    int len = slice->len;
+
+    if (!slice->ptr) {
+	return 0;
+    }
+    if (len > MAX_ICY_STRING - 1) {
+	len = MAX_ICY_STRING - 1;
+    }
+    return g_strndup (slice->ptr, len);
+}
+
+/* Look for a server signature in the fields where servers put it.  
+   If found, the field is copied into valbuf, and the return value 
+   points to the signature within valbuf. */
+static const char*
+http_guess_server (Http_fields *hf, const char *needle, 
+		   char *valbuf, int size)
+{
+    static const int fields[] = {
+	HF_SERVER, HF_ICY_NOTICE1, HF_ICY_NOTICE2, HF_ICY_NAME
+    };
+    int i;
+
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+	Http_slice *slice = &hf->field[fields[i]];
+	const char *p = slice_find (slice, needle);
+	if (p) {
+	    int len = slice->len < size - 1 ? slice->len : size - 1;
+	    memcpy (valbuf, slice->ptr, len);
+	    valbuf[len] = 0;
+	    if (p - slice->ptr >= len) {
+		return valbuf + len;
+	    }
+	    return valbuf + (p - slice->ptr);
+	}
+    }
+    return 0;
 }
 
-/******************************************************************************
- * Private functions
- *****************************************************************************/
 /* See http://www.ietf.org/rfc/rfc3986.txt */
 static void
 unescape_pct_encoding (char* s)
@@ -341,13 +885,46 @@ extract_header_value (char *header, char *dest, char *match, int maxlen)
     return 0;
 }
 
+/* Release the strings allocated by http_parse_sc_header, and 
+   zero the struct */
+void
+http_clear_sc_header (SR_HTTP_HEADER *info)
+{
+    g_free (info->icy_name);
+    g_free (info->icy_genre);
+    g_free (info->icy_url);
+    g_free (info->server);
+    memset (info, 0, sizeof(SR_HTTP_HEADER));
+}
+
+/* Number of heap bytes held by the header strings */
+u_long
+http_sc_header_heap_bytes (SR_HTTP_HEADER *info)
+{
+    u_long bytes = 0;
+    if (info->icy_name) bytes += strlen (info->icy_name) + 1;
+    if (info->icy_genre) bytes += strlen (info->icy_genre) + 1;
+    if (info->icy_url) bytes += strlen (info->icy_url) + 1;
+    if (info->server) bytes += strlen (info->server) + 1;
+    return bytes;
+}
+
+static void
+replace_header_string (char **dest, char *value)
+{
+    g_free (*dest);
+    *dest = value;
+}
+
 error_code
 http_parse_sc_header (const char *url, char *header, SR_HTTP_HEADER *info)
 {
     int rc;
-    char *start;
+    const char *start;
     char versionbuf[64];
-    char stempbr[MAX_ICY_STRING];
+    char valbuf[256];
+    Http_fields hf;
+    Http_slice *f = hf.field;
     URLINFO url_info;
     int url_path_len;
     int content_type_by_url;
@@ -360,21 +937,22 @@ http_parse_sc_header (const char *url, char *header, SR_HTTP_HEADER *info)
     rc = http_parse_url (url, &url_info);
     if (rc != SR_SUCCESS) return rc;
 
-    memset(info, 0, sizeof(SR_HTTP_HEADER));
+    http_clear_sc_header (info);
 
     debug_printf("http header:\n%s\n", header);
 
+    /* Find all the fields in one pass */
+    http_scan_header (header, &hf);
+
     // Get the ICY code.
-    start = (char*) strstr (header, "ICY ");
-    if (!start) {
-	start = (char*) strstr (header, "HTTP/1.");
-	if (!start) {
-	    debug_printf ("Failed to find ICY or HTTP\n");
-	    return SR_ERROR_NO_RESPONSE_HEADER;
-	}
+    if (!hf.status.ptr) {
+	debug_printf ("Failed to find ICY or HTTP\n");
+	return SR_ERROR_NO_RESPONSE_HEADER;
+    }
+    start = strchr (hf.status.ptr, ' ');
+    if (start) {
+	sscanf (start + 1, "%i", &info->icy_code);
     }
-    start = strstr (start, " ") + 1;
-    sscanf (start, "%i", &info->icy_code);
     if (info->icy_code >= 400) {
 	switch (info->icy_code) {
 	case 400:
@@ -395,51 +973,59 @@ http_parse_sc_header (const char *url, char *header, SR_HTTP_HEADER *info)
     }
 
     // read generic headers
-    extract_header_value(header, info->http_location, "Location:", 
-	sizeof(info->http_location));
-    extract_header_value(header, info->server, "Server:", 
-	sizeof(info->server));
-    rc = extract_header_value(header, info->icy_name, "icy-name:", 
-	sizeof(info->icy_name));
-    if (rc == 0) {
+    if (f[HF_LOCATION].ptr) {
+	int len = f[HF_LOCATION].len;
+	if (len > MAX_HOST_LEN - 1) {
+	    len = MAX_HOST_LEN - 1;
+	}
+	memcpy (info->http_location, f[HF_LOCATION].ptr, len);
+	info->http_location[len] = 0;
+    }
+    info->server = slice_strdup (&f[HF_SERVER]);
+    if (f[HF_ICY_NAME].ptr) {
+	info->icy_name = slice_strdup (&f[HF_ICY_NAME]);
+    } else {
 	/* Icecast 2.0.1 */
-	rc = extract_header_value(header, info->icy_name, "ice-name:", 
-	    sizeof(info->icy_name));
+	info->icy_name = slice_strdup (&f[HF_ICE_NAME]);
+    }
+    info->have_icy_name = (info->icy_name != 0);
+    if (f[HF_ICY_URL].ptr) {
+	info->icy_url = slice_strdup (&f[HF_ICY_URL]);
+    } else {
+	info->icy_url = slice_strdup (&f[HF_ICE_URL]);
+    }
+    if (f[HF_ICY_GENRE].ptr) {
+	info->icy_genre = slice_strdup (&f[HF_ICY_GENRE]);
+    } else {
+	info->icy_genre = slice_strdup (&f[HF_ICE_GENRE]);
     }
-    info->have_icy_name = rc;
-    extract_header_value(header, info->icy_url, "icy-url:", 
-	sizeof(info->icy_url));
-    rc = extract_header_value(header, stempbr, 
-	"icy-br:", sizeof(stempbr));
-    if (rc) {
-	info->icy_bitrate = atoi(stempbr);
+    if (f[HF_ICY_BR].ptr) {
+	info->icy_bitrate = slice_to_int (&f[HF_ICY_BR]);
     }
 
     /* interpret the content type from http header */
-    rc = extract_header_value(header, stempbr, 
-	"Content-Type:", sizeof(stempbr));
-    if (rc == 0) {
+    if (!f[HF_CONTENT_TYPE].ptr) {
 	info->content_type = CONTENT_TYPE_UNKNOWN;
     }
-    else if (strstr(stempbr,"audio/mpeg")) {
+    else if (slice_find (&f[HF_CONTENT_TYPE], "audio/mpeg")) {
 	info->content_type = CONTENT_TYPE_MP3;
     }
-    else if (strstr(stempbr,"video/nsv")) {
+    else if (slice_find (&f[HF_CONTENT_TYPE], "video/nsv")) {
 	info->content_type = CONTENT_TYPE_NSV;
     }
-    else if (strstr(stempbr,"misc/ultravox")) {
+    else if (slice_find (&f[HF_CONTENT_TYPE], "misc/ultravox")) {
 	info->content_type = CONTENT_TYPE_ULTRAVOX;
     }
-    else if (strstr(stempbr,"application/ogg")) {
+    else if (slice_find (&f[HF_CONTENT_TYPE], "application/ogg")) {
 	info->content_type = CONTENT_TYPE_OGG;
     }
-    else if (strstr(stempbr,"audio/aac")) {
+    else if (slice_find (&f[HF_CONTENT_TYPE], "audio/aac")) {
 	info->content_type = CONTENT_TYPE_AAC;
     }
-    else if (strstr(stempbr,"audio/x-scpls")) {
+    else if (slice_find (&f[HF_CONTENT_TYPE], "audio/x-scpls")) {
 	info->content_type = CONTENT_TYPE_PLS;
     }
-    else if (strstr(stempbr,"text/html")) {
+    else if (slice_find (&f[HF_CONTENT_TYPE], "text/html")) {
 	if (!info->http_location[0]) {
 	    return SR_ERROR_NO_RESPONSE_HEADER;
 	}
@@ -470,20 +1056,23 @@ http_parse_sc_header (const char *url, char *header, SR_HTTP_HEADER *info)
     // Try to guess the server
 
     // Check for Streamripper relay
-    if ((start = (char *)strstr(header, "[relay stream]")) != NULL) {
-	strcpy(info->server, "Streamripper relay server");
+    if (http_guess_server (&hf, "[relay stream]", valbuf, sizeof(valbuf))) {
+	replace_header_string (&info->server, 
+			       g_strdup ("Streamripper relay server"));
     }
     // Check for Shoutcast
-    else if ((start = (char *)strstr(header, "SHOUTcast")) != NULL) {
-	strcpy(info->server, "SHOUTcast/");
-	if ((start = (char *)strstr(start, "Server/")) != NULL) {
+    else if ((start = http_guess_server (&hf, "SHOUTcast", valbuf, 
+					 sizeof(valbuf))) != NULL) {
+	versionbuf[0] = 0;
+	if ((start = strstr(start, "Server/")) != NULL) {
 	    sscanf(start, "Server/%63[^<]<", versionbuf);
-	    strcat(info->server, versionbuf);
 	}
+	replace_header_string (&info->server, 
+			       g_strconcat ("SHOUTcast/", versionbuf, NULL));
 
     }
     // Check for Icecast 2
-    else if ((start = (char *)strstr(header, "Icecast 2")) != NULL) {
+    else if (http_guess_server (&hf, "Icecast 2", valbuf, sizeof(valbuf))) {
 	/* aac on icecast 2.0-2.1 declares content type of audio/mpeg */
 	/* In addition, there is at least one stream with a url 
 	   radioorenovscotia.ogg, but is actually audio/mpeg */
@@ -494,46 +1083,36 @@ http_parse_sc_header (const char *url, char *header, SR_HTTP_HEADER *info)
 	}
     }
 
-    // Check for Icecast 1
-    else if ((start = (char *)strstr(header, "icecast")) != NULL) {
-	if (!info->server[0]) {
-	    strcpy(info->server, "icecast/");
-	    if ((start = (char *)strstr(start, "version ")) != NULL) {
+    // Check for Icecast 1, or Apache with audiocast headers
+    else if ((start = http_guess_server (&hf, "icecast", valbuf, 
+					 sizeof(valbuf))) != NULL
+	     || (f[HF_XA_NAME].ptr 
+		 && http_guess_server (&hf, "Apache", valbuf, sizeof(valbuf)))) {
+	if (start && (!info->server || !info->server[0])) {
+	    versionbuf[0] = 0;
+	    if ((start = strstr(start, "version ")) != NULL) {
 		sscanf(start, "version %63[^<]<", versionbuf);
-		strcat(info->server, versionbuf);
 	    }
+	    replace_header_string (&info->server, 
+				   g_strconcat ("icecast/", versionbuf, NULL));
 	}
 
 	// icecast 1.x headers.
-	extract_header_value(header, info->icy_url, "x-audiocast-server-url:",
-	    sizeof(info->icy_url));
-	rc = extract_header_value(header, info->icy_name, "x-audiocast-name:",
-	    sizeof(info->icy_name));
-	info->have_icy_name |= rc;
-	extract_header_value(header, info->icy_genre, "x-audiocast-genre:",
-	    sizeof(info->icy_genre));
-	rc = extract_header_value(header, stempbr, "x-audiocast-bitrate:",
-	    sizeof(stempbr));
-	if (rc) {
-	    info->icy_bitrate = atoi(stempbr);
-	}
-    }
-
-    // Check for Apache
-    else if (((start = (char *)strstr(header, "Apache")) != NULL) &&
-	((start = (char *)strstr(header, "x-audiocast-name")) != NULL)) {
-	// Streaming straight from apache with audiocast headers
-	extract_header_value(header, info->icy_url, "x-audiocast-server-url:",
-	    sizeof(info->icy_url));
-	rc = extract_header_value(header, info->icy_name, "x-audiocast-name:",
-	    sizeof(info->icy_name));
-	info->have_icy_name |= rc;
-	extract_header_value(header, info->icy_genre, "x-audiocast-genre:",
-	    sizeof(info->icy_genre));
-	rc = extract_header_value(header, stempbr, "x-audiocast-bitrate:",
-	    sizeof(stempbr));
-	if (rc) {
-	    info->icy_bitrate = atoi(stempbr);
+	if (f[HF_XA_SERVER_URL].ptr) {
+	    replace_header_string (&info->icy_url, 
+				   slice_strdup (&f[HF_XA_SERVER_URL]));
+	}
+	if (f[HF_XA_NAME].ptr) {
+	    replace_header_string (&info->icy_name, 
+				   slice_strdup (&f[HF_XA_NAME]));
+	    info->have_icy_name = 1;
+	}
+	if (f[HF_XA_GENRE].ptr) {
+	    replace_header_string (&info->icy_genre, 
+				   slice_strdup (&f[HF_XA_GENRE]));
+	}
+	if (f[HF_XA_BITRATE].ptr) {
+	    info->icy_bitrate = slice_to_int (&f[HF_XA_BITRATE]);
 	}
     }
 
@@ -548,22 +1127,20 @@ http_parse_sc_header (const char *url, char *header, SR_HTTP_HEADER *info)
 
     debug_printf ("Deduced content type: %d\n", info->content_type);
 
-    // Make sure we don't have any CRLF's at the end of our strings
-    trim(info->icy_url);
-    trim(info->icy_genre);
-    trim(info->icy_name);
-    trim(info->http_location);
-    trim(info->server);
+    /* Headers which were not sent are empty strings */
+    if (!info->icy_url) info->icy_url = g_strdup ("");
+    if (!info->icy_genre) info->icy_genre = g_strdup ("");
+    if (!info->icy_name) info->icy_name = g_strdup ("");
+    if (!info->server) info->server = g_strdup ("");
 
     //get the meta interval
-    start = (char*) strstr (header, "icy-metaint:");
-    if (start) {
-        sscanf (start, "icy-metaint:%i", &info->meta_interval);
-        if (info->meta_interval < 1) {
+    if (f[HF_ICY_METAINT].ptr) {
+	info->meta_interval = slice_to_int (&f[HF_ICY_METAINT]);
+	if (info->meta_interval < 1) {
 	    info->meta_interval = NO_META_INTERVAL;
-        }
+	}
     } else {
-        info->meta_interval = NO_META_INTERVAL;
+	info->meta_interval = NO_META_INTERVAL;
     }
 
     return SR_SUCCESS;
@@ -610,7 +1187,7 @@ http_construct_sc_response(SR_HTTP_HEADER *info, char *header, int size, int icy
 	strcat(header, buf);
     }
 
-    if (info->server[0])
+    if (info->server && info->server[0])
     {
 	sprintf(buf, "Server:%s\r\n", info->server);
 	strcat(header, buf);
@@ -621,7 +1198,7 @@ http_construct_sc_response(SR_HTTP_HEADER *info, char *header, int size, int icy
 	strcat(header, buf);
     }
 
-    if (info->icy_url[0])
+    if (info->icy_url && info->icy_url[0])
     {
 	sprintf(buf, "icy-url:%s\r\n", info->icy_url);
 	strcat(header, buf);
@@ -633,7 +1210,7 @@ http_construct_sc_response(SR_HTTP_HEADER *info, char *header, int size, int icy
 	strcat(header, buf);
     }
 
-    if (info->icy_genre[0])
+    if (info->icy_genre && info->icy_genre[0])
     {
 	sprintf(buf, "icy-genre:%s\r\n", info->icy_genre);
 	strcat(header, buf);
@@ -686,13 +1263,15 @@ Length1=-1
 Version=2
 */
 static error_code
-http_get_pls (RIP_MANAGER_INFO* rmi, HSOCKET *sock, SR_HTTP_HEADER *info)
+http_get_pls (RIP_MANAGER_INFO* rmi, HSOCKET *sock, SR_HTTP_HEADER *info, 
+	      Http_mirrors *mirrors)
 {
     int s, bytes;
     error_code rc;
     char buf[MAX_PLS_LEN];
     char location_buf[MAX_PLS_LEN];
     char title_buf[MAX_PLS_LEN];
+    int have_slots = 1;
 
     debug_printf ("Reading pls\n");
     bytes = socklib_recvall (rmi, sock, buf, MAX_PLS_LEN, rmi->prefs->timeout);
@@ -729,18 +1308,27 @@ http_get_pls (RIP_MANAGER_INFO* rmi, HSOCKET *sock, SR_HTTP_HEADER *info)
 	    sr_strncpy (info->http_location, location_buf, MAX_HOST_LEN);
 	    rc = SR_SUCCESS;
 	}
+	if (mirrors && mirrors->num < HTTP_MAX_MIRRORS) {
+	    sr_strncpy (mirrors->url[mirrors->num++], location_buf, 
+			MAX_HOST_LEN);
+	}
+	if (!have_slots) {
+	    continue;
+	}
 	
 	sprintf (buf1, "Title%d=", s);
 	if (!extract_header_value (buf, title_buf, buf1, sizeof(title_buf))) {
 	    /* Remaining URLs have not title information */
 	    debug_printf ("s = %d, no more title info\n", s);
-	    break;
+	    have_slots = 0;
+	    continue;
 	}
 	num_scanned = sscanf (title_buf, "(#%*[0-9] - %d/%d", &used, &total);
 	if (num_scanned != 2) {
 	    /* Title information doesn't have open slots information */
 	    debug_printf ("s = %d, no more open slots info\n", s);
-	    break;
+	    have_slots = 0;
+	    continue;
 	}
 	open = total - used;
 	if (open > best_open) {
@@ -800,7 +1388,7 @@ http_get_m3u (RIP_MANAGER_INFO* rmi, HSOCKET *sock, SR_HTTP_HEADER *info)
 
 static error_code
 http_get_sc_header(RIP_MANAGER_INFO* rmi, const char* url, 
-		   HSOCKET *sock, SR_HTTP_HEADER *info)
+		   HSOCKET *sock, SR_HTTP_HEADER *info, Http_mirrors *mirrors)
 {
     int ret;
     char headbuf[MAX_HEADER_LEN] = {'\0'};
@@ -817,7 +1405,7 @@ http_get_sc_header(RIP_MANAGER_INFO* rmi, const char* url,
     }
 
     if (info->content_type == CONTENT_TYPE_PLS) {
-	ret = http_get_pls (rmi, sock, info);
+	ret = http_get_pls (rmi, sock, info, mirrors);
 	if (ret != SR_SUCCESS) {
 	    debug_printf ("http_get_pls failed\n");
 	    return ret;
@@ -6,6 +6,9 @@
 
 
 error_code http_parse_sc_header(const char* url, char *header, SR_HTTP_HEADER *info);
+void http_clear_sc_header (SR_HTTP_HEADER *info);
+u_long http_sc_header_heap_bytes (SR_HTTP_HEADER *info);
+int extract_header_value (char *header, char *dest, char *match, int maxlen);
 error_code http_construct_sc_request(const char *url, const char* proxyurl, char *buffer, char *useragent);
 error_code http_construct_page_request(const char *url, BOOL proxyformat, char *buffer);
 error_code http_construct_sc_response(SR_HTTP_HEADER *info, char *header, int size, int icy_meta_support);
@@ -17,6 +20,9 @@ error_code http_sc_connect (RIP_MANAGER_INFO* rmi,
 			    const char *proxyurl, 
 			    SR_HTTP_HEADER *info, char *useragent, 
 			    char *if_name);
+error_code http_sc_connect_standby (RIP_MANAGER_INFO* rmi, HSOCKET *sock, 
+				    const char *url, const char *proxyurl, 
+				    SR_HTTP_HEADER *info);
 
 
 #endif //__HTTP_H__
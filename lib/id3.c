@@ -0,0 +1,191 @@
+/* id3.c
+ * build id3v1 and id3v2.3 tags in memory
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* The whole id3v2 tag is built in one buffer, so that it can be 
+   written with the first audio of the track.  The tag is padded to 
+   leave at least ID3V2_MIN_PADDING bytes free, rounded up to a 
+   multiple of ID3V2_PADDING_ALIGN, so that the frames can later be 
+   rewritten or extended in place without moving the audio. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "errors.h"
+#include "mchar.h"
+#include "id3.h"
+#include "debug.h"
+
+#define ID3V2_HEADER_SIZE	10
+#define ID3V2_FRAME_HEADER_SIZE	10
+#define ID3V2_NUM_FRAMES	6
+#define ID3V2_MAX_TEXT		1600	/* Longest text of one frame */
+#define ID3V2_MIN_SIZE		1600	/* Tag size before the builder */
+#define ID3V2_MIN_PADDING	512
+#define ID3V2_PADDING_ALIGN	512
+
+typedef struct ID3V1st
+{
+        char    tag[3];
+        char    songtitle[30];
+        char    artist[30];
+        char    album[30];
+        char    year[4];
+        char    comment[30];
+        char    genre;
+} ID3V1Tag;
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static u_long id3v2_tag_size (u_long frames_len);
+static u_long
+id3v2_put_frame (RIP_MANAGER_INFO* rmi, char *buf, char *id, mchar *data, 
+		 int charset);
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+/* Build the id3v2.3 tag of ti into tag->buf, which the caller frees 
+   with id3_free.  If align is non-zero, the padding is extended so 
+   that tag->len is offset modulo align. */
+error_code
+id3_build_v2 (RIP_MANAGER_INFO* rmi, Track_record *ti, Id3_tag *tag, 
+	      u_long align, u_long offset)
+{
+    u_long size, max_len, frames_len = 0;
+    char *p;
+    int charset;
+
+    max_len = ID3V2_HEADER_SIZE 
+	    + id3v2_tag_size (ID3V2_NUM_FRAMES 
+			      * (ID3V2_FRAME_HEADER_SIZE + 1 + ID3V2_MAX_TEXT))
+	    + align;
+    tag->buf = (char*) calloc (1, max_len);
+    if (!tag->buf) {
+	tag->len = 0;
+	return SR_ERROR_CANT_ALLOC_MEMORY;
+    }
+
+    /* ID3 V2.3 is only defined for ISO-8859-1 and UCS-2
+       If user specifies another codeset, we will use it, and 
+       report ISO-8859-1 in the encoding field */
+    charset = is_id3_unicode (rmi);
+
+    p = tag->buf + ID3V2_HEADER_SIZE;
+    frames_len += id3v2_put_frame (rmi, p + frames_len, "TPE1", 
+				   ti->artist, charset);
+    frames_len += id3v2_put_frame (rmi, p + frames_len, "TIT2", 
+				   ti->title, charset);
+    frames_len += id3v2_put_frame (rmi, p + frames_len, "TENC", 
+				   m_("Ripped with Streamripper"), charset);
+    frames_len += id3v2_put_frame (rmi, p + frames_len, "TALB", 
+				   ti->album, charset);
+    frames_len += id3v2_put_frame (rmi, p + frames_len, "TRCK", 
+				   ti->track_a, charset);
+    frames_len += id3v2_put_frame (rmi, p + frames_len, "TYER", 
+				   ti->year, charset);
+
+    /* Header, with the size as a syncsafe integer.  The padding is 
+       already zero. */
+    size = id3v2_tag_size (frames_len);
+    if (align) {
+	size += (offset % align + align 
+		 - (ID3V2_HEADER_SIZE + size) % align) % align;
+    }
+    memcpy (tag->buf, "ID3\x03\0\0", 6);
+    tag->buf[6] = (char) ((size >> 21) & 0x7F);
+    tag->buf[7] = (char) ((size >> 14) & 0x7F);
+    tag->buf[8] = (char) ((size >> 7) & 0x7F);
+    tag->buf[9] = (char) (size & 0x7F);
+    tag->len = ID3V2_HEADER_SIZE + size;
+
+    debug_printf ("id3v2 tag: %lu bytes of frames, %lu bytes padding\n",
+		  frames_len, size - frames_len);
+    return SR_SUCCESS;
+}
+
+/* Fill buf, which is ID3V1_TAG_SIZE bytes, with the id3v1 tag of ti */
+void
+id3_build_v1 (RIP_MANAGER_INFO* rmi, Track_record *ti, char *buf)
+{
+    ID3V1Tag id3v1;
+
+    memset (&id3v1, '\000', sizeof(id3v1));
+    strncpy (id3v1.tag, "TAG", strlen("TAG"));
+    string_from_gstring (rmi, id3v1.artist, sizeof(id3v1.artist),
+			 ti->artist, CODESET_ID3);
+    string_from_gstring (rmi, id3v1.songtitle, sizeof(id3v1.songtitle),
+			 ti->title, CODESET_ID3);
+    string_from_gstring (rmi, id3v1.album, sizeof(id3v1.album),
+			 ti->album, CODESET_ID3);
+    string_from_gstring (rmi, id3v1.year, sizeof(id3v1.year),
+			 ti->year, CODESET_ID3);
+    id3v1.genre = (char) 0xFF; // see http://www.id3.org/id3v2.3.0.html#secA
+    memcpy (buf, &id3v1, ID3V1_TAG_SIZE);
+}
+
+void
+id3_free (Id3_tag *tag)
+{
+    free (tag->buf);
+    tag->buf = 0;
+    tag->len = 0;
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+/* Size of the tag after the header, for frames_len bytes of frames */
+static u_long
+id3v2_tag_size (u_long frames_len)
+{
+    u_long size = frames_len + ID3V2_MIN_PADDING;
+    size = (size + ID3V2_PADDING_ALIGN - 1) 
+	    / ID3V2_PADDING_ALIGN * ID3V2_PADDING_ALIGN;
+    if (size < ID3V2_MIN_SIZE) {
+	size = ID3V2_MIN_SIZE;
+    }
+    return size;
+}
+
+/* Put a text frame, using tag_name e.g. TPE1, at buf.  Returns the 
+   length of the frame. */
+static u_long
+id3v2_put_frame (RIP_MANAGER_INFO* rmi, char *buf, char *id, mchar *data, 
+		 int charset)
+{
+    char *text = buf + ID3V2_FRAME_HEADER_SIZE + 1;
+    int len;
+    u_long framesize;
+
+    len = string_from_gstring (rmi, text, ID3V2_MAX_TEXT, data, CODESET_ID3);
+    if (len < 0) {
+	len = 0;
+    }
+
+    /* Frame size counts the encoding byte and the text, and is a 
+       plain big endian integer in id3v2.3 */
+    framesize = len + 1;
+    memcpy (buf, id, 4);
+    buf[4] = (char) ((framesize >> 24) & 0xFF);
+    buf[5] = (char) ((framesize >> 16) & 0xFF);
+    buf[6] = (char) ((framesize >> 8) & 0xFF);
+    buf[7] = (char) (framesize & 0xFF);
+    buf[8] = 0;
+    buf[9] = 0;
+    buf[10] = (char) charset;
+    return ID3V2_FRAME_HEADER_SIZE + 1 + len;
+}
@@ -0,0 +1,41 @@
+/* id3.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __ID3_H__
+#define __ID3_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+#define ID3V1_TAG_SIZE	128
+
+/* A complete tag, ready to be written to the file */
+typedef struct id3_tag Id3_tag;
+struct id3_tag
+{
+    char *buf;
+    u_long len;
+};
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+error_code id3_build_v2 (RIP_MANAGER_INFO* rmi, Track_record *ti, 
+			 Id3_tag *tag, u_long align, u_long offset);
+void id3_build_v1 (RIP_MANAGER_INFO* rmi, Track_record *ti, char *buf);
+void id3_free (Id3_tag *tag);
+
+#endif
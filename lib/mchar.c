@@ -203,8 +203,8 @@ convert_string_with_replacement
  gsize* output_bytes,       /* Output: Size of output string (in bytes) */
  char* input_string,	    /* Input: String to convert */
  gsize input_bytes,	    /* Input: Length of input string (in bytes) */
- char* from_codeset,	    /* Input: Codeset of input string */
- char* to_codeset,	    /* Input: Codeset of output string */
+ const char* from_codeset,  /* Input: Codeset of input string */
+ const char* to_codeset,    /* Input: Codeset of output string */
  char* repl		    /* Input: Replacement character (zero terminated,
 			       in utf-8) */
  )
@@ -405,7 +405,7 @@ int
 gstring_from_string (RIP_MANAGER_INFO* rmi, mchar* m, int mlen, 
 		     char* c, int codeset_type)
 {
-    CODESET_OPTIONS* mchar_cs = &rmi->mchar_cs;
+    Codeset_names* mchar_cs = &rmi->mchar_cs;
     if (mlen < 0) return 0;
     *m = 0;
     if (!c) return 0;
@@ -413,7 +413,7 @@ gstring_from_string (RIP_MANAGER_INFO* rmi, mchar* m, int mlen,
     {
 	gchar* gstring;
 	gsize gstring_len;
-	char* src_codeset;
+	const char* src_codeset;
 	int rc;
 	
 	switch (codeset_type) {
@@ -460,14 +460,14 @@ gstring_from_string (RIP_MANAGER_INFO* rmi, mchar* m, int mlen,
 int
 string_from_gstring (RIP_MANAGER_INFO* rmi, char* c, int clen, mchar* m, int codeset_type)
 {
-    CODESET_OPTIONS* mchar_cs = &rmi->mchar_cs;
+    Codeset_names* mchar_cs = &rmi->mchar_cs;
     if (clen <= 0) return 0;
     *c = 0;
     if (!m) return 0;
     {
 	gchar* cstring;
 	gsize cstring_len;
-	char* tgt_codeset;
+	const char* tgt_codeset;
 	
 	switch (codeset_type) {
 	case CODESET_UTF8:
@@ -591,7 +591,7 @@ set_codesets_default (CODESET_OPTIONS* cs_opt)
 void
 register_codesets (RIP_MANAGER_INFO* rmi, CODESET_OPTIONS* cs_opt)
 {
-    CODESET_OPTIONS* mchar_cs = &rmi->mchar_cs;
+    Codeset_names* mchar_cs = &rmi->mchar_cs;
 
     /* For ID3, force UCS-2, UCS-2LE, UCS-2BE, UTF-16LE, and UTF-16BE 
        to be UTF-16.  This way, we get the BOM like we need.
@@ -602,11 +602,11 @@ register_codesets (RIP_MANAGER_INFO* rmi, CODESET_OPTIONS* cs_opt)
 	strcpy (cs_opt->codeset_id3, "UTF-16");
     }
 
-    strcpy (mchar_cs->codeset_locale, cs_opt->codeset_locale);
-    strcpy (mchar_cs->codeset_filesys, cs_opt->codeset_filesys);
-    strcpy (mchar_cs->codeset_id3, cs_opt->codeset_id3);
-    strcpy (mchar_cs->codeset_metadata, cs_opt->codeset_metadata);
-    strcpy (mchar_cs->codeset_relay, cs_opt->codeset_relay);
+    mchar_cs->codeset_locale = g_intern_string (cs_opt->codeset_locale);
+    mchar_cs->codeset_filesys = g_intern_string (cs_opt->codeset_filesys);
+    mchar_cs->codeset_id3 = g_intern_string (cs_opt->codeset_id3);
+    mchar_cs->codeset_metadata = g_intern_string (cs_opt->codeset_metadata);
+    mchar_cs->codeset_relay = g_intern_string (cs_opt->codeset_relay);
     debug_printf ("Locale codeset: %s\n", mchar_cs->codeset_locale);
     debug_printf ("Filesys codeset: %s\n", mchar_cs->codeset_filesys);
     debug_printf ("ID3 codeset: %s\n", mchar_cs->codeset_id3);
@@ -618,8 +618,8 @@ register_codesets (RIP_MANAGER_INFO* rmi, CODESET_OPTIONS* cs_opt)
 int
 is_id3_unicode (RIP_MANAGER_INFO* rmi)
 {
-    CODESET_OPTIONS* mchar_cs = &rmi->mchar_cs;
-    if (!strcmp ("UTF-16", mchar_cs->codeset_id3)) {
+    Codeset_names* mchar_cs = &rmi->mchar_cs;
+    if (mchar_cs->codeset_id3 == g_intern_static_string ("UTF-16")) {
 	return 1;
     }
     return 0;
@@ -0,0 +1,281 @@
+/* memgov.c
+ * process-wide memory budget for stream buffers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* Each stream charges the memory used by its circular buffer, its
+   relay clients and its silence detection to a single process-wide
+   budget.  Circular buffer chunks are admitted up to the full budget.
+   Optional memory (relay buffers and analysis buffers) is only
+   admitted below the high water mark.  Above the high water mark,
+   streams give back cbuf chunks which are not needed by the
+   splitpoint windows (see cbuf3_insert_free_node).  A budget of
+   zero means there is no limit, but usage is still tracked.  The
+   budget is set once for the process, see rip_manager_set_mem_budget. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "errors.h"
+#include "threadlib.h"
+#include "memgov.h"
+#include "debug.h"
+
+/* Optional reservations must leave 1/8 of the budget free */
+#define HIGH_WATER(budget)	((budget) - (budget) / 8)
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void memgov_lock (void);
+static void memgov_unlock (void);
+static u_long memgov_account_total (Memgov_account *account);
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+static HSEM m_sem;
+static int m_initialized = 0;
+static u_long m_budget = 0;
+static u_long m_total = 0;
+static u_long m_peak = 0;
+static u_long m_usage[MEMGOV_NUM_SUBSYS];
+static GList *m_accounts = 0;
+
+static const char* m_subsys_names[MEMGOV_NUM_SUBSYS] = {
+    "cbuf",
+    "relay",
+    "analysis"
+};
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+void
+memgov_init (void)
+{
+    if (m_initialized) return;
+    m_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_sem);
+    m_initialized = 1;
+}
+
+void
+memgov_cleanup (void)
+{
+    if (!m_initialized) return;
+    memgov_debug_report ();
+    g_list_free (m_accounts);
+    m_accounts = 0;
+    threadlib_destroy_sem (&m_sem);
+    m_initialized = 0;
+}
+
+void
+memgov_set_budget (u_long bytes)
+{
+    memgov_lock ();
+    m_budget = bytes;
+    memgov_unlock ();
+    debug_printf ("MEMGOV: budget set to %lu bytes\n", bytes);
+}
+
+u_long
+memgov_get_budget (void)
+{
+    return m_budget;
+}
+
+void
+memgov_register (Memgov_account *account, char *name)
+{
+    memset (account, 0, sizeof(Memgov_account));
+    account->name = name;
+    memgov_lock ();
+    m_accounts = g_list_append (m_accounts, account);
+    memgov_unlock ();
+}
+
+void
+memgov_unregister (Memgov_account *account)
+{
+    int i;
+
+    memgov_lock ();
+    m_accounts = g_list_remove (m_accounts, account);
+
+    /* Anything not released by now is lost to the stream */
+    for (i = 0; i < MEMGOV_NUM_SUBSYS; i++) {
+	if (account->usage[i]) {
+	    debug_printf ("MEMGOV: %s still holds %lu bytes of %s\n",
+			  account->name ? account->name : "",
+			  account->usage[i], m_subsys_names[i]);
+	    m_usage[i] -= account->usage[i];
+	    m_total -= account->usage[i];
+	    account->usage[i] = 0;
+	}
+    }
+    memgov_unlock ();
+}
+
+/* Returns SR_ERROR_MEMORY_BUDGET_EXCEEDED if the reservation would
+   not fit.  In this case nothing is charged, and the caller should
+   not allocate the memory. */
+error_code
+memgov_reserve (Memgov_account *account, int subsys, u_long bytes)
+{
+    u_long limit;
+    u_long account_total;
+
+    if (!account || subsys < 0 || subsys >= MEMGOV_NUM_SUBSYS) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+
+    memgov_lock ();
+    if (m_budget) {
+	if (subsys == MEMGOV_CBUF) {
+	    limit = m_budget;
+	} else {
+	    limit = HIGH_WATER (m_budget);
+	}
+	if (m_total + bytes > limit) {
+	    account->refused++;
+	    memgov_unlock ();
+	    debug_printf ("MEMGOV: refused %lu bytes of %s for %s "
+			  "(total=%lu, limit=%lu)\n",
+			  bytes, m_subsys_names[subsys],
+			  account->name ? account->name : "",
+			  m_total, limit);
+	    return SR_ERROR_MEMORY_BUDGET_EXCEEDED;
+	}
+    }
+
+    account->usage[subsys] += bytes;
+    m_usage[subsys] += bytes;
+    m_total += bytes;
+    if (m_total > m_peak) {
+	m_peak = m_total;
+    }
+    account_total = memgov_account_total (account);
+    if (account_total > account->peak) {
+	account->peak = account_total;
+    }
+    memgov_unlock ();
+    return SR_SUCCESS;
+}
+
+void
+memgov_release (Memgov_account *account, int subsys, u_long bytes)
+{
+    if (!account || subsys < 0 || subsys >= MEMGOV_NUM_SUBSYS) {
+	return;
+    }
+
+    memgov_lock ();
+    if (bytes > account->usage[subsys]) {
+	debug_printf ("MEMGOV: release of %lu bytes of %s exceeds usage\n",
+		      bytes, m_subsys_names[subsys]);
+	bytes = account->usage[subsys];
+    }
+    account->usage[subsys] -= bytes;
+    m_usage[subsys] -= bytes;
+    m_total -= bytes;
+    memgov_unlock ();
+}
+
+/* Return 1 if streams should give back optional memory */
+int
+memgov_under_pressure (void)
+{
+    int pressure;
+
+    memgov_lock ();
+    pressure = m_budget && m_total > HIGH_WATER (m_budget);
+    memgov_unlock ();
+    return pressure;
+}
+
+u_long
+memgov_get_usage (Memgov_account *account, int subsys)
+{
+    if (subsys < 0 || subsys >= MEMGOV_NUM_SUBSYS) {
+	return 0;
+    }
+    if (!account) {
+	return m_usage[subsys];
+    }
+    return account->usage[subsys];
+}
+
+u_long
+memgov_get_total (void)
+{
+    return m_total;
+}
+
+void
+memgov_debug_report (void)
+{
+    GList *p;
+    int i;
+
+    memgov_lock ();
+    debug_printf ("------ MEMORY BUDGET -------\n");
+    debug_printf ("budget = %lu, total = %lu, peak = %lu\n",
+		  m_budget, m_total, m_peak);
+    for (i = 0; i < MEMGOV_NUM_SUBSYS; i++) {
+	debug_printf ("  %-8s = %lu\n", m_subsys_names[i], m_usage[i]);
+    }
+    for (p = m_accounts; p; p = p->next) {
+	Memgov_account *account = (Memgov_account*) p->data;
+	debug_printf ("stream %s\n", account->name ? account->name : "");
+	for (i = 0; i < MEMGOV_NUM_SUBSYS; i++) {
+	    debug_printf ("  %-8s = %lu\n", m_subsys_names[i],
+			  account->usage[i]);
+	}
+	debug_printf ("  peak     = %lu\n", account->peak);
+	debug_printf ("  refused  = %lu\n", account->refused);
+    }
+    memgov_unlock ();
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void
+memgov_lock (void)
+{
+    if (m_initialized) {
+	threadlib_waitfor_sem (&m_sem);
+    }
+}
+
+static void
+memgov_unlock (void)
+{
+    if (m_initialized) {
+	threadlib_signal_sem (&m_sem);
+    }
+}
+
+static u_long
+memgov_account_total (Memgov_account *account)
+{
+    int i;
+    u_long total = 0;
+    for (i = 0; i < MEMGOV_NUM_SUBSYS; i++) {
+	total += account->usage[i];
+    }
+    return total;
+}
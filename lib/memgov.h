@@ -0,0 +1,41 @@
+/* memgov.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __MEMGOV_H__
+#define __MEMGOV_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+void memgov_init (void);
+void memgov_cleanup (void);
+void memgov_set_budget (u_long bytes);
+u_long memgov_get_budget (void);
+void memgov_register (Memgov_account *account, char *name);
+void memgov_unregister (Memgov_account *account);
+error_code
+memgov_reserve (Memgov_account *account, int subsys, u_long bytes);
+void
+memgov_release (Memgov_account *account, int subsys, u_long bytes);
+int memgov_under_pressure (void);
+u_long memgov_get_usage (Memgov_account *account, int subsys);
+u_long memgov_get_total (void);
+void memgov_debug_report (void);
+
+#endif
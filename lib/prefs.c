@@ -423,11 +423,15 @@ debug_stream_prefs (STREAM_PREFS* prefs)
     debug_printf ("pls_file = %s\n", prefs->pls_file);
     debug_printf ("relay_ip = %s\n", prefs->relay_ip);
     debug_printf ("ext_cmd = %s\n", prefs->ext_cmd);
+    debug_printf ("track_index = %s\n", prefs->track_index);
     debug_printf ("useragent = %s\n", prefs->useragent);
     debug_printf ("relay_port = %d\n", prefs->relay_port);
     debug_printf ("max_port = %d\n", prefs->max_port);
     debug_printf ("max_connections = %d\n", prefs->max_connections);
     debug_printf ("maxMB_rip_size = %d\n", prefs->maxMB_rip_size);
+    debug_printf ("maxMB_mem_budget = %d\n", prefs->maxMB_mem_budget);
+    debug_printf ("write_buffer_kb = %d\n", prefs->write_buffer_kb);
+    debug_printf ("race_mirrors = %d\n", prefs->race_mirrors);
     debug_printf ("auto_reconnect = %d\n",
 		  OPT_FLAG_ISSET (prefs->flags, OPT_AUTO_RECONNECT));
     debug_printf ("make_relay = %d\n",
@@ -446,11 +450,26 @@ debug_stream_prefs (STREAM_PREFS* prefs)
 		  OPT_FLAG_ISSET (prefs->flags, OPT_SINGLE_FILE_OUTPUT));
     debug_printf ("use_ext_cmd = %d\n",
 		  OPT_FLAG_ISSET (prefs->flags, OPT_EXTERNAL_CMD));
+    debug_printf ("hot_standby = %d\n",
+		  OPT_FLAG_ISSET (prefs->flags, OPT_HOT_STANDBY));
+    debug_printf ("tracks_from_show = %d\n",
+		  OPT_FLAG_ISSET (prefs->flags, OPT_TRACKS_FROM_SHOW));
+    debug_printf ("hidden_incomplete = %d\n",
+		  OPT_FLAG_ISSET (prefs->flags, OPT_HIDDEN_INCOMPLETE));
+    debug_printf ("preallocate = %d\n",
+		  OPT_FLAG_ISSET (prefs->flags, OPT_PREALLOCATE));
+    debug_printf ("direct_show = %d\n",
+		  OPT_FLAG_ISSET (prefs->flags, OPT_DIRECT_SHOW));
     debug_printf ("timeout = %d\n", prefs->timeout);
     debug_printf ("dropcount = %d\n", prefs->dropcount);
     debug_printf ("count_start = %d\n", prefs->count_start);
     debug_printf ("overwrite = %s\n", 
 		  overwrite_opt_to_string(prefs->overwrite));
+    debug_printf ("sock_profile = %s\n", 
+		  sock_profile_to_string(prefs->sock_profile));
+    debug_printf ("dedup = %s\n", dedup_mode_to_string(prefs->dedup));
+    debug_printf ("durability = %s\n", 
+		  durable_mode_to_string(prefs->durability));
 };
 
 
@@ -509,6 +528,12 @@ prefs_get_stream_defaults (STREAM_PREFS* prefs)
     prefs->max_port = 18000;
     prefs->max_connections = 1;
     prefs->maxMB_rip_size = 0;
+    prefs->maxMB_mem_budget = 0;
+    prefs->write_buffer_kb = 0;
+    prefs->race_mirrors = 0;
+    prefs->sock_profile = SOCK_PROFILE_NONE;
+    prefs->dedup = DEDUP_NONE;
+    prefs->durability = DURABLE_NONE;
     prefs->flags = OPT_AUTO_RECONNECT | 
 	    OPT_SEPARATE_DIRS | 
 	    OPT_SEARCH_PORTS |
@@ -537,6 +562,7 @@ prefs_get_stream_defaults (STREAM_PREFS* prefs)
     prefs->count_start = 0;
     prefs->overwrite = OVERWRITE_VERSION;
     prefs->ext_cmd[0] = 0;
+    prefs->track_index[0] = 0;
 }
 
 static void
@@ -669,6 +695,9 @@ prefs_get_stream_prefs_keyfile (STREAM_PREFS* prefs, char* group)
 {
     u_long temp;
     char overwrite_str[128];
+    char sock_profile_str[128];
+    char dedup_str[128];
+    char durability_str[128];
 
     if (!m_key_file) return;
 
@@ -683,11 +712,15 @@ prefs_get_stream_prefs_keyfile (STREAM_PREFS* prefs, char* group)
     prefs_get_string (prefs->relay_ip, SR_MAX_PATH, group, "relay_ip");
     prefs_get_string (prefs->useragent, MAX_USERAGENT_STR, group, "useragent");
     prefs_get_string (prefs->ext_cmd, SR_MAX_PATH, group, "ext_cmd");
+    prefs_get_string (prefs->track_index, SR_MAX_PATH, group, "track_index");
     prefs_get_ushort (&prefs->relay_port, group, "relay_port");
     prefs_get_ushort (&prefs->max_port, group, "max_port");
     prefs_get_ulong (&prefs->max_connections, group, "max_connections");
     prefs_get_ulong (&prefs->maxMB_rip_size, group, "maxMB_bytes");
     prefs_get_ulong (&prefs->maxMB_rip_size, group, "maxMB_bytes");
+    prefs_get_ulong (&prefs->maxMB_mem_budget, group, "maxMB_mem_budget");
+    prefs_get_ulong (&prefs->write_buffer_kb, group, "write_buffer_kb");
+    prefs_get_ulong (&prefs->race_mirrors, group, "race_mirrors");
     prefs_get_ulong (&prefs->dropcount, group, "dropcount");
 
     /* Overwrite */
@@ -695,6 +728,30 @@ prefs_get_stream_prefs_keyfile (STREAM_PREFS* prefs, char* group)
 	prefs->overwrite = string_to_overwrite_opt (overwrite_str);
     }
 
+    /* Socket profile */
+    if (prefs_get_string (sock_profile_str, 128, group, "sock_profile")) {
+	enum SockProfile sp = string_to_sock_profile (sock_profile_str);
+	if (sp != SOCK_PROFILE_UNKNOWN) {
+	    prefs->sock_profile = sp;
+	}
+    }
+
+    /* Identical tracks */
+    if (prefs_get_string (dedup_str, 128, group, "dedup")) {
+	enum DedupMode dm = string_to_dedup_mode (dedup_str);
+	if (dm != DEDUP_UNKNOWN) {
+	    prefs->dedup = dm;
+	}
+    }
+
+    /* Syncing to disk */
+    if (prefs_get_string (durability_str, 128, group, "durability")) {
+	enum DurableMode dm = string_to_durable_mode (durability_str);
+	if (dm != DURABLE_UNKNOWN) {
+	    prefs->durability = dm;
+	}
+    }
+
     /* Flags */
     if (prefs_get_ulong (&temp, group, "auto_reconnect")) {
 	OPT_FLAG_SET (prefs->flags, OPT_AUTO_RECONNECT, temp);
@@ -740,6 +797,21 @@ prefs_get_stream_prefs_keyfile (STREAM_PREFS* prefs, char* group)
     if (prefs_get_ulong (&temp, group, "add_id3v2")) {
 	OPT_FLAG_SET (prefs->flags, OPT_ADD_ID3V2, temp);
     }
+    if (prefs_get_ulong (&temp, group, "hot_standby")) {
+	OPT_FLAG_SET (prefs->flags, OPT_HOT_STANDBY, temp);
+    }
+    if (prefs_get_ulong (&temp, group, "tracks_from_show")) {
+	OPT_FLAG_SET (prefs->flags, OPT_TRACKS_FROM_SHOW, temp);
+    }
+    if (prefs_get_ulong (&temp, group, "hidden_incomplete")) {
+	OPT_FLAG_SET (prefs->flags, OPT_HIDDEN_INCOMPLETE, temp);
+    }
+    if (prefs_get_ulong (&temp, group, "preallocate")) {
+	OPT_FLAG_SET (prefs->flags, OPT_PREALLOCATE, temp);
+    }
+    if (prefs_get_ulong (&temp, group, "direct_show")) {
+	OPT_FLAG_SET (prefs->flags, OPT_DIRECT_SHOW, temp);
+    }
 
     /* Splitpoint options */
     prefs_get_int (&prefs->sp_opt.xs, group, "xs");
@@ -802,18 +874,36 @@ prefs_set_stream_prefs_keyfile (STREAM_PREFS* prefs, STREAM_PREFS* gp,
     if (!gp || !strcmp(prefs->ext_cmd, gp->ext_cmd)) {
 	prefs_set_string (group, "ext_cmd", prefs->ext_cmd);
     }
+    if (!gp || !strcmp(prefs->track_index, gp->track_index)) {
+	prefs_set_string (group, "track_index", prefs->track_index);
+    }
 
     prefs_set_integer (group, "relay_port", prefs->relay_port);
     prefs_set_integer (group, "max_port", prefs->max_port);
     prefs_set_integer (group, "max_connections", prefs->max_connections);
     prefs_set_integer (group, "maxMB_bytes", prefs->maxMB_rip_size);
     prefs_set_integer (group, "maxMB_bytes", prefs->maxMB_rip_size);
+    prefs_set_integer (group, "maxMB_mem_budget", prefs->maxMB_mem_budget);
+    prefs_set_integer (group, "write_buffer_kb", prefs->write_buffer_kb);
+    prefs_set_integer (group, "race_mirrors", prefs->race_mirrors);
     prefs_set_integer (group, "dropcount", prefs->dropcount);
 
     /* Overwrite */
     g_key_file_set_string (m_key_file, group, "over_write_complete", 
 			   overwrite_opt_to_string(prefs->overwrite));
 
+    /* Socket profile */
+    g_key_file_set_string (m_key_file, group, "sock_profile", 
+			   sock_profile_to_string(prefs->sock_profile));
+
+    /* Identical tracks */
+    g_key_file_set_string (m_key_file, group, "dedup", 
+			   dedup_mode_to_string(prefs->dedup));
+
+    /* Syncing to disk */
+    g_key_file_set_string (m_key_file, group, "durability", 
+			   durable_mode_to_string(prefs->durability));
+
     /* Flags */
     prefs_set_integer (group, "auto_reconnect",
 		       OPT_FLAG_ISSET (prefs->flags, OPT_AUTO_RECONNECT));
@@ -841,6 +931,16 @@ prefs_set_stream_prefs_keyfile (STREAM_PREFS* prefs, STREAM_PREFS* gp,
 		       OPT_FLAG_ISSET (prefs->flags, OPT_ADD_ID3V1));
     prefs_set_integer (group, "add_id3v2",
 		       OPT_FLAG_ISSET (prefs->flags, OPT_ADD_ID3V2));
+    prefs_set_integer (group, "hot_standby",
+		       OPT_FLAG_ISSET (prefs->flags, OPT_HOT_STANDBY));
+    prefs_set_integer (group, "tracks_from_show",
+		       OPT_FLAG_ISSET (prefs->flags, OPT_TRACKS_FROM_SHOW));
+    prefs_set_integer (group, "hidden_incomplete",
+		       OPT_FLAG_ISSET (prefs->flags, OPT_HIDDEN_INCOMPLETE));
+    prefs_set_integer (group, "preallocate",
+		       OPT_FLAG_ISSET (prefs->flags, OPT_PREALLOCATE));
+    prefs_set_integer (group, "direct_show",
+		       OPT_FLAG_ISSET (prefs->flags, OPT_DIRECT_SHOW));
 
     /* Splitpoint options */
     prefs_set_integer (group, "xs", prefs->sp_opt.xs);
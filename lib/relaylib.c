@@ -50,6 +50,9 @@
 #include "sr_compat.h"
 #include "rip_manager.h"
 #include "cbuf3.h"
+#include "sink.h"
+#include "memgov.h"
+#include "resolver.h"
 
 #if defined (WIN32)
 #ifdef errno
@@ -62,6 +65,9 @@
 //#define BURST_AMOUNT (64*1024)
 #define BURST_AMOUNT (32*1024)
 
+/* Burst length used when the buffer knows the duration of its chunks */
+#define BURST_MS 2000
+
 
 /*****************************************************************************
  * Private functions
@@ -71,6 +77,14 @@ static error_code try_port (RELAYLIB_INFO* rli, u_short port,
 			    char *if_name, char *relay_ip);
 static void relaylib_send_thread_main (void *arg);
 static error_code relaylib_start_threads (RIP_MANAGER_INFO* rmi);
+static error_code relaylib_sink_open (RIP_MANAGER_INFO* rmi);
+
+/* Relay clients read the buffer at their own pace, each from its own
+   position, so the relay takes no events.  It is a sink so that it
+   is started and stopped with the other outputs. */
+static const Sink_ops relay_sink = {
+    "relay", 0, 0, 0, relaylib_sink_open, NULL, relaylib_stop
+};
 
 #define BUFSIZE (1024)
 
@@ -80,12 +94,14 @@ static error_code relaylib_start_threads (RIP_MANAGER_INFO* rmi);
 
 void
 relaylib_free_relay_client (Relay_client *relay_client,
-			    void * not_used)
+			    Memgov_account *mem_account)
 {
     closesocket (relay_client->m_sock);
     if (relay_client->m_buffer) {
 	free (relay_client->m_buffer);
     }
+    memgov_release (mem_account, MEMGOV_RELAY, 
+		    sizeof(Relay_client) + relay_client->m_buffer_size);
     free (relay_client);
 }
 
@@ -94,7 +110,8 @@ relaylib_free_relay_client_list (RIP_MANAGER_INFO* rmi)
 {
     threadlib_waitfor_sem (&rmi->relay_list_sem);
 
-    g_queue_foreach (rmi->relay_list, (GFunc) relaylib_free_relay_client, 0);
+    g_queue_foreach (rmi->relay_list, (GFunc) relaylib_free_relay_client, 
+		     &rmi->mem_account);
     g_queue_free (rmi->relay_list);
     rmi->relay_list = 0;
 
@@ -255,6 +272,12 @@ catch_pipe(int code)
 }
 #endif
 
+error_code
+relaylib_add_sink (RIP_MANAGER_INFO* rmi)
+{
+    return sink_add (rmi, &relay_sink);
+}
+
 error_code
 relaylib_start (RIP_MANAGER_INFO* rmi,
 		BOOL search_ports, u_short relay_port, u_short max_port, 
@@ -335,7 +358,6 @@ relaylib_start (RIP_MANAGER_INFO* rmi,
 static error_code
 try_port (RELAYLIB_INFO* rli, u_short port, char *if_name, char *relay_ip)
 {
-    struct hostent *he;
     struct sockaddr_in local;
 
     rli->m_listensock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
@@ -349,8 +371,20 @@ try_port (RELAYLIB_INFO* rli, u_short port, char *if_name, char *relay_ip)
 	if (read_interface(if_name,&local.sin_addr.s_addr) != 0)
 	    local.sin_addr.s_addr = htonl(INADDR_ANY);
     } else {
-	he = gethostbyname(relay_ip);
-	memcpy(&local.sin_addr, he->h_addr_list[0], he->h_length);
+	Resolver_addr addrs[RESOLVER_MAX_ADDRS];
+	int i, num_addrs = RESOLVER_MAX_ADDRS;
+	error_code rc = resolver_lookup (relay_ip, addrs, &num_addrs, -1);
+	for (i = 0; rc == SR_SUCCESS && i < num_addrs; i++) {
+	    if (addrs[i].family == AF_INET) {
+		break;
+	    }
+	}
+	if (rc != SR_SUCCESS || i == num_addrs) {
+	    debug_printf ("try_port(%d) can't resolve %s\n", port, relay_ip);
+	    closesocket (rli->m_listensock);
+	    return SR_ERROR_CANT_RESOLVE_HOSTNAME;
+	}
+	memcpy (&local, &addrs[i].addr, sizeof(local));
     }
 
     local.sin_family = AF_INET;
@@ -423,6 +457,27 @@ relaylib_stop (RIP_MANAGER_INFO* rmi)
     debug_printf("relaylib_stop:done!\n");
 }
 
+static error_code
+relaylib_sink_open (RIP_MANAGER_INFO* rmi)
+{
+    u_short new_port = 0;
+    error_code rc;
+
+    rc = relaylib_start (rmi, 
+			 GET_SEARCH_PORTS(rmi->prefs->flags), 
+			 rmi->prefs->relay_port,
+			 rmi->prefs->max_port, 
+			 &new_port,
+			 rmi->prefs->if_name, 
+			 rmi->prefs->max_connections,
+			 rmi->prefs->relay_ip,
+			 rmi->http_info.meta_interval != NO_META_INTERVAL);
+    if (rc == SR_SUCCESS) {
+	rmi->prefs->relay_port = new_port;
+    }
+    return rc;
+}
+
 static error_code
 relaylib_start_threads (RIP_MANAGER_INFO* rmi)
 {
@@ -476,6 +531,7 @@ relay_client_add (RIP_MANAGER_INFO *rmi, int newsock, int client_wants_metadata)
     Relay_client *new_client;
     Cbuf3 *cbuf3 = &rmi->cbuf3;
     int streamripper_gets_metadata;
+    int buffer_size;
 
     if (rmi->http_info.meta_interval == NO_META_INTERVAL) {
 	streamripper_gets_metadata = 0;
@@ -483,10 +539,26 @@ relay_client_add (RIP_MANAGER_INFO *rmi, int newsock, int client_wants_metadata)
 	streamripper_gets_metadata = 1;
     }
 
+    if (streamripper_gets_metadata && client_wants_metadata) {
+	buffer_size = cbuf3->chunk_size + 16*256;
+    } else {
+	buffer_size = cbuf3->chunk_size;
+    }
+
+    /* Relay clients are optional, so they are refused if memory 
+       is tight. */
+    if (memgov_reserve (&rmi->mem_account, MEMGOV_RELAY, 
+			sizeof(Relay_client) + buffer_size) != SR_SUCCESS) {
+	debug_printf ("Refusing new client, memory budget exceeded\n");
+	return 0;
+    }
+
     debug_printf ("Creating new client\n");
     new_client = (Relay_client*) malloc (sizeof (Relay_client));
-    if (new_client != NULL) {
-	int buffer_size;
+    if (new_client == NULL) {
+	memgov_release (&rmi->mem_account, MEMGOV_RELAY, 
+			sizeof(Relay_client) + buffer_size);
+    } else {
 	int burst_amount = BURST_AMOUNT;
 
 	new_client->m_sock = newsock;
@@ -495,11 +567,6 @@ relay_client_add (RIP_MANAGER_INFO *rmi, int newsock, int client_wants_metadata)
 	} else {
 	    new_client->m_icy_metadata = 0;
 	}
-	if (new_client->m_icy_metadata) {
-	    buffer_size = cbuf3->chunk_size + 16*256;
-	} else {
-	    buffer_size = cbuf3->chunk_size;
-	}
 
 	new_client->m_offset = 0;
 	new_client->m_left_to_send = 0;
@@ -514,7 +581,8 @@ relay_client_add (RIP_MANAGER_INFO *rmi, int newsock, int client_wants_metadata)
 	debug_printf ("Pushing relay client onto relay_list\n");
 	g_queue_push_tail (rmi->relay_list, new_client);
 	debug_printf ("Registering relay client with cbuf3\n");
-	cbuf3_initialize_relay_client_ptr (cbuf3, new_client, burst_amount);
+	cbuf3_initialize_relay_client_ptr (cbuf3, new_client, burst_amount,
+					   BURST_MS);
 	threadlib_signal_sem (&rmi->relay_list_sem);
 	debug_printf ("relay_client_add released &rmi->relay_list_sem\n");
     }
@@ -594,6 +662,11 @@ relaylib_accept_thread_main (void *arg)
                     good = FALSE;
                     if (header_receive (newsock, &client_wants_metadata) == 0) {
 			int header_len;
+			Socklib_opts opts;
+			socklib_profile_opts (rmi, 1, &opts);
+			socklib_set_opts (newsock, &opts);
+			socklib_get_opts (newsock, &opts, &rmi->relay_sockopts);
+			socklib_debug_opts ("Relay", &rmi->relay_sockopts);
 			make_nonblocking (newsock);
 			client_http_header = client_relay_header_generate (rmi, client_wants_metadata);
 			header_len = strlen (client_http_header);
@@ -732,7 +805,7 @@ relaylib_send (RIP_MANAGER_INFO* rmi, Relay_client *relay_client)
     if (relay_client->m_cbuf_ptr.node == 0) {
 	error_code rc;
 	rc = cbuf3_initialize_relay_client_ptr (cbuf3, relay_client, 
-						BURST_AMOUNT);
+						BURST_AMOUNT, BURST_MS);
 	if (rc != SR_SUCCESS) {
 	    return;
 	}
@@ -808,7 +881,7 @@ relaylib_disconnect (RIP_MANAGER_INFO* rmi, GList *node)
 
     /* Free memory */
     debug_printf ("Trying free relay_client\n");
-    relaylib_free_relay_client (relay_client, 0);
+    relaylib_free_relay_client (relay_client, &rmi->mem_account);
 
     debug_printf ("Disconnect complete\n");
 }
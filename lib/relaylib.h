@@ -33,6 +33,7 @@
  * Function prototypes
  *****************************************************************************/
 error_code relaylib_set_response_header(char *http_header);
+error_code relaylib_add_sink (RIP_MANAGER_INFO* rmi);
 error_code
 relaylib_start (RIP_MANAGER_INFO* rmi,
 		BOOL search_ports, u_short relay_port, u_short max_port, 
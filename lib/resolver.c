@@ -0,0 +1,477 @@
+/* resolver.c
+ * process-wide host name resolver with a shared cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* Host names are resolved with getaddrinfo by a small pool of worker
+   threads, and the results are shared by all streams.  A lookup for
+   a host which is already being resolved waits for that request
+   instead of starting another one, so when many streams on the same
+   server reconnect at once, only one query goes out.  Failures are
+   cached too, for a shorter time.  getaddrinfo does not report the
+   DNS record TTL, so cached entries live for a fixed time.  A caller
+   waiting for a lookup also watches its abort pipe, so stopping a
+   stream doesn't wait for a slow DNS server. */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#if !WIN32
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#endif
+#include "srtypes.h"
+#include "errors.h"
+#include "threadlib.h"
+#include "resolver.h"
+#include "debug.h"
+
+#define RESOLVER_THREADS	4
+#define RESOLVER_TTL_MS		(5 * 60 * 1000)
+#define RESOLVER_NEGATIVE_TTL_MS	(30 * 1000)
+
+#define ENTRY_PENDING	0
+#define ENTRY_DONE	1
+
+typedef struct resolver_entry Resolver_entry;
+struct resolver_entry
+{
+    char *host;
+    int refcount;
+    int state;
+    error_code rc;
+    guint64 expires_ms;
+    int num_addrs;
+    Resolver_addr addrs[RESOLVER_MAX_ADDRS];
+#if WIN32
+    HSEM done;                  /* Signalled when state is ENTRY_DONE */
+#else
+    int done_pipe[2];           /* Readable once state is ENTRY_DONE */
+#endif
+};
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void resolver_lock (void);
+static void resolver_unlock (void);
+static void resolver_start_threads (void);
+static void resolver_worker (void *arg);
+static void resolver_resolve (Resolver_entry *entry);
+static error_code resolver_entry_init (Resolver_entry *entry);
+static error_code resolver_wait (Resolver_entry *entry, int abort_fd);
+static void resolver_signal_done (Resolver_entry *entry);
+static int
+resolver_fill_addrs (struct addrinfo *res, Resolver_addr *addrs, 
+		     int max_addrs);
+static void resolver_entry_unref (Resolver_entry *entry);
+static gboolean
+resolver_entry_expired (gpointer key, gpointer value, gpointer user_data);
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+static HSEM m_sem;
+static HSEM m_work_sem;
+static int m_initialized = 0;
+static int m_shutdown = 0;
+static int m_num_threads = 0;
+static THREAD_HANDLE m_threads[RESOLVER_THREADS];
+static GHashTable *m_cache = 0;
+static GQueue *m_queue = 0;
+
+static u_long m_num_queries = 0;
+static u_long m_num_hits = 0;
+static u_long m_num_coalesced = 0;
+static u_long m_num_failures = 0;
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+void
+resolver_init (void)
+{
+    if (m_initialized) return;
+    m_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_sem);
+    m_work_sem = threadlib_create_sem ();
+    m_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+				     (GDestroyNotify) resolver_entry_unref);
+    m_queue = g_queue_new ();
+    m_shutdown = 0;
+    m_initialized = 1;
+}
+
+void
+resolver_cleanup (void)
+{
+    int i;
+    Resolver_entry *entry;
+
+    if (!m_initialized) return;
+    resolver_debug_report ();
+
+    /* Workers pass the wakeup along as they exit */
+    resolver_lock ();
+    m_shutdown = 1;
+    resolver_unlock ();
+    threadlib_signal_sem (&m_work_sem);
+    for (i = 0; i < m_num_threads; i++) {
+	threadlib_waitforclose (&m_threads[i]);
+    }
+    m_num_threads = 0;
+
+    while ((entry = g_queue_pop_head (m_queue)) != 0) {
+	resolver_entry_unref (entry);
+    }
+    g_queue_free (m_queue);
+    m_queue = 0;
+    g_hash_table_destroy (m_cache);
+    m_cache = 0;
+
+    threadlib_destroy_sem (&m_work_sem);
+    threadlib_destroy_sem (&m_sem);
+    m_initialized = 0;
+}
+
+/* Resolve host to at most *num_addrs addresses, in the order given
+   by getaddrinfo.  On return, *num_addrs is the number of addresses
+   copied into addrs.  The port of the addresses is zero.  If abort_fd
+   is not -1 and becomes readable while the lookup is pending,
+   SR_ERROR_ABORT_PIPE_SIGNALLED is returned at once. */
+error_code
+resolver_lookup (const char *host, Resolver_addr *addrs, int *num_addrs,
+		 int abort_fd)
+{
+    Resolver_entry *entry;
+    guint64 now;
+    error_code rc;
+    int i;
+
+    if (!host || !addrs || !num_addrs || !m_initialized) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+
+    /* Numeric addresses don't need the cache or a worker */
+    {
+	struct addrinfo hints;
+	struct addrinfo *res = 0;
+	memset (&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	if (getaddrinfo (host, 0, &hints, &res) == 0) {
+	    *num_addrs = resolver_fill_addrs (res, addrs, *num_addrs);
+	    freeaddrinfo (res);
+	    return *num_addrs > 0 ? SR_SUCCESS 
+		    : SR_ERROR_CANT_RESOLVE_HOSTNAME;
+	}
+    }
+
+    now = threadlib_monotonic_ms ();
+    resolver_lock ();
+    entry = (Resolver_entry*) g_hash_table_lookup (m_cache, host);
+    if (entry && entry->state == ENTRY_DONE && entry->expires_ms <= now) {
+	g_hash_table_remove (m_cache, host);
+	entry = 0;
+    }
+
+    if (!entry) {
+	/* Not cached, so queue a request for the workers */
+	g_hash_table_foreach_remove (m_cache, resolver_entry_expired, &now);
+	entry = (Resolver_entry*) calloc (1, sizeof(Resolver_entry));
+	if (!entry) {
+	    resolver_unlock ();
+	    return SR_ERROR_CANT_ALLOC_MEMORY;
+	}
+	rc = resolver_entry_init (entry);
+	if (rc != SR_SUCCESS) {
+	    free (entry);
+	    resolver_unlock ();
+	    return rc;
+	}
+	entry->host = strdup (host);
+	entry->state = ENTRY_PENDING;
+	entry->refcount = 2;		/* Cache and queue */
+	g_hash_table_insert (m_cache, entry->host, entry);
+	g_queue_push_tail (m_queue, entry);
+	m_num_queries++;
+	resolver_start_threads ();
+	threadlib_signal_sem (&m_work_sem);
+    } else if (entry->state == ENTRY_PENDING) {
+	m_num_coalesced++;
+    } else {
+	m_num_hits++;
+    }
+    entry->refcount++;
+
+    if (entry->state == ENTRY_PENDING) {
+	resolver_unlock ();
+	debug_printf ("RESOLVER: waiting for %s\n", host);
+	rc = resolver_wait (entry, abort_fd);
+	resolver_lock ();
+	if (rc != SR_SUCCESS) {
+	    /* The worker finishes the entry for the cache */
+	    debug_printf ("RESOLVER: gave up waiting for %s\n", host);
+	    *num_addrs = 0;
+	    resolver_entry_unref (entry);
+	    resolver_unlock ();
+	    return rc;
+	}
+    }
+
+    rc = entry->rc;
+    if (rc == SR_SUCCESS) {
+	if (*num_addrs > entry->num_addrs) {
+	    *num_addrs = entry->num_addrs;
+	}
+	for (i = 0; i < *num_addrs; i++) {
+	    addrs[i] = entry->addrs[i];
+	}
+    } else {
+	*num_addrs = 0;
+    }
+    resolver_entry_unref (entry);
+    resolver_unlock ();
+    return rc;
+}
+
+void
+resolver_debug_report (void)
+{
+    resolver_lock ();
+    debug_printf ("------ RESOLVER -------\n");
+    debug_printf ("queries = %lu, hits = %lu, coalesced = %lu, "
+		  "failures = %lu, cached = %d\n",
+		  m_num_queries, m_num_hits, m_num_coalesced,
+		  m_num_failures,
+		  m_cache ? g_hash_table_size (m_cache) : 0);
+    resolver_unlock ();
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void
+resolver_lock (void)
+{
+    if (m_initialized) {
+	threadlib_waitfor_sem (&m_sem);
+    }
+}
+
+static void
+resolver_unlock (void)
+{
+    if (m_initialized) {
+	threadlib_signal_sem (&m_sem);
+    }
+}
+
+/* Called with the lock held.  A thread is started when there are 
+   more queued requests than threads, up to RESOLVER_THREADS. */
+static void
+resolver_start_threads (void)
+{
+    if (m_num_threads < RESOLVER_THREADS
+	&& m_num_threads < (int) g_queue_get_length (m_queue)) {
+	threadlib_beginthread (&m_threads[m_num_threads],
+			       resolver_worker, 0);
+	m_num_threads++;
+    }
+}
+
+static void
+resolver_worker (void *arg)
+{
+    Resolver_entry *entry;
+
+    while (1) {
+	threadlib_waitfor_sem (&m_work_sem);
+
+	/* Drain the queue.  The work semaphore is an event on win32,
+	   so one wakeup may stand for several requests. */
+	resolver_lock ();
+	while (!m_shutdown && (entry = g_queue_pop_head (m_queue)) != 0) {
+	    resolver_unlock ();
+	    resolver_resolve (entry);
+	    resolver_lock ();
+	    resolver_entry_unref (entry);
+	}
+	if (m_shutdown) {
+	    resolver_unlock ();
+	    threadlib_signal_sem (&m_work_sem);
+	    break;
+	}
+	resolver_unlock ();
+    }
+}
+
+static void
+resolver_resolve (Resolver_entry *entry)
+{
+    struct addrinfo hints;
+    struct addrinfo *res = 0;
+    int num_addrs = 0;
+    int rc;
+
+    memset (&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+#if defined (AI_ADDRCONFIG)
+    hints.ai_flags = AI_ADDRCONFIG;
+#endif
+
+    debug_printf ("RESOLVER: getaddrinfo (%s)\n", entry->host);
+    rc = getaddrinfo (entry->host, 0, &hints, &res);
+
+    resolver_lock ();
+    if (rc == 0) {
+	num_addrs = resolver_fill_addrs (res, entry->addrs, 
+					 RESOLVER_MAX_ADDRS);
+    }
+    entry->num_addrs = num_addrs;
+    if (num_addrs > 0) {
+	entry->rc = SR_SUCCESS;
+	entry->expires_ms = threadlib_monotonic_ms () + RESOLVER_TTL_MS;
+    } else {
+	debug_printf ("RESOLVER: resolving %s failed (%d)\n",
+		      entry->host, rc);
+	entry->rc = SR_ERROR_CANT_RESOLVE_HOSTNAME;
+	entry->expires_ms = threadlib_monotonic_ms ()
+		+ RESOLVER_NEGATIVE_TTL_MS;
+	m_num_failures++;
+    }
+    entry->state = ENTRY_DONE;
+    resolver_unlock ();
+
+    if (res) {
+	freeaddrinfo (res);
+    }
+    resolver_signal_done (entry);
+}
+
+static error_code
+resolver_entry_init (Resolver_entry *entry)
+{
+#if WIN32
+    entry->done = threadlib_create_sem ();
+#else
+    if (pipe (entry->done_pipe) != 0) {
+	return SR_ERROR_CREATE_PIPE_FAILED;
+    }
+#endif
+    return SR_SUCCESS;
+}
+
+/* Wait until the entry is done, or abort_fd is readable.  There is no 
+   abort pipe on win32. */
+static error_code
+resolver_wait (Resolver_entry *entry, int abort_fd)
+{
+#if WIN32
+    threadlib_waitfor_sem (&entry->done);
+    /* Wake the next thread waiting on this entry */
+    threadlib_signal_sem (&entry->done);
+    return SR_SUCCESS;
+#else
+    while (1) {
+	fd_set fds;
+	int maxfd = entry->done_pipe[0];
+
+	FD_ZERO (&fds);
+	FD_SET (entry->done_pipe[0], &fds);
+	if (abort_fd >= 0) {
+	    FD_SET (abort_fd, &fds);
+	    if (abort_fd > maxfd) {
+		maxfd = abort_fd;
+	    }
+	}
+	if (select (maxfd + 1, &fds, NULL, NULL, NULL) < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return SR_ERROR_SELECT_FAILED;
+	}
+	if (abort_fd >= 0 && FD_ISSET (abort_fd, &fds)) {
+	    return SR_ERROR_ABORT_PIPE_SIGNALLED;
+	}
+	if (FD_ISSET (entry->done_pipe[0], &fds)) {
+	    return SR_SUCCESS;
+	}
+    }
+#endif
+}
+
+/* Wake everyone waiting on the entry.  The byte written to the pipe 
+   is never read, so the pipe stays readable for later waiters. */
+static void
+resolver_signal_done (Resolver_entry *entry)
+{
+#if WIN32
+    threadlib_signal_sem (&entry->done);
+#else
+    char c = 0;
+    while (write (entry->done_pipe[1], &c, 1) < 0 && errno == EINTR)
+	;
+#endif
+}
+
+static int
+resolver_fill_addrs (struct addrinfo *res, Resolver_addr *addrs, 
+		     int max_addrs)
+{
+    struct addrinfo *ai;
+    int num_addrs = 0;
+
+    for (ai = res; ai && num_addrs < max_addrs; ai = ai->ai_next) {
+	Resolver_addr *addr = &addrs[num_addrs];
+	if (ai->ai_addrlen > sizeof(addr->addr)) {
+	    continue;
+	}
+	addr->family = ai->ai_family;
+	addr->addrlen = ai->ai_addrlen;
+	memcpy (&addr->addr, ai->ai_addr, ai->ai_addrlen);
+	num_addrs++;
+    }
+    return num_addrs;
+}
+
+/* Called with the lock held */
+static void
+resolver_entry_unref (Resolver_entry *entry)
+{
+    if (--entry->refcount > 0) {
+	return;
+    }
+#if WIN32
+    threadlib_destroy_sem (&entry->done);
+#else
+    close (entry->done_pipe[0]);
+    close (entry->done_pipe[1]);
+#endif
+    free (entry->host);
+    free (entry);
+}
+
+static gboolean
+resolver_entry_expired (gpointer key, gpointer value, gpointer user_data)
+{
+    Resolver_entry *entry = (Resolver_entry*) value;
+    guint64 now = *(guint64*) user_data;
+    return entry->state == ENTRY_DONE && entry->expires_ms <= now;
+}
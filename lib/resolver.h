@@ -0,0 +1,50 @@
+/* resolver.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__
+
+#if WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+#include "srtypes.h"
+#include "errors.h"
+
+#define RESOLVER_MAX_ADDRS	16
+
+typedef struct resolver_addr Resolver_addr;
+struct resolver_addr
+{
+    int family;
+    int addrlen;
+    struct sockaddr_storage addr;
+};
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+void resolver_init (void);
+void resolver_cleanup (void);
+error_code
+resolver_lookup (const char *host, Resolver_addr *addrs, int *num_addrs,
+		 int abort_fd);
+void resolver_debug_report (void);
+
+#endif
@@ -22,6 +22,7 @@
  *                              int message, void *data));
  *   Functions
  *     void rip_manager_init (void);
+ *     void rip_manager_set_mem_budget (u_long maxMB);
  *     error_code rip_manager_start (RIP_MANAGER_INFO **rmi, 
  *	  STREAM_PREFS *prefs, RIP_MANAGER_CALLBACK status_callback);
  *     void rip_manager_stop (RIP_MANAGER_INFO *rmi);
@@ -56,12 +57,28 @@
 #include "parse.h"
 #include "http.h"
 #include "callback.h"
+#include "memgov.h"
+#include "resolver.h"
+#include "connsched.h"
+#include "track_info.h"
+#include "standby.h"
+#include "bgcopy.h"
+#include "trackindex.h"
+#include "dedup.h"
+#include "durable.h"
+#include "dircache.h"
+#include "sink.h"
+
+/* Times to try replacing the connection before restarting everything */
+#define RESUME_ATTEMPTS 5
 
 /******************************************************************************
  * Private functions
  *****************************************************************************/
 static void ripthread (void *thread_arg);
 static error_code start_ripping (RIP_MANAGER_INFO* rmi);
+static error_code resume_ripping (RIP_MANAGER_INFO* rmi);
+static const char* get_proxy_url (STREAM_PREFS* prefs);
 void destroy_subsystems (RIP_MANAGER_INFO* rmi);
 
 /******************************************************************************
@@ -75,6 +92,27 @@ static const char* overwrite_opt_strings[] = {
     "version"
 };
 
+static const char* sock_profile_strings[] = {
+    "",		// UNKNOWN
+    "none",
+    "normal",
+    "lowlatency"
+};
+
+static const char* dedup_mode_strings[] = {
+    "",		// UNKNOWN
+    "none",
+    "link",
+    "reflink"
+};
+
+static const char* durable_mode_strings[] = {
+    "",		// UNKNOWN
+    "none",
+    "complete",
+    "periodic"
+};
+
 /******************************************************************************
  * Public functions
  *****************************************************************************/
@@ -83,6 +121,24 @@ rip_manager_init (void)
 {
     errors_init ();
     socklib_init();
+    memgov_init ();
+    track_info_init ();
+    resolver_init ();
+    connsched_init ();
+    bgcopy_init ();
+    trackindex_init ();
+    dedup_init ();
+    durable_init ();
+    dircache_init ();
+}
+
+/* The memory budget is shared by all streams, so it is set once for 
+   the process rather than by each stream as it starts.  A budget of 
+   zero means there is no limit. */
+void
+rip_manager_set_mem_budget (u_long maxMB)
+{
+    memgov_set_budget (maxMB * 1024 * 1024);
 }
 
 /** Create a RMI structure and start the ripping thread. 
@@ -111,6 +167,13 @@ rip_manager_start (RIP_MANAGER_INFO **rmip,
 
     register_codesets (rmi, &prefs->cs_opt);
 
+    /* Open the index of completed tracks, shared by all streams */
+    if (prefs->track_index[0]) {
+	if (trackindex_open (prefs->track_index) != SR_SUCCESS) {
+	    debug_printf ("Can't open track index %s\n", prefs->track_index);
+	}
+    }
+
     /* From select() man page:
        On systems that lack pselect() reliable (and more
        portable)  signal  trapping  can  be achieved using the self-pipe trick
@@ -134,6 +197,8 @@ rip_manager_start (RIP_MANAGER_INFO **rmip,
        But he has no cleanup routine to call! */
     init_metadata_parser (rmi, prefs->rules_file);
 
+    memgov_register (&rmi->mem_account, prefs->url);
+
     /* Start the ripping thread */
     debug_printf ("Pre ripthread: %s\n", rmi->prefs->url);
     rmi->started = 1;
@@ -180,6 +245,9 @@ rip_manager_stop (RIP_MANAGER_INFO *rmi)
     threadlib_waitforclose(&rmi->hthread_ripper);
     debug_printf ("Destroying subsystems...\n");
     destroy_subsystems (rmi);
+    http_clear_sc_header (&rmi->http_info);
+    memgov_debug_report ();
+    memgov_unregister (&rmi->mem_account);
     debug_printf ("Destroying m_started_sem\n");
     threadlib_destroy_sem(&rmi->started_sem);
     debug_printf ("Done with rip_manager_stop\n");
@@ -195,7 +263,16 @@ rip_manager_stop (RIP_MANAGER_INFO *rmi)
 void
 rip_manager_cleanup (void)
 {
+    bgcopy_cleanup ();
+    durable_cleanup ();
+    dircache_cleanup ();
+    trackindex_cleanup ();
+    dedup_cleanup ();
     socklib_cleanup();
+    memgov_cleanup ();
+    track_info_cleanup ();
+    connsched_cleanup ();
+    resolver_cleanup ();
 }
 
 
@@ -213,6 +290,25 @@ debug_ripthread (RIP_MANAGER_INFO* rmi)
     debug_printf ("status = %d\n", rmi->status);
     debug_printf ("track_count = %d\n", rmi->track_count);
     debug_printf ("external_process = %p\n", rmi->ep);
+
+    /* Bytes held by an idle stream, before any audio is buffered */
+    debug_printf ("------ STREAM FOOTPRINT -------\n");
+    debug_printf ("sizeof(RIP_MANAGER_INFO) = %lu\n", 
+		  (u_long) sizeof(RIP_MANAGER_INFO));
+    debug_printf ("sizeof(STREAM_PREFS) = %lu\n", 
+		  (u_long) sizeof(STREAM_PREFS));
+    debug_printf ("sizeof(SR_HTTP_HEADER) = %lu (+%lu heap)\n", 
+		  (u_long) sizeof(SR_HTTP_HEADER),
+		  http_sc_header_heap_bytes (&rmi->http_info));
+    debug_printf ("sizeof(FILELIB_INFO) = %lu\n", 
+		  (u_long) sizeof(FILELIB_INFO));
+    debug_printf ("sizeof(TRACK_INFO) = %lu\n", 
+		  (u_long) sizeof(TRACK_INFO));
+    debug_printf ("sizeof(Writer) = %lu\n", 
+		  (u_long) sizeof(Writer));
+    debug_printf ("bytes per idle stream = %lu\n", 
+		  (u_long) (sizeof(RIP_MANAGER_INFO) + sizeof(STREAM_PREFS))
+		  + http_sc_header_heap_bytes (&rmi->http_info));
 }
 
 /** Main function launched by ripping thread.
@@ -225,6 +321,8 @@ static void
 ripthread (void *thread_arg)
 {
     error_code ret;
+    guint64 backoff_ms;
+    int i;
     RIP_MANAGER_INFO* rmi = (RIP_MANAGER_INFO*) thread_arg;
     debug_ripthread (rmi);
     debug_stream_prefs (rmi->prefs);
@@ -270,11 +368,22 @@ ripthread (void *thread_arg)
 	else if ((ret == SR_ERROR_RECV_FAILED || 
 		  ret == SR_ERROR_TIMEOUT || 
 		  ret == SR_ERROR_NO_TRACK_INFO || 
-		  ret == SR_ERROR_SELECT_FAILED) && 
+		  ret == SR_ERROR_SELECT_FAILED ||
+		  ret == SR_ERROR_SOURCE_TOO_SLOW) && 
 		 GET_AUTO_RECONNECT (rmi->prefs->flags)) {
 	    /* Try to reconnect */
 	    callback_post_status (rmi, RM_STATUS_RECONNECTING);
-	    while (rmi->started) {
+	    backoff_ms = 0;
+
+	    /* First try to replace only the connection, keeping the 
+	       buffers, the relay clients and the current track */
+	    for (i = 0; i < RESUME_ATTEMPTS && rmi->started; i++) {
+		ret = resume_ripping (rmi);
+		if (ret == SR_SUCCESS || ret == SR_ERROR_STREAM_CHANGED)
+		    break;
+		connsched_backoff (rmi, &backoff_ms);
+	    }
+	    while (ret != SR_SUCCESS && rmi->started) {
 		socklib_close(&rmi->stream_sock);
 		if (rmi->ep) {
 		    debug_printf ("Close external\n");
@@ -284,7 +393,7 @@ ripthread (void *thread_arg)
 		ret = start_ripping (rmi);
 		if (ret == SR_SUCCESS)
 		    break;
-		Sleep(1000);
+		connsched_backoff (rmi, &backoff_ms);
 	    }
 	    if (!rmi->started) {
 		break;
@@ -320,8 +429,9 @@ ripthread (void *thread_arg)
 void
 destroy_subsystems (RIP_MANAGER_INFO* rmi)
 {
+    standby_stop (rmi);
     ripstream_destroy (rmi);
-    relaylib_stop (rmi);
+    sink_stop_all (rmi);
     /* GCS Feb 17,2008.  The socklib_cleanup() is done at program 
        shutdown, not rip_manager shutdown. */
     // socklib_cleanup();
@@ -354,14 +464,10 @@ create_pls_file (RIP_MANAGER_INFO* rmi)
     return 0;
 }
 
-static error_code
-start_ripping (RIP_MANAGER_INFO* rmi)
+static const char*
+get_proxy_url (STREAM_PREFS* prefs)
 {
-    STREAM_PREFS* prefs = rmi->prefs;
-    error_code ret;
-
     const char *pproxy = prefs->proxyurl[0] ? prefs->proxyurl : NULL;
-    debug_printf ("start_ripping: checkpoint 1\n");
 
     /* If proxy URL not spec'd on command line (or plugin field), 
        check the environment variable */
@@ -372,6 +478,54 @@ start_ripping (RIP_MANAGER_INFO* rmi)
 	    debug_printf ("Getting proxy from $http_proxy: %s\n", pproxy);
 	}
     }
+    return pproxy;
+}
+
+/* Replace the stream connection, keeping everything else.  The new 
+   connection must carry the same kind of stream.  The first block 
+   read from it is realigned on a frame or page boundary, and spliced 
+   onto the cbuf.  Returns SR_ERROR_STREAM_CHANGED if the stream has 
+   changed, and a full restart is needed. */
+static error_code
+resume_ripping (RIP_MANAGER_INFO* rmi)
+{
+    STREAM_PREFS* prefs = rmi->prefs;
+    SR_HTTP_HEADER info;
+    error_code ret;
+
+    debug_printf ("resume_ripping\n");
+    socklib_close (&rmi->stream_sock);
+    memset (&info, 0, sizeof(SR_HTTP_HEADER));
+    ret = http_sc_connect (rmi, &rmi->stream_sock, prefs->url, 
+			   get_proxy_url (prefs), &info, 
+			   prefs->useragent, prefs->if_name);
+    if (ret == SR_SUCCESS 
+	&& (info.content_type != rmi->http_info.content_type 
+	    || info.meta_interval != rmi->meta_interval)) {
+	debug_printf ("resume_ripping: stream has changed\n");
+	socklib_close (&rmi->stream_sock);
+	ret = SR_ERROR_STREAM_CHANGED;
+    }
+    http_clear_sc_header (&info);
+    if (ret != SR_SUCCESS) {
+	return ret;
+    }
+
+    ripstream_new_connection (rmi);
+    rmi->rate_started = 0;
+    rmi->source_too_slow = 0;
+    callback_post_status (rmi, RM_STATUS_BUFFERING);
+    return SR_SUCCESS;
+}
+
+static error_code
+start_ripping (RIP_MANAGER_INFO* rmi)
+{
+    STREAM_PREFS* prefs = rmi->prefs;
+    error_code ret;
+
+    const char *pproxy = get_proxy_url (prefs);
+    debug_printf ("start_ripping: checkpoint 1\n");
 
     debug_printf ("start_ripping: checkpoint 2\n");
 
@@ -387,7 +541,8 @@ start_ripping (RIP_MANAGER_INFO* rmi)
     /* If the icy_name exists, but is empty, set to a bogus name so 
        that we can create the directory correctly, etc. */
     if (strlen(rmi->http_info.icy_name) == 0) {
-	strcpy (rmi->http_info.icy_name, "Streamripper_rips");
+	g_free (rmi->http_info.icy_name);
+	rmi->http_info.icy_name = g_strdup ("Streamripper_rips");
     }
 
     /* Set the ripinfo struct from the data we now know about the 
@@ -397,8 +552,9 @@ start_ripping (RIP_MANAGER_INFO* rmi)
     rmi->http_bitrate = rmi->http_info.icy_bitrate;
     rmi->detected_bitrate = -1;
     rmi->bitrate = -1;
-    strcpy (rmi->streamname, rmi->http_info.icy_name);
-    strcpy (rmi->server_name, rmi->http_info.server);
+    sr_strncpy (rmi->streamname, rmi->http_info.icy_name, 
+		MAX_STREAMNAME_LEN);
+    sr_strncpy (rmi->server_name, rmi->http_info.server, MAX_SERVER_LEN);
 
     /* Initialize file writing code. */
     ret = filelib_init
@@ -433,7 +589,7 @@ start_ripping (RIP_MANAGER_INFO* rmi)
     }
 
     /* Allocate buffers for ripstream */
-    strcpy(rmi->no_meta_name, rmi->http_info.icy_name);
+    sr_strncpy (rmi->no_meta_name, rmi->http_info.icy_name, MAX_TRACK_LEN);
     rmi->getbuffer = 0;
     ret = ripstream_init(rmi);
     if (ret != SR_SUCCESS) {
@@ -441,31 +597,31 @@ start_ripping (RIP_MANAGER_INFO* rmi)
 	goto RETURN_ERR;
     }
 
+    /* Feed the show file and cue sheet from the stream */
+    ret = filelib_add_sinks (rmi);
+    if (ret != SR_SUCCESS) {
+	goto RETURN_ERR;
+    }
+
     /* Launch relay server threads */
     debug_printf ("start_ripping: checkpoint 3\n");
     if (GET_MAKE_RELAY (rmi->prefs->flags)) {
-	u_short new_port = 0;
-	ret = relaylib_start (rmi, 
-			      GET_SEARCH_PORTS(rmi->prefs->flags), 
-			      rmi->prefs->relay_port,
-			      rmi->prefs->max_port, 
-			      &new_port,
-			      rmi->prefs->if_name, 
-			      rmi->prefs->max_connections,
-			      rmi->prefs->relay_ip,
-			      rmi->http_info.meta_interval != NO_META_INTERVAL);
+	ret = relaylib_add_sink (rmi);
 	if (ret != SR_SUCCESS) {
 	    goto RETURN_ERR;
 	}
 
-	rmi->prefs->relay_port = new_port;
-
 	/* Create pls file with address of relay stream */
 	if (0 != rmi->prefs->pls_file[0]) {
 	    create_pls_file (rmi);
 	}
     }
 
+    /* Open the second connection, which is used if this one stalls */
+    if (GET_HOT_STANDBY (rmi->prefs->flags)) {
+	standby_start (rmi, pproxy);
+    }
+
     /* Done. */
     debug_printf ("start_ripping: checkpoint 4\n");
     callback_post_status (rmi, RM_STATUS_BUFFERING);
@@ -500,3 +656,57 @@ overwrite_opt_to_string (enum OverwriteOpt oo)
 {
     return overwrite_opt_strings[(int) oo];
 }
+
+enum SockProfile
+string_to_sock_profile (char* str)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+	if (strcmp(str, sock_profile_strings[i]) == 0) {
+	    return i;
+	}
+    }
+    return SOCK_PROFILE_UNKNOWN;
+}
+
+const char*
+sock_profile_to_string (enum SockProfile sp)
+{
+    return sock_profile_strings[(int) sp];
+}
+
+enum DedupMode
+string_to_dedup_mode (char* str)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+	if (strcmp(str, dedup_mode_strings[i]) == 0) {
+	    return i;
+	}
+    }
+    return DEDUP_UNKNOWN;
+}
+
+const char*
+dedup_mode_to_string (enum DedupMode dm)
+{
+    return dedup_mode_strings[(int) dm];
+}
+
+enum DurableMode
+string_to_durable_mode (char* str)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+	if (strcmp(str, durable_mode_strings[i]) == 0) {
+	    return i;
+	}
+    }
+    return DURABLE_UNKNOWN;
+}
+
+const char*
+durable_mode_to_string (enum DurableMode dm)
+{
+    return durable_mode_strings[(int) dm];
+}
@@ -47,6 +47,11 @@
 #define OPT_EXTERNAL_CMD	0x00004000	// use external command to get metadata?
 #define OPT_ADD_ID3V1		0x00008000	// Add ID3V1
 #define OPT_ADD_ID3V2		0x00010000	// Add ID3V2
+#define OPT_HOT_STANDBY		0x00020000	// keep a second connection to switch to
+#define OPT_TRACKS_FROM_SHOW	0x00040000	// copy tracks out of the show file
+#define OPT_HIDDEN_INCOMPLETE	0x00080000	// write tracks to unnamed files until finished
+#define OPT_PREALLOCATE		0x00100000	// reserve disk space for output files
+#define OPT_DIRECT_SHOW		0x00200000	// write the show file with O_DIRECT
 
 #define OPT_FLAG_ISSET(flags, opt)	    ((flags & opt) > 0)
 // #define OPT_FLAG_SET(flags, opt)	    (flags =| opt)
@@ -67,12 +72,18 @@
 #define GET_EXTERNAL_CMD(flags)			(OPT_FLAG_ISSET(flags, OPT_EXTERNAL_CMD))
 #define GET_ADD_ID3V1(flags)			(OPT_FLAG_ISSET(flags, OPT_ADD_ID3V1))
 #define GET_ADD_ID3V2(flags)			(OPT_FLAG_ISSET(flags, OPT_ADD_ID3V2))
+#define GET_HOT_STANDBY(flags)			(OPT_FLAG_ISSET(flags, OPT_HOT_STANDBY))
+#define GET_TRACKS_FROM_SHOW(flags)		(OPT_FLAG_ISSET(flags, OPT_TRACKS_FROM_SHOW))
+#define GET_HIDDEN_INCOMPLETE(flags)		(OPT_FLAG_ISSET(flags, OPT_HIDDEN_INCOMPLETE))
+#define GET_PREALLOCATE(flags)			(OPT_FLAG_ISSET(flags, OPT_PREALLOCATE))
+#define GET_DIRECT_SHOW(flags)			(OPT_FLAG_ISSET(flags, OPT_DIRECT_SHOW))
 
 /* Public functions */
 char *rip_manager_get_error_str(int code);
 //u_short rip_mananger_get_relay_port();	
 void set_rip_manager_options_defaults (STREAM_PREFS *m_opt);
 void rip_manager_init (void);
+void rip_manager_set_mem_budget (u_long maxMB);
 error_code rip_manager_start (RIP_MANAGER_INFO **rmi, STREAM_PREFS *prefs,
 			      RIP_MANAGER_CALLBACK status_callback);
 void rip_manager_stop (RIP_MANAGER_INFO *rmi);
@@ -86,6 +97,15 @@ error_code rip_manager_end_track (RIP_MANAGER_INFO* rmi, TRACK_INFO* ti);
 const char*
 overwrite_opt_to_string (enum OverwriteOpt oo);
 enum OverwriteOpt string_to_overwrite_opt (char* str);
+const char*
+sock_profile_to_string (enum SockProfile sp);
+enum SockProfile string_to_sock_profile (char* str);
+const char*
+dedup_mode_to_string (enum DedupMode dm);
+enum DedupMode string_to_dedup_mode (char* str);
+const char*
+durable_mode_to_string (enum DurableMode dm);
+enum DurableMode string_to_durable_mode (char* str);
 int rip_manager_get_content_type (RIP_MANAGER_INFO* rmi);
 
 #endif //__RIP_MANANGER_H__
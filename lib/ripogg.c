@@ -429,6 +429,31 @@ vorbis_end (stream_processor *stream)
     vorbis_info_clear (&inf->vi);
 
     free (stream->data);
+    stream->data = 0;
+}
+
+/* Add the playback time of the current page to rmi->ogg_stream_ms.  
+   The granule position is the sample count at the end of the page, 
+   and restarts with each logical stream. */
+static void
+ripogg_add_page_time (RIP_MANAGER_INFO* rmi)
+{
+    misc_vorbis_info *inf = rmi->stream.data;
+    ogg_int64_t gp;
+
+    if (ogg_page_bos (&rmi->ogg_pg)) {
+	rmi->ogg_granulepos = 0;
+    }
+    if (!inf || inf->vi.rate <= 0) {
+	return;
+    }
+    gp = ogg_page_granulepos (&rmi->ogg_pg);
+    if (gp < 0 || (guint64) gp < rmi->ogg_granulepos) {
+	return;
+    }
+    rmi->ogg_stream_ms += (guint64) gp * 1000 / inf->vi.rate
+	    - rmi->ogg_granulepos * 1000 / inf->vi.rate;
+    rmi->ogg_granulepos = (guint64) gp;
 }
 
 static void
@@ -494,7 +519,7 @@ ripogg_process_chunk (RIP_MANAGER_INFO* rmi,
         Ogg_page_reference *opr;
         opr = (Ogg_page_reference*) cbuf3->ogg_page_refs->tail->data;
         cbuf3_pointer_add (cbuf3, &cbuf3_page_loc,
-	    &opr->m_cbuf3_loc, opr->m_page_len);
+	    &opr->m_cbuf3_loc, opr->m_page_len + rmi->ogg_skipped);
     }
     debug_printf ("cbuf3_page_loc initialized to (%p,%d)\n",
 	cbuf3_page_loc.node, cbuf3_page_loc.offset);
@@ -504,8 +529,20 @@ ripogg_process_chunk (RIP_MANAGER_INFO* rmi,
     ogg_sync_wrote (&rmi->ogg_sync, size);
 
     do {
-	debug_printf ("Looping on ogg_sync_pageout.\n");
-        switch (ret = ogg_sync_pageout (&rmi->ogg_sync, &rmi->ogg_pg)) {
+	debug_printf ("Looping on ogg_sync_pageseek.\n");
+	/* Like ogg_sync_pageout, but tells how many bytes were skipped, 
+	   so the pages after a hole (such as a switch to the standby 
+	   connection) are still found in the cbuf */
+	ret = ogg_sync_pageseek (&rmi->ogg_sync, &rmi->ogg_pg);
+	if (ret < 0) {
+	    rmi->ogg_skipped += -ret;
+	    cbuf3_pointer_add (cbuf3, &cbuf3_page_loc, &cbuf3_page_loc, -ret);
+	    ret = -1;
+	} else if (ret > 0) {
+	    rmi->ogg_skipped = 0;
+	    ret = 1;
+	}
+        switch (ret) {
         case - 1:
             /* -1 if we were not properly synced and had to skip some bytes */
             debug_printf ("Hole in ogg, skipping bytes\n");
@@ -536,6 +573,7 @@ ripogg_process_chunk (RIP_MANAGER_INFO* rmi,
                 }
             }
             header = vorbis_process (rmi, &rmi->stream, &rmi->ogg_pg, ti);
+            ripogg_add_page_time (rmi);
             if (ogg_page_eos (&rmi->ogg_pg)) {
                 debug_printf ("Calling vorbis_end\n");
                 vorbis_end (&rmi->stream);
@@ -705,6 +743,7 @@ ripogg_init (RIP_MANAGER_INFO* rmi)
     memset (&rmi->stream, 0, sizeof(stream_processor));
     rmi->ogg_curr_header = 0;
     rmi->ogg_curr_header_len = 0;
+    rmi->ogg_skipped = 0;
 }
 
 #else
@@ -731,3 +770,20 @@ ripogg_init (RIP_MANAGER_INFO* rmi)
 }
 
 #endif /* OGG_VORBIS_FOUND */
+
+/* Return the offset of the first ogg page in the buffer, or -1 if 
+   there is none.  This doesn't need libogg, so it is used to realign 
+   the stream on a new connection even without ogg support. */
+long
+ripogg_find_page_start (const char* buf, long size)
+{
+    long pos;
+
+    for (pos = 0; pos + 5 <= size; pos++) {
+	/* Capture pattern, then stream structure version 0 */
+	if (!memcmp (&buf[pos], "OggS", 4) && buf[pos + 4] == 0) {
+	    return pos;
+	}
+    }
+    return -1;
+}
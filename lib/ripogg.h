@@ -25,5 +25,6 @@ void ripogg_process_chunk (RIP_MANAGER_INFO* rmi,
 			   const char* chunk, 
 			   u_long size,
 			   TRACK_INFO* ti);
+long ripogg_find_page_start (const char* buf, long size);
 
 #endif
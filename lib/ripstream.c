@@ -40,12 +40,29 @@
 #include "ripogg.h"
 #include "track_info.h"
 #include "callback.h"
+#include "threadlib.h"
+#include "standby.h"
+
+/* How often the delivery rate of a raced mirror is checked */
+#define RATE_WINDOW_MS (60 * 1000)
+
+/* Blocks dropped while looking for a frame or page after a new 
+   connection, before giving up and splicing it as it is */
+#define RESYNC_MAX_BLOCKS 4
 
 /*****************************************************************************
  * Private functions
  *****************************************************************************/
 static int
 ripstream_recvall (RIP_MANAGER_INFO* rmi, char* buffer, int size);
+static error_code
+ripstream_get_block (RIP_MANAGER_INFO* rmi, char *data_buf, u_long have, 
+		     char *track_buf);
+static error_code
+ripstream_resync (RIP_MANAGER_INFO* rmi, char *data_buf, char *track_buf);
+static void
+ripstream_check_source_rate (RIP_MANAGER_INFO* rmi, int bytes, 
+			     guint64 recv_ms);
 static error_code get_track_from_metadata (RIP_MANAGER_INFO* rmi, 
 					   int size, char *newtrack);
 
@@ -75,10 +92,19 @@ ripstream_init (RIP_MANAGER_INFO* rmi)
     rmi->getbuffer_size = (rmi->meta_interval == NO_META_INTERVAL) 
 	    ? DEFAULT_META_INTERVAL : rmi->meta_interval;
 
-    track_info_clear (&rmi->old_track);
-    track_info_clear (&rmi->new_track);
+    track_record_set (&rmi->old_track, 0);
+    track_record_set (&rmi->new_track, 0);
     track_info_clear (&rmi->current_track);
     rmi->ripstream_first_time_through = 1;
+    memset (&rmi->mp3_scan, 0, sizeof (Mp3_scan));
+    rmi->ogg_granulepos = 0;
+    rmi->ogg_stream_ms = 0;
+    rmi->adapt_bytes = 0;
+    rmi->adapt_time_us = 0;
+    rmi->rate_started = 0;
+    rmi->source_too_slow = 0;
+    rmi->resync_pending = 0;
+    rmi->carry_len = 0;
 
     if ((rmi->getbuffer = malloc (rmi->getbuffer_size)) == NULL)
 	return SR_ERROR_CANT_ALLOC_MEMORY;
@@ -89,6 +115,11 @@ ripstream_init (RIP_MANAGER_INFO* rmi)
 
     memset (&rmi->cbuf3, 0, sizeof (Cbuf3));
 
+    /* Ogg tracks are written as their pages are completed, mp3
+       tracks as the chunks leave the buffer */
+    if (rmi->http_info.content_type != CONTENT_TYPE_OGG) {
+	return ripstream_mp3_add_sink (rmi);
+    }
     return SR_SUCCESS;
 }
 
@@ -105,8 +136,8 @@ ripstream_clear(RIP_MANAGER_INFO* rmi)
     rmi->cbuf2_size = 0;
     cbuf3_destroy (&rmi->cbuf3);
 
-    track_info_clear (&rmi->old_track);
-    track_info_clear (&rmi->new_track);
+    track_record_set (&rmi->old_track, 0);
+    track_record_set (&rmi->new_track, 0);
     track_info_clear (&rmi->current_track);
 
     rmi->ripstream_first_time_through = 1;
@@ -126,10 +157,17 @@ ripstream_destroy (RIP_MANAGER_INFO* rmi)
     rmi->find_silence = -1;
     rmi->cbuf2_size = 0;
 
+    /* Unfinished tracks are left in the incomplete directory */
+    if (rmi->cbuf3.write_list) {
+	GList *p;
+	for (p = rmi->cbuf3.write_list->head; p; p = p->next) {
+	    filelib_abandon (rmi, (Writer*) p->data);
+	}
+    }
     cbuf3_destroy (&rmi->cbuf3);
 
-    track_info_clear (&rmi->old_track);
-    track_info_clear (&rmi->new_track);
+    track_record_set (&rmi->old_track, 0);
+    track_record_set (&rmi->new_track, 0);
     track_info_clear (&rmi->current_track);
 
     rmi->ripstream_first_time_through = 1;
@@ -137,50 +175,57 @@ ripstream_destroy (RIP_MANAGER_INFO* rmi)
     rmi->track_count = 0;
 }
 
-/* Data followed by meta-data */
+/* Read the next block of the stream.  If the connection stalls or 
+   fails and a standby connection is ready, the block is read from 
+   the standby instead.  After a new connection, the block is 
+   realigned on a frame or page boundary. */
 error_code
 ripstream_get_data (RIP_MANAGER_INFO* rmi, char *data_buf, char *track_buf)
 {
-    int ret = 0;
-    char c;
-    char newtrack[MAX_TRACK_LEN];
-
-    *track_buf = 0;
-    rmi->current_track.have_track_info = 0;
-    debug_printf ("ripstream_recvall (%p, %d)\n", 
-		  data_buf, 
-		  rmi->getbuffer_size);
-    ret = ripstream_recvall (rmi, data_buf, rmi->getbuffer_size);
-    debug_printf ("ripstream_recvall (ret = %d)\n", ret);
-    if (ret <= 0)
-	return ret;
+    error_code ret;
 
-    if (rmi->meta_interval == NO_META_INTERVAL) {
-	return SR_SUCCESS;
+    /* The last block was read in full before the source was found 
+       to be too slow, so nothing is lost by reconnecting now */
+    if (rmi->source_too_slow) {
+	rmi->source_too_slow = 0;
+	return SR_ERROR_SOURCE_TOO_SLOW;
     }
 
-    if ((ret = ripstream_recvall (rmi, &c, 1)) <= 0)
-	return ret;
+    standby_check (rmi);
+    if (rmi->carry_len) {
+	memcpy (data_buf, rmi->getbuffer, rmi->carry_len);
+    }
+    ret = ripstream_get_block (rmi, data_buf, rmi->carry_len, track_buf);
+    if ((ret == SR_ERROR_RECV_FAILED || ret == SR_ERROR_TIMEOUT 
+	 || ret == SR_ERROR_SELECT_FAILED)
+	&& standby_take_over (rmi) == SR_SUCCESS) {
+	debug_printf ("Switched to standby connection\n");
+	/* The standby was drained in blocks, so the block read next 
+	   starts in the middle of a frame or page */
+	ripstream_new_connection (rmi);
+	ret = ripstream_get_block (rmi, data_buf, 0, track_buf);
+    }
+    if (ret == SR_SUCCESS && rmi->resync_pending) {
+	ret = ripstream_resync (rmi, data_buf, track_buf);
+    }
+    return ret;
+}
 
-    debug_printf ("METADATA LEN: %d\n",(int)c);
-    if (c < 0) {
-	debug_printf ("Got invalid metadata: %d\n",c);
-	return SR_ERROR_INVALID_METADATA;
-    } else if (c == 0) {
-	/* We didn't get any metadata this time. */
-	return SR_SUCCESS;
-    } else {
-	/* We got metadata this time. */
-	ret = get_track_from_metadata (rmi, c * 16, newtrack);
-	if (ret != SR_SUCCESS) {
-	    debug_printf("get_trackname had a bad return %d\n", ret);
-	    return ret;
-	}
+/* The next block comes from a new connection, which starts in the 
+   middle of a frame or page.  The carried bytes of the old 
+   connection are dropped, and the new one is realigned when its 
+   first block is read.  Only mp3 and ogg streams can be realigned. */
+void
+ripstream_new_connection (RIP_MANAGER_INFO* rmi)
+{
+    int content_type = rmi->http_info.content_type;
 
-	strncpy(track_buf, newtrack, MAX_TRACK_LEN);
-	rmi->current_track.have_track_info = 1;
+    rmi->carry_len = 0;
+    rmi->resync_pending = (content_type == CONTENT_TYPE_MP3 
+			   || content_type == CONTENT_TYPE_OGG);
+    if (content_type != CONTENT_TYPE_OGG) {
+	mp3_scan_resync (&rmi->mp3_scan);
     }
-    return SR_SUCCESS;
 }
 
 error_code
@@ -217,7 +262,7 @@ ripstream_put_data (RIP_MANAGER_INFO *rmi, char *buf, int size)
 error_code
 ripstream_queue_writer (
     RIP_MANAGER_INFO* rmi, 
-    TRACK_INFO* ti, 
+    Track_record* ti, 
     Cbuf3_pointer start_byte
 )
 {
@@ -244,7 +289,7 @@ ripstream_queue_writer (
     /* Initialize writer */
     memset (writer, 0, sizeof(Writer));
     writer->m_next_byte = start_byte;
-    track_info_copy (&writer->m_ti, ti);
+    writer->m_ti = track_record_ref (ti);
     writer->m_track_no = rmi->track_count;
 
     /* Update track count */
@@ -272,7 +317,7 @@ ripstream_queue_writer (
 }
 
 error_code
-ripstream_start_track (RIP_MANAGER_INFO* rmi, TRACK_INFO* ti)
+ripstream_start_track (RIP_MANAGER_INFO* rmi, Track_record* ti)
 {
     error_code rc;
 
@@ -313,6 +358,8 @@ ripstream_end_track (RIP_MANAGER_INFO* rmi, Writer *writer)
 	if (rc != SR_SUCCESS) {
 	    return rc;
 	}
+    } else {
+	filelib_abandon (rmi, writer);
     }
 
     /* Post status */
@@ -330,12 +377,136 @@ ripstream_end_track (RIP_MANAGER_INFO* rmi, Writer *writer)
 /******************************************************************************
  * Private functions
  *****************************************************************************/
+/* Shift the first block of a new connection to start on a frame or 
+   page boundary.  The bytes before the boundary are dropped, and the 
+   block is filled up from the next one.  The rest of that block is 
+   carried into the next chunk, and so on. */
+static error_code
+ripstream_resync (RIP_MANAGER_INFO* rmi, char *data_buf, char *track_buf)
+{
+    long size = rmi->getbuffer_size;
+    long off = -1;
+    char saved_track[MAX_TRACK_LEN];
+    int have_saved = 0;
+    error_code ret;
+    int i;
+
+    rmi->resync_pending = 0;
+    for (i = 0; i < RESYNC_MAX_BLOCKS; i++) {
+	if (rmi->http_info.content_type == CONTENT_TYPE_OGG) {
+	    off = ripogg_find_page_start (data_buf, size);
+	} else {
+	    off = find_frame_start (data_buf, size);
+	}
+	if (off >= 0) {
+	    break;
+	}
+
+	/* Drop the whole block, but not its metadata */
+	debug_printf ("ripstream_resync: no frame or page in block\n");
+	if (rmi->current_track.have_track_info) {
+	    strncpy (saved_track, track_buf, MAX_TRACK_LEN);
+	    have_saved = 1;
+	}
+	ret = ripstream_get_block (rmi, data_buf, 0, track_buf);
+	if (ret != SR_SUCCESS) {
+	    return ret;
+	}
+    }
+    if (off <= 0) {
+	/* Already aligned, or there is nothing to align to */
+	return SR_SUCCESS;
+    }
+
+    debug_printf ("ripstream_resync: dropped %ld bytes\n", off);
+    if (rmi->current_track.have_track_info) {
+	strncpy (saved_track, track_buf, MAX_TRACK_LEN);
+	have_saved = 1;
+    }
+    memmove (data_buf, data_buf + off, size - off);
+    ret = ripstream_get_block (rmi, data_buf, size - off, track_buf);
+    if (ret != SR_SUCCESS) {
+	return ret;
+    }
+    if (have_saved && !rmi->current_track.have_track_info) {
+	strncpy (track_buf, saved_track, MAX_TRACK_LEN);
+	rmi->current_track.have_track_info = 1;
+    }
+    return SR_SUCCESS;
+}
+
+/* Data followed by meta-data.  The first have bytes of data_buf are 
+   already filled, so the last have bytes of the block are kept in 
+   getbuffer for the next chunk. */
+static error_code
+ripstream_get_block (RIP_MANAGER_INFO* rmi, char *data_buf, u_long have, 
+		     char *track_buf)
+{
+    int ret = 0;
+    char c;
+    char newtrack[MAX_TRACK_LEN];
+    guint64 recv_start;
+
+    *track_buf = 0;
+    rmi->current_track.have_track_info = 0;
+    debug_printf ("ripstream_recvall (%p, %d)\n", 
+		  data_buf, 
+		  rmi->getbuffer_size);
+    recv_start = threadlib_monotonic_ms ();
+    ret = ripstream_recvall (rmi, data_buf + have, 
+			     rmi->getbuffer_size - have);
+    debug_printf ("ripstream_recvall (ret = %d)\n", ret);
+    if (ret <= 0)
+	return ret;
+    if (have) {
+	ret = ripstream_recvall (rmi, rmi->getbuffer, have);
+	if (ret <= 0)
+	    return ret;
+	rmi->carry_len = have;
+    }
+
+    ripstream_check_source_rate (rmi, rmi->getbuffer_size, 
+				 threadlib_monotonic_ms () - recv_start);
+
+    if (rmi->meta_interval == NO_META_INTERVAL) {
+	return SR_SUCCESS;
+    }
+
+    if ((ret = ripstream_recvall (rmi, &c, 1)) <= 0)
+	return ret;
+
+    debug_printf ("METADATA LEN: %d\n",(int)c);
+    if (c < 0) {
+	debug_printf ("Got invalid metadata: %d\n",c);
+	return SR_ERROR_INVALID_METADATA;
+    } else if (c == 0) {
+	/* We didn't get any metadata this time. */
+	return SR_SUCCESS;
+    } else {
+	/* We got metadata this time. */
+	ret = get_track_from_metadata (rmi, c * 16, newtrack);
+	if (ret != SR_SUCCESS) {
+	    debug_printf("get_trackname had a bad return %d\n", ret);
+	    return ret;
+	}
+
+	strncpy(track_buf, newtrack, MAX_TRACK_LEN);
+	rmi->current_track.have_track_info = 1;
+    }
+    return SR_SUCCESS;
+}
+
 static int
 ripstream_recvall (RIP_MANAGER_INFO* rmi, char* buffer, int size)
 {
     int ret;
-    ret = socklib_recvall (rmi, &rmi->stream_sock, buffer, size, 
-			   rmi->prefs->timeout);
+    int timeout = rmi->prefs->timeout;
+
+    /* Don't wait long when there is something to switch to */
+    if (standby_ready (rmi)) {
+	timeout = STANDBY_STALL_TIMEOUT;
+    }
+    ret = socklib_recvall (rmi, &rmi->stream_sock, buffer, size, timeout);
     if (ret >= 0 && ret != size) {
 	debug_printf ("rip_manager_recv: expected %d, got %d\n",size,ret);
 	ret = SR_ERROR_RECV_FAILED;
@@ -343,6 +514,47 @@ ripstream_recvall (RIP_MANAGER_INFO* rmi, char* buffer, int size)
     return ret;
 }
 
+/* When the server was chosen by racing mirrors, make sure it keeps 
+   up with the stream.  If it delivers below the nominal bitrate for 
+   a whole window, forget the chosen server, and reconnect before the 
+   next block so that the mirrors are raced again.  Only the time 
+   spent in recv counts, so stalls of the disk or the sinks are not 
+   blamed on the source. */
+static void
+ripstream_check_source_rate (RIP_MANAGER_INFO* rmi, int bytes, 
+			     guint64 recv_ms)
+{
+    u_long kbps;
+
+    if (rmi->num_mirrors < 2 || rmi->http_bitrate <= 0 
+	|| !GET_AUTO_RECONNECT (rmi->prefs->flags)) {
+	return;
+    }
+    if (!rmi->rate_started) {
+	/* Skip the first block, the server may send a burst */
+	rmi->rate_started = 1;
+	rmi->rate_recv_ms = 0;
+	rmi->rate_bytes = 0;
+	return;
+    }
+    rmi->rate_recv_ms += recv_ms;
+    rmi->rate_bytes += bytes;
+    if (rmi->rate_recv_ms < RATE_WINDOW_MS) {
+	return;
+    }
+
+    /* bytes per msec * 8 = kbits per sec */
+    kbps = (u_long) ((guint64) rmi->rate_bytes * 8 / rmi->rate_recv_ms);
+    rmi->rate_recv_ms = 0;
+    rmi->rate_bytes = 0;
+    if (kbps < (u_long) (rmi->http_bitrate - rmi->http_bitrate / 8)) {
+	debug_printf ("Source delivers %lu kbps, stream is %d kbps\n",
+		      kbps, rmi->http_bitrate);
+	rmi->endpoint_url[0] = 0;
+	rmi->source_too_slow = 1;
+    }
+}
+
 static error_code
 get_track_from_metadata (RIP_MANAGER_INFO* rmi, int size, char *newtrack)
 {
@@ -32,14 +32,15 @@ error_code ripstream_rip (RIP_MANAGER_INFO* rmi);
 void ripstream_destroy (RIP_MANAGER_INFO* rmi);
 error_code
 ripstream_get_data (RIP_MANAGER_INFO* rmi, char *data_buf, char *track_buf);
+void ripstream_new_connection (RIP_MANAGER_INFO* rmi);
 error_code 
 ripstream_put_data (RIP_MANAGER_INFO *rmi, char *buf, int size);
 error_code
-ripstream_start_track (RIP_MANAGER_INFO* rmi, TRACK_INFO* ti);
+ripstream_start_track (RIP_MANAGER_INFO* rmi, Track_record* ti);
 error_code
 ripstream_queue_writer (
     RIP_MANAGER_INFO* rmi, 
-    TRACK_INFO* ti, 
+    Track_record* ti, 
     Cbuf3_pointer start_byte
 );
 error_code
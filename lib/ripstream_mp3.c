@@ -39,8 +39,14 @@
 #include "ripogg.h"
 #include "track_info.h"
 #include "callback.h"
+#include "memgov.h"
+#include "id3.h"
+#include "sink.h"
 
 
+/* How often to check the bitrate of mp3 streams, in stream time */
+#define ADAPT_INTERVAL_MS	10000
+
 /*****************************************************************************
  * Private functions
  *****************************************************************************/
@@ -54,11 +60,9 @@ compute_cbuf2_size (RIP_MANAGER_INFO* rmi,
 		    int bitrate, 
 		    int meta_interval);
 static int ms_to_bytes (int ms, int bitrate);
-static int bytes_to_secs (unsigned int bytes, int bitrate);
-static error_code
-write_id3v2_frame (RIP_MANAGER_INFO *rmi, 
-		   Writer *writer, char* tag_name, mchar* data,
-		   int charset, int *sent);
+static unsigned int pointer_to_secs (RIP_MANAGER_INFO* rmi, 
+				     Cbuf3_pointer *ptr);
+static void ripstream_mp3_stamp_chunk (RIP_MANAGER_INFO* rmi, GList *node);
 static error_code
 ripstream_mp3_check_for_track_change (RIP_MANAGER_INFO* rmi);
 static error_code
@@ -67,35 +71,33 @@ ripstream_mp3_end_track (RIP_MANAGER_INFO* rmi,
 static error_code
 ripstream_mp3_check_bitrate (RIP_MANAGER_INFO* rmi);
 static error_code
+ripstream_mp3_adapt_cbuf (RIP_MANAGER_INFO* rmi);
+static error_code
 ripstream_mp3_write_oldest_node (RIP_MANAGER_INFO* rmi);
-
+static error_code
+ripstream_mp3_write_node (RIP_MANAGER_INFO* rmi, GList *node);
+static error_code
+ripstream_mp3_sink_event (RIP_MANAGER_INFO* rmi, Sink_event *ev);
 
 /*****************************************************************************
- * Private structs
+ * Private Vars
  *****************************************************************************/
-typedef struct ID3V1st
-{
-        char    tag[3];
-        char    songtitle[30];
-        char    artist[30];
-        char    album[30];
-        char    year[4];
-        char    comment[30];
-        char    genre;
-} ID3V1Tag;
-
-typedef struct ID3V2framest {
-	char	id[4];
-	int	size;
-	char	pad[3];
-} ID3V2frame;
-
-#define HEADER_SIZE 1600
+/* The tracks are written from the buffer itself, so this sink runs
+   in the ripping thread */
+static const Sink_ops tracks_sink = {
+    "tracks", SINK_RETIRE, 0, 0, NULL, ripstream_mp3_sink_event, NULL
+};
 
 
 /******************************************************************************
  * Public functions
  *****************************************************************************/
+error_code
+ripstream_mp3_add_sink (RIP_MANAGER_INFO* rmi)
+{
+    return sink_add (rmi, &tracks_sink);
+}
+
 /** Called once per loop for mp3-style streams.
     \callgraph
 */
@@ -106,15 +108,21 @@ ripstream_mp3_rip (RIP_MANAGER_INFO* rmi)
     int real_rc = SR_SUCCESS;
     GList *node;
     Cbuf3 *cbuf3 = &rmi->cbuf3;
+    Track_record *changed;
+    guint64 show_offset;
 
     debug_printf ("RIPSTREAM_RIP_MP3: top of loop\n");
 
     if (rmi->ripstream_first_time_through) {
 	u_long min_chunks = 24;
-	rc = cbuf3_init (&rmi->cbuf3, rmi->http_info.content_type,
+	rc = cbuf3_init (&rmi->cbuf3, &rmi->mem_account,
+			 rmi->http_info.content_type,
 			 GET_MAKE_RELAY(rmi->prefs->flags),
 			 rmi->getbuffer_size,
 			 min_chunks);
+	if (rc != SR_SUCCESS) {
+	    return rc;
+	}
     }
 
     /* Get new data from the stream */
@@ -122,6 +130,8 @@ ripstream_mp3_rip (RIP_MANAGER_INFO* rmi)
     rc = ripstream_get_data (rmi, node->data, rmi->current_track.raw_metadata);
     if (rc != SR_SUCCESS) {
 	debug_printf ("get_stream_data bad return code: %d\n", rc);
+	/* Keep the node for after the reconnect */
+	cbuf3_insert_free_node (cbuf3, node);
 	return rc;
     }
 
@@ -146,6 +156,7 @@ ripstream_mp3_rip (RIP_MANAGER_INFO* rmi)
 	    track_info_clear (&rmi->current_track);
 	}
     }
+    track_info_set_identity (&rmi->current_track);
 
     /* Copy the data into cbuffer */
     rc = cbuf3_insert_node (cbuf3, node);
@@ -153,20 +164,31 @@ ripstream_mp3_rip (RIP_MANAGER_INFO* rmi)
 	debug_printf ("cbuf3_insert had bad return code %d\n", rc);
 	return rc;
     }
+    ripstream_mp3_stamp_chunk (rmi, node);
 
     /* Insert the metadata into cbuf */
-    rc = cbuf3_insert_metadata (cbuf3, &rmi->current_track);
+    rc = cbuf3_insert_metadata (cbuf3, &rmi->current_track, &changed);
     if (rc != SR_SUCCESS) {
 	debug_printf ("cbuf3_insert_metadata had bad return code %d\n", rc);
 	return rc;
     }
 
-    /* Write showfile immediately */
-    rc = filelib_write_show (rmi, node->data, cbuf3->chunk_size);
+    /* Pass the chunk to the sinks immediately.  If the show file 
+       took all of it, remember where, so the tracks can be copied 
+       out of the show file when the chunk leaves the cbuf. */
+    show_offset = filelib_get_show_offset (rmi);
+    rc = sink_post_chunk (rmi, node->data, cbuf3->chunk_size);
     if (rc != SR_SUCCESS) {
-        debug_printf("filelib_write_show had bad return code: %d\n", rc);
+        debug_printf("sink_post_chunk had bad return code: %d\n", rc);
         return rc;
     }
+    if (filelib_can_copy_show (rmi) 
+	&& filelib_get_show_offset (rmi) == show_offset + cbuf3->chunk_size) {
+	cbuf3_set_show_offset (cbuf3, node, show_offset);
+    }
+    if (changed) {
+	sink_post_metadata (rmi, changed);
+    }
 
     /* Set the track number */
     if (rmi->current_track.track_p[0]) {
@@ -197,27 +219,35 @@ ripstream_mp3_rip (RIP_MANAGER_INFO* rmi)
 	msnprintf (rmi->current_track.track_a, MAX_HEADER_LEN, m_("0"));
 
 	/* Queue new writer, and notify callback */
-	rc = ripstream_queue_writer (rmi, &rmi->current_track, first_byte);
+	track_record_set (&rmi->old_track, 0);
+	rmi->old_track = track_record_new (&rmi->current_track);
+	rc = ripstream_queue_writer (rmi, rmi->old_track, first_byte);
 	if (rc != SR_SUCCESS) {
 	    debug_printf ("ripstream_mp3_start_track failed(#1): %d\n",rc);
 	    return rc;
 	}
 
 	/* Add artist/title to cue sheet */
-	secs = bytes_to_secs (rmi->cue_sheet_bytes, rmi->bitrate);
-	rc = filelib_write_cue (rmi, &rmi->current_track, secs);
+	secs = pointer_to_secs (rmi, &first_byte);
+	rc = sink_post_track (rmi, rmi->old_track, secs);
 	if (rc != SR_SUCCESS) {
-	    debug_printf ("filelib_write_cue failed %d\n", rc);
+	    debug_printf ("sink_post_track failed %d\n", rc);
 	    return rc;
 	}
 
 	rmi->ripstream_first_time_through = 0;
-	track_info_copy (&rmi->old_track, &rmi->current_track);
     }
 
     /* Check for track change. */
     ripstream_mp3_check_for_track_change (rmi);
 
+    /* Follow changes in the bitrate of VBR streams */
+    rc = ripstream_mp3_adapt_cbuf (rmi);
+    if (rc != SR_SUCCESS) {
+	debug_printf ("ripstream_mp3_adapt_cbuf returned: %d\n", rc);
+	return rc;
+    }
+
     /* If buffer is full, write oldest node to disk */
     rc = ripstream_mp3_write_oldest_node (rmi);
     if (rc != SR_SUCCESS) {
@@ -239,10 +269,15 @@ ripstream_mp3_rip (RIP_MANAGER_INFO* rmi)
 /*****************************************************************************
  * Private functions
  *****************************************************************************/
+/* Open the output file and build its id3v2 tag, which the caller 
+   writes with the first audio of the track.  If align is non-zero, 
+   the tag is padded so that the audio starts at offset modulo align 
+   in the file. */
 static error_code
-ripstream_mp3_start_track (RIP_MANAGER_INFO* rmi, Writer *writer)
+ripstream_mp3_start_track (RIP_MANAGER_INFO* rmi, Writer *writer, 
+			   Id3_tag *tag, u_long align, u_long offset)
 {
-    TRACK_INFO *ti = &writer->m_ti;
+    Track_record *ti = writer->m_ti;
     error_code rc;
 
     debug_printf ("ripstream_mp3_start_track (starting)\n");
@@ -254,61 +289,9 @@ ripstream_mp3_start_track (RIP_MANAGER_INFO* rmi, Writer *writer)
         return rc;
     }
 
-    /* Write ID3V2 */
+    /* Build ID3V2 */
     if (GET_ADD_ID3V2(rmi->prefs->flags)) {
-	int i;
-	char bigbuf[HEADER_SIZE] = "";
-	int header_size = HEADER_SIZE;
-	char header1[6] = "ID3\x03\0\0";
-	int sent = 0;
-	int id3_charset;
-
-	memset(bigbuf, '\000', sizeof(bigbuf));
-
-	/* Write header */
-	rc = filelib_write_track (writer, header1, 6);
-	if (rc != SR_SUCCESS) return rc;
-	for (i = 0; i < 4; i++) {
-	    char x = (header_size >> (3-i)*7) & 0x7F;
-	    rc = filelib_write_track (writer, (char *)&x, 1);
-	    if (rc != SR_SUCCESS) return rc;
-	}
-
-	/* ID3 V2.3 is only defined for ISO-8859-1 and UCS-2
-	   If user specifies another codeset, we will use it, and 
-	   report ISO-8859-1 in the encoding field */
-	id3_charset = is_id3_unicode(rmi);
-
-	/* Lead performer */
-        rc = write_id3v2_frame (rmi, writer, "TPE1", 
-				ti->artist, id3_charset, &sent);
-
-        /* Title */
-        rc = write_id3v2_frame (rmi, writer, "TIT2", 
-				ti->title, id3_charset, &sent);
-
-        /* Encoded by */
-        rc = write_id3v2_frame (rmi, writer, "TENC",
-				m_("Ripped with Streamripper"), 
-				id3_charset, &sent);
-	
-        /* Album */
-        rc = write_id3v2_frame (rmi, writer, "TALB", 
-				ti->album, id3_charset, &sent);
-
-        /* Track */
-        rc = write_id3v2_frame (rmi, writer, "TRCK", 
-				ti->track_a, id3_charset, &sent);
-
-        /* Year */
-        rc = write_id3v2_frame (rmi, writer, "TYER", 
-				ti->year, id3_charset, &sent);
-
-	/* Zero out padding */
-	memset (bigbuf, '\000', sizeof(bigbuf));
-
-	/* Pad up to header_size */
-	rc = filelib_write_track (writer, bigbuf, HEADER_SIZE-sent);
+	rc = id3_build_v2 (rmi, ti, tag, align, offset);
 	if (rc != SR_SUCCESS) {
 	    return rc;
 	}
@@ -320,26 +303,56 @@ ripstream_mp3_start_track (RIP_MANAGER_INFO* rmi, Writer *writer)
 static error_code
 ripstream_mp3_write_oldest_node (RIP_MANAGER_INFO* rmi)
 {
-    int i;
     Cbuf3 *cbuf3 = &rmi->cbuf3;
-    GQueue *write_list = cbuf3->write_list;
     GList *node;
-    GList *p, *nextp;
 
-    /* Only write oldest node if buffer is full */
-    if (! cbuf3_is_full (cbuf3)) {
-	return SR_SUCCESS;
+    /* Only write oldest node if buffer is full.  Under memory pressure 
+       the node may be released instead of going onto the free list, 
+       in which case we write the next oldest node too. */
+    while (cbuf3_is_full (cbuf3)) {
+	/* While the relay history is short, the cbuf grows instead */
+	if (cbuf3_grow_history (cbuf3)) {
+	    break;
+	}
+
+	/* Remove oldest node from used queue */
+	node = cbuf3_extract_oldest_node (rmi, cbuf3);
+	if (!node) {
+	    break;
+	}
+
+	sink_post_retire (rmi, node);
+
+	/* Put it on the free list */
+	cbuf3_insert_free_node (cbuf3, node);
     }
+    return SR_SUCCESS;
+}
 
-    /* Remove oldest node from used queue */
-    node = cbuf3_extract_oldest_node (rmi, cbuf3);
+static error_code
+ripstream_mp3_sink_event (RIP_MANAGER_INFO* rmi, Sink_event *ev)
+{
+    return ripstream_mp3_write_node (rmi, ev->node);
+}
 
-    /* Put it on the free list */
-    cbuf3_insert_free_node (cbuf3, node);
+static error_code
+ripstream_mp3_write_node (RIP_MANAGER_INFO* rmi, GList *node)
+{
+    int i;
+    Cbuf3 *cbuf3 = &rmi->cbuf3;
+    GQueue *write_list = cbuf3->write_list;
+    GList *p, *nextp;
+    guint64 show_offset = 0;
+    int from_show;
 
     debug_printf ("ripstream_mp3_write_oldest_node: %d, %d\n",
 	GET_INDIVIDUAL_TRACKS (rmi->prefs->flags), rmi->write_data);
 
+    /* The node has just left the cbuf.  Its offset in the show file 
+       was recorded when it was written there. */
+    from_show = cbuf3_take_show_offset (cbuf3, node, &show_offset)
+	    && filelib_can_copy_show (rmi);
+
     /* If we're not writing tracks, return */
     /* GCS FIX - this logic is obsolete - writer shouldn't enter 
        write_list if not needed. */
@@ -360,18 +373,27 @@ ripstream_mp3_write_oldest_node (RIP_MANAGER_INFO* rmi)
 	    node,
 	    writer->m_next_byte.node, 
 	    writer->m_last_byte.node,
-	    writer->m_ti.raw_metadata);
+	    writer->m_ti->raw_metadata);
 
 	/* Check if the writer needs to write this node */
 	if (writer->m_next_byte.node == node) {
 	    char* write_ptr;
 	    long write_sz;
+	    Id3_tag tag = { 0, 0 };
 
 	    debug_printf ("Writer requesed this node\n");
 
-	    /* Open the file and write header */
+	    /* Open the file and build header.  When copying from the show 
+	       file, line the track up with it for reflinks. */
 	    if (!writer->m_started) {
-		ripstream_mp3_start_track (rmi, writer);
+		if (from_show) {
+		    guint64 start = show_offset + writer->m_next_byte.offset;
+		    ripstream_mp3_start_track (rmi, writer, &tag, 
+			FILELIB_BLOCK_SIZE, 
+			(u_long) (start % FILELIB_BLOCK_SIZE));
+		} else {
+		    ripstream_mp3_start_track (rmi, writer, &tag, 0, 0);
+		}
 		writer->m_started = 1;
 	    }
 
@@ -384,7 +406,28 @@ ripstream_mp3_write_oldest_node (RIP_MANAGER_INFO* rmi)
 		    - writer->m_next_byte.offset;
 	    }
 	    write_ptr = ((char*) node->data) + writer->m_next_byte.offset;
-	    filelib_write_track (writer, write_ptr, write_sz);
+	    if (from_show && filelib_can_copy_show (rmi)) {
+		/* Only the tag is written, the audio is copied */
+		u_long copied = 0;
+		if (tag.len) {
+		    filelib_write_tag (writer, tag.buf, tag.len);
+		    id3_free (&tag);
+		}
+		filelib_copy_show_to_track (rmi, writer, 
+		    show_offset + writer->m_next_byte.offset, write_ptr, 
+		    write_sz, &copied);
+		if (copied < (u_long) write_sz) {
+		    filelib_write_track (writer, write_ptr + copied, 
+					 write_sz - copied);
+		}
+	    } else if (tag.len) {
+		/* The header goes out with the first audio */
+		filelib_writev_track (writer, tag.buf, tag.len, 
+				      write_ptr, write_sz);
+		id3_free (&tag);
+	    } else {
+		filelib_write_track (writer, write_ptr, write_sz);
+	    }
 
 	    /* Check if we need to end the track */
 	    if (writer->m_last_byte.node == node) {
@@ -393,6 +436,7 @@ ripstream_mp3_write_oldest_node (RIP_MANAGER_INFO* rmi)
 		ripstream_mp3_end_track (rmi, writer);
 
 		/* Free up writer */
+		track_record_unref (writer->m_ti);
 		free (writer);
 		write_list->head = g_list_delete_link (write_list->head, p);
 
@@ -419,12 +463,15 @@ ripstream_mp3_check_for_track_change (RIP_MANAGER_INFO* rmi)
     debug_printf ("rmi->current_track.have_track_info = %d\n", 
 		  rmi->current_track.have_track_info);
     if (rmi->current_track.have_track_info 
-	&& track_info_different (&rmi->old_track, &rmi->current_track)) {
+	&& track_info_different (rmi->old_track, &rmi->current_track)) {
 	/* Set m_find_silence equal to the number of additional blocks 
 	   needed until we can do silence separation. */
 	debug_printf ("VERIFIED TRACK CHANGE (find_silence counter = %d)\n",
 	    rmi->find_silence);
-	track_info_copy (&rmi->new_track, &rmi->current_track);
+	if (track_info_different (rmi->new_track, &rmi->current_track)) {
+	    track_record_set (&rmi->new_track, 0);
+	    rmi->new_track = track_record_new (&rmi->current_track);
+	}
 	if (rmi->find_silence < 0) {
 	    if (rmi->mic_to_cb_end > 0) {
 		rmi->find_silence = rmi->mic_to_cb_end;
@@ -434,8 +481,8 @@ ripstream_mp3_check_for_track_change (RIP_MANAGER_INFO* rmi)
 	}
     }
 
-    track_info_debug (&rmi->old_track, "old");
-    track_info_debug (&rmi->new_track, "new");
+    track_record_debug (rmi->old_track, "old");
+    track_record_debug (rmi->new_track, "new");
     track_info_debug (&rmi->current_track, "current");
 
     if (rmi->find_silence == 0) {
@@ -458,7 +505,7 @@ ripstream_mp3_check_for_track_change (RIP_MANAGER_INFO* rmi)
 	prev_writer->m_ended = 1;
 
 	/* Create file, queue new writer, and notify callback */
-	rc = ripstream_queue_writer (rmi, &rmi->new_track, start_of_next);
+	rc = ripstream_queue_writer (rmi, rmi->new_track, start_of_next);
 	if (rc != SR_SUCCESS) {
 	    debug_printf ("ripstream_mp3_start_track had bad "
 			  "return code %d\n", rc);
@@ -466,10 +513,10 @@ ripstream_mp3_check_for_track_change (RIP_MANAGER_INFO* rmi)
 	}
 
 	/* Add artist/title to cue sheet */
-	secs = bytes_to_secs (rmi->cue_sheet_bytes, rmi->bitrate);
-	rc = filelib_write_cue (rmi, &rmi->new_track, secs);
+	secs = pointer_to_secs (rmi, &start_of_next);
+	rc = sink_post_track (rmi, rmi->new_track, secs);
 	if (rc != SR_SUCCESS) {
-	    debug_printf ("filelib_write_cue failed %d\n", rc);
+	    debug_printf ("sink_post_track failed %d\n", rc);
 	    return rc;
 	}
 
@@ -481,7 +528,7 @@ ripstream_mp3_check_for_track_change (RIP_MANAGER_INFO* rmi)
 
 	rmi->find_silence = -1;
 
-	track_info_copy (&rmi->old_track, &rmi->new_track);
+	track_record_set (&rmi->old_track, rmi->new_track);
     }
     if (rmi->find_silence >= 0) rmi->find_silence --;
 
@@ -541,6 +588,13 @@ find_sep (RIP_MANAGER_INFO* rmi,
 	debug_printf ("(not mp3) taking middle: sw_sil=%d\n", midpoint);
 	cbuf3_pointer_add (cbuf3, end_of_previous, &rw_start, midpoint - 1);
 	cbuf3_pointer_add (cbuf3, start_of_next, &rw_start, midpoint);
+    } else if (memgov_reserve (&rmi->mem_account, MEMGOV_ANALYSIS, 
+			       rw_size) != SR_SUCCESS) {
+	/* Not enough memory to decode, so split like above */
+	long midpoint = rw_size / 2;
+	debug_printf ("(memory budget) taking middle: sw_sil=%d\n", midpoint);
+	cbuf3_pointer_add (cbuf3, end_of_previous, &rw_start, midpoint - 1);
+	cbuf3_pointer_add (cbuf3, start_of_next, &rw_start, midpoint);
     } else {
 	u_long bufsize = rw_size;
 	char* buf = (char*) malloc (bufsize);
@@ -550,6 +604,7 @@ find_sep (RIP_MANAGER_INFO* rmi,
 	if (rc != SR_SUCCESS) {
 	    debug_printf ("PEEK FAILED: %d\n", rc);
 	    free(buf);
+	    memgov_release (&rmi->mem_account, MEMGOV_ANALYSIS, bufsize);
 	    return rc;
 	}
 	debug_printf ("PEEK OK\n");
@@ -580,6 +635,7 @@ find_sep (RIP_MANAGER_INFO* rmi,
 	cbuf3_pointer_add (cbuf3, end_of_previous, &rw_start, pos1);
 	cbuf3_pointer_add (cbuf3, start_of_next, &rw_start, pos2);
 	free(buf);
+	memgov_release (&rmi->mem_account, MEMGOV_ANALYSIS, bufsize);
     }
 
     return SR_SUCCESS;
@@ -593,19 +649,9 @@ ripstream_mp3_end_track (RIP_MANAGER_INFO* rmi,
 
     /* Add id3v1 if requested */
     if (GET_ADD_ID3V1(rmi->prefs->flags)) {
-	ID3V1Tag id3v1;
-	memset (&id3v1, '\000',sizeof(id3v1));
-	strncpy (id3v1.tag, "TAG", strlen("TAG"));
-	string_from_gstring (rmi, id3v1.artist, sizeof(id3v1.artist),
-	    writer->m_ti.artist, CODESET_ID3);
-	string_from_gstring (rmi, id3v1.songtitle, sizeof(id3v1.songtitle),
-	    writer->m_ti.title, CODESET_ID3);
-	string_from_gstring (rmi, id3v1.album, sizeof(id3v1.album),
-	    writer->m_ti.album, CODESET_ID3);
-	string_from_gstring (rmi, id3v1.year, sizeof(id3v1.year),
-	    writer->m_ti.year, CODESET_ID3);
-	id3v1.genre = (char) 0xFF; // see http://www.id3.org/id3v2.3.0.html#secA
-	rc = filelib_write_track (writer, (char *)&id3v1, sizeof(id3v1));
+	char id3v1[ID3V1_TAG_SIZE];
+	id3_build_v1 (rmi, writer->m_ti, id3v1);
+	rc = filelib_write_tag (writer, id3v1, ID3V1_TAG_SIZE);
 	if (rc != SR_SUCCESS) {
 	    return rc;
 	}
@@ -620,49 +666,11 @@ ripstream_mp3_end_track (RIP_MANAGER_INFO* rmi,
     return SR_SUCCESS;
 }
 
-// Write data to a new frame, using tag_name e.g. TPE1, and increment
-// *sent with the number of bytes written
-static error_code
-write_id3v2_frame (RIP_MANAGER_INFO *rmi, 
-		   Writer *writer, char* tag_name, mchar* data,
-		   int charset, int *sent)
-{
-    int ret;
-    int rc;
-    char bigbuf[HEADER_SIZE] = "";
-    ID3V2frame id3v2frame;
-#ifndef WIN32
-    __uint32_t framesize = 0;
-#else
-    unsigned long int framesize = 0;
-#endif
-
-    memset(&id3v2frame, '\000', sizeof(id3v2frame));
-    strncpy(id3v2frame.id, tag_name, 4);
-    id3v2frame.pad[2] = charset;
-    rc = string_from_gstring (rmi, bigbuf, HEADER_SIZE, data, CODESET_ID3);
-    framesize = htonl (rc+1);
-    ret = filelib_write_track (writer, (char *)&(id3v2frame.id), 4);
-    if (ret != SR_SUCCESS) return ret;
-    *sent += 4;
-    ret = filelib_write_track (writer, (char *)&(framesize),
-			      sizeof(framesize));
-    if (ret != SR_SUCCESS) return ret;
-    *sent += sizeof(framesize);
-    ret = filelib_write_track (writer, (char *)&(id3v2frame.pad), 3);
-    if (ret != SR_SUCCESS) return ret;
-    *sent += 3;
-    ret = filelib_write_track (writer, bigbuf, rc);
-    if (ret != SR_SUCCESS) return ret;
-    *sent += rc;
-
-    return SR_SUCCESS;
-}
-
 /* First time through, need to determine the bitrate. 
    The bitrate is needed to do the track splitting parameters 
-   properly in seconds.  See the readme file for details.  */
-/* GCS FIX: For VBR streams, the detected_bitrate is unreliable */
+   properly in seconds.  See the readme file for details.  
+   For VBR streams, the detected_bitrate is unreliable, so it 
+   is revised later by ripstream_mp3_adapt_cbuf(). */
 static error_code
 ripstream_mp3_check_bitrate (RIP_MANAGER_INFO* rmi)
 {
@@ -711,6 +719,71 @@ ripstream_mp3_check_bitrate (RIP_MANAGER_INFO* rmi)
     return rc;
 }
 
+/* Recompute the cbuf size from the bitrate measured over the frames 
+   of the last ADAPT_INTERVAL_MS.  The splitpoint windows are given 
+   in ms, so the number of chunks they need follows the bitrate.  
+   The size grows as soon as the bitrate rises above the one used 
+   for sizing, but only shrinks after a large drop, so the cbuf 
+   doesn't churn.  Sizing is not changed while a split is pending, 
+   because the windows would move. */
+static error_code
+ripstream_mp3_adapt_cbuf (RIP_MANAGER_INFO* rmi)
+{
+    Mp3_scan *scan = &rmi->mp3_scan;
+    guint64 bytes, time_us;
+    int measured, bitrate;
+    error_code rc;
+
+    if (rmi->http_info.content_type != CONTENT_TYPE_MP3) {
+	return SR_SUCCESS;
+    }
+    if (rmi->find_silence >= 0) {
+	return SR_SUCCESS;
+    }
+    time_us = scan->time_us - rmi->adapt_time_us;
+    if (time_us < (guint64) ADAPT_INTERVAL_MS * 1000) {
+	return SR_SUCCESS;
+    }
+    bytes = scan->bytes - rmi->adapt_bytes;
+    rmi->adapt_bytes = scan->bytes;
+    rmi->adapt_time_us = scan->time_us;
+
+    measured = (int) (bytes * 8000 / time_us);
+    debug_printf ("Measured bitrate: %d kbps (sized for %d kbps)\n", 
+		  measured, rmi->bitrate);
+    if (measured <= 0) {
+	return SR_SUCCESS;
+    }
+    if (measured <= rmi->bitrate 
+	&& measured >= rmi->bitrate - rmi->bitrate / 4) {
+	return SR_SUCCESS;
+    }
+
+    /* The bitrate changed, so size for it with 1/8 headroom, 
+       rounded up to 8 kbps */
+    bitrate = measured + measured / 8;
+    bitrate = (bitrate + 7) / 8 * 8;
+    debug_printf ("Adapting cbuf to bitrate %d -> %d kbps\n", 
+		  rmi->bitrate, bitrate);
+    compute_cbuf2_size (rmi, &rmi->prefs->sp_opt, 
+			bitrate, rmi->getbuffer_size);
+    rc = cbuf3_resize (&rmi->cbuf3, rmi->cbuf2_size);
+    if (rc != SR_SUCCESS) {
+	/* Keep the windows of the cbuf we still have, and try again 
+	   at the next interval */
+	compute_cbuf2_size (rmi, &rmi->prefs->sp_opt, 
+			    rmi->bitrate, rmi->getbuffer_size);
+	if (rc == SR_ERROR_MEMORY_BUDGET_EXCEEDED) {
+	    debug_printf ("No budget to resize cbuf for %d kbps\n", 
+			  bitrate);
+	    return SR_SUCCESS;
+	}
+	return rc;
+    }
+    rmi->bitrate = bitrate;
+    return SR_SUCCESS;
+}
+
 #if defined (commentout)
 /* GCS: This converts either positive or negative ms to blocks,
    and must work for rounding up and rounding down */
@@ -745,13 +818,41 @@ ms_to_bytes (int ms, int bitrate)
 	return -((-bits)/8);
 }
 
-/* Assume positive, round toward zero */
-static int
-bytes_to_secs (unsigned int bytes, int bitrate)
+/* Stream time of a byte in the cbuf, rounded toward zero */
+static unsigned int
+pointer_to_secs (RIP_MANAGER_INFO* rmi, Cbuf3_pointer *ptr)
+{
+    guint64 ms;
+
+    if (cbuf3_pointer_to_time (&rmi->cbuf3, ptr, &ms) != SR_SUCCESS) {
+	return 0;
+    }
+    return (unsigned int) (ms / 1000);
+}
+
+/* Add the duration of a newly inserted chunk to the cbuf3 time index.  
+   For mp3, the duration comes from the frame headers, which is 
+   accurate for VBR streams.  Otherwise, assume a constant bitrate.  
+   A frame is counted in the chunk where it starts, so a chunk in 
+   which no frame starts has no duration of its own once the scan 
+   has found the frames. */
+static void
+ripstream_mp3_stamp_chunk (RIP_MANAGER_INFO* rmi, GList *node)
 {
-    /* divided by 125 because 125 = 1000 / 8 */
-    int secs = (bytes / bitrate) / 125;
-    return secs;
+    Cbuf3 *cbuf3 = &rmi->cbuf3;
+    u_long frames = 0;
+    u_long duration_ms = 0;
+
+    if (rmi->http_info.content_type == CONTENT_TYPE_MP3) {
+	find_frames (&rmi->mp3_scan, (char*) node->data, cbuf3->chunk_size, 
+		     &frames, &duration_ms);
+    }
+    if (rmi->mp3_scan.frames == 0 && rmi->bitrate > 0) {
+	duration_ms = cbuf3->chunk_size * 8 / rmi->bitrate;
+    }
+    debug_printf ("Chunk duration: %lu ms (%lu frames)\n", 
+		  duration_ms, frames);
+    cbuf3_set_tail_timing (cbuf3, duration_ms);
 }
 
 /* --------------------------------------------------------------------------
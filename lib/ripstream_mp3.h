@@ -21,5 +21,7 @@
 
 error_code
 ripstream_mp3_rip (RIP_MANAGER_INFO* rmi);
+error_code
+ripstream_mp3_add_sink (RIP_MANAGER_INFO* rmi);
 
 #endif
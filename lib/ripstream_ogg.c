@@ -31,6 +31,7 @@
 #include "socklib.h"
 #include "external.h"
 #include "ripogg.h"
+#include "sink.h"
 #include "track_info.h"
 
 /******************************************************************************
@@ -51,8 +52,9 @@ ripstream_ogg_handle_bos (
 
     debug_printf ("ripstream_ogg_handle_bos: testing track_info\n");
     if (rmi->current_track.have_track_info) {
-	if (track_info_different (&rmi->old_track, &rmi->current_track)) {
+	if (track_info_different (rmi->old_track, &rmi->current_track)) {
 	    error_code rc;
+	    Track_record *tr;
 
 	    if (rmi->ogg_track_state == 2) {
 		Writer *writer = (Writer*) g_queue_pop_head (write_list);
@@ -66,19 +68,22 @@ ripstream_ogg_handle_bos (
 		}
 
 		/* Free up writer */
+		track_record_unref (writer->m_ti);
 		free (writer);
 	    }
 
 	    debug_printf ("ripstream_ogg_handle_bos: starting track\n");
 
-	    rc = ripstream_queue_writer (rmi, &rmi->current_track, 
-		opr->m_cbuf3_loc);
+	    tr = track_record_new (&rmi->current_track);
+	    rc = ripstream_queue_writer (rmi, tr, opr->m_cbuf3_loc);
 	    if (rc != SR_SUCCESS) {
 		debug_printf ("ripstream_queue_writer: returned bad error "
 		    "code: %d\n", rc);
+		track_record_unref (tr);
 		return rc;
 	    }
-	    track_info_copy (&rmi->old_track, &rmi->current_track);
+	    track_record_set (&rmi->old_track, tr);
+	    track_record_unref (tr);
 	}
 	rmi->ogg_track_state = 1;
     }
@@ -103,11 +108,11 @@ ripstream_ogg_write_page (RIP_MANAGER_INFO *rmi, Ogg_page_reference *opr)
     debug_printf ("Writer: (%p,%p) %s\n", 
 	writer->m_next_byte.node, 
 	writer->m_last_byte.node,
-	writer->m_ti.raw_metadata);
+	writer->m_ti->raw_metadata);
 
     /* Open output file if needed */
     if (!writer->m_started) {
-	rc = filelib_start (rmi, writer, &writer->m_ti);
+	rc = filelib_start (rmi, writer, writer->m_ti);
 	if (rc != SR_SUCCESS) {
 	    debug_printf ("filelib_start failed %d\n", rc);
 	    return rc;
@@ -141,10 +146,10 @@ ripstream_ogg_write_page (RIP_MANAGER_INFO *rmi, Ogg_page_reference *opr)
 	    writer->m_next_byte.offset,
 	    write_sz, bytes_remaining);
 
-	/* Do the actual write -- showfile */
-	rc = filelib_write_show (rmi, write_ptr, write_sz);
+	/* Pass the page to the sinks -- showfile */
+	rc = sink_post_chunk (rmi, write_ptr, write_sz);
 	if (rc != SR_SUCCESS) {
-	    debug_printf("filelib_write_show had bad return code: %d\n", rc);
+	    debug_printf("sink_post_chunk had bad return code: %d\n", rc);
 	    return rc;
 	}
 
@@ -175,6 +180,7 @@ ripstream_ogg_rip (RIP_MANAGER_INFO* rmi)
     error_code rc;
     GList *node;
     Cbuf3 *cbuf3 = &rmi->cbuf3;
+    guint64 stream_ms;
 
     debug_printf ("RIPSTREAM_RIP_OGG: top of loop\n");
 
@@ -184,7 +190,8 @@ ripstream_ogg_rip (RIP_MANAGER_INFO* rmi)
 	rmi->bitrate = -1;
 	rmi->getbuffer_size = 1024;
 	rmi->cbuf2_size = 128;
-	rc = cbuf3_init (cbuf3, rmi->http_info.content_type, 
+	rc = cbuf3_init (cbuf3, &rmi->mem_account,
+	    rmi->http_info.content_type, 
 	    GET_MAKE_RELAY(rmi->prefs->flags),
 	    rmi->getbuffer_size, rmi->cbuf2_size);
 	if (rc != SR_SUCCESS) {
@@ -203,6 +210,8 @@ ripstream_ogg_rip (RIP_MANAGER_INFO* rmi)
     rc = ripstream_get_data (rmi, node->data, rmi->current_track.raw_metadata);
     if (rc != SR_SUCCESS) {
 	debug_printf ("get_stream_data bad return code: %d\n", rc);
+	/* Keep the node for after the reconnect */
+	cbuf3_insert_free_node (cbuf3, node);
 	return rc;
     }
 
@@ -215,8 +224,14 @@ ripstream_ogg_rip (RIP_MANAGER_INFO* rmi)
 
     /* Fill in this_page_list with ogg page references */
     track_info_clear (&rmi->current_track);
+    stream_ms = rmi->ogg_stream_ms;
     ripogg_process_chunk (rmi, node->data, cbuf3->chunk_size, 
 	&rmi->current_track);
+    track_info_set_identity (&rmi->current_track);
+
+    /* The granule positions of the completed pages give the 
+       duration of the chunk */
+    cbuf3_set_tail_timing (cbuf3, (u_long) (rmi->ogg_stream_ms - stream_ms));
 
     debug_printf ("ogg_track_state[a] = %d\n", rmi->ogg_track_state);
 
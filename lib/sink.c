@@ -0,0 +1,469 @@
+/* sink.c
+ * outputs fed by the stream
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* The ripping thread passes over the stream once, and posts what it
+   finds to the sinks of the stream: the chunks as they arrive, the
+   starts of tracks, changes of metadata, and chunks leaving the
+   buffer once the tracks in them are split.  Each sink takes the
+   events it asked for.  Sinks which must see the buffer itself, like
+   the track writers, are called directly.  The others can have a
+   thread of their own, and get copies of the events in a queue.
+   Such a sink never holds up the stream: if it falls too far behind,
+   its queue is thrown away and it is closed and opened again, and
+   the same happens when it fails. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "errors.h"
+#include "threadlib.h"
+#include "track_info.h"
+#include "sink.h"
+#include "debug.h"
+
+/* How long to wait before opening a sink again which failed to open */
+#define SINK_RETRY_MS		(30 * 1000)
+
+typedef struct sink Sink;
+struct sink
+{
+    const Sink_ops *ops;
+    RIP_MANAGER_INFO *rmi;
+    int is_open;
+    guint64 retry_ms;
+
+    /* Threaded sinks only.  The queue is locked by sem. */
+    HSEM sem;
+    HSEM work_sem;
+    int have_thread;
+    THREAD_HANDLE thread;
+    int stop;
+    int restart;		/* Close and open before the next event */
+    GQueue *queue;
+    u_long queued;		/* Bytes in the queue */
+    u_long max_queue;
+
+    u_long num_events;
+    u_long num_dropped;
+    u_long num_restarts;
+    u_long num_errors;
+    u_long max_queued;
+};
+
+struct sinks
+{
+    GList *list;		/* Sink*, in the order they were added */
+    guint64 pos;		/* Bytes posted as chunks so far */
+};
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static error_code sink_post (RIP_MANAGER_INFO* rmi, Sink_event *ev);
+static void sink_queue (Sink *s, Sink_event *ev);
+static void sink_thread (void *arg);
+static void sink_open (Sink *s);
+static void sink_close (Sink *s);
+static void sink_drop_queue (Sink *s);
+static u_long sink_event_size (Sink_event *ev);
+static void sink_event_free (Sink_event *ev);
+static void sink_lock (Sink *s);
+static void sink_unlock (Sink *s);
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+/* Add a sink to the stream.  A sink which runs in the ripping thread
+   is opened now, and its error is returned.  A threaded sink is
+   opened by its thread. */
+error_code
+sink_add (RIP_MANAGER_INFO* rmi, const Sink_ops *ops)
+{
+    Sinks *sinks = rmi->sinks;
+    Sink *s;
+
+    if ((ops->events && !ops->event)
+	|| (ops->threaded && (ops->events & SINK_RETIRE))) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+    if (!sinks) {
+	sinks = (Sinks*) calloc (1, sizeof(Sinks));
+	if (!sinks) {
+	    return SR_ERROR_CANT_ALLOC_MEMORY;
+	}
+	rmi->sinks = sinks;
+    }
+    s = (Sink*) calloc (1, sizeof(Sink));
+    if (!s) {
+	return SR_ERROR_CANT_ALLOC_MEMORY;
+    }
+    s->ops = ops;
+    s->rmi = rmi;
+
+    if (ops->threaded) {
+	s->max_queue = ops->max_queue ? ops->max_queue : SINK_DEFAULT_QUEUE;
+	s->queue = g_queue_new ();
+	s->sem = threadlib_create_sem ();
+	threadlib_signal_sem (&s->sem);
+	s->work_sem = threadlib_create_sem ();
+	if (threadlib_beginthread (&s->thread, sink_thread, s)
+	    == SR_SUCCESS) {
+	    s->have_thread = 1;
+	} else {
+	    debug_printf ("SINK: %s runs in the ripping thread\n", ops->name);
+	}
+    }
+    if (!s->have_thread) {
+	s->is_open = 1;
+	if (ops->open) {
+	    error_code rc = ops->open (rmi);
+	    if (rc != SR_SUCCESS) {
+		debug_printf ("SINK: %s failed to open (%d)\n", ops->name, rc);
+		if (s->queue) {
+		    g_queue_free (s->queue);
+		    threadlib_destroy_sem (&s->work_sem);
+		    threadlib_destroy_sem (&s->sem);
+		}
+		free (s);
+		return rc;
+	    }
+	}
+    }
+    sinks->list = g_list_append (sinks->list, s);
+    debug_printf ("SINK: added %s, events %x%s\n", ops->name, ops->events,
+		  s->have_thread ? ", threaded" : "");
+    return SR_SUCCESS;
+}
+
+error_code
+sink_post_chunk (RIP_MANAGER_INFO* rmi, char *data, u_long len)
+{
+    Sink_event ev;
+    error_code rc;
+
+    if (!rmi->sinks) {
+	return SR_SUCCESS;
+    }
+    memset (&ev, 0, sizeof(ev));
+    ev.type = SINK_CHUNK;
+    ev.data = data;
+    ev.len = len;
+    ev.pos = rmi->sinks->pos;
+    rc = sink_post (rmi, &ev);
+    rmi->sinks->pos += len;
+    return rc;
+}
+
+error_code
+sink_post_track (RIP_MANAGER_INFO* rmi, Track_record *ti, u_long secs)
+{
+    Sink_event ev;
+
+    memset (&ev, 0, sizeof(ev));
+    ev.type = SINK_TRACK;
+    ev.ti = ti;
+    ev.secs = secs;
+    return sink_post (rmi, &ev);
+}
+
+error_code
+sink_post_metadata (RIP_MANAGER_INFO* rmi, Track_record *ti)
+{
+    Sink_event ev;
+
+    memset (&ev, 0, sizeof(ev));
+    ev.type = SINK_METADATA;
+    ev.ti = ti;
+    return sink_post (rmi, &ev);
+}
+
+error_code
+sink_post_retire (RIP_MANAGER_INFO* rmi, GList *node)
+{
+    Sink_event ev;
+
+    memset (&ev, 0, sizeof(ev));
+    ev.type = SINK_RETIRE;
+    ev.node = node;
+    return sink_post (rmi, &ev);
+}
+
+/* Threaded sinks finish their queues first.  The sinks are closed
+   in the order they were added. */
+void
+sink_stop_all (RIP_MANAGER_INFO* rmi)
+{
+    Sinks *sinks = rmi->sinks;
+    GList *p;
+
+    if (!sinks) return;
+    for (p = sinks->list; p; p = p->next) {
+	Sink *s = (Sink*) p->data;
+	if (s->have_thread) {
+	    sink_lock (s);
+	    s->stop = 1;
+	    sink_unlock (s);
+	    threadlib_signal_sem (&s->work_sem);
+	    threadlib_waitforclose (&s->thread);
+	    s->have_thread = 0;
+	} else {
+	    sink_close (s);
+	}
+    }
+    sink_debug_report (rmi);
+
+    for (p = sinks->list; p; p = p->next) {
+	Sink *s = (Sink*) p->data;
+	if (s->queue) {
+	    sink_drop_queue (s);
+	    g_queue_free (s->queue);
+	    threadlib_destroy_sem (&s->work_sem);
+	    threadlib_destroy_sem (&s->sem);
+	}
+	free (s);
+    }
+    g_list_free (sinks->list);
+    free (sinks);
+    rmi->sinks = 0;
+}
+
+void
+sink_debug_report (RIP_MANAGER_INFO* rmi)
+{
+    GList *p;
+
+    if (!rmi->sinks) return;
+    debug_printf ("------ SINKS -------\n");
+    debug_printf ("stream bytes = %llu\n",
+		  (unsigned long long) rmi->sinks->pos);
+    for (p = rmi->sinks->list; p; p = p->next) {
+	Sink *s = (Sink*) p->data;
+	sink_lock (s);
+	debug_printf ("%-8s events = %lu, dropped = %lu, restarts = %lu, "
+		      "errors = %lu, max queued = %lu\n",
+		      s->ops->name, s->num_events, s->num_dropped,
+		      s->num_restarts, s->num_errors, s->max_queued);
+	sink_unlock (s);
+    }
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+/* Give the event to each sink which takes it.  The first error of a
+   sink in the ripping thread is returned, after the other sinks have
+   had the event. */
+static error_code
+sink_post (RIP_MANAGER_INFO* rmi, Sink_event *ev)
+{
+    GList *p;
+    error_code ret = SR_SUCCESS;
+
+    if (!rmi->sinks) {
+	return SR_SUCCESS;
+    }
+    for (p = rmi->sinks->list; p; p = p->next) {
+	Sink *s = (Sink*) p->data;
+	if (!(s->ops->events & ev->type)) {
+	    continue;
+	}
+	if (s->have_thread) {
+	    sink_queue (s, ev);
+	} else {
+	    error_code rc = s->ops->event (rmi, ev);
+	    s->num_events++;
+	    if (rc != SR_SUCCESS) {
+		s->num_errors++;
+		if (ret == SR_SUCCESS) {
+		    ret = rc;
+		}
+	    }
+	}
+    }
+    return ret;
+}
+
+/* Queue a copy of the event for a threaded sink.  A sink which has
+   fallen too far behind starts over with this event. */
+static void
+sink_queue (Sink *s, Sink_event *ev)
+{
+    Sink_event *copy;
+
+    copy = (Sink_event*) malloc (sizeof(Sink_event));
+    if (!copy) {
+	sink_lock (s);
+	s->num_dropped++;
+	sink_unlock (s);
+	return;
+    }
+    *copy = *ev;
+    if (ev->data) {
+	copy->data = (char*) malloc (ev->len);
+	if (!copy->data) {
+	    free (copy);
+	    sink_lock (s);
+	    s->num_dropped++;
+	    sink_unlock (s);
+	    return;
+	}
+	memcpy (copy->data, ev->data, ev->len);
+    }
+    track_record_ref (copy->ti);
+
+    sink_lock (s);
+    if (s->queued + sink_event_size (copy) > s->max_queue) {
+	debug_printf ("SINK: %s fell behind by %lu bytes\n",
+		      s->ops->name, s->queued);
+	sink_drop_queue (s);
+	s->restart = 1;
+    }
+    g_queue_push_tail (s->queue, copy);
+    s->queued += sink_event_size (copy);
+    if (s->queued > s->max_queued) {
+	s->max_queued = s->queued;
+    }
+    sink_unlock (s);
+    threadlib_signal_sem (&s->work_sem);
+}
+
+static void
+sink_thread (void *arg)
+{
+    Sink *s = (Sink*) arg;
+    Sink_event *ev;
+    int stop;
+
+    sink_open (s);
+    while (1) {
+	threadlib_waitfor_sem (&s->work_sem);
+
+	/* Drain the queue, one wakeup may stand for several events */
+	sink_lock (s);
+	while (1) {
+	    error_code rc;
+	    if (s->restart) {
+		s->restart = 0;
+		s->num_restarts++;
+		sink_unlock (s);
+		sink_close (s);
+		sink_open (s);
+		sink_lock (s);
+		continue;
+	    }
+	    ev = (Sink_event*) g_queue_pop_head (s->queue);
+	    if (!ev) {
+		break;
+	    }
+	    s->queued -= sink_event_size (ev);
+	    sink_unlock (s);
+
+	    /* A sink which couldn't be opened is tried again later */
+	    if (!s->is_open && threadlib_monotonic_ms () >= s->retry_ms) {
+		sink_open (s);
+	    }
+	    rc = s->is_open ? s->ops->event (s->rmi, ev) : SR_SUCCESS;
+	    sink_event_free (ev);
+
+	    sink_lock (s);
+	    if (!s->is_open) {
+		s->num_dropped++;
+	    } else {
+		s->num_events++;
+		if (rc != SR_SUCCESS) {
+		    debug_printf ("SINK: %s failed (%d)\n", s->ops->name, rc);
+		    s->num_errors++;
+		    sink_drop_queue (s);
+		    s->restart = 1;
+		}
+	    }
+	}
+	stop = s->stop;
+	sink_unlock (s);
+	if (stop) {
+	    break;
+	}
+    }
+    sink_close (s);
+}
+
+static void
+sink_open (Sink *s)
+{
+    error_code rc = SR_SUCCESS;
+
+    if (s->ops->open) {
+	rc = s->ops->open (s->rmi);
+    }
+    if (rc != SR_SUCCESS) {
+	debug_printf ("SINK: %s failed to open (%d)\n", s->ops->name, rc);
+	s->retry_ms = threadlib_monotonic_ms () + SINK_RETRY_MS;
+    }
+    s->is_open = (rc == SR_SUCCESS);
+}
+
+static void
+sink_close (Sink *s)
+{
+    if (s->is_open && s->ops->close) {
+	s->ops->close (s->rmi);
+    }
+    s->is_open = 0;
+}
+
+/* Caller holds the lock */
+static void
+sink_drop_queue (Sink *s)
+{
+    Sink_event *ev;
+
+    while ((ev = (Sink_event*) g_queue_pop_head (s->queue)) != 0) {
+	sink_event_free (ev);
+	s->num_dropped++;
+    }
+    s->queued = 0;
+}
+
+/* What a queued event counts against max_queue */
+static u_long
+sink_event_size (Sink_event *ev)
+{
+    return sizeof(Sink_event) + ev->len;
+}
+
+static void
+sink_event_free (Sink_event *ev)
+{
+    track_record_unref (ev->ti);
+    free (ev->data);
+    free (ev);
+}
+
+static void
+sink_lock (Sink *s)
+{
+    if (s->queue) {
+	threadlib_waitfor_sem (&s->sem);
+    }
+}
+
+static void
+sink_unlock (Sink *s)
+{
+    if (s->queue) {
+	threadlib_signal_sem (&s->sem);
+    }
+}
@@ -0,0 +1,75 @@
+/* sink.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __SINK_H__
+#define __SINK_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+/* Events, also used as the mask of events a sink takes */
+#define SINK_CHUNK	0x01	/* Stream data, as it is received */
+#define SINK_TRACK	0x02	/* A track starts, secs into the show */
+#define SINK_METADATA	0x04	/* The metadata of the stream changed */
+#define SINK_RETIRE	0x08	/* A chunk leaves the buffer, its track
+				   boundaries are final (not threaded) */
+
+/* How far a threaded sink may fall behind, unless it says otherwise */
+#define SINK_DEFAULT_QUEUE	(1024 * 1024)
+
+typedef struct sink_event Sink_event;
+struct sink_event
+{
+    int type;
+    char *data;			/* SINK_CHUNK */
+    u_long len;
+    guint64 pos;		/* Stream bytes before data */
+    Track_record *ti;		/* SINK_TRACK and SINK_METADATA */
+    u_long secs;		/* SINK_TRACK */
+    GList *node;		/* SINK_RETIRE */
+};
+
+/* A threaded sink gets copies of the events in a queue, which its
+   thread works through.  The others are called by the ripping
+   thread as the events happen, and may use the buffer directly.
+   open and close may be NULL, and so may event if there are none.
+   A threaded sink is closed and opened again when it fails or falls
+   behind by more than max_queue bytes. */
+typedef struct sink_ops Sink_ops;
+struct sink_ops
+{
+    const char *name;
+    int events;
+    int threaded;
+    u_long max_queue;		/* 0 for SINK_DEFAULT_QUEUE */
+    error_code (*open) (RIP_MANAGER_INFO* rmi);
+    error_code (*event) (RIP_MANAGER_INFO* rmi, Sink_event *ev);
+    void (*close) (RIP_MANAGER_INFO* rmi);
+};
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+error_code sink_add (RIP_MANAGER_INFO* rmi, const Sink_ops *ops);
+error_code sink_post_chunk (RIP_MANAGER_INFO* rmi, char *data, u_long len);
+error_code sink_post_track (RIP_MANAGER_INFO* rmi, Track_record *ti,
+			    u_long secs);
+error_code sink_post_metadata (RIP_MANAGER_INFO* rmi, Track_record *ti);
+error_code sink_post_retire (RIP_MANAGER_INFO* rmi, GList *node);
+void sink_stop_all (RIP_MANAGER_INFO* rmi);
+void sink_debug_report (RIP_MANAGER_INFO* rmi);
+
+#endif
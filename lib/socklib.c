@@ -27,6 +27,7 @@
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <netdb.h>
@@ -43,6 +44,7 @@
 #include "srtypes.h"
 #include "socklib.h"
 #include "threadlib.h"
+#include "resolver.h"
 #include "sr_compat.h"
 #include "debug.h"
 
@@ -52,6 +54,45 @@
 #define FIRST_READ_TIMEOUT	(30 * 1000)
 #endif
 
+/* Delay between starting connection attempts, from RFC 8305 */
+#define CONNECT_ATTEMPT_DELAY_MS	250
+/* Used if no timeout is given to socklib_open */
+#define DEFAULT_CONNECT_TIMEOUT		30
+
+/* Socket buffers are sized to hold this many seconds of the stream */
+#define SOCK_BUFFER_SECS		4
+#define SOCK_MIN_BUFFER			(32 * 1024)
+#define SOCK_MAX_BUFFER			(1024 * 1024)
+#define SOCK_DEFAULT_BITRATE		128
+#define SOCK_NOTSENT_LOWAT		(16 * 1024)
+#define SOCK_KEEPIDLE			10
+#define SOCK_KEEPIDLE_LOW_LATENCY	5
+#define SOCK_BUSY_POLL_US		50
+
+/****************************************************************************
+ * Private functions
+ ****************************************************************************/
+static int
+socklib_recv_some (RIP_MANAGER_INFO* rmi, HSOCKET *socket_handle, 
+		   char* buffer, int size, int timeout);
+static int find_header_end (const char *buffer, int start, int len);
+static int
+socklib_take_pending (HSOCKET *socket_handle, char *buffer, int size);
+static void socklib_drop_pending (HSOCKET *socket_handle);
+static int
+socklib_order_addrs (Resolver_addr *addrs, int num_addrs, int *order, 
+		     int family);
+static error_code
+socklib_race_connect (Resolver_addr *addrs, int *order, int num_addrs, 
+		      int port, char *if_name, int timeout, 
+		      Socklib_opts *opts, SOCKET *sock);
+static error_code
+socklib_start_connect (Resolver_addr *addr, int port, char *if_name, 
+		       Socklib_opts *opts, SOCKET *sock, int *connected);
+static void socklib_set_blocking (SOCKET sock, int blocking);
+static void socklib_setopt (SOCKET s, int level, int name, int value);
+static int socklib_getopt (SOCKET s, int level, int name);
+
 
 /****************************************************************************
  * Function definitions
@@ -102,74 +143,62 @@ read_interface (char *if_name, uint32_t *addr)
 
 /*
  * open's a tcp connection to host at port, host can be a dns name or IP,
- * socket_handle gets assigned to the handle for the connection
+ * socket_handle gets assigned to the handle for the connection.
+ * All addresses of the host are tried, IPv4 and IPv6 alternating,
+ * with a new attempt started every CONNECT_ATTEMPT_DELAY_MS while 
+ * the earlier ones are still in progress (RFC 8305).  The first 
+ * connection to complete is kept.  timeout is the deadline for 
+ * the whole race in seconds.
  */
 error_code 
 socklib_open (HSOCKET *socket_handle, char *host, int port, 
-	      char *if_name, int timeout)
+	      char *if_name, int timeout, Socklib_opts *opts, int abort_fd)
 {
     int rc;
-    struct sockaddr_in address, local;
-    struct hostent *hp;
-    int len;
+    Resolver_addr addrs[RESOLVER_MAX_ADDRS];
+    int order[RESOLVER_MAX_ADDRS];
+    int num_addrs = RESOLVER_MAX_ADDRS;
 
     if (!socket_handle || !host)
 	return SR_ERROR_INVALID_PARAM;
 
-    /* On error:
-       Unix returns -1 and sets errno.
-       Windows??? */
-    socket_handle->s = socket(AF_INET, SOCK_STREAM, 0);
-    if (socket_handle->s == SOCKET_ERROR) {
-	debug_printf ("socket() failed\n");
+    socket_handle->pending = 0;
+    socket_handle->pending_len = 0;
+    socket_handle->pending_pos = 0;
+
+    debug_printf ("Calling resolver_lookup\n");
+    rc = resolver_lookup (host, addrs, &num_addrs, abort_fd);
+    if (rc == SR_ERROR_ABORT_PIPE_SIGNALLED) {
 	WSACleanup ();
-	return SR_ERROR_CANT_CREATE_SOCKET;
+	return rc;
     }
-
-    if (if_name) {
-	if (read_interface (if_name, &local.sin_addr.s_addr) != 0)
-	    local.sin_addr.s_addr = htonl(INADDR_ANY);
-	local.sin_family = AF_INET;
-	local.sin_port = htons(0);
-	/* On error:
-	   Unix returns -1 and sets errno.
-	   Windows??? */
-	debug_printf ("Calling bind\n");
-	if (bind(socket_handle->s, (struct sockaddr *)&local, 
-		 sizeof(local)) == SOCKET_ERROR) {
-	    debug_printf ("Bind failed\n");
-	    WSACleanup ();
-	    closesocket (socket_handle->s);
-	    return SR_ERROR_CANT_BIND_ON_INTERFACE;
-	}
+    if (rc != SR_SUCCESS) {
+	debug_printf ("resolving hostname: %s failed\n", host);
+	WSACleanup ();
+	return SR_ERROR_CANT_RESOLVE_HOSTNAME;
     }
 
-    if ((address.sin_addr.s_addr = inet_addr(host)) == INADDR_NONE) {
-	debug_printf ("Calling gethostbyname\n");
-	hp = gethostbyname (host);
-	if (hp) {
-	    memcpy (&address.sin_addr, hp->h_addr_list[0], hp->h_length);
-	} else {
-	    debug_printf ("resolving hostname: %s failed\n", host);
-	    WSACleanup ();
-	    /* GCS Added... */
-	    closesocket (socket_handle->s);
-	    return SR_ERROR_CANT_RESOLVE_HOSTNAME;
-	}
+    /* The interface address is IPv4, so only IPv4 can be bound to it.
+       The prefs pass an empty name when no interface is wanted. */
+    if (if_name && !if_name[0]) {
+	if_name = 0;
+    }
+    num_addrs = socklib_order_addrs (addrs, num_addrs, order, 
+				     if_name ? AF_INET : AF_UNSPEC);
+    if (num_addrs == 0) {
+	debug_printf ("no usable address for %s\n", host);
+	WSACleanup ();
+	return SR_ERROR_CANT_RESOLVE_HOSTNAME;
     }
-    address.sin_family = AF_INET;
-    address.sin_port = htons((unsigned short)port);
-    len = sizeof(address);
 
-    debug_printf ("Calling connect\n");
-    rc = connect (socket_handle->s, (struct sockaddr *)&address, len);
-    debug_printf ("Connect complete\n");
-    if (rc == SOCKET_ERROR) {
-	debug_printf ("connect failed\n");
-	/* GCS Added... */
+    rc = socklib_race_connect (addrs, order, num_addrs, port, if_name, 
+			       timeout, opts, &socket_handle->s);
+    if (rc != SR_SUCCESS) {
 	WSACleanup ();
-	closesocket (socket_handle->s);
-	return SR_ERROR_CONNECT_FAILED;
+	return rc;
+    }
+    if (opts) {
+	socklib_get_opts (socket_handle->s, opts, opts);
     }
 
 #ifdef WIN32
@@ -197,23 +226,171 @@ socklib_cleanup()
     WSACleanup();
 }
 
+/* Fill opts with the options of the socket profile of the stream.  
+   Relay client sockets mostly send, the stream socket mostly 
+   receives.  The buffers hold SOCK_BUFFER_SECS of the stream, and 
+   dead peers are given up on after the stream timeout.  With 
+   SOCK_PROFILE_NONE opts is left empty, so nothing is set. */
+void
+socklib_profile_opts (RIP_MANAGER_INFO* rmi, int relay, Socklib_opts *opts)
+{
+    STREAM_PREFS *prefs = rmi->prefs;
+    int bitrate, bufsize;
+
+    memset (opts, 0, sizeof(Socklib_opts));
+    if (prefs->sock_profile == SOCK_PROFILE_NONE) {
+	return;
+    }
+
+    if (rmi->bitrate > 0) {
+	bitrate = rmi->bitrate;
+    } else if (rmi->http_bitrate > 0) {
+	bitrate = rmi->http_bitrate;
+    } else {
+	bitrate = SOCK_DEFAULT_BITRATE;
+    }
+    bufsize = bitrate * 1000 / 8 * SOCK_BUFFER_SECS;
+    if (bufsize < SOCK_MIN_BUFFER) {
+	bufsize = SOCK_MIN_BUFFER;
+    } else if (bufsize > SOCK_MAX_BUFFER) {
+	bufsize = SOCK_MAX_BUFFER;
+    }
+
+    opts->keepidle = SOCK_KEEPIDLE;
+    opts->user_timeout = (int) prefs->timeout * 1000;
+    if (relay) {
+	opts->sndbuf = bufsize;
+	opts->notsent_lowat = SOCK_NOTSENT_LOWAT;
+	opts->nodelay = 1;
+    } else {
+	opts->rcvbuf = bufsize;
+    }
+    if (prefs->sock_profile == SOCK_PROFILE_LOW_LATENCY) {
+	opts->nodelay = 1;
+	opts->keepidle = SOCK_KEEPIDLE_LOW_LATENCY;
+	opts->busy_poll = SOCK_BUSY_POLL_US;
+    }
+}
+
+/* Set the non-zero options of opts.  Options which the platform 
+   doesn't have are skipped. */
+void
+socklib_set_opts (SOCKET s, Socklib_opts *opts)
+{
+    if (opts->rcvbuf) {
+	socklib_setopt (s, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf);
+    }
+    if (opts->sndbuf) {
+	socklib_setopt (s, SOL_SOCKET, SO_SNDBUF, opts->sndbuf);
+    }
+    if (opts->nodelay) {
+	socklib_setopt (s, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+#if defined (TCP_NOTSENT_LOWAT)
+    if (opts->notsent_lowat) {
+	socklib_setopt (s, IPPROTO_TCP, TCP_NOTSENT_LOWAT, 
+			opts->notsent_lowat);
+    }
+#endif
+    if (opts->keepidle) {
+	socklib_setopt (s, SOL_SOCKET, SO_KEEPALIVE, 1);
+#if defined (TCP_KEEPIDLE)
+	socklib_setopt (s, IPPROTO_TCP, TCP_KEEPIDLE, opts->keepidle);
+#endif
+    }
+#if defined (TCP_USER_TIMEOUT)
+    if (opts->user_timeout) {
+	socklib_setopt (s, IPPROTO_TCP, TCP_USER_TIMEOUT, 
+			opts->user_timeout);
+    }
+#endif
+#if defined (SO_BUSY_POLL)
+    if (opts->busy_poll) {
+	socklib_setopt (s, SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll);
+    }
+#endif
+}
+
+/* Read back the options which opts asks for into effective, which 
+   may be opts itself.  The kernel may round or double the buffer 
+   sizes, and options it doesn't have read back as zero. */
+void
+socklib_get_opts (SOCKET s, Socklib_opts *opts, Socklib_opts *effective)
+{
+    Socklib_opts eff;
+
+    memset (&eff, 0, sizeof(Socklib_opts));
+    if (opts->rcvbuf) {
+	eff.rcvbuf = socklib_getopt (s, SOL_SOCKET, SO_RCVBUF);
+    }
+    if (opts->sndbuf) {
+	eff.sndbuf = socklib_getopt (s, SOL_SOCKET, SO_SNDBUF);
+    }
+    if (opts->nodelay) {
+	eff.nodelay = socklib_getopt (s, IPPROTO_TCP, TCP_NODELAY);
+    }
+#if defined (TCP_NOTSENT_LOWAT)
+    if (opts->notsent_lowat) {
+	eff.notsent_lowat = socklib_getopt (s, IPPROTO_TCP, 
+					    TCP_NOTSENT_LOWAT);
+    }
+#endif
+#if defined (TCP_KEEPIDLE)
+    if (opts->keepidle && socklib_getopt (s, SOL_SOCKET, SO_KEEPALIVE)) {
+	eff.keepidle = socklib_getopt (s, IPPROTO_TCP, TCP_KEEPIDLE);
+    }
+#endif
+#if defined (TCP_USER_TIMEOUT)
+    if (opts->user_timeout) {
+	eff.user_timeout = socklib_getopt (s, IPPROTO_TCP, 
+					   TCP_USER_TIMEOUT);
+    }
+#endif
+#if defined (SO_BUSY_POLL)
+    if (opts->busy_poll) {
+	eff.busy_poll = socklib_getopt (s, SOL_SOCKET, SO_BUSY_POLL);
+    }
+#endif
+    *effective = eff;
+}
+
+void
+socklib_debug_opts (char *label, Socklib_opts *opts)
+{
+    debug_printf ("%s socket: rcvbuf = %d, sndbuf = %d, nodelay = %d, "
+		  "notsent_lowat = %d\n", label, opts->rcvbuf, opts->sndbuf,
+		  opts->nodelay, opts->notsent_lowat);
+    debug_printf ("%s socket: keepidle = %d, user_timeout = %d, "
+		  "busy_poll = %d\n", label, opts->keepidle, 
+		  opts->user_timeout, opts->busy_poll);
+}
+
 void
 socklib_close(HSOCKET *socket_handle)
 {
+    /* The descriptor may already belong to another connection */
+    if (socket_handle->closed)
+	return;
     closesocket(socket_handle->s);
     socket_handle->closed = TRUE;
+    socklib_drop_pending (socket_handle);
 }
 
+/* Read the http response header into buffer, null terminated.  The 
+   socket is read in large blocks, and only the new bytes are scanned 
+   for the end of the header.  Any bytes after the header (usually the 
+   start of the stream) are kept with the socket, and are returned by 
+   the next call to socklib_recvall(). */
 error_code
 socklib_read_header(RIP_MANAGER_INFO* rmi, HSOCKET *socket_handle, 
 		    char *buffer, int size)
 {
-    int i;
+    int len = 0;
+    int hdr_end = -1;
 #ifdef WIN32
     int timeout;
 #endif
     int ret;
-    char *t;
 
     if (socket_handle->closed)
 	return SR_ERROR_SOCKET_CLOSED;
@@ -225,9 +402,21 @@ socklib_read_header(RIP_MANAGER_INFO* rmi, HSOCKET *socket_handle,
 #endif
 
     memset(buffer, 0, size);
-    for (i = 0; i < size; i++)
+    while (hdr_end < 0)
     {
-	ret = socklib_recvall (rmi, socket_handle, &buffer[i], 1, 0);
+	int scan_start;
+
+	if (len == size) {
+	    debug_printf("http header:\n%s\n", buffer);
+	    return SR_ERROR_NO_HTTP_HEADER;
+	}
+
+	/* Bytes put back with socklib_unread() go first */
+	ret = socklib_take_pending (socket_handle, &buffer[len], size - len);
+	if (ret == 0) {
+	    ret = socklib_recv_some (rmi, socket_handle, &buffer[len], 
+				     size - len, 0);
+	}
 	if (ret < 0) {
 	    return ret;
 	}
@@ -240,27 +429,23 @@ socklib_read_header(RIP_MANAGER_INFO* rmi, HSOCKET *socket_handle,
 	if (socket_handle->closed)
 	    return SR_ERROR_SOCKET_CLOSED;
 
-#if defined (commentout)
-	/* This is too restrictive.  Some servers do not send this. */
-	if (!strstr(buffer, "icy-") && !strstr(buffer,"ice-"))
-	    continue;
-#endif
-
-	t = buffer + (i > 3 ? i - 3: i);
-
-	if (strncmp(t, "\r\n\r\n", 4) == 0)
-	    break;
-	/* Allegedly live365 used to do this */
-	if (strncmp(t, "\n\0\r\n", 4) == 0)
-	    break;
+	/* The terminator may straddle the previous read */
+	scan_start = len > 3 ? len - 3 : 0;
+	len += ret;
+	hdr_end = find_header_end (buffer, scan_start, len);
     }
 
-    if (i == size) {
-	debug_printf("http header:\n%s\n", buffer);
-	return SR_ERROR_NO_HTTP_HEADER;
+    /* Keep the bytes after the header for the stream reader */
+    if (len > hdr_end) {
+	ret = socklib_unread (socket_handle, &buffer[hdr_end], len - hdr_end);
+	if (ret != SR_SUCCESS) {
+	    return ret;
+	}
+	debug_printf ("http header: %d bytes past header\n", len - hdr_end);
     }
 
-    buffer[i] = '\0';
+    /* Drop the last newline of the terminator, like before */
+    memset (&buffer[hdr_end - 1], 0, len - hdr_end + 1);
 
 #ifdef WIN32
     timeout = rmi->prefs->timeout * 1000;  /* Convert sec to msec */
@@ -276,47 +461,19 @@ socklib_recvall (RIP_MANAGER_INFO* rmi, HSOCKET *socket_handle,
 		 char* buffer, int size, int timeout)
 {
     int ret = 0, read = 0;
-    int sock;
-    fd_set fds;
-    struct timeval tv;
-    
-    sock = socket_handle->s;
-    FD_ZERO(&fds);
+
+    /* Bytes which came in with the http header go first */
+    read = socklib_take_pending (socket_handle, buffer, size);
+    size -= read;
+
     while(size) {
 	if (socket_handle->closed)
 	    return SR_ERROR_SOCKET_CLOSED;
-	
-	if (timeout > 0) {
-	    /* Wait up to 'timeout' seconds for data on socket to be 
-	       ready for read */
-#if __UNIX__
-	    FD_SET(rmi->abort_pipe[0], &fds);
-#endif
-	    FD_SET(sock, &fds);
-	    tv.tv_sec = timeout;
-	    tv.tv_usec = 0;
-	    ret = select (sock + 1, &fds, NULL, NULL, &tv);
-	    if (ret == SOCKET_ERROR) {
-		/* This happens when I kill winamp while ripping */
-		return SR_ERROR_SELECT_FAILED;
-	    }
-	    if (ret == 0) {
-		return SR_ERROR_TIMEOUT;
-	    }
-	}
-#if __UNIX__
-	if (FD_ISSET(rmi->abort_pipe[0], &fds)) {
-	    debug_printf ("socklib_recvall detected write to abort pipe.\n");
-	    return SR_ERROR_ABORT_PIPE_SIGNALLED;
-	}
-#endif
-        ret = recv(socket_handle->s, &buffer[read], size, 0);
-	debug_printf ("RECV req %5d bytes, got %5d bytes\n", size, ret);
 
-        if (ret == SOCKET_ERROR) {
-	    debug_printf ("RECV failed, errno = %d\n", errno);
-	    debug_printf ("Err = %s\n",strerror(errno));
-	    return SR_ERROR_RECV_FAILED;
+	ret = socklib_recv_some (rmi, socket_handle, &buffer[read], 
+				 size, timeout);
+	if (ret < 0) {
+	    return ret;
 	}
 
 	/* Got zero bytes on blocking read.  For unix this is an 
@@ -355,3 +512,477 @@ socklib_sendall (HSOCKET *socket_handle, char* buffer, int size)
 
     return sent;
 }
+
+/* Put bytes back in front of anything not yet read from the socket.  
+   They are returned by the next socklib_read_header() or 
+   socklib_recvall(). */
+error_code
+socklib_unread (HSOCKET *socket_handle, char *buffer, int len)
+{
+    int rest = socket_handle->pending_len - socket_handle->pending_pos;
+    char *p;
+
+    if (len <= 0) {
+	return SR_SUCCESS;
+    }
+    p = (char*) malloc (len + rest);
+    if (!p) {
+	return SR_ERROR_CANT_ALLOC_MEMORY;
+    }
+    memcpy (p, buffer, len);
+    if (rest > 0) {
+	memcpy (&p[len], &socket_handle->pending[socket_handle->pending_pos], 
+		rest);
+    }
+    socklib_drop_pending (socket_handle);
+    socket_handle->pending = p;
+    socket_handle->pending_len = len + rest;
+    socket_handle->pending_pos = 0;
+    return SR_SUCCESS;
+}
+
+/* Receive on several sockets at once for duration_ms, to compare 
+   how fast the servers deliver.  Each probe reads into its own 
+   buffer until it is full, or the connection ends.  The time of the 
+   first and last byte are recorded for each probe. */
+error_code
+socklib_probe_recv (RIP_MANAGER_INFO* rmi, Socklib_probe *probes, 
+		    int num_probes, int duration_ms)
+{
+    guint64 now = threadlib_monotonic_ms ();
+    guint64 deadline = now + duration_ms;
+    int i;
+
+    while (now < deadline) {
+	fd_set fds;
+	struct timeval tv;
+	SOCKET maxfd = 0;
+	int num_active = 0;
+	int ret;
+
+	FD_ZERO (&fds);
+#if __UNIX__
+	FD_SET (rmi->abort_pipe[0], &fds);
+	maxfd = rmi->abort_pipe[0];
+#endif
+	for (i = 0; i < num_probes; i++) {
+	    if (probes[i].done) {
+		continue;
+	    }
+	    FD_SET (probes[i].sock->s, &fds);
+	    if (probes[i].sock->s > maxfd) {
+		maxfd = probes[i].sock->s;
+	    }
+	    num_active++;
+	}
+	if (num_active == 0) {
+	    break;
+	}
+
+	tv.tv_sec = (long) ((deadline - now) / 1000);
+	tv.tv_usec = (long) ((deadline - now) % 1000) * 1000;
+	ret = select (maxfd + 1, &fds, NULL, NULL, &tv);
+	if (ret == SOCKET_ERROR) {
+	    return SR_ERROR_SELECT_FAILED;
+	}
+#if __UNIX__
+	if (FD_ISSET (rmi->abort_pipe[0], &fds)) {
+	    debug_printf ("socklib_probe_recv detected write to abort pipe.\n");
+	    return SR_ERROR_ABORT_PIPE_SIGNALLED;
+	}
+#endif
+	now = threadlib_monotonic_ms ();
+	for (i = 0; i < num_probes; i++) {
+	    Socklib_probe *pr = &probes[i];
+	    if (pr->done || !FD_ISSET (pr->sock->s, &fds)) {
+		continue;
+	    }
+	    ret = recv (pr->sock->s, &pr->buffer[pr->len], 
+			pr->size - pr->len, 0);
+	    if (ret == SOCKET_ERROR || ret == 0) {
+		pr->done = 1;
+		continue;
+	    }
+	    if (pr->len == 0) {
+		pr->first_byte_ms = now;
+	    }
+	    pr->len += ret;
+	    pr->last_byte_ms = now;
+	    if (pr->len == pr->size) {
+		pr->done = 1;
+	    }
+	}
+    }
+    return SR_SUCCESS;
+}
+
+/****************************************************************************
+ * Private functions
+ ****************************************************************************/
+/* Wait up to 'timeout' seconds (if timeout > 0) and do a single recv.  
+   Returns the number of bytes received, which is 0 if the peer shut 
+   down the connection. */
+static int
+socklib_recv_some (RIP_MANAGER_INFO* rmi, HSOCKET *socket_handle, 
+		   char* buffer, int size, int timeout)
+{
+    int ret;
+    int sock;
+    fd_set fds;
+    struct timeval tv;
+
+    sock = socket_handle->s;
+    FD_ZERO(&fds);
+    if (timeout > 0) {
+	/* Wait up to 'timeout' seconds for data on socket to be 
+	   ready for read */
+#if __UNIX__
+	FD_SET(rmi->abort_pipe[0], &fds);
+#endif
+	FD_SET(sock, &fds);
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
+	ret = select (sock + 1, &fds, NULL, NULL, &tv);
+	if (ret == SOCKET_ERROR) {
+	    /* This happens when I kill winamp while ripping */
+	    return SR_ERROR_SELECT_FAILED;
+	}
+	if (ret == 0) {
+	    return SR_ERROR_TIMEOUT;
+	}
+    }
+#if __UNIX__
+    if (FD_ISSET(rmi->abort_pipe[0], &fds)) {
+	debug_printf ("socklib_recvall detected write to abort pipe.\n");
+	return SR_ERROR_ABORT_PIPE_SIGNALLED;
+    }
+#endif
+    ret = recv(sock, buffer, size, 0);
+    debug_printf ("RECV req %5d bytes, got %5d bytes\n", size, ret);
+
+    if (ret == SOCKET_ERROR) {
+	debug_printf ("RECV failed, errno = %d\n", errno);
+	debug_printf ("Err = %s\n",strerror(errno));
+	return SR_ERROR_RECV_FAILED;
+    }
+    return ret;
+}
+
+/* Return the index just past the end of the http header, or -1 if 
+   the end is not in buffer[start..len).  Allegedly live365 used to 
+   end the header with "\n\0\r\n". */
+static int
+find_header_end (const char *buffer, int start, int len)
+{
+    int i;
+
+    for (i = start; i + 4 <= len; i++) {
+	if (buffer[i] == '\r' && memcmp (&buffer[i], "\r\n\r\n", 4) == 0)
+	    return i + 4;
+	if (buffer[i] == '\n' && memcmp (&buffer[i], "\n\0\r\n", 4) == 0)
+	    return i + 4;
+    }
+    return -1;
+}
+
+/* Copy out bytes left over from socklib_read_header() */
+static int
+socklib_take_pending (HSOCKET *socket_handle, char *buffer, int size)
+{
+    int n = socket_handle->pending_len - socket_handle->pending_pos;
+
+    if (n <= 0) {
+	return 0;
+    }
+    if (n > size) {
+	n = size;
+    }
+    memcpy (buffer, &socket_handle->pending[socket_handle->pending_pos], n);
+    socket_handle->pending_pos += n;
+    if (socket_handle->pending_pos == socket_handle->pending_len) {
+	socklib_drop_pending (socket_handle);
+    }
+    return n;
+}
+
+static void
+socklib_drop_pending (HSOCKET *socket_handle)
+{
+    free (socket_handle->pending);
+    socket_handle->pending = 0;
+    socket_handle->pending_len = 0;
+    socket_handle->pending_pos = 0;
+}
+
+/* Put the addresses in the order they should be tried: the family 
+   of the first address first, then alternating between families, 
+   keeping the order of the resolver within each family.  If family 
+   is not AF_UNSPEC, only addresses of that family are used.  Returns 
+   the number of entries in order. */
+static int
+socklib_order_addrs (Resolver_addr *addrs, int num_addrs, int *order, 
+		     int family)
+{
+    int first[RESOLVER_MAX_ADDRS], other[RESOLVER_MAX_ADDRS];
+    int num_first = 0, num_other = 0;
+    int first_family = -1;
+    int i, n = 0;
+
+    for (i = 0; i < num_addrs; i++) {
+	if (family != AF_UNSPEC && addrs[i].family != family) {
+	    continue;
+	}
+	if (addrs[i].family != AF_INET && addrs[i].family != AF_INET6) {
+	    continue;
+	}
+	if (first_family == -1) {
+	    first_family = addrs[i].family;
+	}
+	if (addrs[i].family == first_family) {
+	    first[num_first++] = i;
+	} else {
+	    other[num_other++] = i;
+	}
+    }
+    for (i = 0; i < num_first || i < num_other; i++) {
+	if (i < num_first) order[n++] = first[i];
+	if (i < num_other) order[n++] = other[i];
+    }
+    return n;
+}
+
+/* Race non-blocking connects to the addresses.  A new attempt is 
+   started every CONNECT_ATTEMPT_DELAY_MS, or as soon as an attempt 
+   fails.  The first socket to connect is returned in blocking mode, 
+   and the rest are closed. */
+static error_code
+socklib_race_connect (Resolver_addr *addrs, int *order, int num_addrs, 
+		      int port, char *if_name, int timeout, 
+		      Socklib_opts *opts, SOCKET *sock)
+{
+    SOCKET socks[RESOLVER_MAX_ADDRS];
+    int num_socks = 0;
+    int next = 0;
+    int i;
+    guint64 now, deadline, next_attempt_ms;
+    error_code rc = SR_ERROR_CONNECT_FAILED;
+    SOCKET winner = SOCKET_ERROR;
+
+    if (timeout <= 0) {
+	timeout = DEFAULT_CONNECT_TIMEOUT;
+    }
+    now = threadlib_monotonic_ms ();
+    deadline = now + (guint64) timeout * 1000;
+    next_attempt_ms = now;
+
+    while (winner == SOCKET_ERROR) {
+	fd_set wfds, efds;
+	struct timeval tv;
+	guint64 wait_ms;
+	SOCKET maxfd = 0;
+	int ret;
+
+	now = threadlib_monotonic_ms ();
+
+	/* Start the next attempt when it is due */
+	if (next < num_addrs && (num_socks == 0 || now >= next_attempt_ms)) {
+	    SOCKET s;
+	    int connected = 0;
+	    Resolver_addr *addr = &addrs[order[next++]];
+	    error_code arc;
+
+	    arc = socklib_start_connect (addr, port, if_name, opts, 
+					 &s, &connected);
+	    if (arc != SR_SUCCESS) {
+		rc = arc;
+		continue;
+	    }
+	    if (connected) {
+		winner = s;
+		break;
+	    }
+	    socks[num_socks++] = s;
+	    next_attempt_ms = now + CONNECT_ATTEMPT_DELAY_MS;
+	    continue;
+	}
+
+	if (num_socks == 0) {
+	    /* Every address failed */
+	    break;
+	}
+	if (now >= deadline) {
+	    debug_printf ("connect timed out\n");
+	    rc = SR_ERROR_CONNECT_FAILED;
+	    break;
+	}
+
+	wait_ms = deadline - now;
+	if (next < num_addrs && next_attempt_ms - now < wait_ms) {
+	    wait_ms = next_attempt_ms - now;
+	}
+	tv.tv_sec = (long) (wait_ms / 1000);
+	tv.tv_usec = (long) (wait_ms % 1000) * 1000;
+
+	FD_ZERO (&wfds);
+	FD_ZERO (&efds);
+	for (i = 0; i < num_socks; i++) {
+	    FD_SET (socks[i], &wfds);
+	    FD_SET (socks[i], &efds);
+	    if (socks[i] > maxfd) {
+		maxfd = socks[i];
+	    }
+	}
+	ret = select (maxfd + 1, NULL, &wfds, &efds, &tv);
+	if (ret == SOCKET_ERROR) {
+	    rc = SR_ERROR_SELECT_FAILED;
+	    break;
+	}
+
+	for (i = 0; i < num_socks; ) {
+	    int err = 0;
+#if WIN32
+	    int len = sizeof(err);
+#else
+	    socklen_t len = sizeof(err);
+#endif
+	    if (!FD_ISSET (socks[i], &wfds) && !FD_ISSET (socks[i], &efds)) {
+		i++;
+		continue;
+	    }
+	    if (getsockopt (socks[i], SOL_SOCKET, SO_ERROR, 
+			    (char*) &err, &len) == 0 
+		&& err == 0 && !FD_ISSET (socks[i], &efds)) {
+		winner = socks[i];
+		socks[i] = socks[--num_socks];
+		break;
+	    }
+	    debug_printf ("connect attempt failed (%d)\n", err);
+	    closesocket (socks[i]);
+	    socks[i] = socks[--num_socks];
+	    /* Don't wait to start the next attempt */
+	    next_attempt_ms = now;
+	}
+    }
+
+    for (i = 0; i < num_socks; i++) {
+	closesocket (socks[i]);
+    }
+    if (winner == SOCKET_ERROR) {
+	return rc;
+    }
+    debug_printf ("Connect complete\n");
+    socklib_set_blocking (winner, 1);
+    *sock = winner;
+    return SR_SUCCESS;
+}
+
+/* Create a non-blocking socket and start connecting it.  *connected 
+   is set if the connect finished at once. */
+static error_code
+socklib_start_connect (Resolver_addr *addr, int port, char *if_name, 
+		       Socklib_opts *opts, SOCKET *sock, int *connected)
+{
+    struct sockaddr_storage address;
+    SOCKET s;
+    int rc;
+
+    memcpy (&address, &addr->addr, addr->addrlen);
+    if (addr->family == AF_INET6) {
+	((struct sockaddr_in6*) &address)->sin6_port 
+		= htons((unsigned short)port);
+    } else {
+	((struct sockaddr_in*) &address)->sin_port 
+		= htons((unsigned short)port);
+    }
+
+    s = socket(addr->family, SOCK_STREAM, 0);
+    if (s == SOCKET_ERROR) {
+	debug_printf ("socket() failed\n");
+	return SR_ERROR_CANT_CREATE_SOCKET;
+    }
+
+    if (if_name) {
+	struct sockaddr_in local;
+	memset (&local, 0, sizeof(local));
+	if (read_interface (if_name, &local.sin_addr.s_addr) != 0)
+	    local.sin_addr.s_addr = htonl(INADDR_ANY);
+	local.sin_family = AF_INET;
+	local.sin_port = htons(0);
+	debug_printf ("Calling bind\n");
+	if (bind(s, (struct sockaddr *)&local, sizeof(local)) == SOCKET_ERROR) {
+	    debug_printf ("Bind failed\n");
+	    closesocket (s);
+	    return SR_ERROR_CANT_BIND_ON_INTERFACE;
+	}
+    }
+
+    /* Buffer sizes must be set before connecting, so that the 
+       window scale is negotiated for them */
+    if (opts) {
+	socklib_set_opts (s, opts);
+    }
+
+    socklib_set_blocking (s, 0);
+    debug_printf ("Calling connect (family %d)\n", addr->family);
+    rc = connect (s, (struct sockaddr *)&address, addr->addrlen);
+    if (rc == 0) {
+	*connected = 1;
+    } else {
+#if WIN32
+	int in_progress = (WSAGetLastError () == WSAEWOULDBLOCK);
+#else
+	int in_progress = (errno == EINPROGRESS);
+#endif
+	if (!in_progress) {
+	    debug_printf ("connect failed\n");
+	    closesocket (s);
+	    return SR_ERROR_CONNECT_FAILED;
+	}
+	*connected = 0;
+    }
+    *sock = s;
+    return SR_SUCCESS;
+}
+
+static void
+socklib_set_blocking (SOCKET sock, int blocking)
+{
+#if WIN32
+    u_long opt = blocking ? 0 : 1;
+    ioctlsocket (sock, FIONBIO, &opt);
+#else
+    int opt = fcntl (sock, F_GETFL);
+    if (opt != SOCKET_ERROR) {
+	if (blocking) {
+	    opt &= ~O_NONBLOCK;
+	} else {
+	    opt |= O_NONBLOCK;
+	}
+	fcntl (sock, F_SETFL, opt);
+    }
+#endif
+}
+
+static void
+socklib_setopt (SOCKET s, int level, int name, int value)
+{
+    if (setsockopt (s, level, name, (char*) &value, sizeof(value)) 
+	== SOCKET_ERROR) {
+	debug_printf ("setsockopt (%d, %d) failed\n", level, name);
+    }
+}
+
+static int
+socklib_getopt (SOCKET s, int level, int name)
+{
+    int value = 0;
+#if WIN32
+    int len = sizeof(value);
+#else
+    socklen_t len = sizeof(value);
+#endif
+    if (getsockopt (s, level, name, (char*) &value, &len) == SOCKET_ERROR) {
+	return 0;
+    }
+    return value;
+}
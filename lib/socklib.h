@@ -8,10 +8,30 @@
 #define INADDR_NONE (-1)
 #endif
 
+/* Data received from one socket by socklib_probe_recv() */
+typedef struct socklib_probe Socklib_probe;
+struct socklib_probe
+{
+    HSOCKET *sock;
+    char *buffer;
+    int size;
+    int len;			/* Bytes received */
+    int done;			/* Buffer full, or connection ended */
+    guint64 start_ms;		/* When the request was sent */
+    guint64 first_byte_ms;
+    guint64 last_byte_ms;
+};
+
 error_code socklib_init ();
-error_code socklib_open (HSOCKET *socket_handle, char *host, int port, char *if_name, int timeout);
+error_code socklib_open (HSOCKET *socket_handle, char *host, int port, char *if_name, int timeout, Socklib_opts *opts, int abort_fd);
 void socklib_close (HSOCKET *socket_handle);
 void socklib_cleanup ();
+void
+socklib_profile_opts (RIP_MANAGER_INFO* rmi, int relay, Socklib_opts *opts);
+void socklib_set_opts (SOCKET s, Socklib_opts *opts);
+void
+socklib_get_opts (SOCKET s, Socklib_opts *opts, Socklib_opts *effective);
+void socklib_debug_opts (char *label, Socklib_opts *opts);
 error_code
 socklib_read_header(RIP_MANAGER_INFO* rmi, HSOCKET *socket_handle, 
 		    char *buffer, int size);
@@ -19,6 +39,10 @@ error_code
 socklib_recvall (RIP_MANAGER_INFO* rmi, HSOCKET *socket_handle, 
 		 char* buffer, int size, int timeout);
 int socklib_sendall (HSOCKET *socket_handle, char* buffer, int size);
+error_code socklib_unread (HSOCKET *socket_handle, char *buffer, int len);
+error_code
+socklib_probe_recv (RIP_MANAGER_INFO* rmi, Socklib_probe *probes, 
+		    int num_probes, int duration_ms);
 error_code read_interface (char *if_name, uint32_t *addr);
 
 #endif	//__socklib_h__
@@ -161,6 +161,20 @@ typedef struct CODESET_OPTIONSst
     char codeset_relay[MAX_CODESET_STRING];
 } CODESET_OPTIONS;
 
+/* 
+ * The codesets in use by a running stream.  The names are interned, 
+ * so streams which use the same codesets share the strings.
+ */
+typedef struct codeset_names Codeset_names;
+struct codeset_names
+{
+    const char* codeset_locale;
+    const char* codeset_filesys;
+    const char* codeset_id3;
+    const char* codeset_metadata;
+    const char* codeset_relay;
+};
+
 /* 
  * Various CODESET types
  */
@@ -218,8 +232,37 @@ typedef struct TRACK_INFOst
     mchar year[MAX_TRACK_LEN];
     char composed_metadata[MAX_METADATA_LEN+1];  /* For relay stream */
     BOOL save_track;
+    guint64 identity;            /* Set by track_info_set_identity() */
 } TRACK_INFO;
 
+/* 
+ * Track_record is an immutable, reference counted copy of a TRACK_INFO.
+ * TRACK_INFO is only used while parsing the metadata; everything that 
+ * holds on to a track (old_track, new_track, writers, metadata list) 
+ * shares a Track_record instead.  The strings are interned in a pool 
+ * shared by all streams, and must not be modified.  Identity is a hash 
+ * of the fields compared by track_info_different().
+ */
+typedef struct track_record Track_record;
+struct track_record
+{
+    int refcount;
+    guint64 identity;
+    int have_track_info;
+    BOOL save_track;
+    char* raw_metadata;
+    mchar* artist;
+    mchar* title;
+    mchar* album;
+    mchar* track_p;
+    mchar* track_a;
+    mchar* year;
+    char* composed_metadata;
+    mchar* fn_artist;		/* Artist, title and album with the */
+    mchar* fn_title;		/*   characters which can't be in a */
+    mchar* fn_album;		/*   file name replaced */
+};
+
 #ifndef WIN32
 typedef int SOCKET;
 #endif
@@ -228,8 +271,24 @@ typedef struct HSOCKETst
 {
 	SOCKET	s;
 	BOOL	closed;
+	char	*pending;	/* Bytes received after the http header */
+	int	pending_len;
+	int	pending_pos;
 } HSOCKET;
 
+/* Socket options.  A zero option is left at the OS default. */
+typedef struct socklib_opts Socklib_opts;
+struct socklib_opts
+{
+    int rcvbuf;			/* Bytes */
+    int sndbuf;			/* Bytes */
+    int nodelay;
+    int notsent_lowat;		/* Bytes */
+    int keepidle;		/* Seconds */
+    int user_timeout;		/* Milliseconds */
+    int busy_poll;		/* Microseconds */
+};
+
 /* 
  * OverwriteOpt controls how files in complete directory are overwritten
  */
@@ -241,19 +300,50 @@ enum OverwriteOpt {
     OVERWRITE_VERSION	// Never overwrite, instead make a new version
 };
 
+/* 
+ * SockProfile selects the options of the stream and relay sockets
+ */
+enum SockProfile {
+    SOCK_PROFILE_UNKNOWN,	// Error case
+    SOCK_PROFILE_NONE,		// Leave the OS defaults
+    SOCK_PROFILE_NORMAL,	// Buffers sized for the bitrate, keepalive
+    SOCK_PROFILE_LOW_LATENCY	// Also no Nagle delay, and busy polling
+};
+
+/* 
+ * DedupMode selects what is done with a track whose audio is the 
+ * same as a track already completed
+ */
+enum DedupMode {
+    DEDUP_UNKNOWN,		// Error case
+    DEDUP_NONE,			// Keep both files
+    DEDUP_LINK,			// Hard link to the existing file
+    DEDUP_REFLINK		// Share the blocks of the existing file
+};
+
+/* 
+ * DurableMode selects when the data of output files is synced to disk
+ */
+enum DurableMode {
+    DURABLE_UNKNOWN,		// Error case
+    DURABLE_NONE,		// Leave it to the OS
+    DURABLE_COMPLETE,		// Before a track is moved to complete
+    DURABLE_PERIODIC		// Also every few seconds while writing
+};
+
 /* Information extracted from the stream's HTTP header */
 typedef struct SR_HTTP_HEADERst
 {
     int content_type;
     int meta_interval;
     int have_icy_name;
-    char icy_name[MAX_ICY_STRING];
-    int icy_code;
-    int icy_bitrate;
-    char icy_genre[MAX_ICY_STRING];
-    char icy_url[MAX_ICY_STRING];
+    char* icy_name;		/* These four strings are allocated by */
+    int icy_code;		/* http_parse_sc_header(), and released */
+    int icy_bitrate;		/* by http_clear_sc_header().  They */
+    char* icy_genre;		/* are never NULL after a successful */
+    char* icy_url;		/* parse. */
     char http_location[MAX_HOST_LEN];
-    char server[MAX_SERVER_LEN];
+    char* server;
 } SR_HTTP_HEADER;
 
 typedef struct URLINFOst
@@ -287,8 +377,8 @@ struct external_process
 typedef struct metadata Metadata;
 struct metadata
 {
-    /* m_composed_metadata includes 1 byte for size*16 */
-    char    m_composed_metadata[MAX_METADATA_LEN+1];
+    /* m_track->composed_metadata includes 1 byte for size*16 */
+    Track_record *m_track;
     /* m_node is pointer to chunk associated with metadata */
     GList   *m_node;
 };
@@ -311,6 +401,52 @@ struct OGG_PAGE_LIST_struct
     LIST m_list;
 };
 
+/* Subsystems which are charged against the process-wide memory budget */
+#define MEMGOV_CBUF		0	/* Circular buffer chunks (required) */
+#define MEMGOV_RELAY		1	/* Relay client buffers (optional) */
+#define MEMGOV_ANALYSIS		2	/* Silence detection buffers (optional) */
+#define MEMGOV_NUM_SUBSYS	3
+
+/* Hot standby connection, private to standby.c */
+typedef struct standby Standby;
+
+/* Outputs fed by the stream, private to sink.c */
+typedef struct sinks Sinks;
+
+/* Memory charged to the budget by a single stream.  See memgov.c */
+typedef struct memgov_account Memgov_account;
+struct memgov_account
+{
+    char        *name;
+    u_long      usage[MEMGOV_NUM_SUBSYS];
+    u_long      peak;
+    u_long      refused;          /**< Number of refused reservations */
+};
+
+/* State of the mp3 frame header scan, carried from one chunk to the 
+   next.  See find_frames() */
+typedef struct mp3_scan Mp3_scan;
+struct mp3_scan
+{
+    u_long      skip;             /**< Bytes of current frame still to come */
+    u_char      partial[3];       /**< Start of a header split by a chunk */
+    int         partial_len;
+    u_long      frames;           /**< Frames seen so far */
+    guint64     bytes;            /**< Bytes in frames seen so far */
+    guint64     time_us;          /**< Decoded time of frames seen so far */
+    u_long      samplerate;       /**< Of the most recent frame */
+    u_long      bitrate;          /**< Of the most recent frame (kbps) */
+};
+
+/* Timing of one chunk in the cbuf3 time index.  See cbuf3.c */
+typedef struct cbuf3_stamp Cbuf3_stamp;
+struct cbuf3_stamp
+{
+    GList       *node;            /**< Chunk this stamp describes */
+    guint64     start_ms;         /**< Stream time at start of chunk */
+    u_long      duration_ms;      /**< Decoded duration of chunk */
+};
+
 typedef struct cbuf3 Cbuf3;
 struct cbuf3 {
     HSEM        sem;
@@ -320,9 +456,13 @@ struct cbuf3 {
     char        *pending;         /**< Filled, but not yet ready for relay */
 
     u_long      num_chunks;
+    u_long      min_chunks;       /**< Chunks needed by splitpoint windows */
+    u_long      target_chunks;    /**< Chunks above this are given back */
     u_long	chunk_size;
     int         have_relay;
 
+    Memgov_account *mem_account;  /**< Where chunk memory is charged */
+
     int         content_type;
 
     /* This should be moved out of cbuf */
@@ -334,6 +474,18 @@ struct cbuf3 {
 
     /* MP3/AAC/NSV stuff */
     GQueue      *metadata_list;   /**< List of all metadata */
+
+    /* Time index, one stamp per chunk in buf, oldest first */
+    Cbuf3_stamp *stamps;          /**< Ring of stamps */
+    u_long      stamps_size;      /**< Allocated length of ring */
+    u_long      stamps_head;      /**< Ring position of oldest stamp */
+    u_long      stamps_len;       /**< Number of stamps in ring */
+    u_long      stamps_seq;       /**< Sequence number of oldest stamp */
+    GHashTable  *stamp_seq;       /**< Chunk node to sequence number */
+    guint64     stream_ms;        /**< Stream time at end of buf */
+
+    /* Where the chunks in buf were written in the show file */
+    GHashTable  *show_offsets;    /**< Chunk node to guint64 offset */
 };
 
 typedef struct cbuf3_pointer Cbuf3_pointer;
@@ -355,6 +507,48 @@ struct ogg_page_reference
     unsigned long    m_header_buf_len;
 };
 
+/* State of the hash of the audio of a track, see dedup.c */
+typedef struct dedup_hash Dedup_hash;
+struct dedup_hash
+{
+    guint64 v[4];
+    guint64 total;		/* Bytes hashed */
+    unsigned char buf[32];	/* Left over from the last write */
+    int buf_len;
+};
+
+/* Write-behind buffer and preallocation of an output file */
+typedef struct filelib_wbuf Filelib_wbuf;
+struct filelib_wbuf
+{
+    char *buf;
+    u_long len;			/* Bytes waiting in buf */
+    u_long size;		/* Of buf, 0 if writes aren't buffered */
+    guint64 offset;		/* End of the data written to the file */
+    guint64 prealloc_end;	/* 0 if nothing was preallocated */
+    u_long prealloc_step;	/* 0 to not preallocate */
+    int direct;			/* The file is written with O_DIRECT */
+};
+
+/* An output file name pattern, compiled by filelib_init into runs of
+   literal text and the fields which change from track to track */
+typedef struct filelib_pat_op Filelib_pat_op;
+struct filelib_pat_op
+{
+    int type;
+    int off;			/* Literal text, or what a field that */
+    int len;			/*   can't be filled in stands for */
+    int arg;			/* Start of %Nq */
+};
+
+typedef struct filelib_pattern Filelib_pattern;
+struct filelib_pattern
+{
+    Filelib_pat_op *ops;
+    int num_ops;
+    mchar *text;
+};
+
 /* These are pointers to song boundaries for write_list (MP3 only) */
 typedef struct writer Writer;
 struct writer
@@ -365,7 +559,12 @@ struct writer
     Cbuf3_pointer    m_next_byte;
     Cbuf3_pointer    m_last_byte;
     FHANDLE          m_file;
-    TRACK_INFO       m_ti;
+    int              m_tmpfile;	/* m_file has no name yet */
+    int              m_duplicate;	/* Known track, nothing is written */
+    guint64          m_bytes;	/* Written to m_file so far */
+    Dedup_hash       m_hash;	/* Of the audio, without tags */
+    Filelib_wbuf     m_wbuf;
+    Track_record     *m_ti;
 };
 
 
@@ -415,7 +614,6 @@ typedef struct RELAYLIB_INFO_struct RELAYLIB_INFO;
 struct RELAYLIB_INFO_struct
 {
     HSEM m_sem_not_connected;
-    char m_http_header[MAX_HEADER_LEN];
     SOCKET m_listensock;
     BOOL m_running;
     BOOL m_running_accept;
@@ -426,6 +624,9 @@ struct RELAYLIB_INFO_struct
 
 #define DATEBUF_LEN 50
 
+/* Directories of the output tree, private to dircache.c */
+typedef struct dircache Dircache;
+
 typedef struct FILELIB_INFO_struct FILELIB_INFO;
 struct FILELIB_INFO_struct
 {
@@ -433,19 +634,27 @@ struct FILELIB_INFO_struct
     FHANDLE m_cue_file;
     int m_count;
     int m_do_show;
-    mchar m_default_pattern[SR_MAX_PATH];
-    mchar m_default_showfile_pattern[SR_MAX_PATH];
+    guint64 m_show_offset;	/* Bytes written to the show file */
+    int m_copy_show;		/* Copy tracks out of the show file */
+    int m_reflink_show;		/* ... and try to reflink them */
+    int m_use_tmpfile;		/* Write tracks to unnamed files */
+    u_long m_wbuf_size;		/* Write-behind buffer of each file */
+    int m_preallocate;		/* Reserve disk space for files */
+    int m_direct_show;		/* Write the show file with O_DIRECT */
+    Filelib_wbuf m_show_wbuf;
+    guint64 m_track_bytes;	/* Of the tracks completed so far */
+    u_long m_tracks_done;
+    Dircache *m_dircache;
+    /* The patterns are only kept compiled, see filelib_init */
     mchar m_output_directory[SR_MAX_PATH];
-    mchar m_output_pattern[SR_MAX_PATH];
+    Filelib_pattern m_output_pat;
     mchar m_incomplete_directory[SR_MAX_PATH];
     mchar m_incomplete_filename[SR_MAX_PATH];
     mchar m_showfile_directory[SR_MAX_PATH];
-    mchar m_showfile_pattern[SR_MAX_PATH];
+    Filelib_pattern m_showfile_pat;
     BOOL m_keep_incomplete;
     int m_max_filename_length;
     mchar m_show_name[SR_MAX_PATH];
-    mchar m_cue_name[SR_MAX_PATH];
-    mchar m_icy_name[SR_MAX_PATH];
     mchar* m_extension;
     BOOL m_do_individual_tracks;
     mchar m_session_datebuf[DATEBUF_LEN];
@@ -476,6 +685,8 @@ struct stream_prefs
     char relay_ip[SR_MAX_PATH];		// optional, ip to bind relaying 
                                         //  socket to
     char ext_cmd[SR_MAX_PATH];          // cmd to spawn for external metadata
+    char track_index[SR_MAX_PATH];	// optional, file that indexes 
+                                        //  the completed tracks
     char useragent[MAX_USERAGENT_STR];	// optional, use a different useragent
     u_short relay_port;			// port to use for the relay server
 					//  GCS 3/30/07 change to u_short
@@ -486,6 +697,12 @@ struct stream_prefs
 					//  GCS 8/18/07 change int to u_long
     u_long maxMB_rip_size;		// max number of megabytes that 
                                         //  can by writen out before we stop
+    u_long maxMB_mem_budget;		// process-wide memory budget for 
+                                        //  stream buffers, 0 is no limit
+    u_long write_buffer_kb;		// write-behind buffer of each 
+                                        //  output file, 0 is none
+    u_long race_mirrors;		// number of pls entries to probe 
+                                        //  at once, 0 or 1 is no racing
     u_long flags;			// all booleans logically OR'd 
                                         //  together (see above)
     u_long timeout;			// timeout, in seconds, before a 
@@ -497,6 +714,9 @@ struct stream_prefs
 					//  GCS 8/18/07 change int to u_long
     int count_start;                    // which number to start counting?
     enum OverwriteOpt overwrite;	// overwrite file in complete?
+    enum SockProfile sock_profile;	// options for the sockets
+    enum DedupMode dedup;		// what to do with identical tracks
+    enum DurableMode durability;	// when to sync output files
     SPLITPOINT_OPTIONS sp_opt;		// options for splitpoint rules
     CODESET_OPTIONS cs_opt;             // which codeset should i use?
 };
@@ -563,6 +783,31 @@ struct RIP_MANAGER_INFOst
     /* Socket for connection to stream */
     HSOCKET stream_sock;
 
+    /* Stream url found by the last connect, after playlists and 
+       redirects, and when to stop reconnecting straight to it */
+    char endpoint_url[MAX_URL_LEN];
+    guint64 endpoint_expires_ms;
+
+    /* Number of mirrors raced by the last connect.  The delivery 
+       rate of the source is measured over the time spent in recv, 
+       see ripstream_check_source_rate. */
+    int num_mirrors;
+    int rate_started;
+    guint64 rate_recv_ms;
+    u_long rate_bytes;
+    int source_too_slow;	/* Reconnect before the next block */
+
+    /* Second connection to switch to when the stream stalls */
+    Standby *standby;
+
+    /* Outputs fed with the chunks, tracks and metadata of the stream */
+    Sinks *sinks;
+
+    /* Socket options in effect on the last stream connection and 
+       the last relay client */
+    Socklib_opts stream_sockopts;
+    Socklib_opts relay_sockopts;
+
     /* Handle to ripping thread */
     THREAD_HANDLE hthread_ripper;
 
@@ -589,8 +834,8 @@ struct RIP_MANAGER_INFOst
     int ogg_track_state;
 
     /* Title & artist info */
-    TRACK_INFO old_track;	    /* The track that's being ripped now */
-    TRACK_INFO new_track;	    /* The track that's gonna start soon */
+    Track_record *old_track;	    /* The track that's being ripped now */
+    Track_record *new_track;	    /* The track that's gonna start soon */
     TRACK_INFO current_track;       /* The metadata as I'm parsing it */
 
     /* After the first buffer, we collect statistics about the stream */
@@ -623,6 +868,9 @@ struct RIP_MANAGER_INFOst
     int rw_end_to_cb_end;       /* bytes */
     int mic_to_cb_end;          /* blocks */
 
+    /* Memory charged to the global budget by this stream */
+    Memgov_account mem_account;
+
     /* The Relay list */
     GQueue *relay_list;
     HSEM relay_list_sem;
@@ -646,8 +894,25 @@ struct RIP_MANAGER_INFOst
 #endif
     uint32_t ogg_fixed_page_no;
 
+    /* After a new connection, the stream is realigned on a frame or 
+       page boundary.  From then on the last carry_len bytes of each 
+       block are kept in getbuffer for the next chunk.  See 
+       ripstream_get_data */
+    int resync_pending;
+    u_long carry_len;
+
+    /* Frame header scan and ogg granule used for the cbuf3 time index */
+    Mp3_scan mp3_scan;
+    guint64 ogg_granulepos;
+    guint64 ogg_stream_ms;
+    u_long ogg_skipped;		/* Bytes skipped since the last page */
+
+    /* Mp3 scan totals at the last check of the cbuf size */
+    guint64 adapt_bytes;
+    guint64 adapt_time_us;
+
     /* Mchar codesets -- these shadow prefs codesets */
-    CODESET_OPTIONS mchar_cs;
+    Codeset_names mchar_cs;
 };
 
 #endif
@@ -0,0 +1,342 @@
+/* standby.c
+ * hot standby connection to the stream
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* A second connection to the stream is opened by its own thread,
+   which reads and discards the stream one block (meta interval and
+   metadata) at a time.  When the main connection stalls, the ripping
+   thread asks for the standby; the standby thread stops at the end
+   of its current block, and the ripping thread carries on reading
+   from the standby socket as if it had been the stream socket all
+   along.  The buffers, the relay and the output files are kept. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "errors.h"
+#include "threadlib.h"
+#include "socklib.h"
+#include "http.h"
+#include "mchar.h"
+#include "standby.h"
+#include "debug.h"
+
+/* How long to wait before reconnecting a standby which failed */
+#define STANDBY_RETRY_MS	(30 * 1000)
+
+#define STANDBY_NONE		0
+#define STANDBY_CONNECTING	1
+#define STANDBY_READY		2
+#define STANDBY_HANDOVER	3	/* Stop at the end of the block */
+#define STANDBY_FAILED		4
+
+struct standby
+{
+    HSEM sem;
+    int state;
+    int stop;
+    int have_thread;
+    THREAD_HANDLE thread;
+    HSOCKET sock;
+    SR_HTTP_HEADER info;
+    const char *proxyurl;
+
+    /* Copied from rmi by standby_start, so the standby thread never 
+       reads the connection fields which a reconnect rewrites */
+    char url[MAX_URL_LEN];
+    int content_type;
+    int meta_interval;
+    unsigned long block_size;
+
+    guint64 retry_ms;
+    char *buf;
+    int buf_size;
+};
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void standby_thread (void *arg);
+static error_code standby_drain_block (RIP_MANAGER_INFO* rmi, Standby *sb);
+static void standby_set_state (Standby *sb, int state);
+static int standby_get_state (Standby *sb);
+static void standby_join (Standby *sb);
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+/* Start connecting the standby.  The connection is made by the
+   standby thread, so this does not block.  Called by the ripping 
+   thread, which is the only one to change the stream url and format, 
+   so they are copied here for the standby thread. */
+error_code
+standby_start (RIP_MANAGER_INFO* rmi, const char *proxyurl)
+{
+    Standby *sb = rmi->standby;
+
+    if (!sb) {
+	sb = (Standby*) calloc (1, sizeof(Standby));
+	if (!sb) {
+	    return SR_ERROR_CANT_ALLOC_MEMORY;
+	}
+	sb->sem = threadlib_create_sem ();
+	threadlib_signal_sem (&sb->sem);
+	sb->sock.closed = TRUE;
+	rmi->standby = sb;
+    }
+    standby_join (sb);
+
+    threadlib_waitfor_sem (&sb->sem);
+    if (rmi->endpoint_url[0]) {
+	sr_strncpy (sb->url, rmi->endpoint_url, MAX_URL_LEN);
+    } else {
+	sr_strncpy (sb->url, rmi->prefs->url, MAX_URL_LEN);
+    }
+    sb->content_type = rmi->http_info.content_type;
+    sb->meta_interval = rmi->meta_interval;
+    sb->block_size = rmi->getbuffer_size;
+    sb->proxyurl = proxyurl;
+    sb->stop = 0;
+    sb->state = STANDBY_CONNECTING;
+    threadlib_signal_sem (&sb->sem);
+    if (threadlib_beginthread (&sb->thread, standby_thread, rmi)
+	!= SR_SUCCESS) {
+	standby_set_state (sb, STANDBY_FAILED);
+	sb->retry_ms = threadlib_monotonic_ms () + STANDBY_RETRY_MS;
+	return SR_ERROR_CANT_CREATE_THREAD;
+    }
+    sb->have_thread = 1;
+    return SR_SUCCESS;
+}
+
+void
+standby_stop (RIP_MANAGER_INFO* rmi)
+{
+    Standby *sb = rmi->standby;
+
+    if (!sb) return;
+    threadlib_waitfor_sem (&sb->sem);
+    sb->stop = 1;
+    threadlib_signal_sem (&sb->sem);
+    standby_join (sb);
+
+    socklib_close (&sb->sock);
+    http_clear_sc_header (&sb->info);
+    free (sb->buf);
+    threadlib_destroy_sem (&sb->sem);
+    free (sb);
+    rmi->standby = 0;
+}
+
+/* Called by the ripping thread for each block.  A standby which
+   failed is reconnected after a while. */
+void
+standby_check (RIP_MANAGER_INFO* rmi)
+{
+    Standby *sb = rmi->standby;
+
+    if (!sb || standby_get_state (sb) != STANDBY_FAILED) {
+	return;
+    }
+    if (threadlib_monotonic_ms () < sb->retry_ms) {
+	return;
+    }
+    debug_printf ("STANDBY: reconnecting\n");
+    standby_start (rmi, sb->proxyurl);
+}
+
+int
+standby_ready (RIP_MANAGER_INFO* rmi)
+{
+    return rmi->standby && standby_get_state (rmi->standby) == STANDBY_READY;
+}
+
+/* Replace the stream socket with the standby socket.  On return,
+   the next byte read from the stream socket is the first byte of a
+   block, though not of a frame or page; the caller realigns it 
+   with ripstream_new_connection.  The socket profile is applied 
+   again for the current bitrate, as for a new stream connection.  
+   A new standby is started. */
+error_code
+standby_take_over (RIP_MANAGER_INFO* rmi)
+{
+    Standby *sb = rmi->standby;
+    Socklib_opts opts;
+    int state;
+
+    if (!sb) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+    threadlib_waitfor_sem (&sb->sem);
+    state = sb->state;
+    if (state == STANDBY_READY) {
+	sb->state = STANDBY_HANDOVER;
+    }
+    threadlib_signal_sem (&sb->sem);
+    if (state != STANDBY_READY) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+
+    debug_printf ("STANDBY: taking over\n");
+    standby_join (sb);
+    if (standby_get_state (sb) != STANDBY_HANDOVER) {
+	/* The standby failed while finishing its block */
+	return SR_ERROR_RECV_FAILED;
+    }
+
+    socklib_close (&rmi->stream_sock);
+    rmi->stream_sock = sb->sock;
+    memset (&sb->sock, 0, sizeof(HSOCKET));
+    sb->sock.closed = TRUE;
+    http_clear_sc_header (&sb->info);
+    standby_set_state (sb, STANDBY_NONE);
+
+    socklib_profile_opts (rmi, 0, &opts);
+    socklib_set_opts (rmi->stream_sock.s, &opts);
+    socklib_get_opts (rmi->stream_sock.s, &opts, &opts);
+    socklib_debug_opts ("Stream", &opts);
+    rmi->stream_sockopts = opts;
+
+    rmi->rate_started = 0;
+    rmi->source_too_slow = 0;
+    standby_start (rmi, sb->proxyurl);
+    return SR_SUCCESS;
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void
+standby_thread (void *arg)
+{
+    RIP_MANAGER_INFO* rmi = (RIP_MANAGER_INFO*) arg;
+    Standby *sb = rmi->standby;
+    error_code rc;
+
+    rc = http_sc_connect_standby (rmi, &sb->sock, sb->url, sb->proxyurl, 
+				  &sb->info);
+    if (rc == SR_SUCCESS
+	&& (sb->info.content_type != sb->content_type
+	    || sb->info.meta_interval != sb->meta_interval)) {
+	debug_printf ("STANDBY: stream format differs\n");
+	rc = SR_ERROR_STREAM_CHANGED;
+    }
+    if (rc == SR_SUCCESS && (unsigned long) sb->buf_size < sb->block_size) {
+	free (sb->buf);
+	sb->buf_size = sb->block_size;
+	sb->buf = (char*) malloc (sb->buf_size);
+	if (!sb->buf) {
+	    sb->buf_size = 0;
+	    rc = SR_ERROR_CANT_ALLOC_MEMORY;
+	}
+    }
+    if (rc == SR_SUCCESS) {
+	debug_printf ("STANDBY: ready\n");
+	threadlib_waitfor_sem (&sb->sem);
+	if (sb->state == STANDBY_CONNECTING) {
+	    sb->state = STANDBY_READY;
+	}
+	threadlib_signal_sem (&sb->sem);
+    }
+
+    while (rc == SR_SUCCESS) {
+	int state;
+	threadlib_waitfor_sem (&sb->sem);
+	state = sb->state;
+	if (sb->stop) {
+	    rc = SR_ERROR_ABORT_PIPE_SIGNALLED;
+	}
+	threadlib_signal_sem (&sb->sem);
+	if (rc != SR_SUCCESS || state == STANDBY_HANDOVER) {
+	    break;
+	}
+	rc = standby_drain_block (rmi, sb);
+    }
+
+    if (rc != SR_SUCCESS) {
+	debug_printf ("STANDBY: failed (%d)\n", rc);
+	socklib_close (&sb->sock);
+	http_clear_sc_header (&sb->info);
+	threadlib_waitfor_sem (&sb->sem);
+	sb->state = STANDBY_FAILED;
+	sb->retry_ms = threadlib_monotonic_ms () + STANDBY_RETRY_MS;
+	threadlib_signal_sem (&sb->sem);
+    }
+}
+
+/* Read and discard one block of stream data and its metadata */
+static error_code
+standby_drain_block (RIP_MANAGER_INFO* rmi, Standby *sb)
+{
+    int ret;
+    char c;
+
+    ret = socklib_recvall (rmi, &sb->sock, sb->buf, (int) sb->block_size,
+			   rmi->prefs->timeout);
+    if (ret != (int) sb->block_size) {
+	return ret < 0 ? ret : SR_ERROR_RECV_FAILED;
+    }
+    if (sb->meta_interval == NO_META_INTERVAL) {
+	return SR_SUCCESS;
+    }
+
+    ret = socklib_recvall (rmi, &sb->sock, &c, 1, rmi->prefs->timeout);
+    if (ret != 1) {
+	return ret < 0 ? ret : SR_ERROR_RECV_FAILED;
+    }
+    if (c < 0) {
+	return SR_ERROR_INVALID_METADATA;
+    }
+    if (c > 0) {
+	/* At most 127 * 16 bytes, less than any meta interval */
+	int len = c * 16;
+	if (len > sb->buf_size) {
+	    return SR_ERROR_INVALID_METADATA;
+	}
+	ret = socklib_recvall (rmi, &sb->sock, sb->buf, len,
+			       rmi->prefs->timeout);
+	if (ret != len) {
+	    return ret < 0 ? ret : SR_ERROR_RECV_FAILED;
+	}
+    }
+    return SR_SUCCESS;
+}
+
+static void
+standby_set_state (Standby *sb, int state)
+{
+    threadlib_waitfor_sem (&sb->sem);
+    sb->state = state;
+    threadlib_signal_sem (&sb->sem);
+}
+
+static int
+standby_get_state (Standby *sb)
+{
+    int state;
+    threadlib_waitfor_sem (&sb->sem);
+    state = sb->state;
+    threadlib_signal_sem (&sb->sem);
+    return state;
+}
+
+static void
+standby_join (Standby *sb)
+{
+    if (sb->have_thread) {
+	threadlib_waitforclose (&sb->thread);
+	sb->have_thread = 0;
+    }
+}
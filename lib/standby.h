@@ -0,0 +1,35 @@
+/* standby.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __STANDBY_H__
+#define __STANDBY_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+/* Seconds without data before the ripper switches to the standby */
+#define STANDBY_STALL_TIMEOUT	1
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+error_code standby_start (RIP_MANAGER_INFO* rmi, const char *proxyurl);
+void standby_stop (RIP_MANAGER_INFO* rmi);
+void standby_check (RIP_MANAGER_INFO* rmi);
+int standby_ready (RIP_MANAGER_INFO* rmi);
+error_code standby_take_over (RIP_MANAGER_INFO* rmi);
+
+#endif
@@ -26,6 +26,7 @@
 #endif
 #include <stdio.h>
 #include <time.h>
+#include <errno.h>
 #include "srtypes.h"
 #include "threadlib.h"
 #include "debug.h"
@@ -67,6 +68,38 @@ threadlib_waitfor_sem (HSEM *e)
     return SR_SUCCESS;
 }
 
+/* Like threadlib_waitfor_sem, but gives up after ms milliseconds.
+   Returns SR_ERROR_TIMEOUT if the semaphore wasn't signalled. */
+error_code
+threadlib_waitfor_sem_timeout (HSEM *e, u_long ms)
+{
+#if WIN32
+    if (!e)
+	return SR_ERROR_INVALID_PARAM;
+    if (WaitForSingleObject (*e, ms) != WAIT_OBJECT_0)
+	return SR_ERROR_TIMEOUT;
+    ResetEvent (*e);
+    return SR_SUCCESS;
+#else
+    struct timespec ts;
+    int rc;
+
+    if (!e)
+	return SR_ERROR_INVALID_PARAM;
+    /* sem_timedwait takes a deadline on the wall clock */
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long) (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+	ts.tv_sec++;
+	ts.tv_nsec -= 1000000000;
+    }
+    while ((rc = sem_timedwait (e, &ts)) != 0 && errno == EINTR)
+	;
+    return rc == 0 ? SR_SUCCESS : SR_ERROR_TIMEOUT;
+#endif
+}
+
 error_code
 threadlib_signal_sem(HSEM *e)
 {
@@ -81,3 +114,39 @@ threadlib_destroy_sem (HSEM *e)
 {
     DestroyThread (*e);
 }
+
+/* Milliseconds from an arbitrary start, not affected by changes 
+   to the wall clock */
+guint64
+threadlib_monotonic_ms (void)
+{
+#if WIN32
+    static DWORD last = 0;
+    static guint64 wraps = 0;
+    DWORD now = GetTickCount ();
+    if (now < last) {
+	wraps++;
+    }
+    last = now;
+    return (wraps << 32) + now;
+#elif defined (CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (guint64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+    return (guint64) time (NULL) * 1000;
+#endif
+}
+
+/* Like threadlib_monotonic_ms, for timing short system calls */
+guint64
+threadlib_monotonic_us (void)
+{
+#if defined (CLOCK_MONOTONIC) && !defined (WIN32)
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (guint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return threadlib_monotonic_ms () * 1000;
+#endif
+}
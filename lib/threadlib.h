@@ -16,8 +16,11 @@ extern BOOL		threadlib_sem_signaled(HSEM *e);
 
 extern HSEM		threadlib_create_sem();
 extern error_code	threadlib_waitfor_sem(HSEM *e);
+extern error_code	threadlib_waitfor_sem_timeout(HSEM *e, u_long ms);
 extern error_code	threadlib_signal_sem(HSEM *e);
 extern void		threadlib_destroy_sem(HSEM *e);
+extern guint64		threadlib_monotonic_ms(void);
+extern guint64		threadlib_monotonic_us(void);
 
 
 #endif //__THREADLIB__
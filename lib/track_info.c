@@ -36,27 +36,92 @@
 #include "socklib.h"
 #include "external.h"
 #include "ripogg.h"
+#include "threadlib.h"
+#include "track_info.h"
+
+/* FNV-1a, 64 bit */
+#define IDENTITY_BASIS	G_GUINT64_CONSTANT(14695981039346656037)
+#define IDENTITY_PRIME	G_GUINT64_CONSTANT(1099511628211)
+
+/******************************************************************************
+ * Private functions
+ *****************************************************************************/
+static guint64 identity_add_string (guint64 h, const char* s);
+static char* pool_intern (const char* s);
+static void pool_release (char* s);
+static void pool_lock (void);
+static void pool_unlock (void);
+
+/******************************************************************************
+ * Private Vars
+ *****************************************************************************/
+/* Interned strings are shared by the track records of all streams.  
+   The refcount is stored in front of the string, so releasing 
+   doesn't need a lookup of the owner. */
+typedef struct pool_string Pool_string;
+struct pool_string
+{
+    int refcount;
+    char str[1];
+};
+#define POOL_STRING(s) \
+    ((Pool_string*) ((s) - G_STRUCT_OFFSET (Pool_string, str)))
+
+static HSEM m_pool_sem;
+static int m_pool_initialized = 0;
+static GHashTable* m_pool = 0;
+static u_long m_pool_bytes = 0;
+static u_long m_records = 0;
+static char m_empty_string[1] = "";
 
 /******************************************************************************
  * Public functions
  *****************************************************************************/
-BOOL
-track_info_different (TRACK_INFO *t1, TRACK_INFO *t2)
+void
+track_info_init (void)
 {
+    if (m_pool_initialized) return;
+    m_pool_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_pool_sem);
+    m_pool_initialized = 1;
+}
+
+void
+track_info_cleanup (void)
+{
+    if (!m_pool_initialized) return;
+    track_record_debug_pool ();
+    threadlib_destroy_sem (&m_pool_sem);
+    m_pool_initialized = 0;
+}
+
+/* Compute the identity of the parsed fields.  This is called once 
+   each time the metadata is parsed, so that the track change test 
+   is a single compare. */
+void
+track_info_set_identity (TRACK_INFO* ti)
+{
+    guint64 h = IDENTITY_BASIS;
+
     /* We test the parsed fields instead of raw_metadata because the 
        parse rules may have stripped garbage out, causing the resulting 
        track info to be the same. */
-    if (!strcmp(t1->artist, t2->artist)
-	&& !strcmp(t1->title, t2->title)
-	&& !strcmp(t1->album, t2->album)
-	&& !strcmp(t1->track_p, t2->track_p)
-	&& !strcmp(t1->year, t2->year))
-    {
-	return 0;
-    }
+    h = identity_add_string (h, ti->artist);
+    h = identity_add_string (h, ti->title);
+    h = identity_add_string (h, ti->album);
+    h = identity_add_string (h, ti->track_p);
+    h = identity_add_string (h, ti->year);
+    ti->identity = h;
+}
 
-    /* Otherwise, there was a change. */
-    return 1;
+BOOL
+track_info_different (Track_record *tr, TRACK_INFO *ti)
+{
+    /* No track yet, so this is a change. */
+    if (!tr) {
+	return 1;
+    }
+    return tr->identity != ti->identity;
 }
 
 void
@@ -97,20 +162,205 @@ track_info_clear (TRACK_INFO* ti)
     ti->year[0] = 0;
     ti->composed_metadata[0] = 0;
     ti->save_track = TRUE;
+    track_info_set_identity (ti);
+}
+
+/* Make an immutable copy of ti, with a refcount of 1.  The fields 
+   used in file names are cleaned up once here, instead of each time 
+   a name is made. */
+Track_record*
+track_record_new (TRACK_INFO* ti)
+{
+    Track_record* tr;
+    mchar fn_artist[MAX_TRACK_LEN];
+    mchar fn_title[MAX_TRACK_LEN];
+    mchar fn_album[MAX_TRACK_LEN];
+
+    tr = g_new0 (Track_record, 1);
+    tr->refcount = 1;
+    track_info_set_identity (ti);
+    tr->identity = ti->identity;
+    tr->have_track_info = ti->have_track_info;
+    tr->save_track = ti->save_track;
+
+    mstrncpy (fn_artist, ti->artist, MAX_TRACK_LEN);
+    mstrncpy (fn_title, ti->title, MAX_TRACK_LEN);
+    mstrncpy (fn_album, ti->album, MAX_TRACK_LEN);
+    filelib_replace_invalid_chars (fn_artist);
+    filelib_replace_invalid_chars (fn_title);
+    filelib_replace_invalid_chars (fn_album);
+
+    pool_lock ();
+    tr->raw_metadata = pool_intern (ti->raw_metadata);
+    tr->artist = pool_intern (ti->artist);
+    tr->title = pool_intern (ti->title);
+    tr->album = pool_intern (ti->album);
+    tr->track_p = pool_intern (ti->track_p);
+    tr->track_a = pool_intern (ti->track_a);
+    tr->year = pool_intern (ti->year);
+    tr->composed_metadata = pool_intern (ti->composed_metadata);
+    tr->fn_artist = pool_intern (fn_artist);
+    tr->fn_title = pool_intern (fn_title);
+    tr->fn_album = pool_intern (fn_album);
+    m_records++;
+    pool_unlock ();
+
+    return tr;
 }
 
+Track_record*
+track_record_ref (Track_record* tr)
+{
+    if (tr) {
+	g_atomic_int_inc (&tr->refcount);
+    }
+    return tr;
+}
+
+void
+track_record_unref (Track_record* tr)
+{
+    if (!tr) return;
+    if (!g_atomic_int_dec_and_test (&tr->refcount)) return;
+
+    pool_lock ();
+    pool_release (tr->raw_metadata);
+    pool_release (tr->artist);
+    pool_release (tr->title);
+    pool_release (tr->album);
+    pool_release (tr->track_p);
+    pool_release (tr->track_a);
+    pool_release (tr->year);
+    pool_release (tr->composed_metadata);
+    pool_release (tr->fn_artist);
+    pool_release (tr->fn_title);
+    pool_release (tr->fn_album);
+    m_records--;
+    pool_unlock ();
+    g_free (tr);
+}
+
+/* Point *dest at src, adjusting the refcounts.  src may be NULL. */
 void
-track_info_copy (TRACK_INFO* dest, TRACK_INFO* src)
+track_record_set (Track_record** dest, Track_record* src)
 {
-    dest->have_track_info = src->have_track_info;
-    strcpy (dest->raw_metadata, src->raw_metadata);
-    mstrcpy (dest->artist, src->artist);
-    mstrcpy (dest->title, src->title);
-    mstrcpy (dest->album, src->album);
-    mstrcpy (dest->track_p, src->track_p);
-    mstrcpy (dest->track_a, src->track_a);
-    mstrcpy (dest->year, src->year);
-    strcpy (dest->composed_metadata, src->composed_metadata);
-    dest->save_track = src->save_track;
+    Track_record* old = *dest;
+    *dest = track_record_ref (src);
+    track_record_unref (old);
 }
 
+void
+track_record_debug (Track_record* tr, char* tag)
+{
+    if (!tr) {
+	debug_printf ("----- TRACK_RECORD %s\n(none)\n", tag);
+	return;
+    }
+    debug_mprintf (m_("----- TRACK_RECORD ") m_s m_("\n")
+		   m_("REFS:   %d\n")
+		   m_("ID:     %08x%08x\n")
+		   m_("RAW_MD: ") m_s m_("\n")
+		   m_("ARTIST: ") m_S m_("\n")
+		   m_("TITLE:  ") m_S m_("\n")
+		   m_("ALBUM:  ") m_S m_("\n")
+		   m_("SAVE:   %d\n"),
+		   tag,
+		   tr->refcount,
+		   (unsigned int) (tr->identity >> 32),
+		   (unsigned int) (tr->identity & 0xffffffff),
+		   tr->raw_metadata,
+		   tr->artist,
+		   tr->title,
+		   tr->album,
+		   tr->save_track);
+}
+
+void
+track_record_debug_pool (void)
+{
+    pool_lock ();
+    debug_printf ("------ TRACK RECORDS -------\n");
+    debug_printf ("records = %lu (%lu bytes each)\n", 
+		  m_records, (u_long) sizeof(Track_record));
+    debug_printf ("interned strings = %u, %lu bytes\n", 
+		  m_pool ? g_hash_table_size (m_pool) : 0, m_pool_bytes);
+    pool_unlock ();
+}
+
+/******************************************************************************
+ * Private functions
+ *****************************************************************************/
+static guint64
+identity_add_string (guint64 h, const char* s)
+{
+    while (*s) {
+	h ^= (guchar) *s++;
+	h *= IDENTITY_PRIME;
+    }
+    /* Field separator, so "ab","c" differs from "a","bc" */
+    h ^= 0xff;
+    h *= IDENTITY_PRIME;
+    return h;
+}
+
+/* Caller holds the pool lock */
+static char*
+pool_intern (const char* s)
+{
+    Pool_string* ps;
+    size_t len;
+
+    if (!s[0]) {
+	return m_empty_string;
+    }
+    if (!m_pool) {
+	m_pool = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+    ps = (Pool_string*) g_hash_table_lookup (m_pool, s);
+    if (ps) {
+	ps->refcount++;
+	return ps->str;
+    }
+
+    len = strlen (s);
+    ps = (Pool_string*) g_malloc (sizeof(Pool_string) + len);
+    ps->refcount = 1;
+    memcpy (ps->str, s, len + 1);
+    g_hash_table_insert (m_pool, ps->str, ps);
+    m_pool_bytes += sizeof(Pool_string) + len;
+    return ps->str;
+}
+
+/* Caller holds the pool lock */
+static void
+pool_release (char* s)
+{
+    Pool_string* ps;
+
+    if (s == m_empty_string) {
+	return;
+    }
+    ps = POOL_STRING (s);
+    if (--ps->refcount > 0) {
+	return;
+    }
+    g_hash_table_remove (m_pool, ps->str);
+    m_pool_bytes -= sizeof(Pool_string) + strlen (ps->str);
+    g_free (ps);
+}
+
+static void
+pool_lock (void)
+{
+    if (m_pool_initialized) {
+	threadlib_waitfor_sem (&m_pool_sem);
+    }
+}
+
+static void
+pool_unlock (void)
+{
+    if (m_pool_initialized) {
+	threadlib_signal_sem (&m_pool_sem);
+    }
+}
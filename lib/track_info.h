@@ -19,13 +19,29 @@
 
 #include "srtypes.h"
 
+void
+track_info_init (void);
+void
+track_info_cleanup (void);
+void
+track_info_set_identity (TRACK_INFO* ti);
 BOOL
-track_info_different (TRACK_INFO *t1, TRACK_INFO *t2);
+track_info_different (Track_record *tr, TRACK_INFO *ti);
 void
 track_info_debug (TRACK_INFO* ti, char* tag);
 void
 track_info_clear (TRACK_INFO* ti);
+Track_record*
+track_record_new (TRACK_INFO* ti);
+Track_record*
+track_record_ref (Track_record* tr);
+void
+track_record_unref (Track_record* tr);
+void
+track_record_set (Track_record** dest, Track_record* src);
+void
+track_record_debug (Track_record* tr, char* tag);
 void
-track_info_copy (TRACK_INFO* dest, TRACK_INFO* src);
+track_record_debug_pool (void);
 
 #endif
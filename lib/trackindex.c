@@ -0,0 +1,458 @@
+/* trackindex.c
+ * process-wide index of completed tracks, kept in a mapped file
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* The index is an open addressed hash table, stored in a file which
+   is mapped shared, so it is written back by the kernel and survives
+   restarts.  Tracks are keyed by a hash of their artist, title and
+   album, case folded and with runs of white space squeezed, so the
+   same song ripped from two stations under different file names is
+   still found.  The table doubles into a new file when it is three
+   quarters full.  All streams of the process share one index; the
+   file is locked, so a second process doesn't use it. */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined (WIN32)
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+#include "srtypes.h"
+#include "errors.h"
+#include "threadlib.h"
+#include "trackindex.h"
+#include "debug.h"
+
+#define TRACKINDEX_MAGIC	0x58495253	/* "SRIX" */
+#define TRACKINDEX_VERSION	1
+#define TRACKINDEX_MIN_CAPACITY	4096
+#define TRACKINDEX_PRIME	1099511628211ULL
+#define TRACKINDEX_OFFSET	14695981039346656037ULL
+
+typedef struct trackindex_header Trackindex_header;
+struct trackindex_header
+{
+    guint32 magic;
+    guint32 version;
+    guint32 capacity;		/* Number of entries, a power of two */
+    guint32 count;
+};
+
+/* A key of zero is an empty slot */
+typedef struct trackindex_entry Trackindex_entry;
+struct trackindex_entry
+{
+    guint64 key;
+    guint64 size;
+    guint64 content_hash;
+    guint32 duration_ms;
+    guint32 reserved;
+};
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void trackindex_lock (void);
+static void trackindex_unlock (void);
+static void trackindex_close (void);
+static Trackindex_entry*
+trackindex_find (Trackindex_header *hdr, guint64 key);
+static error_code trackindex_grow (void);
+static guint64 trackindex_add_string (guint64 h, const mchar *s);
+#if !defined (WIN32)
+static error_code
+trackindex_map (int fd, guint32 capacity, int create,
+		Trackindex_header **hdr);
+static void trackindex_unmap (Trackindex_header *hdr);
+#endif
+
+/*****************************************************************************
+ * Private Vars
+ *****************************************************************************/
+static HSEM m_sem;
+static int m_initialized = 0;
+static char *m_filename = 0;
+static int m_fd = -1;
+static Trackindex_header *m_hdr = 0;
+
+static u_long m_num_lookups = 0;
+static u_long m_num_hits = 0;
+static u_long m_num_updates = 0;
+
+/*****************************************************************************
+ * Public functions
+ *****************************************************************************/
+void
+trackindex_init (void)
+{
+    if (m_initialized) return;
+    m_sem = threadlib_create_sem ();
+    threadlib_signal_sem (&m_sem);
+    m_initialized = 1;
+}
+
+void
+trackindex_cleanup (void)
+{
+    if (!m_initialized) return;
+    trackindex_debug_report ();
+    trackindex_lock ();
+    trackindex_close ();
+    trackindex_unlock ();
+    threadlib_destroy_sem (&m_sem);
+    m_initialized = 0;
+}
+
+/* Open the index file, creating it if needed.  The first stream to
+   open an index decides which file is used by the process. */
+error_code
+trackindex_open (const char *filename)
+{
+#if defined (WIN32)
+    return SR_ERROR_INVALID_PARAM;
+#else
+    struct stat st;
+    int fd;
+    error_code rc;
+
+    if (!m_initialized || !filename || !*filename) {
+	return SR_ERROR_INVALID_PARAM;
+    }
+    trackindex_lock ();
+    if (m_hdr) {
+	if (strcmp (filename, m_filename)) {
+	    debug_printf ("TRACKINDEX: already using %s, not %s\n",
+			  m_filename, filename);
+	}
+	trackindex_unlock ();
+	return SR_SUCCESS;
+    }
+
+    fd = open (filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+	trackindex_unlock ();
+	return SR_ERROR_CANT_CREATE_FILE;
+    }
+    if (flock (fd, LOCK_EX | LOCK_NB) != 0) {
+	debug_printf ("TRACKINDEX: %s is used by another process\n",
+		      filename);
+	close (fd);
+	trackindex_unlock ();
+	return SR_ERROR_CANT_CREATE_FILE;
+    }
+
+    /* An empty or damaged file gets a new table */
+    rc = SR_ERROR_INVALID_PARAM;
+    if (fstat (fd, &st) == 0 && st.st_size >= sizeof(Trackindex_header)) {
+	Trackindex_header h;
+	if (pread (fd, &h, sizeof(h), 0) == sizeof(h)
+	    && h.magic == TRACKINDEX_MAGIC
+	    && h.version == TRACKINDEX_VERSION
+	    && h.capacity >= TRACKINDEX_MIN_CAPACITY
+	    && (h.capacity & (h.capacity - 1)) == 0
+	    && h.count < h.capacity
+	    && st.st_size == sizeof(Trackindex_header)
+	    + (off_t) h.capacity * sizeof(Trackindex_entry)) {
+	    rc = trackindex_map (fd, h.capacity, 0, &m_hdr);
+	}
+    }
+    if (rc != SR_SUCCESS) {
+	debug_printf ("TRACKINDEX: starting a new index in %s\n", filename);
+	rc = trackindex_map (fd, TRACKINDEX_MIN_CAPACITY, 1, &m_hdr);
+    }
+    if (rc != SR_SUCCESS) {
+	close (fd);
+	trackindex_unlock ();
+	return rc;
+    }
+    m_fd = fd;
+    m_filename = strdup (filename);
+    debug_printf ("TRACKINDEX: %s has %u tracks\n", filename, m_hdr->count);
+    trackindex_unlock ();
+    return SR_SUCCESS;
+#endif
+}
+
+int
+trackindex_is_open (void)
+{
+    return m_hdr != 0;
+}
+
+/* The key of a track, or zero if the track has no artist and title */
+guint64
+trackindex_key (Track_record *ti)
+{
+    guint64 h = TRACKINDEX_OFFSET;
+
+    if (!ti || (!ti->artist[0] && !ti->title[0])) {
+	return 0;
+    }
+    h = trackindex_add_string (h, ti->artist);
+    h = trackindex_add_string (h, ti->title);
+    h = trackindex_add_string (h, ti->album);
+    return h ? h : 1;
+}
+
+/* Returns 1 and fills in info if the track is in the index */
+int
+trackindex_lookup (guint64 key, Trackindex_info *info)
+{
+    Trackindex_entry *e;
+    int found = 0;
+
+    if (!key || !m_hdr) {
+	return 0;
+    }
+    trackindex_lock ();
+    m_num_lookups++;
+    e = m_hdr ? trackindex_find (m_hdr, key) : 0;
+    if (e && e->key == key) {
+	info->size = e->size;
+	info->content_hash = e->content_hash;
+	info->duration_ms = e->duration_ms;
+	m_num_hits++;
+	found = 1;
+    }
+    trackindex_unlock ();
+    return found;
+}
+
+/* Add the track, or replace what is known about it */
+void
+trackindex_update (guint64 key, Trackindex_info *info)
+{
+    Trackindex_entry *e;
+
+    if (!key || !m_hdr) {
+	return;
+    }
+    trackindex_lock ();
+    if (m_hdr && (m_hdr->count + 1) * 4 > m_hdr->capacity * 3) {
+	if (trackindex_grow () != SR_SUCCESS) {
+	    debug_printf ("TRACKINDEX: can't grow, index is closed\n");
+	    trackindex_close ();
+	}
+    }
+    e = m_hdr ? trackindex_find (m_hdr, key) : 0;
+    if (e) {
+	if (e->key != key) {
+	    e->key = key;
+	    m_hdr->count++;
+	}
+	e->size = info->size;
+	e->content_hash = info->content_hash;
+	e->duration_ms = info->duration_ms;
+	m_num_updates++;
+    }
+    trackindex_unlock ();
+}
+
+void
+trackindex_debug_report (void)
+{
+    trackindex_lock ();
+    debug_printf ("------ TRACKINDEX -------\n");
+    debug_printf ("tracks = %u, capacity = %u, lookups = %lu, "
+		  "hits = %lu, updates = %lu\n",
+		  m_hdr ? m_hdr->count : 0, m_hdr ? m_hdr->capacity : 0,
+		  m_num_lookups, m_num_hits, m_num_updates);
+    trackindex_unlock ();
+}
+
+/*****************************************************************************
+ * Private functions
+ *****************************************************************************/
+static void
+trackindex_lock (void)
+{
+    if (m_initialized) {
+	threadlib_waitfor_sem (&m_sem);
+    }
+}
+
+static void
+trackindex_unlock (void)
+{
+    if (m_initialized) {
+	threadlib_signal_sem (&m_sem);
+    }
+}
+
+/* Called with the lock held */
+static void
+trackindex_close (void)
+{
+#if !defined (WIN32)
+    if (m_hdr) {
+	trackindex_unmap (m_hdr);
+	m_hdr = 0;
+    }
+    if (m_fd >= 0) {
+	close (m_fd);
+	m_fd = -1;
+    }
+#endif
+    free (m_filename);
+    m_filename = 0;
+}
+
+/* Return the slot holding key, or the empty slot where it would go.
+   Called with the lock held. */
+static Trackindex_entry*
+trackindex_find (Trackindex_header *hdr, guint64 key)
+{
+    Trackindex_entry *table = (Trackindex_entry*) (hdr + 1);
+    guint32 mask = hdr->capacity - 1;
+    guint32 i = (guint32) (key ^ (key >> 32)) & mask;
+
+    while (table[i].key && table[i].key != key) {
+	i = (i + 1) & mask;
+    }
+    return &table[i];
+}
+
+/* Rehash into a file twice the size, and rename it over the old
+   one.  Called with the lock held. */
+static error_code
+trackindex_grow (void)
+{
+#if defined (WIN32)
+    return SR_ERROR_INVALID_PARAM;
+#else
+    Trackindex_header *old_hdr = m_hdr;
+    Trackindex_header *new_hdr;
+    Trackindex_entry *old_table = (Trackindex_entry*) (old_hdr + 1);
+    char *new_fn;
+    int fd;
+    guint32 i;
+    error_code rc;
+
+    new_fn = g_strdup_printf ("%s.new", m_filename);
+    fd = open (new_fn, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+	g_free (new_fn);
+	return SR_ERROR_CANT_CREATE_FILE;
+    }
+    flock (fd, LOCK_EX | LOCK_NB);
+    rc = trackindex_map (fd, old_hdr->capacity * 2, 1, &new_hdr);
+    if (rc != SR_SUCCESS) {
+	close (fd);
+	unlink (new_fn);
+	g_free (new_fn);
+	return rc;
+    }
+
+    for (i = 0; i < old_hdr->capacity; i++) {
+	if (old_table[i].key) {
+	    *trackindex_find (new_hdr, old_table[i].key) = old_table[i];
+	    new_hdr->count++;
+	}
+    }
+    if (rename (new_fn, m_filename) != 0) {
+	trackindex_unmap (new_hdr);
+	close (fd);
+	unlink (new_fn);
+	g_free (new_fn);
+	return SR_ERROR_CANT_WRITE_TO_FILE;
+    }
+    g_free (new_fn);
+
+    trackindex_unmap (old_hdr);
+    close (m_fd);
+    m_hdr = new_hdr;
+    m_fd = fd;
+    debug_printf ("TRACKINDEX: grew to %u entries\n", new_hdr->capacity);
+    return SR_SUCCESS;
+#endif
+}
+
+#if !defined (WIN32)
+/* Map the table in fd.  A new table is written first if create is
+   set. */
+static error_code
+trackindex_map (int fd, guint32 capacity, int create,
+		Trackindex_header **hdr)
+{
+    size_t len = sizeof(Trackindex_header)
+	    + (size_t) capacity * sizeof(Trackindex_entry);
+    void *p;
+
+    if (create) {
+	if (ftruncate (fd, 0) != 0 || ftruncate (fd, len) != 0) {
+	    return SR_ERROR_CANT_WRITE_TO_FILE;
+	}
+    }
+    p = mmap (0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+	debug_printf ("TRACKINDEX: mmap failed: %d\n", errno);
+	return SR_ERROR_CANT_ALLOC_MEMORY;
+    }
+    *hdr = (Trackindex_header*) p;
+    if (create) {
+	(*hdr)->magic = TRACKINDEX_MAGIC;
+	(*hdr)->version = TRACKINDEX_VERSION;
+	(*hdr)->capacity = capacity;
+	(*hdr)->count = 0;
+    }
+    return SR_SUCCESS;
+}
+
+static void
+trackindex_unmap (Trackindex_header *hdr)
+{
+    size_t len = sizeof(Trackindex_header)
+	    + (size_t) hdr->capacity * sizeof(Trackindex_entry);
+    msync (hdr, len, MS_ASYNC);
+    munmap (hdr, len);
+}
+#endif
+
+/* Hash s case folded, without leading or trailing white space, and
+   with runs of white space counted as one space */
+static guint64
+trackindex_add_string (guint64 h, const mchar *s)
+{
+    gchar *folded = g_utf8_casefold (s, -1);
+    gchar *p;
+    int started = 0;
+    int space = 0;
+
+    for (p = folded; *p; p++) {
+	if (g_ascii_isspace (*p)) {
+	    space = 1;
+	    continue;
+	}
+	if (space && started) {
+	    h ^= (guchar) ' ';
+	    h *= TRACKINDEX_PRIME;
+	}
+	started = 1;
+	space = 0;
+	h ^= (guchar) *p;
+	h *= TRACKINDEX_PRIME;
+    }
+    g_free (folded);
+
+    /* Field separator */
+    h ^= 0xff;
+    h *= TRACKINDEX_PRIME;
+    return h;
+}
@@ -0,0 +1,44 @@
+/* trackindex.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __TRACKINDEX_H__
+#define __TRACKINDEX_H__
+
+#include "srtypes.h"
+#include "errors.h"
+
+/* What the index knows about a completed track */
+typedef struct trackindex_info Trackindex_info;
+struct trackindex_info
+{
+    guint64 size;		/* Bytes in the completed file */
+    guint64 content_hash;	/* Hash of the audio, 0 if unknown */
+    u_long duration_ms;
+};
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+void trackindex_init (void);
+void trackindex_cleanup (void);
+error_code trackindex_open (const char *filename);
+int trackindex_is_open (void);
+guint64 trackindex_key (Track_record *ti);
+int trackindex_lookup (guint64 key, Trackindex_info *info);
+void trackindex_update (guint64 key, Trackindex_info *info);
+void trackindex_debug_report (void);
+
+#endif
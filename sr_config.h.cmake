@@ -21,6 +21,9 @@
 
 #cmakedefine OGG_FOUND 1
 #cmakedefine VORBIS_FOUND 1
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+#cmakedefine HAVE_FALLOCATE 1
+#cmakedefine HAVE_SYNCFS 1
 
 #if (OGG_FOUND && VORBIS_FOUND)
 #define OGG_VORBIS_FOUND 1
@@ -0,0 +1,52 @@
+/* check.h
+ * helpers for the check programs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <stdio.h>
+
+/* A failed check is reported and counted, and the program carries 
+   on with the next one */
+static int check_failures = 0;
+
+#define CHECK(cond)							\
+    do {								\
+	if (!(cond)) {							\
+	    printf ("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond);	\
+	    check_failures++;						\
+	}								\
+    } while (0)
+
+#define CHECK_EQ(got, want)						\
+    do {								\
+	unsigned long long got_ = (unsigned long long) (got);		\
+	unsigned long long want_ = (unsigned long long) (want);	\
+	if (got_ != want_) {						\
+	    printf ("FAIL: %s:%d: %s is %llu (0x%llx), expected "	\
+		    "%llu (0x%llx)\n", __FILE__, __LINE__, #got,	\
+		    got_, got_, want_, want_);				\
+	    check_failures++;						\
+	}								\
+    } while (0)
+
+/* The exit code of the program */
+#define CHECK_DONE(name)						\
+    (printf ("%s: %s\n", (name), check_failures ? "FAILED" : "ok"),	\
+     check_failures ? 1 : 0)
+
+#endif
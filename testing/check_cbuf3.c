@@ -0,0 +1,161 @@
+/* check_cbuf3.c
+ * known answers for the cbuf3 time index
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* Chunks of known duration are pushed through a small cbuf, so the 
+   ring of stamps wraps, and then grows while wrapped.  After each 
+   step the stream time of every buffered chunk is checked, and the 
+   relay burst search is checked against a linear search. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "cbuf3.h"
+#include "memgov.h"
+#include "check.h"
+
+#define CHUNK_SIZE 1000
+#define NUM_CHUNKS 4
+#define MAX_PUSHED 64
+
+/* Stream time and duration of each chunk pushed so far */
+static guint64 m_start_ms[MAX_PUSHED];
+static u_long m_duration_ms[MAX_PUSHED];
+static int m_pushed = 0;
+
+static u_long
+chunk_duration (int i)
+{
+    return 20 + (i * 13) % 17;
+}
+
+static void
+push_chunk (Cbuf3 *cbuf3)
+{
+    GList *node = cbuf3_request_free_node (0, cbuf3);
+
+    CHECK (node != 0);
+    if (!node) return;
+    m_start_ms[m_pushed] = m_pushed 
+	    ? m_start_ms[m_pushed-1] + m_duration_ms[m_pushed-1] : 0;
+    m_duration_ms[m_pushed] = chunk_duration (m_pushed);
+    cbuf3_insert_node (cbuf3, node);
+    cbuf3_set_tail_timing (cbuf3, m_duration_ms[m_pushed]);
+    m_pushed++;
+}
+
+/* The buffer holds the newest chunks pushed, oldest at the head */
+static int
+first_buffered (Cbuf3 *cbuf3)
+{
+    return m_pushed - (int) cbuf3->buf->length;
+}
+
+static void
+check_times (Cbuf3 *cbuf3)
+{
+    GList *node;
+    int i = first_buffered (cbuf3);
+
+    for (node = cbuf3->buf->head; node; node = node->next, i++) {
+	Cbuf3_pointer ptr;
+	guint64 ms;
+
+	ptr.node = node;
+	ptr.offset = 0;
+	CHECK_EQ (cbuf3_pointer_to_time (cbuf3, &ptr, &ms), SR_SUCCESS);
+	CHECK_EQ (ms, m_start_ms[i]);
+	ptr.offset = CHUNK_SIZE / 2;
+	CHECK_EQ (cbuf3_pointer_to_time (cbuf3, &ptr, &ms), SR_SUCCESS);
+	CHECK_EQ (ms, m_start_ms[i] + m_duration_ms[i] / 2);
+    }
+}
+
+/* A relay client asking for burst_ms of history starts on the chunk 
+   playing at that time, or the oldest chunk if there isn't enough */
+static void
+check_burst (Cbuf3 *cbuf3)
+{
+    guint64 stream_ms = m_start_ms[m_pushed-1] + m_duration_ms[m_pushed-1];
+    int first = first_buffered (cbuf3);
+    u_long burst_ms;
+
+    for (burst_ms = 1; burst_ms < stream_ms; burst_ms += 7) {
+	Relay_client relay_client;
+	GList *node;
+	int want = first;
+	int i;
+
+	for (i = first; i < m_pushed; i++) {
+	    if (m_start_ms[i] <= stream_ms - burst_ms) {
+		want = i;
+	    }
+	}
+	memset (&relay_client, 0, sizeof(relay_client));
+	CHECK_EQ (cbuf3_initialize_relay_client_ptr (cbuf3, &relay_client, 
+						     0, burst_ms), 
+		  SR_SUCCESS);
+	node = cbuf3->buf->head;
+	for (i = first; i < want; i++) {
+	    node = node->next;
+	}
+	CHECK (relay_client.m_cbuf_ptr.node == node);
+	CHECK_EQ (relay_client.m_cbuf_ptr.offset, 0);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    Memgov_account account;
+    Cbuf3 cbuf3;
+    Cbuf3_pointer ptr;
+    guint64 ms;
+    int i;
+
+    memgov_init ();
+    memgov_register (&account, "check_cbuf3");
+    memset (&cbuf3, 0, sizeof(cbuf3));
+    CHECK_EQ (cbuf3_init (&cbuf3, &account, CONTENT_TYPE_MP3, 0, 
+			  CHUNK_SIZE, NUM_CHUNKS), SR_SUCCESS);
+
+    /* Wrap the ring, stopping part way round */
+    for (i = 0; i < 5 * NUM_CHUNKS - 1; i++) {
+	push_chunk (&cbuf3);
+	check_times (&cbuf3);
+    }
+    CHECK_EQ (cbuf3.buf->length, NUM_CHUNKS);
+    check_burst (&cbuf3);
+
+    /* Chunks which are not in the buffer have no time */
+    CHECK_EQ (cbuf3_resize (&cbuf3, 3 * NUM_CHUNKS), SR_SUCCESS);
+    ptr.node = cbuf3.free_list->head;
+    ptr.offset = 0;
+    CHECK_EQ (cbuf3_pointer_to_time (&cbuf3, &ptr, &ms), 
+	      SR_ERROR_BUFFER_TOO_SMALL);
+
+    /* Grow the ring while it is wrapped */
+    for (i = 0; i < 3 * NUM_CHUNKS; i++) {
+	push_chunk (&cbuf3);
+	check_times (&cbuf3);
+    }
+    CHECK_EQ (cbuf3.buf->length, 3 * NUM_CHUNKS);
+    check_burst (&cbuf3);
+
+    cbuf3_destroy (&cbuf3);
+    memgov_unregister (&account);
+    memgov_cleanup ();
+    return CHECK_DONE ("check_cbuf3");
+}
@@ -0,0 +1,110 @@
+/* check_dedup.c
+ * known answers for the audio hash
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* The audio hash is XXH64 with a seed of zero, so the expected 
+   values are those of the reference implementation.  The long input 
+   is also hashed in pieces of many sizes, as it is when a track is 
+   written one chunk at a time. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "dedup.h"
+#include "check.h"
+
+#define LONG_LEN 1000
+
+typedef struct hash_vector Hash_vector;
+struct hash_vector
+{
+    const char *input;
+    guint64 hash;
+};
+
+static const Hash_vector m_vectors[] = {
+    {"", 0xEF46DB3751D8E999ULL},
+    {"a", 0xD24EC4F1A98C6E5BULL},
+    {"abc", 0x44BC2CF5AD770999ULL},
+    {"Nobody inspects the spammish repetition", 0xFBCEA83C8A378BF1ULL},
+};
+
+#define NUM_VECTORS (sizeof(m_vectors) / sizeof(m_vectors[0]))
+
+/* XXH64 of the LONG_LEN bytes made by make_long_input */
+#define LONG_HASH 0x5F235FA033F1A3FBULL
+
+static void
+make_long_input (char *buf)
+{
+    int i;
+
+    for (i = 0; i < LONG_LEN; i++) {
+	buf[i] = (char) (i * 7 + 3);
+    }
+}
+
+static guint64
+hash_of (const char *buf, u_long size)
+{
+    Dedup_hash dh;
+
+    dedup_hash_init (&dh);
+    dedup_hash_update (&dh, buf, size);
+    return dedup_hash_digest (&dh);
+}
+
+int
+main (int argc, char *argv[])
+{
+    char buf[LONG_LEN];
+    Dedup_hash dh;
+    u_long pos, step;
+    int i;
+
+    for (i = 0; i < NUM_VECTORS; i++) {
+	const Hash_vector *v = &m_vectors[i];
+	CHECK_EQ (hash_of (v->input, strlen (v->input)), v->hash);
+    }
+
+    make_long_input (buf);
+    CHECK_EQ (hash_of (buf, LONG_LEN), LONG_HASH);
+
+    /* The same bytes in pieces, some smaller than a stripe, some 
+       larger, and some empty.  Taking the digest along the way 
+       doesn't change the state. */
+    dedup_hash_init (&dh);
+    for (pos = 0, step = 1; pos < LONG_LEN; step = step * 3 % 37 + 1) {
+	u_long size = step - 1;
+	if (pos + size > LONG_LEN) {
+	    size = LONG_LEN - pos;
+	}
+	dedup_hash_update (&dh, buf + pos, size);
+	pos += size;
+	CHECK_EQ (dedup_hash_digest (&dh), hash_of (buf, pos));
+    }
+    CHECK_EQ (dedup_hash_digest (&dh), LONG_HASH);
+
+    /* Every split of the first 64 bytes into two pieces */
+    for (pos = 0; pos <= 64; pos++) {
+	guint64 want = hash_of (buf, 64);
+	dedup_hash_init (&dh);
+	dedup_hash_update (&dh, buf, pos);
+	dedup_hash_update (&dh, buf + pos, 64 - pos);
+	CHECK_EQ (dedup_hash_digest (&dh), want);
+    }
+
+    return CHECK_DONE ("check_dedup");
+}
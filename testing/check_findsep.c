@@ -0,0 +1,234 @@
+/* check_findsep.c
+ * known answers for the mp3 frame header scan
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* The frames are made of a header and a body of zeros, so their 
+   lengths and durations are known from the standard, and nothing in 
+   the body looks like a header. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "findsep.h"
+#include "check.h"
+
+typedef struct frame_type Frame_type;
+struct frame_type
+{
+    const char *name;
+    unsigned char hdr[4];
+    u_long frame_len;
+    u_long samples;
+    u_long samplerate;
+    u_long bitrate;
+};
+
+static const Frame_type m_frame_types[] = {
+    {"MPEG 1 layer III, 128 kbps, 44.1 kHz", 
+     {0xff, 0xfb, 0x90, 0x00}, 417, 1152, 44100, 128},
+    {"MPEG 1 layer III, 128 kbps, 44.1 kHz, padded", 
+     {0xff, 0xfb, 0x92, 0x00}, 418, 1152, 44100, 128},
+    {"MPEG 1 layer II, 192 kbps, 48 kHz", 
+     {0xff, 0xfd, 0xa4, 0x00}, 576, 1152, 48000, 192},
+    {"MPEG 1 layer I, 384 kbps, 32 kHz", 
+     {0xff, 0xff, 0xc8, 0x00}, 576, 384, 32000, 384},
+    {"MPEG 2 layer III, 64 kbps, 22.05 kHz", 
+     {0xff, 0xf3, 0x80, 0x00}, 208, 576, 22050, 64},
+    {"MPEG 2.5 layer III, 32 kbps, 11.025 kHz", 
+     {0xff, 0xe3, 0x40, 0x00}, 208, 576, 11025, 32},
+};
+
+#define NUM_FRAME_TYPES (sizeof(m_frame_types) / sizeof(m_frame_types[0]))
+
+#define MAX_FRAMES 40
+
+/* Frames of the first type, used when the type doesn't matter */
+#define FRAME_LEN 417
+
+static char m_buf[MAX_FRAMES * 1024];
+
+/* Fill buf with n frames of type t, and return the bytes used */
+static long
+make_frames (char *buf, const Frame_type *t, int n)
+{
+    long pos = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	memset (buf + pos, 0, t->frame_len);
+	memcpy (buf + pos, t->hdr, 4);
+	pos += t->frame_len;
+    }
+    return pos;
+}
+
+/* Each kind of header gives the frame length, duration, sample rate 
+   and bitrate from the standard */
+static void
+check_frame_types (void)
+{
+    int i;
+
+    for (i = 0; i < NUM_FRAME_TYPES; i++) {
+	const Frame_type *t = &m_frame_types[i];
+	Mp3_scan scan;
+	u_long frames, duration_ms;
+	guint64 frame_us = (guint64) t->samples * 1000000 / t->samplerate;
+	long len = make_frames (m_buf, t, 10);
+
+	printf ("%s\n", t->name);
+	memset (&scan, 0, sizeof(scan));
+	find_frames (&scan, m_buf, len, &frames, &duration_ms);
+	CHECK_EQ (frames, 10);
+	CHECK_EQ (scan.bytes, 10 * t->frame_len);
+	CHECK_EQ (scan.time_us, 10 * frame_us);
+	CHECK_EQ (duration_ms, 10 * frame_us / 1000);
+	CHECK_EQ (scan.samplerate, t->samplerate);
+	CHECK_EQ (scan.bitrate, t->bitrate);
+	CHECK_EQ (scan.skip, 0);
+    }
+}
+
+/* Invalid headers are not counted: the reserved version, the free 
+   and bad bitrates, and the reserved sample rate */
+static void
+check_bad_headers (void)
+{
+    static const unsigned char bad[][4] = {
+	{0xff, 0xeb, 0x90, 0x00},
+	{0xff, 0xfb, 0x00, 0x00},
+	{0xff, 0xfb, 0xf0, 0x00},
+	{0xff, 0xfb, 0x9c, 0x00},
+	{0xff, 0xf9, 0x90, 0x00},
+    };
+    int i;
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+	Mp3_scan scan;
+	u_long frames, duration_ms;
+
+	memset (m_buf, 0, 1024);
+	memcpy (m_buf, bad[i], 4);
+	memset (&scan, 0, sizeof(scan));
+	find_frames (&scan, m_buf, 1024, &frames, &duration_ms);
+	CHECK_EQ (frames, 0);
+    }
+}
+
+/* Frames are counted once however the stream is cut into chunks, 
+   including cuts inside a header */
+static void
+check_chunks (void)
+{
+    const Frame_type *t = &m_frame_types[0];
+    long len = make_frames (m_buf, t, MAX_FRAMES);
+    Mp3_scan scan;
+    u_long frames, duration_ms;
+    u_long total_frames = 0;
+    long pos = 0;
+    long size = 1;
+
+    memset (&scan, 0, sizeof(scan));
+    while (pos < len) {
+	if (pos + size > len) {
+	    size = len - pos;
+	}
+	find_frames (&scan, m_buf + pos, size, &frames, &duration_ms);
+	total_frames += frames;
+	pos += size;
+	size = (size * 7) % 509 + 1;
+    }
+    CHECK_EQ (total_frames, MAX_FRAMES);
+    CHECK_EQ (scan.bytes, MAX_FRAMES * FRAME_LEN);
+}
+
+/* The first frame is found after junk, and a lone sync word is not 
+   taken for a frame */
+static void
+check_frame_start (void)
+{
+    const Frame_type *t = &m_frame_types[0];
+
+    memset (m_buf, 0, 150);
+    make_frames (m_buf + 150, t, 5);
+    CHECK_EQ (find_frame_start (m_buf, 150 + 5 * FRAME_LEN), 150);
+
+    /* A header at 10 whose frame would end in the middle of the 
+       real frames */
+    memcpy (m_buf + 10, t->hdr, 4);
+    CHECK_EQ (find_frame_start (m_buf, 150 + 5 * FRAME_LEN), 150);
+
+    /* A frame which runs past the end can't be confirmed, so it is 
+       taken */
+    memset (m_buf, 0, 300);
+    memcpy (m_buf + 50, t->hdr, 4);
+    CHECK_EQ (find_frame_start (m_buf, 300), 50);
+
+    /* No frame at all */
+    memset (m_buf, 0, 300);
+    CHECK_EQ (find_frame_start (m_buf, 300), -1);
+    CHECK_EQ (find_frame_start (m_buf, 3), -1);
+}
+
+/* After mp3_scan_resync, a new connection which starts with a frame 
+   is counted from its first byte, not from where the frame of the 
+   old connection would have ended */
+static void
+check_resync (void)
+{
+    const Frame_type *t = &m_frame_types[0];
+    long len;
+    Mp3_scan scan;
+    u_long frames, duration_ms;
+
+    /* Cut off in the middle of a frame */
+    len = make_frames (m_buf, t, 1);
+    memset (&scan, 0, sizeof(scan));
+    find_frames (&scan, m_buf, 200, &frames, &duration_ms);
+    CHECK_EQ (frames, 1);
+    CHECK_EQ (scan.skip, FRAME_LEN - 200);
+
+    /* Without the resync, the first new frame is skipped */
+    len = make_frames (m_buf, t, 5);
+    {
+	Mp3_scan stale = scan;
+	find_frames (&stale, m_buf, len, &frames, &duration_ms);
+	CHECK_EQ (frames, 4);
+    }
+    mp3_scan_resync (&scan);
+    find_frames (&scan, m_buf, len, &frames, &duration_ms);
+    CHECK_EQ (frames, 5);
+
+    /* Cut off in the middle of a header */
+    memset (&scan, 0, sizeof(scan));
+    find_frames (&scan, (const char*) t->hdr, 2, &frames, &duration_ms);
+    CHECK_EQ (frames, 0);
+    CHECK_EQ (scan.partial_len, 2);
+    mp3_scan_resync (&scan);
+    CHECK_EQ (scan.partial_len, 0);
+    find_frames (&scan, m_buf, len, &frames, &duration_ms);
+    CHECK_EQ (frames, 5);
+}
+
+int
+main (int argc, char *argv[])
+{
+    check_frame_types ();
+    check_bad_headers ();
+    check_chunks ();
+    check_frame_start ();
+    check_resync ();
+    return CHECK_DONE ("check_findsep");
+}
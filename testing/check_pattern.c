@@ -0,0 +1,146 @@
+/* check_pattern.c
+ * known answers for the file name patterns
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* Each pattern is compiled and expanded as filelib does for a 
+   completed track, and the file name and number of ops are checked.  
+   %D and %q depend on the clock and the directory, so they are not 
+   used here. */
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "filelib.h"
+#include "check.h"
+
+#define DIRECTORY "out/"
+#define EXTENSION ".mp3"
+
+typedef struct pattern_vector Pattern_vector;
+struct pattern_vector
+{
+    const char *pattern;
+    int is_for_showfile;
+    int have_track;
+    const char *newfile;
+    int num_ops;
+};
+
+static const Pattern_vector m_vectors[] = {
+    /* Literal text, the stream name and the session date are one op */
+    {"plain", 0, 1, "plain", 1},
+    {"%S_%d", 0, 1, "Radio_2008_01_02_03_04_05", 1},
+    {"%%S 100%", 0, 1, "%S 100%", 1},
+    {"%x%", 0, 1, "%x%", 1},
+    /* Track fields */
+    {"%A - %T (%a)", 0, 1, "Artist - Title (Album)", 6},
+    {"%S/%A/%T", 0, 1, "Radio/Artist/Title", 4},
+    {"%A - %T", 0, 0, "%A - %T", 3},
+    /* Fields which don't apply to the show file */
+    {"%S %A %T", 1, 0, "Radio %A %T", 1},
+    /* Track counts */
+    {"%5q_%T", 0, 1, "0005_Title", 3},
+    {"%5", 0, 1, "%5", 1},
+    {"%1234567q", 0, 1, "%1234567q", 1},
+};
+
+#define NUM_VECTORS (sizeof(m_vectors) / sizeof(m_vectors[0]))
+
+static RIP_MANAGER_INFO*
+new_rmi (void)
+{
+    RIP_MANAGER_INFO *rmi = 
+	    (RIP_MANAGER_INFO*) calloc (1, sizeof(RIP_MANAGER_INFO));
+    FILELIB_INFO *fli = &rmi->filelib_info;
+
+    strcpy (fli->m_stripped_icy_name, "Radio");
+    strcpy (fli->m_session_datebuf, "2008_01_02_03_04_05");
+    fli->m_count = -1;
+    return rmi;
+}
+
+static void
+check_vectors (void)
+{
+    Track_record ti;
+    gchar newfile[SR_MAX_PATH];
+    int i;
+
+    memset (&ti, 0, sizeof(ti));
+    ti.fn_artist = "Artist";
+    ti.fn_title = "Title";
+    ti.fn_album = "Album";
+
+    for (i = 0; i < NUM_VECTORS; i++) {
+	const Pattern_vector *v = &m_vectors[i];
+	RIP_MANAGER_INFO *rmi = new_rmi ();
+	Filelib_pattern fp;
+	gchar want[SR_MAX_PATH];
+
+	memset (&fp, 0, sizeof(fp));
+	filelib_compile_pattern (rmi, &fp, (gchar*) v->pattern, 
+				 v->is_for_showfile);
+	filelib_expand_pattern (rmi, newfile, v->have_track ? &ti : 0, 
+				DIRECTORY, &fp, EXTENSION);
+	snprintf (want, SR_MAX_PATH, "%s%s%s", DIRECTORY, v->newfile, 
+		  EXTENSION);
+	if (strcmp (newfile, want)) {
+	    printf ("FAIL: %s expanded to %s, expected %s\n", 
+		    v->pattern, newfile, want);
+	    check_failures++;
+	}
+	CHECK_EQ (fp.num_ops, v->num_ops);
+	filelib_free_pattern (&fp);
+	free (rmi);
+    }
+}
+
+/* A long name is cut short, leaving room for the extension */
+static void
+check_long_name (void)
+{
+    RIP_MANAGER_INFO *rmi = new_rmi ();
+    Filelib_pattern fp;
+    Track_record ti;
+    gchar newfile[SR_MAX_PATH];
+    gchar title[2 * SR_MAX_PATH];
+    size_t len;
+
+    memset (title, 'x', sizeof(title) - 1);
+    title[sizeof(title) - 1] = 0;
+    memset (&ti, 0, sizeof(ti));
+    ti.fn_artist = "Artist";
+    ti.fn_title = title;
+    ti.fn_album = "";
+
+    memset (&fp, 0, sizeof(fp));
+    filelib_compile_pattern (rmi, &fp, "%A - %T", 0);
+    filelib_expand_pattern (rmi, newfile, &ti, DIRECTORY, &fp, EXTENSION);
+    len = strlen (newfile);
+    CHECK_EQ (len, SR_MAX_PATH - 5 + strlen (EXTENSION));
+    CHECK (!strncmp (newfile, DIRECTORY "Artist - x", 
+		     strlen (DIRECTORY "Artist - x")));
+    CHECK (!strcmp (newfile + len - strlen (EXTENSION), EXTENSION));
+    filelib_free_pattern (&fp);
+    free (rmi);
+}
+
+int
+main (int argc, char *argv[])
+{
+    check_vectors ();
+    check_long_name ();
+    return CHECK_DONE ("check_pattern");
+}
@@ -0,0 +1,189 @@
+/* check_trackindex.c
+ * known answers for the track index
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* The index is filled with keys which land on the same slot, 
+   including the last slot so the probe wraps, and then with enough 
+   keys to double the table.  Every key must be found with what was 
+   stored for it, before and after the index is closed and opened 
+   again.
+
+   Usage: check_trackindex [index_file] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "srtypes.h"
+#include "trackindex.h"
+#include "check.h"
+
+#define INDEX_FILE "check_trackindex.idx"
+
+/* The smallest table, and the fill at which it doubles */
+#define MIN_CAPACITY 4096
+#define NUM_KEYS (MIN_CAPACITY * 3 / 4 + 100)
+
+/* The start of the index file */
+typedef struct index_header Index_header;
+struct index_header
+{
+    guint32 magic;
+    guint32 version;
+    guint32 capacity;
+    guint32 count;
+};
+
+static guint64 m_keys[NUM_KEYS];
+static int m_num_keys = 0;
+
+static void
+info_for (guint64 key, Trackindex_info *info)
+{
+    info->size = key * 3 + 1;
+    info->content_hash = ~key;
+    info->duration_ms = (u_long) (key % 600000);
+}
+
+static void
+add_key (guint64 key)
+{
+    Trackindex_info info;
+
+    info_for (key, &info);
+    trackindex_update (key, &info);
+    m_keys[m_num_keys++] = key;
+}
+
+static void
+check_keys (void)
+{
+    int i;
+
+    for (i = 0; i < m_num_keys; i++) {
+	Trackindex_info info, want;
+
+	memset (&info, 0, sizeof(info));
+	info_for (m_keys[i], &want);
+	CHECK (trackindex_lookup (m_keys[i], &info));
+	CHECK_EQ (info.size, want.size);
+	CHECK_EQ (info.content_hash, want.content_hash);
+	CHECK_EQ (info.duration_ms, want.duration_ms);
+    }
+}
+
+static void
+read_header (const char *filename, Index_header *hdr)
+{
+    FILE *fp = fopen (filename, "rb");
+
+    memset (hdr, 0, sizeof(*hdr));
+    CHECK (fp != 0);
+    if (!fp) return;
+    CHECK_EQ (fread (hdr, sizeof(*hdr), 1, fp), 1);
+    fclose (fp);
+}
+
+/* Keys are made the same when case and white space differ, and not 
+   otherwise */
+static void
+check_track_keys (void)
+{
+    Track_record a, b;
+
+    memset (&a, 0, sizeof(a));
+    memset (&b, 0, sizeof(b));
+    a.artist = "The  Artist";
+    a.title = "Title";
+    a.album = "";
+    b.artist = " the artist ";
+    b.title = "TITLE";
+    b.album = "";
+    CHECK (trackindex_key (&a) != 0);
+    CHECK_EQ (trackindex_key (&a), trackindex_key (&b));
+
+    b.title = "Title 2";
+    CHECK (trackindex_key (&a) != trackindex_key (&b));
+
+    /* The fields are kept apart */
+    a.artist = "ab";
+    a.title = "c";
+    b.artist = "a";
+    b.title = "bc";
+    CHECK (trackindex_key (&a) != trackindex_key (&b));
+
+    a.artist = "";
+    a.title = "";
+    CHECK_EQ (trackindex_key (&a), 0);
+    CHECK_EQ (trackindex_key (0), 0);
+}
+
+int
+main (int argc, char *argv[])
+{
+    const char *filename = argc > 1 ? argv[1] : INDEX_FILE;
+    Trackindex_info info;
+    Index_header hdr;
+    guint64 key;
+    int i;
+
+    unlink (filename);
+    check_track_keys ();
+
+    trackindex_init ();
+    CHECK_EQ (trackindex_open (filename), SR_SUCCESS);
+    CHECK (trackindex_is_open ());
+    CHECK (!trackindex_lookup (12345, &info));
+
+    /* Keys on the same slot, and on the last slot */
+    for (i = 1; i <= 8; i++) {
+	add_key ((guint64) i * MIN_CAPACITY + 7);
+    }
+    for (i = 1; i <= 8; i++) {
+	add_key ((guint64) i * MIN_CAPACITY + MIN_CAPACITY - 1);
+    }
+    check_keys ();
+    CHECK (!trackindex_lookup (9 * MIN_CAPACITY + 7, &info));
+    CHECK (!trackindex_lookup (9 * MIN_CAPACITY + MIN_CAPACITY - 1, &info));
+
+    /* Updating a key doesn't add it again */
+    add_key (MIN_CAPACITY + 7);
+    m_num_keys--;
+    read_header (filename, &hdr);
+    CHECK_EQ (hdr.capacity, MIN_CAPACITY);
+    CHECK_EQ (hdr.count, m_num_keys);
+
+    /* Double the table */
+    key = 0x9e3779b97f4a7c15ULL;
+    while (m_num_keys < NUM_KEYS) {
+	add_key (key);
+	key = key * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    check_keys ();
+    read_header (filename, &hdr);
+    CHECK_EQ (hdr.capacity, 2 * MIN_CAPACITY);
+    CHECK_EQ (hdr.count, m_num_keys);
+
+    /* The doubled table is the one kept in the file */
+    trackindex_cleanup ();
+    CHECK (!trackindex_is_open ());
+    trackindex_init ();
+    CHECK_EQ (trackindex_open (filename), SR_SUCCESS);
+    check_keys ();
+    trackindex_cleanup ();
+
+    unlink (filename);
+    return CHECK_DONE ("check_trackindex");
+}
@@ -0,0 +1,252 @@
+/* http_header_bench.c
+ * check and time the ICY/HTTP response header parser
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* Parses a corpus of responses captured from servers, and checks the 
+   fields found in each.  Then times http_parse_sc_header against 
+   searching the header once per field, which is how the header used 
+   to be parsed.
+
+   Usage: http_header_bench [iterations] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "http.h"
+#include "threadlib.h"
+
+typedef struct corpus_entry Corpus_entry;
+struct corpus_entry
+{
+    const char *url;
+    const char *response;
+    /* Expected results.  NULL strings and -1 numbers aren't checked. */
+    int content_type;
+    int bitrate;
+    int meta_interval;
+    const char *name;
+    const char *genre;
+    const char *icy_url;
+    const char *server;
+    const char *location;
+};
+
+static const Corpus_entry m_corpus[] = {
+    {
+	"http://localhost:8000/",
+	"ICY 200 OK\r\n"
+	"icy-notice1:<BR>This stream requires "
+	"<a href=\"http://www.winamp.com/\">Winamp</a><BR>\r\n"
+	"icy-notice2:SHOUTcast Distributed Network Audio Server/Linux "
+	"v1.9.8<BR>\r\n"
+	"icy-name:Radio Paradise - DJ-mixed modern & classic rock, world, "
+	"electronica & more - info: radioparadise.com\r\n"
+	"icy-genre:Eclectic Rock\r\n"
+	"icy-url:http://www.radioparadise.com\r\n"
+	"content-type:audio/mpeg\r\n"
+	"icy-pub:1\r\n"
+	"icy-metaint:16000\r\n"
+	"icy-br:128\r\n"
+	"\r\n",
+	CONTENT_TYPE_MP3, 128, 16000,
+	"Radio Paradise - DJ-mixed modern & classic rock, world, "
+	"electronica & more - info: radioparadise.com",
+	"Eclectic Rock", "http://www.radioparadise.com",
+	"SHOUTcast/Linux v1.9.8", ""
+    },
+    {
+	"http://localhost:8000/stream.ogg",
+	"HTTP/1.0 200 OK\r\n"
+	"Content-Type: application/ogg\r\n"
+	"ice-audio-info: ice-samplerate=44100;ice-bitrate=128;"
+	"ice-channels=2\r\n"
+	"icy-br:128\r\n"
+	"icy-description:Unspecified description\r\n"
+	"icy-genre:various\r\n"
+	"icy-name:Unspecified name\r\n"
+	"icy-pub:0\r\n"
+	"icy-url:http://localhost:8000\r\n"
+	"Server: Icecast 2.3.2\r\n"
+	"Cache-Control: no-cache\r\n"
+	"\r\n",
+	CONTENT_TYPE_OGG, 128, -1,
+	"Unspecified name", "various", "http://localhost:8000",
+	"Icecast 2.3.2", ""
+    },
+    {
+	"http://localhost:8000/lounge",
+	"HTTP/1.0 200 OK\r\n"
+	"Date: Tue, 14 Apr 2009 01:23:45 GMT\r\n"
+	"Server: Apache/2.2.9 (Debian)\r\n"
+	"x-audiocast-name: Lounge Radio\r\n"
+	"x-audiocast-genre: Lounge\r\n"
+	"x-audiocast-server-url: http://www.loungeradio.com\r\n"
+	"x-audiocast-bitrate: 96\r\n"
+	"Connection: close\r\n"
+	"Content-Type: audio/mpeg\r\n"
+	"\r\n",
+	CONTENT_TYPE_MP3, 96, -1,
+	"Lounge Radio", "Lounge", "http://www.loungeradio.com",
+	"Apache/2.2.9 (Debian)", ""
+    },
+    {
+	"http://localhost:8000/live",
+	"HTTP/1.0 302 Found\r\n"
+	"Server: Icecast 2.3.2\r\n"
+	"Location: http://stream2.example.com:8000/live.mp3\r\n"
+	"Content-Type: text/html\r\n"
+	"\r\n",
+	-1, -1, -1,
+	NULL, NULL, NULL,
+	"Icecast 2.3.2", "http://stream2.example.com:8000/live.mp3"
+    },
+};
+
+#define CORPUS_SIZE (sizeof(m_corpus) / sizeof(m_corpus[0]))
+
+/* The fields the old parser searched for, one scan of the header each */
+static const char* m_field_names[] = {
+    "Location:", "Server:", "Content-Type:", "icy-name:", "ice-name:", 
+    "icy-url:", "ice-url:", "icy-genre:", "ice-genre:", "icy-br:", 
+    "icy-metaint:", "icy-notice1:", "icy-notice2:", 
+    "x-audiocast-server-url:", "x-audiocast-name:", 
+    "x-audiocast-genre:", "x-audiocast-bitrate:"
+};
+
+#define NUM_FIELD_NAMES (sizeof(m_field_names) / sizeof(m_field_names[0]))
+
+static int
+check_string (int i, const char *what, const char *got, const char *want)
+{
+    if (!want || !strcmp (got ? got : "", want)) {
+	return 0;
+    }
+    printf ("FAIL: response %d: %s is \"%s\", expected \"%s\"\n", 
+	    i, what, got ? got : "(null)", want);
+    return 1;
+}
+
+static int
+check_int (int i, const char *what, int got, int want)
+{
+    if (want == -1 || got == want) {
+	return 0;
+    }
+    printf ("FAIL: response %d: %s is %d, expected %d\n", 
+	    i, what, got, want);
+    return 1;
+}
+
+static int
+check_corpus (void)
+{
+    char header[MAX_HEADER_LEN];
+    SR_HTTP_HEADER info;
+    int failures = 0;
+    int i;
+
+    memset (&info, 0, sizeof(info));
+    for (i = 0; i < CORPUS_SIZE; i++) {
+	const Corpus_entry *c = &m_corpus[i];
+	error_code rc;
+
+	strcpy (header, c->response);
+	rc = http_parse_sc_header (c->url, header, &info);
+	if (rc != SR_SUCCESS) {
+	    printf ("FAIL: response %d: http_parse_sc_header returned %d\n",
+		    i, rc);
+	    failures++;
+	    continue;
+	}
+	failures += check_int (i, "content type", info.content_type, 
+			       c->content_type);
+	failures += check_int (i, "bitrate", info.icy_bitrate, c->bitrate);
+	failures += check_int (i, "meta interval", info.meta_interval, 
+			       c->meta_interval);
+	failures += check_string (i, "name", info.icy_name, c->name);
+	failures += check_string (i, "genre", info.icy_genre, c->genre);
+	failures += check_string (i, "url", info.icy_url, c->icy_url);
+	failures += check_string (i, "server", info.server, c->server);
+	failures += check_string (i, "location", info.http_location, 
+				  c->location);
+    }
+    http_clear_sc_header (&info);
+    return failures;
+}
+
+static void
+time_corpus (int iterations)
+{
+    static char headers[CORPUS_SIZE][MAX_HEADER_LEN];
+    char value[MAX_ICY_STRING];
+    SR_HTTP_HEADER info;
+    guint64 start, parse_ms, search_ms;
+    int i, j, k;
+
+    memset (&info, 0, sizeof(info));
+    for (j = 0; j < CORPUS_SIZE; j++) {
+	strcpy (headers[j], m_corpus[j].response);
+    }
+
+    start = threadlib_monotonic_ms ();
+    for (i = 0; i < iterations; i++) {
+	for (j = 0; j < CORPUS_SIZE; j++) {
+	    http_parse_sc_header (m_corpus[j].url, headers[j], &info);
+	}
+    }
+    parse_ms = threadlib_monotonic_ms () - start;
+    http_clear_sc_header (&info);
+
+    start = threadlib_monotonic_ms ();
+    for (i = 0; i < iterations; i++) {
+	for (j = 0; j < CORPUS_SIZE; j++) {
+	    for (k = 0; k < NUM_FIELD_NAMES; k++) {
+		extract_header_value (headers[j], value, 
+				      (char*) m_field_names[k], 
+				      sizeof(value));
+	    }
+	}
+    }
+    search_ms = threadlib_monotonic_ms () - start;
+
+    printf ("%d iterations over %d responses\n", 
+	    iterations, (int) CORPUS_SIZE);
+    printf ("http_parse_sc_header:  %6lu ms\n", (u_long) parse_ms);
+    printf ("search per field:      %6lu ms (fields only)\n", 
+	    (u_long) search_ms);
+}
+
+int
+main (int argc, char *argv[])
+{
+    int iterations = 10000;
+    int failures;
+
+    if (argc > 1) {
+	iterations = atoi (argv[1]);
+    }
+
+    failures = check_corpus ();
+    if (failures) {
+	return 1;
+    }
+    printf ("%d responses parsed as expected\n", (int) CORPUS_SIZE);
+
+    if (iterations > 0) {
+	time_corpus (iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+/* stream_footprint.c
+ * report the memory held by an idle stream
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/* Prints the size of each per-stream structure, and the bytes held 
+   by a stream which is connected but has buffered no audio.  The 
+   heap part is the header strings of a typical shoutcast response.
+
+   Usage: stream_footprint [max_bytes]
+   With max_bytes, exits non-zero if a stream holds more than that. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "srtypes.h"
+#include "http.h"
+
+static const char sample_response[] =
+    "ICY 200 OK\r\n"
+    "icy-notice1:<BR>This stream requires "
+    "<a href=\"http://www.winamp.com/\">Winamp</a><BR>\r\n"
+    "icy-notice2:SHOUTcast Distributed Network Audio Server/Linux "
+    "v1.9.8<BR>\r\n"
+    "icy-name:Groove Salad: a nicely chilled plate of ambient beats\r\n"
+    "icy-genre:Ambient Chill\r\n"
+    "icy-url:http://somafm.com\r\n"
+    "content-type:audio/mpeg\r\n"
+    "icy-pub:1\r\n"
+    "icy-metaint:32768\r\n"
+    "icy-br:128\r\n"
+    "\r\n";
+
+static void
+report (const char *name, u_long bytes)
+{
+    printf ("%-28s %8lu\n", name, bytes);
+}
+
+int
+main (int argc, char *argv[])
+{
+    SR_HTTP_HEADER info;
+    char header[sizeof(sample_response)];
+    u_long heap;
+    u_long total;
+    u_long max_bytes = 0;
+    error_code rc;
+
+    if (argc > 1) {
+	max_bytes = strtoul (argv[1], 0, 10);
+    }
+
+    memset (&info, 0, sizeof(info));
+    memcpy (header, sample_response, sizeof(sample_response));
+    rc = http_parse_sc_header ("http://localhost:8000/", header, &info);
+    if (rc != SR_SUCCESS) {
+	printf ("FAIL: http_parse_sc_header returned %d\n", rc);
+	return 1;
+    }
+    heap = http_sc_header_heap_bytes (&info);
+
+    report ("sizeof(RIP_MANAGER_INFO)", (u_long) sizeof(RIP_MANAGER_INFO));
+    report ("  sizeof(SR_HTTP_HEADER)", (u_long) sizeof(SR_HTTP_HEADER));
+    report ("  sizeof(FILELIB_INFO)", (u_long) sizeof(FILELIB_INFO));
+    report ("  sizeof(RELAYLIB_INFO)", (u_long) sizeof(RELAYLIB_INFO));
+    report ("  sizeof(TRACK_INFO)", (u_long) sizeof(TRACK_INFO));
+    report ("  sizeof(Cbuf3)", (u_long) sizeof(Cbuf3));
+    report ("  sizeof(Writer)", (u_long) sizeof(Writer));
+    report ("sizeof(STREAM_PREFS)", (u_long) sizeof(STREAM_PREFS));
+    report ("header strings (heap)", heap);
+
+    total = (u_long) (sizeof(RIP_MANAGER_INFO) + sizeof(STREAM_PREFS)) 
+	    + heap;
+    report ("bytes per idle stream", total);
+
+    http_clear_sc_header (&info);
+
+    if (max_bytes && total > max_bytes) {
+	printf ("FAIL: an idle stream holds more than %lu bytes\n", 
+		max_bytes);
+	return 1;
+    }
+    return 0;
+}
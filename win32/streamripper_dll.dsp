@@ -101,14 +101,34 @@ PostBuild_Cmds=copy debug\streamripper.dll "C:\Program Files\Streamripper"
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=..\lib\bgcopy.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\cbuf3.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\connsched.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\debug.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\dedup.c
+# End Source File
+# Begin Source File
+
+SOURCE=..\lib\dircache.c
+# End Source File
+# Begin Source File
+
+SOURCE=..\lib\durable.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\errors.c
 # End Source File
 # Begin Source File
@@ -137,10 +157,18 @@ SOURCE=..\lib\iconvert.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\id3.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\mchar.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\memgov.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\parse.c
 # End Source File
 # Begin Source File
@@ -153,6 +181,10 @@ SOURCE=..\lib\relaylib.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\resolver.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\rip_manager.c
 # End Source File
 # Begin Source File
@@ -173,10 +205,18 @@ SOURCE=..\lib\ripstream_ogg.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\sink.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\socklib.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\standby.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\streamripper.def
 # End Source File
 # Begin Source File
@@ -189,6 +229,10 @@ SOURCE=..\lib\track_info.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\trackindex.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\utf8.c
 # End Source File
 # End Group
@@ -197,6 +241,10 @@ SOURCE=..\lib\utf8.c
 # PROP Default_Filter "h;hpp;hxx;hm;inl"
 # Begin Source File
 
+SOURCE=..\lib\bgcopy.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\cbuf2.h
 # End Source File
 # Begin Source File
@@ -209,10 +257,26 @@ SOURCE=..\lib\confw32.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\connsched.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\debug.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\dedup.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\lib\dircache.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\lib\durable.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\external.h
 # End Source File
 # Begin Source File
@@ -233,10 +297,18 @@ SOURCE="..\iconv-win32\static\iconv.h"
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\id3.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\mchar.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\memgov.h
+# End Source File
+# Begin Source File
+
 SOURCE="..\libogg-1.1.3\ogg\ogg.h"
 # End Source File
 # Begin Source File
@@ -253,6 +325,10 @@ SOURCE=..\lib\relaylib.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\resolver.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\rip_manager.h
 # End Source File
 # Begin Source File
@@ -265,6 +341,10 @@ SOURCE=..\lib\ripstream.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\sink.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\socklib.h
 # End Source File
 # Begin Source File
@@ -277,10 +357,18 @@ SOURCE=..\lib\srtypes.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\standby.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\threadlib.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\lib\trackindex.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\lib\uce_dirent.h
 # End Source File
 # Begin Source File
@@ -892,6 +892,7 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance,
     rip_manager_init ();
 
     init ();
+    rip_manager_set_mem_budget (g_rmo.maxMB_mem_budget);
 
     debug_printf ("command line args: %d %d %d\n",
 	    g_running_standalone, m_hpipe_exe_read,